@@ -0,0 +1,774 @@
+/*
+ * arith.c
+ *
+ * Compiler and evaluator for $((...)) expressions, and the cache of
+ * compiled programs
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include "arith.h"
+
+#define ARITH_STACK 64          // deepest evaluation stack a program may use
+#define ARITH_CACHE_MAX 256     // programs kept before the cache is emptied
+#define INIT_CODE_CAP 32        // initial words of code in a program
+#define MAX_NESTING 256         // deepest nesting of parentheses, unary
+                                //   operators, ?: and assignments
+
+/*
+ * Stack machine instructions. Each is one word of code, followed by
+ * an operand word for the ones marked.
+ */
+typedef enum {
+  OP_PUSH,      // operand: the value
+  OP_LOAD,      // operand: index into names
+  OP_STORE,     // operand: index into names; the value stays on the stack
+  OP_DUP,
+  OP_POP,
+  OP_NEG, OP_NOT, OP_BNOT, OP_BOOL,
+  OP_MUL, OP_DIV, OP_MOD, OP_ADD, OP_SUB, OP_SHL, OP_SHR,
+  OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE, OP_AND, OP_XOR, OP_OR,
+  OP_JMP,       // operand: target
+  OP_JZ,        // operand: target; pops the condition
+  OP_JZ_KEEP,   // operand: target; jumps keeping a zero, else pops (&&)
+  OP_JNZ_KEEP   // operand: target; jumps leaving 1, else pops (||)
+} op_t;
+
+typedef struct {
+  int64_t *code;
+  int n_code;
+  char **names;                 // variables referred to
+  int n_names;
+} program_t;
+
+typedef struct {
+  char *expr;                   // NULL for an empty slot
+  program_t *prog;
+} slot_t;
+
+struct arith_cache_s {
+  slot_t slots[2 * ARITH_CACHE_MAX];  // at most half full
+  int used;
+};
+
+/*
+ * Compiler state: a recursive descent parser that emits code as it
+ * goes, tracking the stack depth the code will reach
+ */
+typedef struct {
+  const char *in;
+  program_t *prog;
+  int code_cap;
+  int depth;
+  int max_depth;
+  int nesting;                  // recursions into a nested expression
+  bool failed;
+  const char *err;
+} compiler_t;
+
+// the binary operators, by precedence level from loosest to tightest
+static const struct {
+  const char *text;
+  int level;
+  op_t op;
+} binary_ops[] = {
+  {"||", 1, OP_JNZ_KEEP}, {"&&", 2, OP_JZ_KEEP},
+  {"|", 3, OP_OR}, {"^", 4, OP_XOR}, {"&", 5, OP_AND},
+  {"==", 6, OP_EQ}, {"!=", 6, OP_NE},
+  {"<=", 7, OP_LE}, {">=", 7, OP_GE}, {"<", 7, OP_LT}, {">", 7, OP_GT},
+  {"<<", 8, OP_SHL}, {">>", 8, OP_SHR},
+  {"+", 9, OP_ADD}, {"-", 9, OP_SUB},
+  {"*", 10, OP_MUL}, {"/", 10, OP_DIV}, {"%", 10, OP_MOD},
+};
+#define N_BINARY_OPS (sizeof(binary_ops) / sizeof(binary_ops[0]))
+#define MAX_LEVEL 10
+
+// the assignment operators, with the operation they apply
+static const struct {
+  const char *text;
+  op_t op;
+} assign_ops[] = {
+  {"<<=", OP_SHL}, {">>=", OP_SHR}, {"*=", OP_MUL}, {"/=", OP_DIV},
+  {"%=", OP_MOD}, {"+=", OP_ADD}, {"-=", OP_SUB}, {"&=", OP_AND},
+  {"^=", OP_XOR}, {"|=", OP_OR}, {"=", OP_POP},
+};
+#define N_ASSIGN_OPS (sizeof(assign_ops) / sizeof(assign_ops[0]))
+
+
+static void
+program_free(program_t *prog)
+{
+  if (!prog)
+    return;
+  for (int i = 0; i < prog->n_names; i++)
+    free(prog->names[i]);
+  free(prog->names);
+  free(prog->code);
+  free(prog);
+}
+
+/*
+ * Reads a number in C syntax, without a sign
+ *
+ * Returns:
+ *   True with *value set and *end just past the number, or false if
+ *   there is no valid number at s
+ */
+static bool
+read_number(const char *s, const char **end, int64_t *value)
+{
+  int base = 10;
+  const char *digits = s;
+
+  if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+    base = 16;
+    digits = s + 2;
+  } else if (s[0] == '0') {
+    base = 8;
+  }
+  if (!isxdigit(*digits))
+    return false;
+
+  char *e;
+  *value = (int64_t)strtoull(digits, &e, base);
+  *end = e;
+  return !isalnum(*e) && *e != '_';
+}
+
+static void
+fail(compiler_t *c, const char *err)
+{
+  if (!c->failed) {
+    c->failed = true;
+    c->err = err;
+  }
+}
+
+/*
+ * Counts one more level of nesting before a recursive call, failing
+ * if there are so many that the C stack could run out. Every call is
+ * paired with c->nesting-- after the recursion, whatever it returned.
+ *
+ * Returns:
+ *   True if compiling may go on
+ */
+static bool
+enter(compiler_t *c)
+{
+  if (++c->nesting > MAX_NESTING)
+    fail(c, "Expression nested too deeply");
+  return !c->failed;
+}
+
+static int
+emit(compiler_t *c, op_t op, int64_t operand, int depth_change)
+{
+  if (c->failed)
+    return 0;
+
+  program_t *p = c->prog;
+  if (p->n_code + 2 > c->code_cap) {
+    c->code_cap *= 2;
+    int64_t *grown = realloc(p->code, c->code_cap * sizeof(int64_t));
+    if (!grown) {
+      fail(c, "Out of memory");
+      return 0;
+    }
+    p->code = grown;
+  }
+
+  int at = p->n_code;
+  p->code[p->n_code++] = op;
+  if (op == OP_PUSH || op == OP_LOAD || op == OP_STORE || op >= OP_JMP)
+    p->code[p->n_code++] = operand;
+
+  c->depth += depth_change;
+  if (c->depth > c->max_depth)
+    c->max_depth = c->depth;
+  return at;
+}
+
+/*
+ * Points the jump at code offset at to the current end of the code
+ */
+static void
+patch(compiler_t *c, int at)
+{
+  if (!c->failed)
+    c->prog->code[at + 1] = c->prog->n_code;
+}
+
+/*
+ * Returns the index of a variable name in the program, adding it if
+ * need be
+ */
+static int
+name_index(compiler_t *c, const char *name, size_t len)
+{
+  program_t *p = c->prog;
+  for (int i = 0; i < p->n_names; i++)
+    if (strlen(p->names[i]) == len && !strncmp(p->names[i], name, len))
+      return i;
+
+  char **grown = realloc(p->names, (p->n_names + 1) * sizeof(char *));
+  if (!grown || !(grown[p->n_names] = strndup(name, len))) {
+    if (grown)
+      p->names = grown;
+    fail(c, "Out of memory");
+    return 0;
+  }
+  p->names = grown;
+  return p->n_names++;
+}
+
+static void
+skip_space(compiler_t *c)
+{
+  while (isspace(*c->in))
+    c->in++;
+}
+
+/*
+ * Returns the length of the operator at in, taking the longest match
+ * so that "<<=" is not read as "<<" or "<"
+ */
+static size_t
+operator_length(const char *in)
+{
+  static const char *longer[] = {
+    "<<=", ">>=", "<=", ">=", "==", "!=", "&&", "||", "<<", ">>", "++", "--",
+    "*=", "/=", "%=", "+=", "-=", "&=", "^=", "|=", NULL
+  };
+
+  for (const char **op = longer; *op; op++)
+    if (!strncmp(in, *op, strlen(*op)))
+      return strlen(*op);
+  return 1;
+}
+
+/*
+ * Consumes the operator text if it is the next one in the input
+ */
+static bool
+accept(compiler_t *c, const char *text)
+{
+  skip_space(c);
+  size_t len = strlen(text);
+  if (strncmp(c->in, text, len) != 0 || operator_length(c->in) != len)
+    return false;
+  c->in += len;
+  return true;
+}
+
+static int compile_assign(compiler_t *c);
+static void compile_expr(compiler_t *c);
+
+/*
+ * Reads a variable reference, NAME, $NAME, or $ followed by a digit,
+ * '#' or '?'
+ *
+ * Returns:
+ *   The name's index, or -1 if there is no variable here
+ */
+static int
+read_variable(compiler_t *c)
+{
+  const char *start = c->in;
+  bool dollar = (*start == '$');
+  if (dollar)
+    start++;
+
+  const char *end = start;
+  if (dollar && (isdigit(*end) || *end == '#' || *end == '?'))
+    end++;
+  else if (isalpha(*end) || *end == '_')
+    while (isalnum(*end) || *end == '_')
+      end++;
+
+  if (end == start)
+    return -1;
+  c->in = end;
+  return name_index(c, start, end - start);
+}
+
+/*
+ * Compiles ++NAME or --NAME, or NAME++ or NAME-- if post is set
+ */
+static void
+compile_increment(compiler_t *c, int var, op_t op, bool post)
+{
+  emit(c, OP_LOAD, var, 1);
+  if (post)
+    emit(c, OP_DUP, 0, 1);
+  emit(c, OP_PUSH, 1, 1);
+  emit(c, op, 0, -1);
+  emit(c, OP_STORE, var, 0);
+  if (post)
+    emit(c, OP_POP, 0, -1);
+}
+
+/*
+ * Compiles a unary expression
+ *
+ * Returns:
+ *   The variable's index if the expression is nothing but a variable,
+ *   which makes it something that can be assigned to, or -1
+ */
+static int
+compile_unary(compiler_t *c)
+{
+  skip_space(c);
+
+  if (!strncmp(c->in, "++", 2) || !strncmp(c->in, "--", 2)) {
+    op_t op = (*c->in == '+') ? OP_ADD : OP_SUB;
+    c->in += 2;
+    skip_space(c);
+    int var = read_variable(c);
+    if (var < 0)
+      fail(c, "Syntax error in expression");
+    else
+      compile_increment(c, var, op, false);
+    return -1;
+  }
+
+  if (strchr("+-!~", *c->in) && *c->in) {
+    char unary = *c->in++;
+    if (enter(c))
+      compile_unary(c);
+    c->nesting--;
+    if (unary == '-')
+      emit(c, OP_NEG, 0, 0);
+    else if (unary == '!')
+      emit(c, OP_NOT, 0, 0);
+    else if (unary == '~')
+      emit(c, OP_BNOT, 0, 0);
+    return -1;
+  }
+
+  if (*c->in == '(') {
+    c->in++;
+    if (enter(c))
+      compile_expr(c);
+    c->nesting--;
+    skip_space(c);
+    if (*c->in != ')')
+      fail(c, "Syntax error in expression");
+    else
+      c->in++;
+    return -1;
+  }
+
+  int64_t value;
+  const char *end;
+  if (isdigit(*c->in)) {
+    if (!read_number(c->in, &end, &value))
+      fail(c, "Syntax error in expression");
+    else
+      c->in = end;
+    emit(c, OP_PUSH, value, 1);
+    return -1;
+  }
+
+  int var = read_variable(c);
+  if (var < 0) {
+    fail(c, "Syntax error in expression");
+    return -1;
+  }
+
+  skip_space(c);
+  if (!strncmp(c->in, "++", 2) || !strncmp(c->in, "--", 2)) {
+    compile_increment(c, var, (*c->in == '+') ? OP_ADD : OP_SUB, true);
+    c->in += 2;
+    return -1;
+  }
+  emit(c, OP_LOAD, var, 1);
+  return var;
+}
+
+/*
+ * Compiles the binary operators of level and tighter, by precedence
+ * climbing. Returns as compile_unary().
+ */
+static int
+compile_binary(compiler_t *c, int level)
+{
+  if (level > MAX_LEVEL)
+    return compile_unary(c);
+
+  int var = compile_binary(c, level + 1);
+
+  for (;;) {
+    int i;
+    for (i = 0; i < N_BINARY_OPS; i++)
+      if (binary_ops[i].level == level && accept(c, binary_ops[i].text))
+        break;
+    if (i == N_BINARY_OPS || c->failed)
+      return var;
+
+    var = -1;
+    op_t op = binary_ops[i].op;
+    if (op == OP_JZ_KEEP || op == OP_JNZ_KEEP) {
+      // the right-hand side only runs if the left does not decide
+      int jump = emit(c, op, 0, -1);
+      compile_binary(c, level + 1);
+      emit(c, OP_BOOL, 0, 0);
+      patch(c, jump);
+    } else {
+      compile_binary(c, level + 1);
+      emit(c, op, 0, -1);
+    }
+  }
+}
+
+/*
+ * Compiles COND ? EXPR : COND. Returns as compile_unary().
+ */
+static int
+compile_conditional(compiler_t *c)
+{
+  int var = compile_binary(c, 1);
+  if (!accept(c, "?"))
+    return var;
+
+  int to_else = emit(c, OP_JZ, 0, -1);
+  if (enter(c))
+    compile_expr(c);
+  c->nesting--;
+  int to_end = emit(c, OP_JMP, 0, 0);
+  c->depth--;
+  if (!accept(c, ":"))
+    fail(c, "Syntax error in expression");
+  patch(c, to_else);
+  if (enter(c))
+    compile_conditional(c);
+  c->nesting--;
+  patch(c, to_end);
+  return -1;
+}
+
+/*
+ * Compiles an assignment, or a conditional expression. Returns as
+ * compile_unary().
+ */
+static int
+compile_assign(compiler_t *c)
+{
+  int load_at = c->prog->n_code;
+  int var = compile_conditional(c);
+  if (var < 0 || c->failed)
+    return var;
+
+  for (int i = 0; i < N_ASSIGN_OPS; i++) {
+    if (!accept(c, assign_ops[i].text))
+      continue;
+
+    if (assign_ops[i].op == OP_POP) {
+      // plain "=": the variable's old value is not needed
+      c->prog->n_code = load_at;
+      c->depth--;
+      if (enter(c))
+        compile_assign(c);
+    } else {
+      if (enter(c))
+        compile_assign(c);
+      emit(c, assign_ops[i].op, 0, -1);
+    }
+    c->nesting--;
+    emit(c, OP_STORE, var, 0);
+    return -1;
+  }
+  return var;
+}
+
+/*
+ * Compiles a comma-separated list, whose value is the last one
+ */
+static void
+compile_expr(compiler_t *c)
+{
+  compile_assign(c);
+  while (accept(c, ",")) {
+    emit(c, OP_POP, 0, -1);
+    compile_assign(c);
+  }
+}
+
+/*
+ * Compiles expr into a new program, or returns NULL with *err set
+ */
+static program_t *
+compile(const char *expr, const char **err)
+{
+  compiler_t c = { .in = expr, .code_cap = INIT_CODE_CAP };
+
+  if (!(c.prog = calloc(1, sizeof(program_t)))
+      || !(c.prog->code = malloc(c.code_cap * sizeof(int64_t)))) {
+    free(c.prog);
+    *err = "Out of memory";
+    return NULL;
+  }
+
+  compile_expr(&c);
+  skip_space(&c);
+  if (*c.in)
+    fail(&c, "Syntax error in expression");
+  if (c.max_depth > ARITH_STACK)
+    fail(&c, "Expression too complex");
+
+  if (c.failed) {
+    *err = c.err;
+    program_free(c.prog);
+    return NULL;
+  }
+  return c.prog;
+}
+
+/*
+ * Converts a variable's value to a number; empty text is 0
+ */
+static bool
+value_of(const char *text, int64_t *value)
+{
+  const char *end;
+  bool negative = false;
+
+  *value = 0;
+  while (isspace(*text))
+    text++;
+  if (*text == '\0')
+    return true;
+  if (*text == '-' || *text == '+')
+    negative = (*text++ == '-');
+  if (!read_number(text, &end, value))
+    return false;
+  while (isspace(*end))
+    end++;
+  if (negative)
+    *value = (int64_t)(0 - (uint64_t)*value);
+  return *end == '\0';
+}
+
+/*
+ * Runs a compiled program
+ */
+static int
+run(program_t *prog, arith_get_fn get, arith_set_fn set, void *arg,
+    int64_t *result, char *err_msg, size_t err_msg_len)
+{
+  int64_t stack[ARITH_STACK];
+  int sp = 0;                 // stack[sp - 1] is the top
+  int64_t *code = prog->code;
+  char buf[32];
+
+  for (int pc = 0; pc < prog->n_code; ) {
+    op_t op = code[pc++];
+    int64_t a, b;
+
+    if (op >= OP_MUL && op <= OP_OR) {
+      b = stack[--sp];
+      a = stack[sp - 1];
+      uint64_t ua = a, ub = b;
+      int64_t r;
+
+      switch (op) {
+      case OP_MUL: r = (int64_t)(ua * ub); break;
+      case OP_ADD: r = (int64_t)(ua + ub); break;
+      case OP_SUB: r = (int64_t)(ua - ub); break;
+      case OP_DIV:
+      case OP_MOD:
+        if (b == 0) {
+          snprintf(err_msg, err_msg_len, "Division by zero");
+          return -1;
+        }
+        if (b == -1)  // INT64_MIN / -1 overflows
+          r = (op == OP_DIV) ? (int64_t)(0 - ua) : 0;
+        else
+          r = (op == OP_DIV) ? a / b : a % b;
+        break;
+      case OP_SHL: r = (int64_t)(ua << (ub & 63)); break;
+      case OP_SHR: r = a >> (ub & 63); break;
+      case OP_LT: r = a < b; break;
+      case OP_LE: r = a <= b; break;
+      case OP_GT: r = a > b; break;
+      case OP_GE: r = a >= b; break;
+      case OP_EQ: r = a == b; break;
+      case OP_NE: r = a != b; break;
+      case OP_AND: r = a & b; break;
+      case OP_XOR: r = a ^ b; break;
+      default: r = a | b; break;
+      }
+      stack[sp - 1] = r;
+      continue;
+    }
+
+    switch (op) {
+    case OP_PUSH:
+      stack[sp++] = code[pc++];
+      break;
+
+    case OP_LOAD: {
+      const char *name = prog->names[code[pc++]];
+      const char *text = get(arg, name);
+      if (text && !value_of(text, &a)) {
+        snprintf(err_msg, err_msg_len, "Bad number '%s' in %s", text, name);
+        return -1;
+      }
+      stack[sp++] = text ? a : 0;
+      break;
+    }
+
+    case OP_STORE: {
+      const char *name = prog->names[code[pc++]];
+      snprintf(buf, sizeof(buf), "%" PRId64, stack[sp - 1]);
+      if (set(arg, name, buf) != 0) {
+        snprintf(err_msg, err_msg_len, "Cannot assign to %s", name);
+        return -1;
+      }
+      break;
+    }
+
+    case OP_DUP:  stack[sp] = stack[sp - 1]; sp++; break;
+    case OP_POP:  sp--; break;
+    case OP_NEG:  stack[sp - 1] = (int64_t)(0 - (uint64_t)stack[sp - 1]); break;
+    case OP_NOT:  stack[sp - 1] = !stack[sp - 1]; break;
+    case OP_BNOT: stack[sp - 1] = ~stack[sp - 1]; break;
+    case OP_BOOL: stack[sp - 1] = stack[sp - 1] != 0; break;
+
+    case OP_JMP:
+      pc = code[pc];
+      break;
+
+    case OP_JZ:
+      pc = stack[--sp] ? pc + 1 : code[pc];
+      break;
+
+    case OP_JZ_KEEP:
+      if (stack[sp - 1] == 0)
+        pc = code[pc];
+      else {
+        sp--;
+        pc++;
+      }
+      break;
+
+    case OP_JNZ_KEEP:
+      if (stack[sp - 1] != 0) {
+        stack[sp - 1] = 1;
+        pc = code[pc];
+      } else {
+        sp--;
+        pc++;
+      }
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  *result = stack[0];
+  return 0;
+}
+
+/*
+ * FNV-1a hash of an expression
+ */
+static unsigned int
+hash_expr(const char *expr)
+{
+  unsigned int h = 2166136261u;
+  for (; *expr; expr++)
+    h = (h ^ (unsigned char)*expr) * 16777619u;
+  return h;
+}
+
+/*
+ * Returns the slot holding expr, or the empty slot where it would go
+ */
+static slot_t *
+find_slot(arith_cache_t *cache, const char *expr)
+{
+  unsigned int cap = 2 * ARITH_CACHE_MAX;
+  unsigned int i = hash_expr(expr) % cap;
+
+  while (cache->slots[i].expr && strcmp(cache->slots[i].expr, expr) != 0)
+    i = (i + 1) % cap;
+  return &cache->slots[i];
+}
+
+/*
+ * Empties the cache. Entries are never removed one by one, so the
+ * probe sequences need no tombstones.
+ */
+static void
+flush(arith_cache_t *cache)
+{
+  for (int i = 0; i < 2 * ARITH_CACHE_MAX; i++) {
+    free(cache->slots[i].expr);
+    program_free(cache->slots[i].prog);
+  }
+  memset(cache, 0, sizeof(*cache));
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the arith_ calls. All documentation is in the
+ * arith.h file.
+ *
+ **********************************************************************/
+
+arith_cache_t *
+arith_cache_new()
+{
+  return calloc(1, sizeof(arith_cache_t));
+}
+
+
+void
+arith_cache_free(arith_cache_t *cache)
+{
+  if (!cache)
+    return;
+  flush(cache);
+  free(cache);
+}
+
+
+int
+arith_eval(arith_cache_t *cache, const char *expr, arith_get_fn get,
+           arith_set_fn set, void *arg, int64_t *result,
+           char *err_msg, size_t err_msg_len)
+{
+  slot_t *slot = find_slot(cache, expr);
+
+  if (!slot->expr) {
+    const char *err;
+    program_t *prog = compile(expr, &err);
+    if (!prog) {
+      snprintf(err_msg, err_msg_len, "%s", err);
+      return -1;
+    }
+
+    // a full cache starts again, rather than tracking which is oldest
+    if (cache->used == ARITH_CACHE_MAX) {
+      flush(cache);
+      slot = find_slot(cache, expr);
+    }
+    if (!(slot->expr = strdup(expr))) {
+      program_free(prog);
+      snprintf(err_msg, err_msg_len, "Out of memory");
+      return -1;
+    }
+    slot->prog = prog;
+    cache->used++;
+  }
+
+  return run(slot->prog, get, set, arg, result, err_msg, err_msg_len);
+}
@@ -0,0 +1,85 @@
+/*
+ * arith.h
+ *
+ * Shell arithmetic, as in $((i + 1)): 64-bit integer expressions with
+ * the C operators, variable references and assignments. Each distinct
+ * expression is compiled once into a small stack-machine program and
+ * kept in a cache under its source text, so an expression in a loop
+ * body is only parsed the first time round.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _ARITH_H_
+#define _ARITH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct arith_cache_s arith_cache_t;
+
+/*
+ * Called to read a variable. name is a variable name, or a digit,
+ * '#' or '?' for $1, $# and $? written inside the expression.
+ *
+ * Returns:
+ *   The value as text, or NULL if the variable is not set, which
+ *   counts as 0
+ */
+typedef const char *(*arith_get_fn)(void *arg, const char *name);
+
+/*
+ * Called to assign to a variable; value is the result in decimal.
+ * Returns 0 on success, -1 on failure.
+ */
+typedef int (*arith_set_fn)(void *arg, const char *name, const char *value);
+
+/*
+ * Creates an empty cache of compiled expressions. A cache is not
+ * locked, so each thread that evaluates expressions needs its own.
+ *
+ * Returns:
+ *   The cache, to be freed with arith_cache_free(), or NULL if out of
+ *   memory
+ */
+arith_cache_t *arith_cache_new();
+
+/*
+ * Frees a cache and every program in it. Passing NULL is allowed.
+ */
+void arith_cache_free(arith_cache_t *cache);
+
+/*
+ * Evaluates an expression, compiling it first unless the cache holds
+ * it already.
+ *
+ * The operators are those of C, with their C precedence, on signed
+ * 64-bit integers that wrap on overflow:
+ *
+ *   ( )  ++ -- (prefix and postfix)  + - ! ~ (unary)  * / %  + -
+ *   << >>  < <= > >=  == !=  &  ^  |  &&  ||  ?:
+ *   = *= /= %= += -= <<= >>= &= ^= |=  ,
+ *
+ * && || and ?: only evaluate the operand they need. Numbers may be
+ * decimal, octal with a leading 0, or hex with 0x. A variable is
+ * written as NAME or $NAME, and its value must be such a number, or
+ * empty; an unset variable is 0.
+ *
+ * Parameters:
+ *   cache        Where the compiled form is kept
+ *   expr         The text between "$((" and "))"
+ *   get, set     Variable access; arg is passed to both
+ *   result       Set to the value of the expression
+ *   err_msg      In case of error, a message is copied here
+ *   err_msg_len  Length of err_msg
+ *
+ * Returns:
+ *   0 on success. On error, -1 with the message in err_msg: "Syntax
+ *   error in expression", "Division by zero", "Expression too
+ *   complex" or "Bad number '<value>' in <name>".
+ */
+int arith_eval(arith_cache_t *cache, const char *expr, arith_get_fn get,
+               arith_set_fn set, void *arg, int64_t *result,
+               char *err_msg, size_t err_msg_len);
+
+#endif /* _ARITH_H_ */
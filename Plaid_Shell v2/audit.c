@@ -0,0 +1,390 @@
+/*
+ * audit.c
+ *
+ * Command audit log: a single-producer, single-consumer queue filled
+ * by the shell and a writer thread that empties it in batches
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#define _GNU_SOURCE         // dup3
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pwd.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "audit.h"
+
+#define RING_SLOTS 256              // a power of two
+#define SLOT_TEXT 480               // cwd and arguments held in the slot
+
+/*
+ * One queued command. The text is the cwd and then the arguments
+ * joined by spaces, each ending in '\0'.
+ */
+typedef struct {
+  struct timespec when;
+  pid_t pid;
+  int status;
+  char *heap;                       // the text, if too long for the slot
+  char text[SLOT_TEXT];
+} slot_t;
+
+static slot_t *ring = NULL;
+static atomic_ulong ring_head = 0;  // slots ever filled; only the shell writes it
+static atomic_ulong ring_tail = 0;  // slots ever written out; only the writer writes it
+
+static int log_fd = -1;
+static char *log_path = NULL;
+static long log_size = 0;
+static long max_bytes = 0;
+static int keep = 0;
+static char *user = NULL;
+static pid_t owner = 0;             // the process whose queue this is
+
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static atomic_bool writer_idle = false;
+static bool stopping = false;
+
+
+/*
+ * Appends s to buf, writing tab, newline and backslash as \t, \n and
+ * \\, and returns the new end of buf
+ */
+static char *
+put_escaped(char *buf, const char *s)
+{
+  for (; *s; s++) {
+    switch (*s) {
+    case '\t': *buf++ = '\\'; *buf++ = 't'; break;
+    case '\n': *buf++ = '\\'; *buf++ = 'n'; break;
+    case '\\': *buf++ = '\\'; *buf++ = '\\'; break;
+    default: *buf++ = *s;
+    }
+  }
+  return buf;
+}
+
+/*
+ * Fills in a slot; the text goes on the heap when it does not fit,
+ * and is cut short if there is no memory for it
+ */
+static void
+fill_slot(slot_t *s, command_t *cmd, const char *cwd, int status)
+{
+  char * const *argv = command_get_argv(cmd);
+  size_t len = strlen(cwd) + 1;
+  for (int i = 0; argv[i]; i++)
+    len += strlen(argv[i]) + 1;
+
+  clock_gettime(CLOCK_REALTIME, &s->when);
+  s->pid = getpid();
+  s->status = status;
+  s->heap = (len > SLOT_TEXT) ? malloc(len) : NULL;
+
+  char *p = s->heap ? s->heap : s->text;
+  char *end = p + (s->heap ? len : SLOT_TEXT) - 1;
+  p = stpncpy(p, cwd, end - p);
+  *p++ = '\0';
+  for (int i = 0; argv[i] && p < end; i++) {
+    if (i > 0)
+      *p++ = ' ';
+    p = stpncpy(p, argv[i], end - p);
+  }
+  *p = '\0';
+}
+
+/*
+ * Returns the most room the line for a slot can take
+ */
+static size_t
+line_max(const slot_t *s)
+{
+  const char *text = s->heap ? s->heap : s->text;
+  size_t cwd_len = strlen(text);
+  return 2 * (strlen(user) + cwd_len + strlen(text + cwd_len + 1)) + 96;
+}
+
+/*
+ * Formats a slot as one line of the log, frees its heap text, and
+ * returns the length of the line. buf must hold line_max(s) bytes.
+ */
+static size_t
+format_slot(slot_t *s, char *buf)
+{
+  const char *text = s->heap ? s->heap : s->text;
+  struct tm tm;
+  gmtime_r(&s->when.tv_sec, &tm);
+
+  char *p = buf + strftime(buf, 32, "%Y-%m-%dT%H:%M:%S", &tm);
+  p += sprintf(p, ".%06ldZ\t", s->when.tv_nsec / 1000);
+  p = put_escaped(p, user);
+  p += sprintf(p, "\t%d\t", (int)s->pid);
+  p = put_escaped(p, text);
+  p += sprintf(p, "\t%d\t", s->status);
+  p = put_escaped(p, text + strlen(text) + 1);
+  *p++ = '\n';
+
+  free(s->heap);
+  s->heap = NULL;
+  return p - buf;
+}
+
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * Moves LOG.<keep-1> to LOG.<keep> and so on down to LOG to LOG.1,
+ * then starts a new LOG on the same descriptor
+ */
+static void
+rotate()
+{
+  size_t len = strlen(log_path) + 16;
+  char from[len], to[len];
+
+  for (int i = keep - 1; i >= 0; i--) {
+    if (i == 0)
+      snprintf(from, len, "%s", log_path);
+    else
+      snprintf(from, len, "%s.%d", log_path, i);
+    snprintf(to, len, "%s.%d", log_path, i + 1);
+    if (rename(from, to) != 0 && errno != ENOENT)
+      fprintf(stderr, "plaidsh: audit: %s: %s\n", to, strerror(errno));
+  }
+
+  int fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "plaidsh: audit: %s: %s\n", log_path, strerror(errno));
+    return;
+  }
+  dup3(fd, log_fd, O_CLOEXEC);
+  close(fd);
+  log_size = 0;
+}
+
+/*
+ * Writes out every queued slot with one write() and one fsync()
+ */
+static void
+write_batch()
+{
+  unsigned long tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+  unsigned long head = atomic_load_explicit(&ring_head, memory_order_acquire);
+  if (tail == head)
+    return;
+
+  size_t cap = 0;
+  for (unsigned long i = tail; i != head; i++)
+    cap += line_max(&ring[i % RING_SLOTS]);
+
+  char *buf = malloc(cap);
+  size_t len = 0;
+  for (unsigned long i = tail; i != head; i++) {
+    slot_t *s = &ring[i % RING_SLOTS];
+    if (buf)
+      len += format_slot(s, buf + len);
+    else
+      free(s->heap);
+  }
+
+  // the slots can be reused as soon as they are formatted
+  atomic_store_explicit(&ring_tail, head, memory_order_release);
+
+  if (!buf || write_all(log_fd, buf, len) != 0 || fsync(log_fd) != 0)
+    fprintf(stderr, "plaidsh: audit: %s: %s\n", log_path,
+            buf ? strerror(errno) : "Out of memory");
+  free(buf);
+
+  log_size += len;
+  if (max_bytes > 0 && log_size >= max_bytes)
+    rotate();
+}
+
+/*
+ * The writer thread. It sleeps until there is something to write, then
+ * gives the shell up to AUDIT_FLUSH_MS to queue more, so that a burst
+ * of commands shares one write and one fsync.
+ */
+static void *
+writer_main(void *arg)
+{
+  for (;;) {
+    pthread_mutex_lock(&lock);
+    for (;;) {
+      atomic_store(&writer_idle, true);
+      if (stopping || atomic_load(&ring_head) != atomic_load(&ring_tail))
+        break;
+      pthread_cond_wait(&wake, &lock);
+    }
+    atomic_store(&writer_idle, false);
+
+    if (!stopping) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += AUDIT_FLUSH_MS * 1000000L;
+      deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+      deadline.tv_nsec %= 1000000000L;
+      while (!stopping && atomic_load(&ring_head) - atomic_load(&ring_tail) < RING_SLOTS / 2)
+        if (pthread_cond_timedwait(&wake, &lock, &deadline) == ETIMEDOUT)
+          break;
+    }
+    bool stop = stopping;
+    pthread_mutex_unlock(&lock);
+
+    write_batch();
+    if (stop && atomic_load(&ring_head) == atomic_load(&ring_tail))
+      return NULL;
+  }
+}
+
+static void
+wake_writer()
+{
+  pthread_mutex_lock(&lock);
+  pthread_cond_signal(&wake);
+  pthread_mutex_unlock(&lock);
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the audit_ calls. All documentation is in the
+ * audit.h file.
+ *
+ **********************************************************************/
+
+int
+audit_open(const char *path, long new_max_bytes, int new_keep)
+{
+  if (log_fd >= 0) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    int err = errno;
+    if (fd >= 0)
+      close(fd);
+    errno = err;
+    return -1;
+  }
+
+  struct passwd *pw = getpwuid(getuid());
+  char uid[16];
+  snprintf(uid, sizeof(uid), "%d", (int)getuid());
+  if (!(ring = calloc(RING_SLOTS, sizeof(slot_t))) || !(log_path = strdup(path))
+      || !(user = strdup(pw ? pw->pw_name : uid))) {
+    free(ring);
+    free(log_path);
+    close(fd);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  log_fd = fd;
+  log_size = st.st_size;
+  max_bytes = new_max_bytes;
+  keep = (new_keep < 1) ? 1 : new_keep;
+  owner = getpid();
+
+  // signals stay with the shell's main thread, where signalfd reads
+  // them
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  int err = pthread_create(&writer, NULL, writer_main, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (err != 0) {
+    close(log_fd);
+    log_fd = -1;
+    errno = err;
+    return -1;
+  }
+
+  atexit(audit_close);
+  return 0;
+}
+
+
+bool
+audit_active()
+{
+  return log_fd >= 0;
+}
+
+
+void
+audit_command(command_t *cmd, const char *cwd, int status)
+{
+  if (log_fd < 0)
+    return;
+
+  // a forked child has no writer thread, so appends the line itself
+  if (getpid() != owner) {
+    slot_t s;
+    fill_slot(&s, cmd, cwd, status);
+    char *buf = malloc(line_max(&s));
+    if (buf)
+      write_all(log_fd, buf, format_slot(&s, buf));
+    else
+      free(s.heap);
+    free(buf);
+    return;
+  }
+
+  unsigned long head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+  while (head - atomic_load_explicit(&ring_tail, memory_order_acquire) == RING_SLOTS) {
+    // full: nothing may be dropped, so wait for the writer
+    wake_writer();
+    nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+  }
+
+  fill_slot(&ring[head % RING_SLOTS], cmd, cwd, status);
+  atomic_store(&ring_head, head + 1);
+
+  if (atomic_load(&writer_idle)
+      || head + 1 - atomic_load(&ring_tail) >= RING_SLOTS / 2)
+    wake_writer();
+}
+
+
+void
+audit_close()
+{
+  if (log_fd < 0 || getpid() != owner)
+    return;
+
+  pthread_mutex_lock(&lock);
+  stopping = true;
+  pthread_cond_signal(&wake);
+  pthread_mutex_unlock(&lock);
+  pthread_join(writer, NULL);
+
+  close(log_fd);
+  log_fd = -1;
+}
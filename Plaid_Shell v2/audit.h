@@ -0,0 +1,74 @@
+/*
+ * audit.h
+ *
+ * Audit log: one line for every command the shell runs, giving the
+ * time, user, process, working directory, exit status and the
+ * command's arguments, tab-separated:
+ *
+ *   2026-10-18T09:15:02.123456Z  alice  4242  /home/alice  0  ls -l
+ *
+ * Tabs, newlines and backslashes inside a field are written as \t,
+ * \n and \\.
+ *
+ * Logging a command only copies it into a lock-free queue. A writer
+ * thread takes everything queued, writes it with one write() and
+ * makes it durable with one fsync() (group commit), then sleeps
+ * until the queue starts to fill or AUDIT_FLUSH_MS passes. When the
+ * log grows past its size limit it is renamed to LOG.1, older logs
+ * move up to LOG.2 ... LOG.<keep>, and a new LOG is started.
+ *
+ * Nothing is dropped: if the queue is full, audit_command() waits for
+ * the writer, and at exit the queue is written out and synced before
+ * the process ends. Commands run by forked children of the shell,
+ * such as background jobs, are appended straight to the log, without
+ * the queue.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _AUDIT_H_
+#define _AUDIT_H_
+
+#include <stdbool.h>
+#include "command.h"
+
+#define AUDIT_FLUSH_MS 100                // longest a record waits to be written
+#define AUDIT_MAX_BYTES (16 * 1024 * 1024) // size at which the log is rotated
+#define AUDIT_KEEP 5                      // rotated logs kept
+
+/*
+ * Starts logging to path, appending to an existing log, and starts
+ * the writer thread. The queue is written out at exit.
+ *
+ * Parameters:
+ *   path        The log file
+ *   max_bytes   Size at which to rotate, or 0 never to rotate
+ *   keep        Number of rotated logs to keep
+ *
+ * Returns:
+ *   0 on success, -1 with errno set
+ */
+int audit_open(const char *path, long max_bytes, int keep);
+
+/*
+ * Returns true if audit_open() has been called successfully
+ */
+bool audit_active();
+
+/*
+ * Logs one command. Does nothing unless logging.
+ *
+ * Parameters:
+ *   cmd      The command, as it was run
+ *   cwd      The directory it ran in
+ *   status   Its exit status
+ */
+void audit_command(command_t *cmd, const char *cwd, int status);
+
+/*
+ * Writes out everything queued, syncs the log and stops the writer.
+ * Called automatically at exit; calling it again does nothing.
+ */
+void audit_close();
+
+#endif /* _AUDIT_H_ */
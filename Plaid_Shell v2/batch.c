@@ -0,0 +1,287 @@
+/*
+ * batch.c
+ *
+ * xargs-style argument batching for commands that are too long for
+ * a single exec
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/pidfd.h>
+#include "batch.h"
+#include "command.h"
+#include "eventloop.h"
+
+#define ARG_HEADROOM 2048     // bytes left spare, as POSIX recommends for xargs
+#define MAX_BATCH_PROCS 64    // upper bound on batches run in parallel
+#define INIT_ARGS_CAP 64      // initial capacity of batch_read_args() vectors
+
+extern char **environ;
+
+/*
+ * Bytes taken by one argument in the exec'd process: the string, its
+ * terminator and its argv pointer
+ */
+static long
+arg_size(const char *arg)
+{
+  return strlen(arg) + 1 + sizeof(char *);
+}
+
+/*
+ * Forks and execs one batch, returning a pidfd for the child or -1
+ */
+static int
+spawn_batch(command_t *batch, pid_t *pid)
+{
+  char * const *argv = command_get_argv(batch);
+
+  fflush(stdout);
+  *pid = fork();
+  if (*pid == -1) {
+    perror("fork");
+    return -1;
+  }
+
+  if (*pid == 0) {
+    ev_reset_child();
+    execvp(argv[0], argv);
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+  }
+
+  int pidfd = pidfd_open(*pid, 0);
+  if (pidfd < 0) {
+    // no pidfd support; fall back to waiting for this batch right away
+    return -2;
+  }
+  return pidfd;
+}
+
+/*
+ * Waits for pid and returns its exit status in the usual shell form
+ */
+static int
+reap(pid_t pid)
+{
+  int status;
+
+  while (waitpid(pid, &status, 0) < 0)
+    if (errno != EINTR)
+      return 127;
+
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the batch_ calls. All documentation is in the
+ * batch.h file.
+ *
+ **********************************************************************/
+
+long
+batch_arg_limit()
+{
+  long limit = sysconf(_SC_ARG_MAX);
+  if (limit <= 0)
+    limit = _POSIX_ARG_MAX;
+
+  for (char **env = environ; *env; env++)
+    limit -= arg_size(*env);
+
+  // the NULL terminators of argv and envp
+  limit -= 2 * sizeof(char *);
+
+  return limit - ARG_HEADROOM;
+}
+
+
+bool
+batch_too_long(command_t *cmd)
+{
+  long size = 0;
+
+  for (char * const *argv = command_get_argv(cmd); *argv; argv++)
+    size += arg_size(*argv);
+
+  return size > batch_arg_limit();
+}
+
+
+char **
+batch_read_args(FILE *fp, int *nargs)
+{
+  int cap = INIT_ARGS_CAP;
+  char **args = malloc(cap * sizeof(char *));
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+
+  *nargs = 0;
+  if (!args)
+    return NULL;
+
+  while ((len = getline(&line, &line_cap, fp)) >= 0) {
+    while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+      line[--len] = '\0';
+    if (len == 0)
+      continue;
+
+    if (*nargs + 1 == cap) {
+      cap *= 2;
+      char **grown = realloc(args, cap * sizeof(char *));
+      if (!grown)
+        goto error;
+      args = grown;
+    }
+
+    if (!(args[*nargs] = strdup(line)))
+      goto error;
+    (*nargs)++;
+  }
+
+  args[*nargs] = NULL;
+  free(line);
+  return args;
+
+ error:
+  args[*nargs] = NULL;
+  batch_free_args(args);
+  free(line);
+  return NULL;
+}
+
+
+void
+batch_free_args(char **args)
+{
+  if (!args)
+    return;
+  for (char **a = args; *a; a++)
+    free(*a);
+  free(args);
+}
+
+
+int
+batch_run(command_t *tmpl, char * const *args, int nargs, int max_procs)
+{
+  long limit = batch_arg_limit();
+  long base = 0;
+  char * const *tmpl_argv = command_get_argv(tmpl);
+
+  for (char * const *a = tmpl_argv; *a; a++)
+    base += arg_size(*a);
+
+  if (max_procs < 1)
+    max_procs = 1;
+  if (max_procs > MAX_BATCH_PROCS)
+    max_procs = MAX_BATCH_PROCS;
+
+  struct pollfd running[MAX_BATCH_PROCS];
+  pid_t pids[MAX_BATCH_PROCS];
+  int n_running = 0;
+  int status = 0;
+  int next = 0;
+
+  while (next < nargs || n_running > 0) {
+
+    // start batches until the parallelism limit is reached
+    while (n_running < max_procs && next < nargs) {
+      command_t *batch = command_new();
+      if (!batch)
+        return 1;
+
+      for (char * const *a = tmpl_argv; *a; a++)
+        command_append_arg(batch, *a);
+
+      long size = base;
+      int first = next;
+      while (next < nargs && size + arg_size(args[next]) <= limit) {
+        size += arg_size(args[next]);
+        command_append_arg(batch, args[next++]);
+      }
+
+      if (next == first) {
+        fprintf(stderr, "%s: argument too long: %.40s...\n", tmpl_argv[0], args[next]);
+        status = 1;
+        next++;
+        command_free(batch);
+        continue;
+      }
+
+      pid_t pid;
+      int pidfd = spawn_batch(batch, &pid);
+      command_free(batch);
+
+      if (pidfd == -1) {
+        status = 127;
+      } else if (pidfd == -2) {
+        int st = reap(pid);
+        if (st != 0)
+          status = st;
+      } else {
+        running[n_running].fd = pidfd;
+        running[n_running].events = POLLIN;
+        pids[n_running++] = pid;
+      }
+    }
+
+    if (n_running == 0)
+      continue;
+
+    // wait for at least one running batch to exit
+    if (poll(running, n_running, -1) < 0 && errno != EINTR)
+      break;
+
+    for (int i = 0; i < n_running; i++) {
+      if (!running[i].revents)
+        continue;
+
+      int st = reap(pids[i]);
+      if (st != 0)
+        status = st;
+      close(running[i].fd);
+
+      running[i] = running[--n_running];
+      pids[i] = pids[n_running];
+      i--;
+    }
+  }
+
+  return status;
+}
+
+
+int
+batch_split(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+  int argc = command_get_argc(cmd);
+
+  command_t *tmpl = command_new();
+  if (!tmpl)
+    return 1;
+
+  int k = 0;
+  do {
+    command_append_arg(tmpl, argv[k++]);
+  } while (k < argc && argv[k][0] == '-');
+
+  int status = batch_run(tmpl, argv + k, argc - k, 1);
+  command_free(tmpl);
+  return status;
+}
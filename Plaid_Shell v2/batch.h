@@ -0,0 +1,88 @@
+/*
+ * batch.h
+ *
+ * Runs a command template over a long list of arguments, packing as
+ * many arguments into each exec as the kernel allows, in the manner
+ * of xargs. Used by the batch builtin, and automatically when a glob
+ * expands to more arguments than a single exec can take.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "command.h"
+
+/*
+ * Returns the number of bytes that the argument strings and argv
+ * pointers of one exec may occupy: sysconf(_SC_ARG_MAX), less the
+ * current environment and some headroom
+ */
+long batch_arg_limit();
+
+/*
+ * Returns true if cmd's argv is too large to pass to a single exec,
+ * which would otherwise fail with E2BIG
+ *
+ * Parameters:
+ *   cmd    The command to check
+ */
+bool batch_too_long(command_t *cmd);
+
+/*
+ * Reads an argument stream, one argument per line. Empty lines are
+ * skipped, and a trailing carriage return is removed from each line.
+ *
+ * Parameters:
+ *   fp      The stream to read until end of file
+ *   nargs   Set to the number of arguments read
+ *
+ * Returns:
+ *   A newly allocated, NULL-terminated vector of newly allocated
+ *   strings, to be released with batch_free_args(); or NULL if out
+ *   of memory
+ */
+char **batch_read_args(FILE *fp, int *nargs);
+
+/*
+ * Frees a vector returned by batch_read_args()
+ */
+void batch_free_args(char **args);
+
+/*
+ * Runs the template once per batch, with as many of args appended as
+ * fit within batch_arg_limit(). Batches keep the order of args. Each
+ * batch is a child process that inherits the shell's current stdin
+ * and stdout; the template's own input and output files are ignored.
+ *
+ * Parameters:
+ *   tmpl        Command whose argv starts every batch
+ *   args        The arguments to distribute over batches
+ *   nargs       Number of entries in args
+ *   max_procs   Number of batches that may run at the same time
+ *
+ * Returns:
+ *   0 if every batch succeeded; otherwise the exit status of the last
+ *   batch that failed, 127 if a batch could not be run, or 1 if a
+ *   single argument is too long to fit in any batch
+ */
+int batch_run(command_t *tmpl, char * const *args, int nargs, int max_procs);
+
+/*
+ * Splits an over-long command for batch_run(): argv[0] and any
+ * leading arguments that begin with '-' form the template, and the
+ * rest are distributed over batches. Redirections of cmd must
+ * already have been applied by the caller.
+ *
+ * Parameters:
+ *   cmd    The command, for which batch_too_long() is true
+ *
+ * Returns:
+ *   As for batch_run()
+ */
+int batch_split(command_t *cmd);
+
+#endif /* _BATCH_H_ */
@@ -0,0 +1,342 @@
+/*
+ * bench_parser.c
+ *
+ * Microbenchmarks for read_word(), parse_input() and
+ * command_append_arg() over a set of representative input corpora.
+ * For each benchmark, prints time per operation, input bytes per
+ * second and heap allocations per operation.
+ *
+ * Usage: bench_parser [-o results.jsonl] [-l label] [-f filter]
+ *
+ * With -o, one JSON object per benchmark is appended to the file,
+ * tagged with the label (normally the commit), so that runs from
+ * different commits can be compared line by line.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "parser.h"
+#include "command.h"
+
+#define MIN_BENCH_SECS 0.2      // each benchmark runs for at least this long
+#define N_LONG_ARGS 1000        // words in the long argument list
+#define N_GLOB_FILES 5000       // files in the glob directory
+
+/**********************************************************************
+ *
+ * Allocation counting. Defining malloc and friends here replaces
+ * them for the whole process, including allocations made inside
+ * glob() and strdup(), so every heap allocation is counted.
+ *
+ **********************************************************************/
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long n_allocs = 0;
+
+void *malloc(size_t size)
+{
+  n_allocs++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+  n_allocs++;
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  n_allocs++;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+  __libc_free(ptr);
+}
+
+
+/**********************************************************************
+ *
+ * Corpora
+ *
+ **********************************************************************/
+
+// short lines, as typed at the prompt
+static const char *interactive_lines[] = {
+  "ls -l",
+  "cd /tmp",
+  "echo hello world",
+  "grep -n main < plaidsh.c > /tmp/out",
+  "make test",
+  "cat README.md",
+  "git status",
+  "pwd",
+  NULL
+};
+
+// quotes and escapes in every word
+static const char *quoted_lines[] = {
+  "echo \"New York\" New\\ Jersey \\\"quoted\\\" \\$HOME",
+  "printf \"%s\\t%s\\n\" \"a b c\" \"d\\\"e\"",
+  "echo a\\ b\\ c\\ d\\ e\\ f \"g h i j k l\" \\<not\\ redirect\\>",
+  "echo \"one;two\" three\\;four \"five && six\" seven\\&\\&eight",
+  NULL
+};
+
+// several variables per line, including adjacent ones
+static const char *variable_lines[] = {
+  "echo $BENCH_A $BENCH_B $BENCH_C",
+  "echo $BENCH_A$BENCH_B$BENCH_C \"$BENCH_LONG\"",
+  "cp $BENCH_A/$BENCH_B $BENCH_C/$BENCH_A.bak",
+  "echo $1 $2 $# $? $0",
+  NULL
+};
+
+static char *long_line[2];      // generated; see make_corpora()
+static char *glob_line[2];
+static char glob_dir[64];
+
+
+/*
+ * Builds the generated corpora and the glob directory
+ */
+static void
+make_corpora()
+{
+  static char *positional[] = { "bench_parser", "first", "second", NULL };
+
+  setenv("BENCH_A", "alpha", 1);
+  setenv("BENCH_B", "bravo", 1);
+  setenv("BENCH_C", "charlie", 1);
+  setenv("BENCH_LONG", "a considerably longer value with several words in it", 1);
+  parser_set_positional(positional);
+
+  size_t len = 16 + N_LONG_ARGS * 16;
+  long_line[0] = __libc_malloc(len);
+  char *p = long_line[0] + sprintf(long_line[0], "cmd");
+  for (int i = 0; i < N_LONG_ARGS; i++)
+    p += sprintf(p, " --argument-%d", i);
+
+  snprintf(glob_dir, sizeof(glob_dir), "/tmp/bench_parser.%d", getpid());
+  mkdir(glob_dir, 0700);
+  char path[128];
+  for (int i = 0; i < N_GLOB_FILES; i++) {
+    snprintf(path, sizeof(path), "%s/file%05d.txt", glob_dir, i);
+    int fd = open(path, O_CREAT | O_WRONLY, 0600);
+    if (fd >= 0)
+      close(fd);
+  }
+
+  glob_line[0] = __libc_malloc(sizeof(path));
+  snprintf(glob_line[0], sizeof(path), "ls %s/*.txt", glob_dir);
+}
+
+/*
+ * Removes the glob directory
+ */
+static void
+remove_corpora()
+{
+  char path[128];
+  for (int i = 0; i < N_GLOB_FILES; i++) {
+    snprintf(path, sizeof(path), "%s/file%05d.txt", glob_dir, i);
+    unlink(path);
+  }
+  rmdir(glob_dir);
+}
+
+
+/**********************************************************************
+ *
+ * Benchmarks. Each op function runs one operation over the whole
+ * corpus and returns the number of input bytes it consumed.
+ *
+ **********************************************************************/
+
+typedef long (*bench_op_fn)(const char **corpus);
+
+static long
+total_bytes(const char **corpus)
+{
+  long bytes = 0;
+  for (; *corpus; corpus++)
+    bytes += strlen(*corpus);
+  return bytes;
+}
+
+/*
+ * read_word() over every word of every line
+ */
+static long
+op_read_word(const char **corpus)
+{
+  char word[512];
+
+  for (const char **line = corpus; *line; line++) {
+    const char *in = *line;
+    int n;
+    while ((n = read_word(in, word, sizeof(word))) > 0)
+      in += n;
+  }
+  return total_bytes(corpus);
+}
+
+/*
+ * parse_input() of every line, freeing the commands
+ */
+static long
+op_parse_input(const char **corpus)
+{
+  char err_msg[256];
+
+  for (const char **line = corpus; *line; line++)
+    command_free(parse_input(*line, err_msg, sizeof(err_msg)));
+  return total_bytes(corpus);
+}
+
+/*
+ * command_append_arg() of every word, as parse_input() would do it
+ */
+static long
+op_append_arg(const char **corpus)
+{
+  static const char *args[N_LONG_ARGS];
+  static char arg_text[N_LONG_ARGS][16];
+
+  if (!args[0]) {
+    for (int i = 0; i < N_LONG_ARGS; i++) {
+      snprintf(arg_text[i], sizeof(arg_text[i]), "--argument-%d", i);
+      args[i] = arg_text[i];
+    }
+  }
+
+  long bytes = 0;
+  command_t *cmd = command_new();
+  for (int i = 0; i < N_LONG_ARGS; i++) {
+    command_append_arg(cmd, args[i]);
+    bytes += strlen(args[i]);
+  }
+  command_free(cmd);
+  return bytes;
+}
+
+typedef struct {
+  const char *name;
+  bench_op_fn op;
+  const char **corpus;
+} bench_t;
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Runs one benchmark for at least MIN_BENCH_SECS and reports it
+ */
+static void
+run_bench(const bench_t *b, FILE *json, const char *label)
+{
+  long ops = 1;
+  double elapsed;
+  long bytes;
+  unsigned long allocs;
+
+  // double the op count until the run is long enough to time
+  for (;;) {
+    bytes = 0;
+    allocs = n_allocs;
+    double start = now();
+    for (long i = 0; i < ops; i++)
+      bytes += b->op(b->corpus);
+    elapsed = now() - start;
+    allocs = n_allocs - allocs;
+
+    if (elapsed >= MIN_BENCH_SECS)
+      break;
+    ops *= 2;
+  }
+
+  double ns_per_op = elapsed * 1e9 / ops;
+  double bytes_per_sec = bytes / elapsed;
+  double allocs_per_op = (double)allocs / ops;
+
+  printf("%-26s %12.1f ns/op %10.1f MB/s %10.1f allocs/op\n",
+    b->name, ns_per_op, bytes_per_sec / 1e6, allocs_per_op);
+
+  if (json)
+    fprintf(json, "{\"label\":\"%s\",\"bench\":\"%s\",\"ops\":%ld,"
+      "\"ns_per_op\":%.1f,\"bytes_per_sec\":%.0f,\"allocs_per_op\":%.2f}\n",
+      label, b->name, ops, ns_per_op, bytes_per_sec, allocs_per_op);
+}
+
+
+int main(int argc, char *argv[])
+{
+  const char *out_path = NULL;
+  const char *label = "";
+  const char *filter = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "o:l:f:")) != -1) {
+    if (opt == 'o')
+      out_path = optarg;
+    else if (opt == 'l')
+      label = optarg;
+    else if (opt == 'f')
+      filter = optarg;
+    else {
+      fprintf(stderr, "Usage: bench_parser [-o results.jsonl] [-l label] [-f filter]\n");
+      return 1;
+    }
+  }
+
+  make_corpora();
+
+  const bench_t benches[] = {
+    { "read_word/interactive",   op_read_word,   interactive_lines },
+    { "read_word/quoted",        op_read_word,   quoted_lines },
+    { "read_word/variables",     op_read_word,   variable_lines },
+    { "read_word/long_args",     op_read_word,   (const char **)long_line },
+    { "parse_input/interactive", op_parse_input, interactive_lines },
+    { "parse_input/quoted",      op_parse_input, quoted_lines },
+    { "parse_input/variables",   op_parse_input, variable_lines },
+    { "parse_input/long_args",   op_parse_input, (const char **)long_line },
+    { "parse_input/glob_5000",   op_parse_input, (const char **)glob_line },
+    { "command_append_arg/1000", op_append_arg,  NULL },
+  };
+
+  FILE *json = NULL;
+  if (out_path && !(json = fopen(out_path, "a"))) {
+    perror(out_path);
+    remove_corpora();
+    return 1;
+  }
+
+  for (int i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+    if (!filter || strstr(benches[i].name, filter))
+      run_bench(&benches[i], json, label);
+
+  if (json)
+    fclose(json);
+  remove_corpora();
+  return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * bench_script.c
+ *
+ * Measures the cost of running builtins inside a loop, comparing a
+ * script parsed once by script_parse() with re-parsing the loop body
+ * on every iteration
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "parser.h"
+#include "script.h"
+
+#define LOOP_WIDTH 1000    // words per for loop; two nested loops
+
+static long builtins_run = 0;
+
+/*
+ * Stand-in for execute_command(): dispatches the "true" builtin the
+ * same way plaidsh does, without forking
+ */
+static int
+bench_exec(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+
+  if (!strcmp(argv[0], "true")) {
+    builtins_run++;
+    return 0;
+  }
+  return 1;
+}
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char *argv[])
+{
+  char err_msg[512];
+
+  // for a in 0 1 ... 999; do for b in 0 1 ... 999; do true; done; done
+  size_t len = 64 + 2 * LOOP_WIDTH * 5;
+  char *words = malloc(LOOP_WIDTH * 5 + 1);
+  char *input = malloc(len);
+  char *w = words;
+  for (int i = 0; i < LOOP_WIDTH; i++)
+    w += sprintf(w, " %d", i);
+  snprintf(input, len, "for a in%s; do for b in%s; do true; done; done",
+    words, words);
+
+  double start = now();
+  script_t *script = script_parse(input, err_msg, sizeof(err_msg));
+  if (!script) {
+    fprintf(stderr, "script_parse: %s\n", err_msg);
+    return 1;
+  }
+  script_run(script, bench_exec);
+  double elapsed = now() - start;
+  script_free(script);
+
+  printf("parsed once:     %ld iterations in %.3f s, %.1f ns/iteration\n",
+    builtins_run, elapsed, elapsed * 1e9 / builtins_run);
+
+  // the same loop variable updates and builtins, re-tokenizing the
+  // body each time as a line-at-a-time shell would
+  long iterations = builtins_run;
+  char value[16];
+  builtins_run = 0;
+  start = now();
+  for (long i = 0; i < iterations; i++) {
+    snprintf(value, sizeof(value), "%ld", i % LOOP_WIDTH);
+    setenv("b", value, 1);
+    command_t *cmd = parse_input("true", err_msg, sizeof(err_msg));
+    bench_exec(cmd);
+    command_free(cmd);
+  }
+  elapsed = now() - start;
+
+  printf("parsed per line: %ld iterations in %.3f s, %.1f ns/iteration\n",
+    builtins_run, elapsed, elapsed * 1e9 / builtins_run);
+
+  free(words);
+  free(input);
+  return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * bench_serve.c
+ *
+ * Measures command throughput through plaidsh --serve, against
+ * starting a new plaidsh for every command. Run from the build
+ * directory, as "make bench" does.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "frame.h"
+
+#define N_CLIENTS 8         // concurrent connections
+#define N_REQUESTS 1000     // requests sent by each connection
+#define N_STARTUPS 500      // shells started for the baseline
+
+static const char *commands[] = { "true", "/bin/true" };
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+connect_to(const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    return fd;
+  if (fd >= 0)
+    close(fd);
+  return -1;
+}
+
+/*
+ * Sends n requests over one connection, each waiting for the last,
+ * and returns the number that succeeded
+ */
+static int
+run_client(const char *path, const char *cmd, int n)
+{
+  char *payload = malloc(FRAME_MAX + 1);
+  int fd = connect_to(path);
+  int ok = 0;
+  char type;
+
+  for (int i = 0; fd >= 0 && i < n; i++) {
+    if (frame_send(fd, FRAME_CMD, cmd, strlen(cmd)) != 0)
+      break;
+
+    ssize_t len;
+    while ((len = frame_recv(fd, &type, payload, FRAME_MAX + 1)) >= 0 && type != FRAME_EXIT && type)
+      ;
+    if (type != FRAME_EXIT)
+      break;
+    if (frame_status(payload) == 0)
+      ok++;
+  }
+  return ok;
+}
+
+/*
+ * Runs N_CLIENTS client processes at once and reports requests/second
+ */
+static void
+bench_served(const char *path, const char *cmd)
+{
+  double start = now();
+
+  for (int i = 0; i < N_CLIENTS; i++) {
+    if (fork() == 0)
+      _exit(run_client(path, cmd, N_REQUESTS) == N_REQUESTS ? 0 : 1);
+  }
+
+  int failed = 0, status;
+  while (wait(&status) > 0)
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      failed++;
+
+  double elapsed = now() - start;
+  int total = N_CLIENTS * N_REQUESTS;
+  printf("serve %-10s %8.0f req/s  %8.1f us/req  (%d clients%s)\n", cmd,
+    total / elapsed, elapsed * 1e6 / total, N_CLIENTS, failed ? ", FAILURES" : "");
+}
+
+/*
+ * Starts a plaidsh per command, feeding it the command on stdin
+ */
+static void
+bench_startup(const char *cmd)
+{
+  double start = now();
+
+  for (int i = 0; i < N_STARTUPS; i++) {
+    int fds[2];
+    if (pipe(fds) != 0)
+      return;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      dup2(fds[0], STDIN_FILENO);
+      close(fds[0]);
+      close(fds[1]);
+      int null_fd = open("/dev/null", O_WRONLY);
+      dup2(null_fd, STDOUT_FILENO);
+      execl("./plaidsh", "plaidsh", (char *)NULL);
+      _exit(127);
+    }
+
+    close(fds[0]);
+    dprintf(fds[1], "%s\n", cmd);
+    close(fds[1]);
+    waitpid(pid, NULL, 0);
+  }
+
+  double elapsed = now() - start;
+  printf("spawn %-10s %8.0f req/s  %8.1f us/req  (sequential)\n", cmd,
+    N_STARTUPS / elapsed, elapsed * 1e6 / N_STARTUPS);
+}
+
+
+int main(int argc, char *argv[])
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/plaidsh-bench-%d.sock", getpid());
+
+  pid_t server = fork();
+  if (server == 0) {
+    execl("./plaidsh", "plaidsh", "--serve", path, (char *)NULL);
+    perror("./plaidsh");
+    _exit(127);
+  }
+
+  // wait for the server to start listening
+  int fd = -1;
+  for (int i = 0; i < 200 && fd < 0; i++) {
+    if ((fd = connect_to(path)) < 0)
+      usleep(10000);
+  }
+  if (fd < 0) {
+    fprintf(stderr, "bench_serve: server did not start\n");
+    kill(server, SIGTERM);
+    return 1;
+  }
+  close(fd);
+
+  // the server is our child too; keep bench_served() from reaping it
+  for (int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+    pid_t clients = fork();
+    if (clients == 0) {
+      bench_served(path, commands[i]);
+      fflush(stdout);
+      _exit(0);
+    }
+    waitpid(clients, NULL, 0);
+  }
+
+  for (int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+    bench_startup(commands[i]);
+
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+  return 0;
+}
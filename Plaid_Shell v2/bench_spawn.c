@@ -0,0 +1,84 @@
+/*
+ * bench_spawn.c
+ *
+ * Measures the latency of launching /bin/true as the launching
+ * process grows, forking directly against going through the zygote
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "zygote.h"
+
+#define N_SPAWNS 300        // launches timed at each size
+#define GROW_STEP_MB 256    // memory added to this process between rounds
+#define N_ROUNDS 4
+
+extern char **environ;
+
+static char * const true_argv[] = { "/bin/true", NULL };
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+time_fork()
+{
+  double start = now();
+  for (int i = 0; i < N_SPAWNS; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      execv(true_argv[0], true_argv);
+      _exit(127);
+    }
+    waitpid(pid, NULL, 0);
+  }
+  return (now() - start) * 1e6 / N_SPAWNS;
+}
+
+static double
+time_zygote()
+{
+  const int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+  pid_t pid;
+  int status;
+
+  double start = now();
+  for (int i = 0; i < N_SPAWNS; i++) {
+    if (zygote_spawn(true_argv, environ, fds, &pid, &status) != 0)
+      return -1;
+  }
+  return (now() - start) * 1e6 / N_SPAWNS;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if (zygote_start() != 0) {
+    perror("zygote_start");
+    return 1;
+  }
+
+  printf("%8s %16s %16s\n", "size MB", "fork us/spawn", "zygote us/spawn");
+  for (int round = 0; round < N_ROUNDS; round++) {
+    printf("%8d %16.1f %16.1f\n", round * GROW_STEP_MB, time_fork(), time_zygote());
+
+    // touch every page so that it really belongs to this process
+    char *block = malloc((size_t)GROW_STEP_MB << 20);
+    if (!block)
+      break;
+    memset(block, 1, (size_t)GROW_STEP_MB << 20);
+  }
+  return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * builtins.c
+ *
+ * Open-addressing table of builtin commands, and loading of builtins
+ * from shared objects
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <link.h>
+#include "builtins.h"
+
+#define INIT_TABLE_CAP 32   // initial slots; always a power of 2
+
+typedef struct {
+  char *name;               // NULL for an empty slot
+  builtin_fn fn;
+  bool enabled;
+  char *path;               // shared object it came from, or NULL
+} slot_t;
+
+static slot_t *table = NULL;
+static unsigned int table_cap = 0;
+static unsigned int table_used = 0;
+
+
+/*
+ * FNV-1a hash of a builtin name
+ */
+static unsigned int
+hash_name(const char *name)
+{
+  unsigned int h = 2166136261u;
+  for (; *name; name++)
+    h = (h ^ (unsigned char)*name) * 16777619u;
+  return h;
+}
+
+/*
+ * Returns the slot holding name, or the empty slot where it would go.
+ * Builtins are never removed, so probing can stop at the first empty
+ * slot without tombstones. The table must exist.
+ */
+static slot_t *
+find_slot(slot_t *tab, unsigned int cap, const char *name)
+{
+  unsigned int i = hash_name(name) & (cap - 1);
+
+  while (tab[i].name && strcmp(tab[i].name, name) != 0)
+    i = (i + 1) & (cap - 1);
+
+  return &tab[i];
+}
+
+/*
+ * Makes sure there is room for one more builtin, keeping the table at
+ * most half full so that probe sequences stay short
+ */
+static int
+reserve_slot()
+{
+  if (table && 2 * (table_used + 1) <= table_cap)
+    return 0;
+
+  unsigned int cap = table_cap ? 2 * table_cap : INIT_TABLE_CAP;
+  slot_t *tab = calloc(cap, sizeof(slot_t));
+  if (!tab)
+    return -1;
+
+  for (unsigned int i = 0; i < table_cap; i++)
+    if (table[i].name)
+      *find_slot(tab, cap, table[i].name) = table[i];
+
+  free(table);
+  table = tab;
+  table_cap = cap;
+  return 0;
+}
+
+/*
+ * Adds or replaces a builtin, remembering the object it came from
+ */
+static int
+register_from(const char *name, builtin_fn fn, const char *path)
+{
+  if (reserve_slot() != 0)
+    return -1;
+
+  slot_t *slot = find_slot(table, table_cap, name);
+  char *path_copy = path ? strdup(path) : NULL;
+  if (path && !path_copy)
+    return -1;
+
+  if (!slot->name) {
+    if (!(slot->name = strdup(name))) {
+      free(path_copy);
+      return -1;
+    }
+    table_used++;
+  }
+
+  free(slot->path);
+  slot->path = path_copy;
+  slot->fn = fn;
+  slot->enabled = true;
+  return 0;
+}
+
+/*
+ * Returns true if addr lies in the object that handle was opened for,
+ * rather than in one of the objects it depends on
+ */
+static bool
+defined_in(void *handle, void *addr)
+{
+  struct link_map *map;
+  Dl_info info;
+
+  if (dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0 || !dladdr(addr, &info))
+    return false;
+  return info.dli_fname && map->l_name && strcmp(info.dli_fname, map->l_name) == 0;
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the builtin_ registry calls. All documentation
+ * is in the builtins.h file.
+ *
+ **********************************************************************/
+
+int
+builtin_register(const char *name, builtin_fn fn)
+{
+  return register_from(name, fn, NULL);
+}
+
+
+builtin_fn
+builtin_lookup(const char *name)
+{
+  if (!table)
+    return NULL;
+
+  slot_t *slot = find_slot(table, table_cap, name);
+  return (slot->name && slot->enabled) ? slot->fn : NULL;
+}
+
+
+int
+builtin_set_enabled(const char *name, bool enable)
+{
+  if (!table)
+    return -1;
+
+  slot_t *slot = find_slot(table, table_cap, name);
+  if (!slot->name)
+    return -1;
+
+  slot->enabled = enable;
+  return 0;
+}
+
+
+int
+builtin_load(const char *path, const char *name, char *err_msg, size_t err_msg_len)
+{
+  void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (!handle) {
+    snprintf(err_msg, err_msg_len, "%s", dlerror());
+    return -1;
+  }
+
+  char symbol[256];
+  snprintf(symbol, sizeof(symbol), "builtin_%s", name);
+
+  // dlsym() also searches the object's dependencies, so a symbol
+  // found in libc or the shell itself must not be taken for the plugin's
+  builtin_fn fn = (builtin_fn)dlsym(handle, symbol);
+  if (!fn || !defined_in(handle, (void *)fn)) {
+    snprintf(err_msg, err_msg_len, "%s: cannot find %s", path, symbol);
+    dlclose(handle);
+    return -1;
+  }
+
+  // the handle is deliberately never closed: fn may be running
+  if (register_from(name, fn, path) != 0) {
+    snprintf(err_msg, err_msg_len, "Out of memory");
+    return -1;
+  }
+  return 0;
+}
+
+
+void
+builtin_list()
+{
+  for (unsigned int i = 0; i < table_cap; i++) {
+    slot_t *slot = &table[i];
+    if (!slot->name)
+      continue;
+
+    if (!slot->enabled)
+      printf("enable -n %s\n", slot->name);
+    else if (slot->path)
+      printf("enable -f %s %s\n", slot->path, slot->name);
+    else
+      printf("enable %s\n", slot->name);
+  }
+}
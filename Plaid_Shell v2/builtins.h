@@ -0,0 +1,91 @@
+/*
+ * builtins.h
+ *
+ * Registry of builtin commands. Builtins are kept in an
+ * open-addressing hash table, so dispatch costs one hash and usually
+ * one string compare however many builtins are registered. Extra
+ * builtins can be loaded at run time from shared objects.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _BUILTINS_H_
+#define _BUILTINS_H_
+
+#include <stdbool.h>
+#include "command.h"
+
+/*
+ * Signature of every builtin. argv[0] is the builtin's name; the
+ * return value is the command's exit status.
+ */
+typedef int (*builtin_fn)(command_t *cmd);
+
+/*
+ * Adds a builtin, or replaces the function of an existing one. The
+ * builtin starts out enabled.
+ *
+ * Parameters:
+ *   name    Name the builtin is invoked by; it is copied
+ *   fn      Function implementing it
+ *
+ * Returns:
+ *   0 on success, -1 if out of memory
+ */
+int builtin_register(const char *name, builtin_fn fn);
+
+/*
+ * Finds the function for an enabled builtin
+ *
+ * Parameters:
+ *   name    The command name, normally argv[0]
+ *
+ * Returns:
+ *   The builtin's function, or NULL if there is no enabled builtin
+ *   by that name
+ */
+builtin_fn builtin_lookup(const char *name);
+
+/*
+ * Enables or disables a registered builtin. A disabled builtin stays
+ * in the table but builtin_lookup() ignores it, so a program of the
+ * same name runs instead.
+ *
+ * Parameters:
+ *   name     The builtin
+ *   enable   True to enable it, false to disable it
+ *
+ * Returns:
+ *   0 on success, -1 if no builtin by that name is registered
+ */
+int builtin_set_enabled(const char *name, bool enable);
+
+/*
+ * Loads a builtin from a shared object with dlopen(). The object
+ * must itself define a function with the builtin_fn signature named
+ * "builtin_<name>"; symbols from the libraries it links against are
+ * not accepted. It may call any of the command_ functions in
+ * command.h, which the shell exports.
+ * The object stays loaded for the life of the shell.
+ *
+ * Parameters:
+ *   path    Path of the shared object, as passed to dlopen()
+ *   name    Name of the builtin to register
+ *   err_msg      In case of error, an error message will be returned
+ *                  in this string
+ *   err_msg_len  Length of the err_msg string
+ *
+ * Returns:
+ *   0 on success, -1 on failure
+ */
+int builtin_load(const char *path, const char *name, char *err_msg, size_t err_msg_len);
+
+/*
+ * Prints every registered builtin, one per line, in table order.
+ * Disabled builtins are shown as "enable -n <name>", and loaded ones
+ * as "enable -f <path> <name>", matching the commands that would
+ * recreate them.
+ */
+void builtin_list();
+
+#endif /* _BUILTINS_H_ */
@@ -10,6 +10,7 @@
 #include <stdlib.h>             // free/malloc
 #include <stdio.h>              // printf
 #include <string.h>             // strcmp
+#include <stdatomic.h>          // atomic_uint
 
 #include "command.h"
 
@@ -20,6 +21,15 @@
 typedef struct command_s {
   char *in_file;      // if non-NULL, the filename to read input from
   char *out_file;     // if non-NULL, the filename to send output to
+  char *in_text;      // if non-NULL, text to feed to stdin instead
+  int n_subst;        // number of process substitutions
+  struct subst_s {
+    int arg;          // index of the argument it stands for, or
+                      //   COMMAND_SUBST_INPUT or COMMAND_SUBST_OUTPUT
+    bool output;      // >(text) rather than <(text)
+    char *text;       // the command inside the parentheses
+  } *subst;           // NULL until the first one is added
+  int argc;           // number of arguments, not counting the NULL
   int argv_cap;       // current length of argv; different from argc!
   char **argv;        // the actual argv vector
 } command_t;
@@ -29,13 +39,14 @@ typedef struct command_s {
  * 
  * Internal versions of malloc, strdup, and free, which keep a count
  * of how many mallocs/strdups have happened in order to guarantee the
- * same number of calls to free
+ * same number of calls to free. The counts are atomic so that commands
+ * can be built and freed on several threads at once.
  *
  **********************************************************************/
 //#define DEBUG_MALLOC
 
-static unsigned int n_malloc = 0;
-static unsigned int n_free = 0;
+static atomic_uint n_malloc = 0;
+static atomic_uint n_free = 0;
 
 
 static void *cint_malloc(size_t size)
@@ -82,7 +93,7 @@ static void cint_free(void *ptr)
 static void cint_assert_all_free()
 {
 #ifdef DEBUG_MALLOC
-  printf("n_malloc=%u n_free=%u\n", n_malloc, n_free);
+  printf("n_malloc=%u n_free=%u\n", atomic_load(&n_malloc), atomic_load(&n_free));
 #endif
 
   assert (n_malloc == n_free);
@@ -90,6 +101,13 @@ static void cint_assert_all_free()
 #endif   // RUN_TESTS
 
 
+unsigned int
+command_outstanding_allocs()
+{
+  return atomic_load(&n_malloc) - atomic_load(&n_free);
+}
+
+
 /**********************************************************************
  * 
  * Implementations for the command_t calls.  All documentation is in
@@ -103,7 +121,11 @@ command_t *command_new()
   if (cmd) {
     cmd->in_file = NULL;
     cmd->out_file = NULL;
+    cmd->in_text = NULL;
+    cmd->n_subst = 0;
+    cmd->subst = NULL;
 
+    cmd->argc = 0;
     cmd->argv_cap = INIT_ARGV_CAP;
     cmd->argv = cint_malloc(cmd->argv_cap * sizeof(char *));
 
@@ -135,6 +157,18 @@ command_free(command_t *cmd)
     cmd->out_file = NULL;
   }
 
+  if (cmd->in_text) {
+    cint_free(cmd->in_text);
+    cmd->in_text = NULL;
+  }
+
+  if (cmd->subst) {
+    for (int i=0; i < cmd->n_subst; i++)
+      cint_free(cmd->subst[i].text);
+    cint_free(cmd->subst);
+    cmd->subst = NULL;
+  }
+
   for (int i=0; cmd->argv[i]; i++) {
     cint_free(cmd->argv[i]);
     cmd->argv[i] = NULL;
@@ -153,10 +187,11 @@ int command_set_input(command_t *cmd, const char *in_file)
 
   int ret = 0;
 
-  if (cmd->in_file) {
-    // there was already an in_file file here; free and return -1
-    cint_free(cmd->in_file);
+  if (cmd->in_file || cmd->in_text) {
+    // input was already redirected here; free and return -1
+    cint_free(cmd->in_file ? cmd->in_file : cmd->in_text);
     cmd->in_file = NULL;
+    cmd->in_text = NULL;
     ret = -1;
   }
   if (in_file) {
@@ -192,6 +227,38 @@ int command_set_output(command_t *cmd, const char *out_file)
 }
 
 
+int command_set_input_text(command_t *cmd, const char *text)
+{
+  if (!cmd)
+    return -1;
+
+  int ret = 0;
+
+  if (cmd->in_file || cmd->in_text) {
+    // input was already redirected; drop it and return -1
+    cint_free(cmd->in_file ? cmd->in_file : cmd->in_text);
+    cmd->in_file = NULL;
+    cmd->in_text = NULL;
+    ret = -1;
+  }
+  if (text) {
+    cmd->in_text = cint_strdup(text);
+    if (cmd->in_text == NULL)
+      ret = -1;
+  }
+
+  return ret;
+}
+
+
+const char *command_get_input_text(command_t *cmd)
+{
+  if (!cmd)
+    return NULL;
+  return cmd->in_text;
+}
+
+
 const char *command_get_input(command_t *cmd)
 {
   if (!cmd)
@@ -216,13 +283,20 @@ void command_dump(command_t *cmd)
   }
     
   printf("Command at %p...\n", cmd);
-  printf("  < %s\n", cmd->in_file ? cmd->in_file : "stdin");
+  if (cmd->in_text)
+    printf("  <<< %zu bytes\n", strlen(cmd->in_text));
+  else
+    printf("  < %s\n", cmd->in_file ? cmd->in_file : "stdin");
   printf("  > %s\n", cmd->out_file ? cmd->out_file : "stdout");
   printf("  argc=%d\n", command_get_argc(cmd));
 
   for (int i=0; cmd->argv[i]; i++) 
     printf("    argv[%d] = %s\n", i, cmd->argv[i]);
 
+  for (int i=0; i < cmd->n_subst; i++)
+    printf("    %s%d runs %s(%s)\n", cmd->subst[i].arg < 0 ? "file " : "argv",
+      cmd->subst[i].arg, cmd->subst[i].output ? ">" : "<", cmd->subst[i].text);
+
 }
 
 
@@ -235,6 +309,11 @@ bool command_compare(command_t *cmd1, command_t *cmd2)
           cmd2->in_file ? cmd2->in_file : "null") != 0)
     return false;
 
+  if (strcmp(cmd1->in_text ? cmd1->in_text : "",
+          cmd2->in_text ? cmd2->in_text : "") != 0
+      || !cmd1->in_text != !cmd2->in_text)
+    return false;
+
   if (strcmp(cmd1->out_file ? cmd1->out_file : "null",
           cmd2->out_file ? cmd2->out_file : "null") != 0)
     return false;
@@ -247,6 +326,14 @@ bool command_compare(command_t *cmd1, command_t *cmd2)
   if (cmd2->argv[i] != NULL)
     return false;
 
+  if (cmd1->n_subst != cmd2->n_subst)
+    return false;
+  for (i=0; i < cmd1->n_subst; i++)
+    if (cmd1->subst[i].arg != cmd2->subst[i].arg
+        || cmd1->subst[i].output != cmd2->subst[i].output
+        || strcmp(cmd1->subst[i].text, cmd2->subst[i].text) != 0)
+      return false;
+
   return true;
 }
 
@@ -255,7 +342,7 @@ bool command_is_empty(command_t *cmd)
   if (!cmd)
     return true;
 
-  if (cmd->in_file || cmd->out_file)
+  if (cmd->in_file || cmd->out_file || cmd->in_text)
     return false;
 
   if (cmd->argv[0] == NULL)
@@ -269,11 +356,7 @@ int command_get_argc(command_t *cmd)
   if (!cmd)
     return -1;
 
-  int cnt;
-  for (cnt = 0; cmd->argv[cnt]; cnt++)
-    ;
-
-  return cnt;
+  return cmd->argc;
 }
 
 int command_append_arg(command_t *cmd, const char *arg)
@@ -281,25 +364,93 @@ int command_append_arg(command_t *cmd, const char *arg)
   if (!cmd || !arg)
     return -1;
 
-  // find the terminal NULL
-  int idx;
-  for (idx = 0; cmd->argv[idx]; idx++)
-    ;
-
+  int idx = cmd->argc;
   assert(idx < cmd->argv_cap);
 
   if (idx + 1 == cmd->argv_cap) {
-    // reallocate argv
-    cmd->argv_cap += INIT_ARGV_CAP;
-    cmd->argv = realloc(cmd->argv, cmd->argv_cap * sizeof(char*));
+    // reallocate argv, doubling it so that appending a large glob
+    // expansion takes linear time overall
+    char **argv = realloc(cmd->argv, 2 * cmd->argv_cap * sizeof(char*));
+    if (!argv)
+      return -1;
+    cmd->argv = argv;
+    cmd->argv_cap *= 2;
   }
-  cmd->argv[idx++] = cint_strdup(arg);
+
+  char *copy = cint_strdup(arg);
+  if (!copy)
+    return -1;
+
+  cmd->argv[idx++] = copy;
   cmd->argv[idx] = NULL;
+  cmd->argc = idx;
+
+  return 0;
+}
+
+
+int command_replace_arg(command_t *cmd, int arg, const char *value)
+{
+  if (!cmd || !value || arg < 0 || arg >= cmd->argc)
+    return -1;
+
+  char *copy = cint_strdup(value);
+  if (!copy)
+    return -1;
+
+  cint_free(cmd->argv[arg]);
+  cmd->argv[arg] = copy;
+  return 0;
+}
+
+
+int command_add_subst(command_t *cmd, int arg, const char *text, bool output)
+{
+  if (!cmd || !text || arg >= cmd->argc
+      || (arg < 0 && arg != COMMAND_SUBST_INPUT && arg != COMMAND_SUBST_OUTPUT))
+    return -1;
+
+  // grow one at a time; commands rarely have more than two
+  struct subst_s *subst;
+  if (!cmd->subst)
+    subst = cint_malloc(sizeof(struct subst_s));
+  else
+    subst = realloc(cmd->subst, (cmd->n_subst + 1) * sizeof(struct subst_s));
+  if (!subst)
+    return -1;
+  cmd->subst = subst;
+
+  char *copy = cint_strdup(text);
+  if (!copy)
+    return -1;
 
+  subst[cmd->n_subst].arg = arg;
+  subst[cmd->n_subst].output = output;
+  subst[cmd->n_subst].text = copy;
+  cmd->n_subst++;
   return 0;
 }
 
 
+int command_get_subst_count(command_t *cmd)
+{
+  if (!cmd)
+    return 0;
+  return cmd->n_subst;
+}
+
+
+const char *command_get_subst(command_t *cmd, int i, int *arg, bool *output)
+{
+  if (!cmd || i < 0 || i >= cmd->n_subst)
+    return NULL;
+
+  *arg = cmd->subst[i].arg;
+  *output = cmd->subst[i].output;
+  return cmd->subst[i].text;
+}
+
+
 char * const * command_get_argv(command_t *cmd)
 {
   if (!cmd)
@@ -342,6 +493,18 @@ void test_command()
   assert( command_set_input(cmd, infile) == 0 );
   assert( command_set_input(cmd, infile) == -1 );
 
+  // input text replaces the input file, and vice versa
+  assert( command_set_input_text(cmd, "hello\n") == -1 );
+  assert( command_get_input(cmd) == NULL );
+  assert( strcmp(command_get_input_text(cmd), "hello\n") == 0 );
+  assert( command_set_input_text(cmd, NULL) == -1 );
+  assert( command_get_input_text(cmd) == NULL );
+  assert( command_is_empty(cmd) );
+  assert( command_set_input_text(cmd, "hello\n") == 0 );
+  assert( !command_is_empty(cmd) );
+  assert( command_set_input(cmd, infile) == -1 );
+  assert( command_get_input_text(cmd) == NULL );
+
   // play with output
   const char *outfile = "/tmp/foo";
   assert( command_set_output(cmd, outfile) == 0 );
@@ -371,6 +534,23 @@ void test_command()
 
   assert( !command_is_empty(cmd) );
 
+  // mark two arguments as process substitutions
+  int arg;
+  bool output;
+  assert( command_get_subst_count(cmd) == 0 );
+  assert( command_add_subst(cmd, argc, "ls", false) == -1 );
+  assert( command_add_subst(cmd, 1, "sort a", false) == 0 );
+  assert( command_add_subst(cmd, 2, "wc", true) == 0 );
+  assert( command_get_subst_count(cmd) == 2 );
+  assert( strcmp(command_get_subst(cmd, 1, &arg, &output), "wc") == 0 );
+  assert( arg == 2 && output );
+  assert( command_get_subst(cmd, 2, &arg, &output) == NULL );
+  assert( command_replace_arg(cmd, 1, "/dev/fd/63") == 0 );
+  assert( strcmp(command_get_argv(cmd)[1], "/dev/fd/63") == 0 );
+  assert( command_replace_arg(cmd, argc, "x") == -1 );
+  assert( command_add_subst(cmd, COMMAND_SUBST_OUTPUT, "tee log", true) == 0 );
+  assert( command_add_subst(cmd, -3, "ls", false) == -1 );
+
   // dump the command
   command_dump(cmd);
 
@@ -72,6 +72,28 @@ const char *command_get_input(command_t *cmd);
 const char *command_get_output(command_t *cmd);
 
 
+/*
+ * Updates the command with text to feed to its stdin, from a
+ * here-document or here-string. The text takes the place of an input
+ * file, so a command has at most one of the two.
+ *
+ * Parameters:
+ *   cmd     The command to be updated
+ *   text    The text, which is copied, or NULL for none
+ *
+ * Returns:
+ *   0 on success
+ *  -1 if the input was already set to a file or to text, or if out
+ *      of memory
+ */
+int command_set_input_text(command_t *cmd, const char *text);
+
+/*
+ * Returns the text set by command_set_input_text(), or NULL
+ */
+const char *command_get_input_text(command_t *cmd);
+
+
 /*
  * Print the contents of a command to stdout
  *
@@ -130,6 +152,61 @@ int command_get_argc(command_t *cmd);
  */
 int command_append_arg(command_t *cmd, const char *arg);
 
+/*
+ * Replaces one argument of this command.
+ *
+ * Parameters:
+ *   cmd      The command
+ *   arg      Index of the argument, which must already exist
+ *   value    The new argument (which will be copied aside)
+ *
+ * Returns:
+ *   0 on success, -1 if arg is out of range or out of memory
+ */
+int command_replace_arg(command_t *cmd, int arg, const char *value);
+
+#define COMMAND_SUBST_INPUT -1     // arg for "< <(text)": the input file
+#define COMMAND_SUBST_OUTPUT -2    // arg for "> >(text)": the output file
+
+/*
+ * Marks an argument, or the input or output file, as a process
+ * substitution, <(text) or >(text). Before the command runs, text is
+ * started as a command of its own with its stdout (or, for >(text),
+ * its stdin) connected to a pipe, and the argument or file is
+ * replaced by a /dev/fd path naming the other end.
+ *
+ * Parameters:
+ *   cmd      The command
+ *   arg      Index of the argument, which must already exist, or
+ *              COMMAND_SUBST_INPUT or COMMAND_SUBST_OUTPUT
+ *   text     The command inside the parentheses (which will be copied)
+ *   output   True for >(text), false for <(text)
+ *
+ * Returns:
+ *   0 on success, -1 if arg is out of range or out of memory
+ */
+int command_add_subst(command_t *cmd, int arg, const char *text, bool output);
+
+/*
+ * Returns the number of process substitutions added to this command
+ */
+int command_get_subst_count(command_t *cmd);
+
+/*
+ * Gets one process substitution of this command.
+ *
+ * Parameters:
+ *   cmd      The command
+ *   i        Which substitution, from 0 in the order they were added
+ *   arg      Set to the index of the argument it stands for, or
+ *              COMMAND_SUBST_INPUT or COMMAND_SUBST_OUTPUT
+ *   output   Set to true for >(text), false for <(text)
+ *
+ * Returns:
+ *   The text of the substitution, or NULL if i is out of range
+ */
+const char *command_get_subst(command_t *cmd, int i, int *arg, bool *output);
+
 /*
  * Get a pointer to the NULL-terminated argv vector for this command
  *
@@ -143,5 +220,12 @@ int command_append_arg(command_t *cmd, const char *arg);
  */
 char * const * command_get_argv(command_t *cmd);
 
+/*
+ * Returns the number of blocks allocated by the command_ functions
+ * that have not yet been freed, across all threads. The count is only
+ * exact while no other thread is creating or freeing commands.
+ */
+unsigned int command_outstanding_allocs();
+
 
 #endif /* _COMMAND_H_ */
@@ -0,0 +1,265 @@
+/*
+ * coproc.c
+ *
+ * Coprocesses started by the shell and the buffered lines read back
+ * from them
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "coproc.h"
+#include "eventloop.h"
+
+#define READ_CHUNK 4096
+
+typedef struct coproc_s {
+  char *name;
+  char *desc;                 // the command line, for coproc_list()
+  pid_t pid;
+  int fd;                     // the shell's end of the socketpair
+  char *buf;                  // output read but not yet returned
+  size_t len, cap;
+  bool eof;
+  struct coproc_s *next;
+} coproc_t;
+
+static coproc_t *coprocs = NULL;
+
+
+static coproc_t *
+find(const char *name)
+{
+  for (coproc_t *c = coprocs; c; c = c->next)
+    if (!strcmp(c->name, name))
+      return c;
+  errno = ENOENT;
+  return NULL;
+}
+
+static long
+now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Reads whatever the coprocess has written, waiting until the deadline
+ * for it to write something
+ *
+ * Returns:
+ *   0 if something was read or the output ended, -1 with errno set
+ */
+static int
+fill(coproc_t *c, long deadline)
+{
+  if (c->cap - c->len < READ_CHUNK) {
+    char *grown = realloc(c->buf, c->cap + READ_CHUNK);
+    if (!grown)
+      return -1;
+    c->buf = grown;
+    c->cap += READ_CHUNK;
+  }
+
+  for (;;) {
+    int wait = (deadline < 0) ? -1 : (int)(deadline - now_ms());
+    if (deadline >= 0 && wait < 0)
+      wait = 0;
+    struct pollfd p = { .fd = c->fd, .events = POLLIN };
+    int ready = poll(&p, 1, wait);
+    if (ready < 0 && errno == EINTR)
+      continue;
+    if (ready < 0)
+      return -1;
+    if (ready == 0) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+
+    ssize_t n = read(c->fd, c->buf + c->len, c->cap - c->len);
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    // a reset is a coprocess that exited without reading all it was sent
+    if (n < 0 && errno != ECONNRESET)
+      return -1;
+    if (n <= 0)
+      c->eof = true;
+    else
+      c->len += n;
+    return 0;
+  }
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the coproc_ calls. All documentation is in the
+ * coproc.h file.
+ *
+ **********************************************************************/
+
+int
+coproc_start(const char *name, char * const *argv)
+{
+  if (find(name)) {
+    errno = EEXIST;
+    return -1;
+  }
+
+  coproc_t *c = calloc(1, sizeof(coproc_t));
+  size_t len = 1;
+  for (int i = 0; argv[i]; i++)
+    len += strlen(argv[i]) + 1;
+  if (!c || !(c->name = strdup(name)) || !(c->desc = malloc(len))) {
+    if (c)
+      free(c->name);
+    free(c);
+    errno = ENOMEM;
+    return -1;
+  }
+  char *p = c->desc;
+  for (int i = 0; argv[i]; i++)
+    p += sprintf(p, i ? " %s" : "%s", argv[i]);
+
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0)
+    goto failed;
+
+  fflush(stdout);
+  c->pid = fork();
+  if (c->pid == -1) {
+    close(sv[0]);
+    close(sv[1]);
+    goto failed;
+  }
+
+  if (c->pid == 0) {
+    ev_reset_child();
+    dup2(sv[1], STDIN_FILENO);
+    dup2(sv[1], STDOUT_FILENO);
+    execvp(argv[0], argv);
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+  }
+
+  close(sv[1]);
+  c->fd = sv[0];
+  c->next = coprocs;
+  coprocs = c;
+  return 0;
+
+ failed:
+  free(c->name);
+  free(c->desc);
+  free(c);
+  return -1;
+}
+
+
+int
+coproc_write(const char *name, const char *data, size_t len)
+{
+  coproc_t *c = find(name);
+  if (!c)
+    return -1;
+
+  while (len > 0) {
+    ssize_t n = send(c->fd, data, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+
+int
+coproc_read(const char *name, int timeout_ms, char **line)
+{
+  coproc_t *c = find(name);
+  if (!c)
+    return -1;
+
+  long deadline = (timeout_ms < 0) ? -1 : now_ms() + timeout_ms;
+  size_t searched = 0;
+  char *nl;
+  for (;;) {
+    nl = (c->len > searched) ? memchr(c->buf + searched, '\n', c->len - searched) : NULL;
+    if (nl || c->eof)
+      break;
+    searched = c->len;
+    if (fill(c, deadline) != 0)
+      return -1;
+  }
+  if (!nl && c->len == 0)
+    return 0;
+
+  // the last line of the output may have no '\n'
+  size_t len = nl ? nl - c->buf : c->len;
+  if (!(*line = strndup(c->buf, len)))
+    return -1;
+  size_t used = nl ? len + 1 : len;
+  memmove(c->buf, c->buf + used, c->len - used);
+  c->len -= used;
+  return 1;
+}
+
+
+int
+coproc_shutdown(const char *name)
+{
+  coproc_t *c = find(name);
+  if (!c)
+    return -1;
+  return shutdown(c->fd, SHUT_WR);
+}
+
+
+int
+coproc_close(const char *name)
+{
+  coproc_t **link = &coprocs;
+  while (*link && strcmp((*link)->name, name))
+    link = &(*link)->next;
+  if (!*link) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  coproc_t *c = *link;
+  *link = c->next;
+  close(c->fd);
+
+  // a forked copy of the shell has the list but not the children
+  int status = 0;
+  while (waitpid(c->pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  free(c->name);
+  free(c->desc);
+  free(c->buf);
+  free(c);
+  return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+
+void
+coproc_list()
+{
+  for (coproc_t *c = coprocs; c; c = c->next)
+    printf("%s  %d  %s\n", c->name, (int)c->pid, c->desc);
+}
@@ -0,0 +1,107 @@
+/*
+ * coproc.h
+ *
+ * Coprocesses: long-lived helper programs, such as a calculator or a
+ * lookup tool, that the shell starts once and then talks to a line
+ * at a time, so that many queries share one process instead of each
+ * forking and execing a new one:
+ *
+ *   coproc greet sed -u "s/^/hello, /"
+ *   cowrite greet world
+ *   coread greet reply          # reply is "hello, world"
+ *   coclose greet
+ *
+ * A coprocess's stdin and stdout are both one end of a socketpair,
+ * which is a pipe in each direction; the shell holds the other end.
+ * Its stderr is the shell's. Writing to a coprocess that has exited
+ * fails with EPIPE rather than raising SIGPIPE in the shell.
+ *
+ * Most programs buffer their output when it is not a terminal, so a
+ * helper must flush after each reply (sed -u, python3 -u, stdbuf -oL)
+ * or coread will wait for it.
+ *
+ * Helpers that answer only at the end of their input, such as sort or
+ * wc, are sent that end with coclose -w, after which their output is
+ * read as usual:
+ *
+ *   coproc s sort
+ *   cowrite s pear
+ *   cowrite s apple
+ *   coclose -w s
+ *   coread s first              # first is "apple"
+ *   coclose s
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _COPROC_H_
+#define _COPROC_H_
+
+/*
+ * Starts a coprocess
+ *
+ * Parameters:
+ *   name   The name it is known by, which must not be in use
+ *   argv   The program and its arguments
+ *
+ * Returns:
+ *   0 on success, -1 with errno set (EEXIST if the name is in use)
+ */
+int coproc_start(const char *name, char * const *argv);
+
+/*
+ * Writes to a coprocess's stdin, waiting until all of it is written
+ *
+ * Parameters:
+ *   name   The coprocess
+ *   data   What to write, normally a line ending in '\n'
+ *   len    The length of data
+ *
+ * Returns:
+ *   0 on success, -1 with errno set (ENOENT for no such coprocess,
+ *   EPIPE if it has stopped reading)
+ */
+int coproc_write(const char *name, const char *data, size_t len);
+
+/*
+ * Reads the next line a coprocess writes
+ *
+ * Parameters:
+ *   name         The coprocess
+ *   timeout_ms   The longest to wait, or -1 to wait for ever
+ *   line         Set to the line without its '\n', in malloc'd
+ *                  memory the caller frees
+ *
+ * Returns:
+ *   1 if a line was read, 0 at the end of its output, -1 with errno
+ *   set (ENOENT for no such coprocess, ETIMEDOUT)
+ */
+int coproc_read(const char *name, int timeout_ms, char **line);
+
+/*
+ * Ends a coprocess's input with shutdown(), keeping the shell's end
+ * open, so that what it writes once it sees the end of its input can
+ * still be read with coproc_read(). Writing to it afterwards fails
+ * with EPIPE.
+ *
+ * Returns:
+ *   0 on success, -1 with errno set (ENOENT for no such coprocess)
+ */
+int coproc_shutdown(const char *name);
+
+/*
+ * Closes the shell's end of a coprocess, which it sees as the end of
+ * its input, and waits for it to exit
+ *
+ * Returns:
+ *   Its exit status, 128 plus the signal number if it was killed by
+ *   a signal, or -1 with errno set (ENOENT for no such coprocess)
+ */
+int coproc_close(const char *name);
+
+/*
+ * Prints one line per coprocess, as "name  pid  command"
+ */
+void coproc_list();
+
+#endif /* _COPROC_H_ */
@@ -0,0 +1,548 @@
+/*
+ * dag.c
+ *
+ * Task files: loading and checking the graph, running it in parallel
+ * and summarizing where the time went
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/pidfd.h>
+#include "dag.h"
+#include "parser.h"
+#include "eventloop.h"
+
+typedef enum { WAITING, RUNNING, SUCCEEDED, FAILED, SKIPPED } state_t;
+
+typedef struct {
+  char *name;
+  command_t *cmd;
+  int line;                   // where it is in the task file
+
+  char **dep_names;
+  int *deps;                  // the tasks it depends on
+  int n_deps;
+  int *after;                 // the tasks that depend on it
+  int n_after;
+  int height;                 // longest chain of tasks from it to the end
+
+  state_t state;
+  int unmet;                  // dependencies that have not yet succeeded
+  int status;
+  int cause;                  // for a skipped task, the one that failed
+  pid_t pid;
+  uint64_t start, end;        // nanoseconds after the run started
+} task_t;
+
+struct dag_s {
+  task_t *tasks;
+  int n;
+  int *order;                 // the tasks, each after its dependencies
+};
+
+
+static uint64_t
+now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Returns the index of the task called name among the first n, or -1
+ */
+static int
+find_task(dag_t *dag, const char *name, int n)
+{
+  for (int i = 0; i < n; i++)
+    if (!strcmp(dag->tasks[i].name, name))
+      return i;
+  return -1;
+}
+
+/*
+ * Reads the name and dependencies before a task's colon into t
+ *
+ * Returns:
+ *   0 on success, -1 if out of memory
+ */
+static int
+read_names(task_t *t, char *words)
+{
+  for (char *w = strtok(words, " \t"); w; w = strtok(NULL, " \t")) {
+    if (!t->name) {
+      if (!(t->name = strdup(w)))
+        return -1;
+      continue;
+    }
+    char **grown = realloc(t->dep_names, (t->n_deps + 1) * sizeof(char *));
+    if (!grown)
+      return -1;
+    t->dep_names = grown;
+    if (!(t->dep_names[t->n_deps] = strdup(w)))
+      return -1;
+    t->n_deps++;
+  }
+  return 0;
+}
+
+/*
+ * Turns dependency names into indexes, fills in each task's list of
+ * the tasks after it, and checks that there is no cycle
+ *
+ * Returns:
+ *   0 on success, -1 with a message in err
+ */
+static int
+link_tasks(dag_t *dag, const char *file, char *err, size_t err_len)
+{
+  int n = dag->n;
+  if (n == 0)
+    return 0;
+
+  for (int i = 0; i < n; i++) {
+    task_t *t = &dag->tasks[i];
+    if (!(t->deps = malloc((t->n_deps + 1) * sizeof(int)))) {
+      snprintf(err, err_len, "%s: Out of memory", file);
+      return -1;
+    }
+    for (int d = 0; d < t->n_deps; d++) {
+      if ((t->deps[d] = find_task(dag, t->dep_names[d], n)) < 0) {
+        snprintf(err, err_len, "%s:%d: %s depends on unknown task %s", file, t->line, t->name,
+                 t->dep_names[d]);
+        return -1;
+      }
+      dag->tasks[t->deps[d]].n_after++;
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    if (!(dag->tasks[i].after = malloc((dag->tasks[i].n_after + 1) * sizeof(int)))) {
+      snprintf(err, err_len, "%s: Out of memory", file);
+      return -1;
+    }
+    dag->tasks[i].n_after = 0;
+  }
+  for (int i = 0; i < n; i++) {
+    task_t *t = &dag->tasks[i];
+    for (int d = 0; d < t->n_deps; d++) {
+      task_t *dep = &dag->tasks[t->deps[d]];
+      dep->after[dep->n_after++] = i;
+    }
+  }
+
+  // Kahn's algorithm: a task is placed once all its dependencies are,
+  // so any that never are lie on a cycle
+  int *order = dag->order = malloc(n * sizeof(int));
+  int placed = 0, unplaced[n];
+  if (!order) {
+    snprintf(err, err_len, "%s: Out of memory", file);
+    return -1;
+  }
+  for (int i = 0; i < n; i++)
+    if (!(unplaced[i] = dag->tasks[i].n_deps))
+      order[placed++] = i;
+  for (int k = 0; k < placed; k++) {
+    task_t *t = &dag->tasks[order[k]];
+    for (int a = 0; a < t->n_after; a++)
+      if (--unplaced[t->after[a]] == 0)
+        order[placed++] = t->after[a];
+  }
+  if (placed < n) {
+    for (int i = 0; i < n; i++)
+      if (unplaced[i]) {
+        snprintf(err, err_len, "%s:%d: %s is part of a dependency cycle", file,
+                 dag->tasks[i].line, dag->tasks[i].name);
+        return -1;
+      }
+  }
+
+  // in reverse order, each task's successors already have heights
+  for (int k = n - 1; k >= 0; k--) {
+    task_t *t = &dag->tasks[order[k]];
+    t->height = 1;
+    for (int a = 0; a < t->n_after; a++)
+      if (dag->tasks[t->after[a]].height + 1 > t->height)
+        t->height = dag->tasks[t->after[a]].height + 1;
+  }
+  return 0;
+}
+
+/*
+ * Waits for pid and returns its exit status in the usual shell form
+ */
+static int
+reap(pid_t pid)
+{
+  int status;
+
+  while (waitpid(pid, &status, 0) < 0)
+    if (errno != EINTR)
+      return 127;
+
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
+/*
+ * Returns the ready task with the longest chain after it, or -1
+ */
+static int
+next_ready(dag_t *dag)
+{
+  int best = -1;
+  for (int i = 0; i < dag->n; i++) {
+    task_t *t = &dag->tasks[i];
+    if (t->state == WAITING && t->unmet == 0 && (best < 0 || t->height > dag->tasks[best].height))
+      best = i;
+  }
+  return best;
+}
+
+/*
+ * Marks everything waiting on a failed task as skipped
+ */
+static void
+skip_after(dag_t *dag, task_t *t, int cause)
+{
+  for (int a = 0; a < t->n_after; a++) {
+    task_t *next = &dag->tasks[t->after[a]];
+    if (next->state == WAITING) {
+      next->state = SKIPPED;
+      next->cause = cause;
+      skip_after(dag, next, cause);
+    }
+  }
+}
+
+/*
+ * Records that a task has finished, releasing or skipping the tasks
+ * after it
+ */
+static void
+finish(dag_t *dag, int i, int status, uint64_t t0)
+{
+  task_t *t = &dag->tasks[i];
+  t->end = now_ns() - t0;
+  t->status = status;
+
+  if (status == 0) {
+    t->state = SUCCEEDED;
+    for (int a = 0; a < t->n_after; a++)
+      dag->tasks[t->after[a]].unmet--;
+  } else {
+    t->state = FAILED;
+    fprintf(stderr, "dag: %s: failed with status %d\n", t->name, status);
+    skip_after(dag, t, i);
+  }
+}
+
+/*
+ * Starts a task in a forked copy of the shell
+ *
+ * Returns:
+ *   A pidfd for the child, or -1 if the task has already finished
+ */
+static int
+start(dag_t *dag, int i, int (*execute)(command_t *cmd), uint64_t t0)
+{
+  task_t *t = &dag->tasks[i];
+
+  fflush(stdout);
+  t->state = RUNNING;
+  t->start = now_ns() - t0;
+  t->pid = fork();
+
+  if (t->pid == -1) {
+    perror("fork");
+    finish(dag, i, 127, t0);
+    return -1;
+  }
+
+  if (t->pid == 0) {
+    ev_reset_child();
+    int status = execute(t->cmd);
+    fflush(NULL);
+    _exit(status);
+  }
+
+  int pidfd = pidfd_open(t->pid, 0);
+  if (pidfd < 0) {
+    // no pidfd support; wait for this task right away
+    finish(dag, i, reap(t->pid), t0);
+    return -1;
+  }
+  return pidfd;
+}
+
+static int
+compare_start(const void *a, const void *b)
+{
+  const task_t *x = *(const task_t **)a, *y = *(const task_t **)b;
+  bool x_ran = x->state == SUCCEEDED || x->state == FAILED;
+  bool y_ran = y->state == SUCCEEDED || y->state == FAILED;
+  if (x_ran != y_ran)
+    return x_ran ? -1 : 1;
+  return (x->start > y->start) - (x->start < y->start);
+}
+
+/*
+ * Returns how long a task ran, 0 if it did not
+ */
+static uint64_t
+duration(const task_t *t)
+{
+  return (t->state == SUCCEEDED || t->state == FAILED) ? t->end - t->start : 0;
+}
+
+/*
+ * Prints when each task ran, and the critical path: the chain of
+ * dependent tasks whose times add up to the most, which is as short
+ * as the run could be with no limit on jobs
+ */
+static void
+print_summary(dag_t *dag, int max_jobs, uint64_t wall)
+{
+  if (dag->n == 0)
+    return;
+
+  int counts[SKIPPED + 1] = { 0 };
+  int width = 4;
+  task_t *sorted[dag->n];
+
+  for (int i = 0; i < dag->n; i++) {
+    task_t *t = &dag->tasks[i];
+    counts[t->state]++;
+    if (strlen(t->name) > width)
+      width = strlen(t->name);
+    sorted[i] = t;
+  }
+  qsort(sorted, dag->n, sizeof(task_t *), compare_start);
+
+  fprintf(stderr, "dag: %d tasks in %.2fs, up to %d at once: %d ok, %d failed, %d skipped\n",
+          dag->n, wall / 1e9, max_jobs, counts[SUCCEEDED], counts[FAILED], counts[SKIPPED]);
+  for (int i = 0; i < dag->n; i++) {
+    task_t *t = sorted[i];
+    if (t->state == SKIPPED)
+      fprintf(stderr, "  %-*s  skipped, %s failed\n", width, t->name, dag->tasks[t->cause].name);
+    else if (t->state == SUCCEEDED || t->state == FAILED)
+      fprintf(stderr, "  %-*s  at %6.2fs  took %6.2fs  %s\n", width, t->name, t->start / 1e9,
+              (t->end - t->start) / 1e9, t->state == SUCCEEDED ? "ok" : "failed");
+  }
+
+  // in dependency order, the longest chain of task times ending at
+  // each task, and the dependency it comes through
+  uint64_t chain[dag->n];
+  int via[dag->n], last = -1;
+  for (int k = 0; k < dag->n; k++) {
+    int i = dag->order[k];
+    task_t *t = &dag->tasks[i];
+    via[i] = -1;
+    for (int d = 0; d < t->n_deps; d++)
+      if (via[i] < 0 || chain[t->deps[d]] > chain[via[i]])
+        via[i] = t->deps[d];
+    chain[i] = duration(t) + (via[i] >= 0 ? chain[via[i]] : 0);
+    if (last < 0 || chain[i] > chain[last])
+      last = i;
+  }
+
+  int path[dag->n], len = 0;
+  for (int i = last; i >= 0; i = via[i])
+    path[len++] = i;
+
+  fprintf(stderr, "dag: critical path %.2fs:", chain[last] / 1e9);
+  for (int k = len - 1; k >= 0; k--)
+    fprintf(stderr, "%s %s %.2fs", (k == len - 1) ? "" : " >", dag->tasks[path[k]].name,
+            duration(&dag->tasks[path[k]]) / 1e9);
+  fprintf(stderr, "\n");
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the dag_ calls. All documentation is in the
+ * dag.h file.
+ *
+ **********************************************************************/
+
+dag_t *
+dag_load(FILE *fp, const char *file, char *err, size_t err_len)
+{
+  dag_t *dag = calloc(1, sizeof(dag_t));
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+  int cap = 0, line_no = 0;
+
+  if (!dag)
+    goto no_memory;
+
+  while ((len = getline(&line, &line_cap, fp)) >= 0) {
+    line_no++;
+    while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+      line[--len] = '\0';
+    char *p = line + strspn(line, " \t");
+    if (!*p || *p == '#')
+      continue;
+
+    char *colon = strchr(p, ':');
+    if (!colon) {
+      snprintf(err, err_len, "%s:%d: Missing ':' before the command", file, line_no);
+      goto error;
+    }
+    *colon = '\0';
+
+    if (dag->n == cap) {
+      cap = cap ? 2 * cap : 16;
+      task_t *grown = realloc(dag->tasks, cap * sizeof(task_t));
+      if (!grown)
+        goto no_memory;
+      dag->tasks = grown;
+    }
+    task_t *t = &dag->tasks[dag->n++];
+    memset(t, 0, sizeof(task_t));
+    t->line = line_no;
+
+    if (read_names(t, p) != 0)
+      goto no_memory;
+    if (!t->name) {
+      snprintf(err, err_len, "%s:%d: Missing task name", file, line_no);
+      goto error;
+    }
+    if (find_task(dag, t->name, dag->n - 1) >= 0) {
+      snprintf(err, err_len, "%s:%d: Task %s is defined twice", file, line_no, t->name);
+      goto error;
+    }
+
+    char msg[256];
+    const char *text = colon + 1 + strspn(colon + 1, " \t");
+    if (!(t->cmd = parse_input(text, msg, sizeof(msg)))) {
+      snprintf(err, err_len, "%s:%d: %s", file, line_no, msg);
+      goto error;
+    }
+    if (command_get_argc(t->cmd) == 0) {
+      snprintf(err, err_len, "%s:%d: Missing command for %s", file, line_no, t->name);
+      goto error;
+    }
+  }
+
+  if (link_tasks(dag, file, err, err_len) != 0)
+    goto error;
+  free(line);
+  return dag;
+
+ no_memory:
+  snprintf(err, err_len, "%s: Out of memory", file);
+ error:
+  free(line);
+  dag_free(dag);
+  return NULL;
+}
+
+
+int
+dag_run(dag_t *dag, int max_jobs, int (*execute)(command_t *cmd))
+{
+  if (max_jobs < 1)
+    max_jobs = 1;
+  if (max_jobs > DAG_MAX_JOBS)
+    max_jobs = DAG_MAX_JOBS;
+
+  for (int i = 0; i < dag->n; i++) {
+    dag->tasks[i].state = WAITING;
+    dag->tasks[i].unmet = dag->tasks[i].n_deps;
+  }
+
+  struct pollfd running[DAG_MAX_JOBS];
+  int running_task[DAG_MAX_JOBS];
+  int n_running = 0;
+  uint64_t t0 = now_ns();
+
+  for (;;) {
+    // start ready tasks until the job limit is reached
+    int next;
+    while (n_running < max_jobs && (next = next_ready(dag)) >= 0) {
+      int pidfd = start(dag, next, execute, t0);
+      if (pidfd >= 0) {
+        running[n_running].fd = pidfd;
+        running[n_running].events = POLLIN;
+        running_task[n_running++] = next;
+      }
+    }
+
+    if (n_running == 0)
+      break;
+
+    // wait for at least one running task to exit
+    if (poll(running, n_running, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("dag");
+      break;
+    }
+
+    for (int i = 0; i < n_running; i++) {
+      if (!running[i].revents)
+        continue;
+
+      int task = running_task[i];
+      close(running[i].fd);
+      finish(dag, task, reap(dag->tasks[task].pid), t0);
+
+      running[i] = running[--n_running];
+      running_task[i] = running_task[n_running];
+      i--;
+    }
+  }
+
+  // on a poll() failure, tasks still running are waited for in turn
+  for (int i = 0; i < n_running; i++) {
+    close(running[i].fd);
+    finish(dag, running_task[i], reap(dag->tasks[running_task[i]].pid), t0);
+  }
+
+  print_summary(dag, max_jobs, now_ns() - t0);
+
+  // the first task to fail, in the order they finished
+  task_t *first = NULL;
+  for (int i = 0; i < dag->n; i++) {
+    task_t *t = &dag->tasks[i];
+    if (t->state == FAILED && (!first || t->end < first->end))
+      first = t;
+  }
+  return first ? first->status : 0;
+}
+
+
+void
+dag_free(dag_t *dag)
+{
+  if (!dag)
+    return;
+
+  for (int i = 0; i < dag->n; i++) {
+    task_t *t = &dag->tasks[i];
+    free(t->name);
+    if (t->cmd)
+      command_free(t->cmd);
+    for (int d = 0; d < t->n_deps; d++)
+      free(t->dep_names[d]);
+    free(t->dep_names);
+    free(t->deps);
+    free(t->after);
+  }
+  free(dag->tasks);
+  free(dag->order);
+  free(dag);
+}
@@ -0,0 +1,77 @@
+/*
+ * dag.h
+ *
+ * Runs a set of tasks with dependencies between them, as many at a
+ * time as the dependencies and a job limit allow. Used by the dag
+ * builtin. A task file has one task per line, its name and the names
+ * of the tasks it depends on, then a colon and its command:
+ *
+ *   # deploy
+ *   fetch: git pull --ff-only
+ *   deps fetch: npm ci > deps.log
+ *   build deps: npm run build
+ *   lint deps: npm run lint
+ *   ship build lint: ./ship.sh "$TARGET"
+ *
+ * Tasks may be given in any order. Each command is read with
+ * parse_input() when the file is loaded, so quotes, variables and
+ * redirections work as they do at the prompt, and mistakes, unknown
+ * dependencies and cycles are reported before anything runs.
+ *
+ * Each task runs in a forked copy of the shell, so a cd or setenv in
+ * one does not reach the others. Of the tasks that are ready, the one
+ * with the longest chain of tasks after it starts first. When a task
+ * fails, everything that depends on it is skipped, while the tasks
+ * that do not go on running. At the end a summary of when each task
+ * started and how long it took, and of the critical path through the
+ * graph, is printed to stderr.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _DAG_H_
+#define _DAG_H_
+
+#include <stdio.h>
+#include "command.h"
+
+#define DAG_MAX_JOBS 64       // upper bound on tasks run at once
+
+typedef struct dag_s dag_t;
+
+/*
+ * Reads and checks a task file
+ *
+ * Parameters:
+ *   fp        The stream to read until end of file
+ *   file      Its name, for error messages
+ *   err       In case of error, a message naming the file and line is
+ *               copied here
+ *   err_len   Size of err
+ *
+ * Returns:
+ *   The tasks, to be freed with dag_free(), or NULL on error
+ */
+dag_t *dag_load(FILE *fp, const char *file, char *err, size_t err_len);
+
+/*
+ * Runs every task whose dependencies succeed, then prints the timing
+ * summary
+ *
+ * Parameters:
+ *   dag        The tasks
+ *   max_jobs   Most tasks to run at the same time
+ *   execute    Called in each task's child to run its command
+ *
+ * Returns:
+ *   0 if every task succeeded, otherwise the exit status of the first
+ *   task that failed
+ */
+int dag_run(dag_t *dag, int max_jobs, int (*execute)(command_t *cmd));
+
+/*
+ * Frees what dag_load() returned
+ */
+void dag_free(dag_t *dag);
+
+#endif /* _DAG_H_ */
@@ -0,0 +1,671 @@
+/*
+ * dircache.c
+ *
+ * LRU cache of directory listings, invalidated by inotify
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#define _GNU_SOURCE         // GLOB_ALTDIRFUNC
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "dircache.h"
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+                    | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+/*
+ * One directory's listing
+ */
+typedef struct entry_s {
+  char *path;                 // absolute, as the directory was named
+  int wd;                     // inotify watch; -1 if not cached
+  unsigned long serial;       // tells this listing from later ones
+  char **names;
+  unsigned char *types;
+  char *blob;                 // the names, one after another
+  int n;
+  size_t bytes;               // memory held, for the stats
+  int users;                  // open glob handles
+  bool dropped;               // out of the cache; freed once users is 0
+  struct entry_s *prev;       // LRU list, most recent first
+  struct entry_s *next;
+} entry_t;
+
+/*
+ * An open directory, as glob() sees it
+ */
+typedef struct {
+  entry_t *entry;
+  int pos;
+  struct dirent de;
+} handle_t;
+
+/*
+ * A directory that a recorded glob looked in. Its modification time
+ * is taken before it is read; if every read of it came from one
+ * cached listing, that listing still being cached is proof enough.
+ */
+typedef struct {
+  char *path;
+  bool exists;
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  int opens;
+  unsigned long serial;       // the cached listing read, or 0
+} seen_t;
+
+struct dircache_record_s {
+  struct timespec start;      // coarse clock when recording began
+  seen_t *dirs;
+  int n;
+  int cap;
+  bool failed;                // out of memory, so incomplete
+};
+
+static int inotify_fd = -1;
+static pid_t owner = 0;
+static int limit = DIRCACHE_DEFAULT_LIMIT;
+
+// held by every thread using the cache; the names of an entry with
+// users never change, so glob_readdir() reads them without it
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static entry_t *head = NULL;
+static entry_t *tail = NULL;
+static int n_entries = 0;
+static entry_t *scratch = NULL;     // the last listing read without caching
+static unsigned long next_serial = 1;
+
+static __thread dircache_record_t *recording = NULL;
+
+static struct {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long invalidations;
+  unsigned long evictions;
+  unsigned long overflows;
+} stats;
+
+
+static bool
+active()
+{
+  return inotify_fd >= 0 && limit > 0 && getpid() == owner;
+}
+
+static void
+entry_free(entry_t *e)
+{
+  if (!e)
+    return;
+  free(e->path);
+  free(e->names);
+  free(e->types);
+  free(e->blob);
+  free(e);
+}
+
+/*
+ * Reads a directory into a new entry, which is not yet in the cache
+ */
+static entry_t *
+read_dir(const char *path)
+{
+  DIR *d = opendir(path);
+  if (!d)
+    return NULL;
+
+  entry_t *e = calloc(1, sizeof(entry_t));
+  size_t blob_cap = 1024, blob_len = 0;
+  int cap = 32;
+  size_t *offsets = malloc(cap * sizeof(size_t));
+  if (!e || !offsets || !(e->path = strdup(path)) || !(e->types = malloc(cap))
+      || !(e->blob = malloc(blob_cap)))
+    goto error;
+  e->wd = -1;
+
+  struct dirent *de;
+  while ((de = readdir(d))) {
+    if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+      continue;
+
+    size_t len = strlen(de->d_name) + 1;
+    if (blob_len + len > blob_cap) {
+      while (blob_len + len > blob_cap)
+        blob_cap *= 2;
+      char *grown = realloc(e->blob, blob_cap);
+      if (!grown)
+        goto error;
+      e->blob = grown;
+    }
+    if (e->n == cap) {
+      cap *= 2;
+      size_t *grown_off = realloc(offsets, cap * sizeof(size_t));
+      unsigned char *grown_types = grown_off ? realloc(e->types, cap) : NULL;
+      if (grown_off)
+        offsets = grown_off;
+      if (!grown_types)
+        goto error;
+      e->types = grown_types;
+    }
+
+    memcpy(e->blob + blob_len, de->d_name, len);
+    offsets[e->n] = blob_len;
+    e->types[e->n] = de->d_type;
+    e->n++;
+    blob_len += len;
+  }
+
+  // the blob has stopped moving, so the names can point into it
+  if (!(e->names = malloc((e->n + 1) * sizeof(char *))))
+    goto error;
+  for (int i = 0; i < e->n; i++)
+    e->names[i] = e->blob + offsets[i];
+  e->names[e->n] = NULL;
+  e->bytes = sizeof(entry_t) + blob_cap + cap + (e->n + 1) * sizeof(char *);
+
+  free(offsets);
+  closedir(d);
+  return e;
+
+ error:
+  free(offsets);
+  entry_free(e);
+  closedir(d);
+  errno = ENOMEM;
+  return NULL;
+}
+
+static void
+unlink_entry(entry_t *e)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+static void
+push_front(entry_t *e)
+{
+  e->next = head;
+  if (head)
+    head->prev = e;
+  head = e;
+  if (!tail)
+    tail = e;
+}
+
+/*
+ * Takes an entry out of the cache, removing its watch unless another
+ * entry names the same directory through a different path
+ */
+static void
+drop(entry_t *e)
+{
+  unlink_entry(e);
+  n_entries--;
+
+  bool shared = false;
+  for (entry_t *o = head; o; o = o->next)
+    shared |= (o->wd == e->wd);
+  if (!shared && e->wd >= 0)
+    inotify_rm_watch(inotify_fd, e->wd);
+
+  e->dropped = true;
+  if (e->users == 0)
+    entry_free(e);
+}
+
+static void
+drop_all()
+{
+  while (head)
+    drop(head);
+}
+
+/*
+ * Drops the listings that the pending inotify events make stale. The
+ * descriptor is non-blocking, so this is one read() when nothing has
+ * changed.
+ */
+static void
+drain_events()
+{
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+    for (char *p = buf; p < buf + len; ) {
+      struct inotify_event *ev = (struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + ev->len;
+
+      if (ev->mask & IN_Q_OVERFLOW) {
+        // events were lost, so nothing cached can be trusted
+        stats.overflows++;
+        drop_all();
+        continue;
+      }
+      for (entry_t *e = head, *next; e; e = next) {
+        next = e->next;
+        if (e->wd == ev->wd) {
+          // the kernel has removed an IN_IGNORED watch already
+          if (ev->mask & IN_IGNORED)
+            e->wd = -1;
+          stats.invalidations++;
+          drop(e);
+        }
+      }
+    }
+  }
+}
+
+/*
+ * Makes a directory name absolute, so that the cache survives cd
+ */
+static bool
+absolute_path(const char *dir, char *path, size_t len)
+{
+  if (dir[0] == '/')
+    return snprintf(path, len, "%s", dir) < len;
+
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd)))
+    return false;
+  if (!strcmp(dir, ".") || dir[0] == '\0')
+    return snprintf(path, len, "%s", cwd) < len;
+  return snprintf(path, len, "%s/%s", strcmp(cwd, "/") ? cwd : "", dir) < len;
+}
+
+/*
+ * Returns the listing of dir, from the cache or freshly read, or NULL
+ * with errno set. Called with the lock held.
+ */
+static entry_t *
+lookup(const char *dir)
+{
+  char path[PATH_MAX];
+
+  if (!active() || !absolute_path(dir, path, sizeof(path))) {
+    entry_free(scratch);
+    return (scratch = read_dir(dir));
+  }
+
+  drain_events();
+  for (entry_t *e = head; e; e = e->next) {
+    if (!strcmp(e->path, path)) {
+      stats.hits++;
+      unlink_entry(e);
+      push_front(e);
+      return e;
+    }
+  }
+
+  stats.misses++;
+
+  // watch first, so that no change can fall between reading and
+  // watching
+  int wd = inotify_add_watch(inotify_fd, path, WATCH_MASK);
+  entry_t *e = read_dir(path);
+  if (!e || wd < 0) {
+    int err = errno;
+    bool shared = false;
+    for (entry_t *o = head; o; o = o->next)
+      shared |= (o->wd == wd);
+    if (wd >= 0 && !shared)
+      inotify_rm_watch(inotify_fd, wd);
+    entry_free(scratch);
+    scratch = e;
+    errno = err;
+    return e;
+  }
+
+  e->wd = wd;
+  e->serial = next_serial++;
+  while (n_entries >= limit && tail) {
+    stats.evictions++;
+    drop(tail);
+  }
+  push_front(e);
+  n_entries++;
+  return e;
+}
+
+
+/**********************************************************************
+ *
+ * Recording the directories a glob looks in
+ *
+ **********************************************************************/
+
+/*
+ * Returns the record's note of path, adding one with the directory's
+ * current state if there is none; NULL if out of memory
+ */
+static seen_t *
+note_dir(const char *path)
+{
+  dircache_record_t *rec = recording;
+  for (int i = 0; i < rec->n; i++)
+    if (!strcmp(rec->dirs[i].path, path))
+      return &rec->dirs[i];
+
+  if (rec->n == rec->cap) {
+    int cap = rec->cap ? 2 * rec->cap : 8;
+    seen_t *grown = realloc(rec->dirs, cap * sizeof(seen_t));
+    if (!grown) {
+      rec->failed = true;
+      return NULL;
+    }
+    rec->dirs = grown;
+    rec->cap = cap;
+  }
+
+  seen_t *seen = &rec->dirs[rec->n];
+  struct stat st;
+  memset(seen, 0, sizeof(seen_t));
+  if (!(seen->path = strdup(path))) {
+    rec->failed = true;
+    return NULL;
+  }
+  seen->exists = (stat(path, &st) == 0);
+  if (seen->exists) {
+    seen->dev = st.st_dev;
+    seen->ino = st.st_ino;
+    seen->mtime = st.st_mtim;
+  }
+  rec->n++;
+  return seen;
+}
+
+/*
+ * Notes the directory holding path, whose entries decide whether
+ * path exists
+ */
+static void
+note_parent(const char *path)
+{
+  const char *slash = strrchr(path, '/');
+  if (!slash) {
+    note_dir(".");
+    return;
+  }
+  char parent[PATH_MAX];
+  int len = (slash == path) ? 1 : slash - path;
+  snprintf(parent, sizeof(parent), "%.*s", len, path);
+  note_dir(parent);
+}
+
+static int
+record_stat(const char *path, struct stat *st)
+{
+  note_parent(path);
+  return stat(path, st);
+}
+
+static int
+record_lstat(const char *path, struct stat *st)
+{
+  note_parent(path);
+  return lstat(path, st);
+}
+
+/*
+ * Returns true if the listing with this serial number is still
+ * cached, and so has not changed
+ */
+static bool
+still_cached(unsigned long serial)
+{
+  bool found = false;
+
+  pthread_mutex_lock(&lock);
+  if (active()) {
+    drain_events();
+    for (entry_t *e = head; e && !found; e = e->next)
+      found = (e->serial == serial);
+  }
+  pthread_mutex_unlock(&lock);
+  return found;
+}
+
+
+/**********************************************************************
+ *
+ * Directory access for glob()
+ *
+ **********************************************************************/
+
+static void *
+glob_opendir(const char *name)
+{
+  // noted before reading, so that a change while reading shows
+  seen_t *seen = recording ? note_dir(name) : NULL;
+
+  pthread_mutex_lock(&lock);
+  entry_t *e = lookup(name);
+  handle_t *h = e ? calloc(1, sizeof(handle_t)) : NULL;
+  if (h) {
+    // keep a listing read without caching from being replaced
+    if (e == scratch)
+      scratch = NULL;
+    h->entry = e;
+    e->users++;
+  }
+  pthread_mutex_unlock(&lock);
+
+  if (seen && h)
+    seen->serial = (seen->opens++ == 0 || seen->serial == e->serial) ? e->serial : 0;
+  return h;
+}
+
+static struct dirent *
+glob_readdir(void *dir)
+{
+  handle_t *h = dir;
+  entry_t *e = h->entry;
+  if (h->pos == e->n + 2)
+    return NULL;
+
+  // the listing leaves out "." and "..", but readdir() gives them, and
+  // ".*" and GLOB_PERIOD match them
+  int i = h->pos++ - 2;
+  const char *name = (i == -2) ? "." : (i == -1) ? ".." : e->names[i];
+  h->de.d_ino = 1;            // glob() skips entries whose inode is 0
+  h->de.d_type = (i < 0) ? DT_DIR : e->types[i];
+  snprintf(h->de.d_name, sizeof(h->de.d_name), "%s", name);
+  return &h->de;
+}
+
+static void
+glob_closedir(void *dir)
+{
+  handle_t *h = dir;
+  entry_t *e = h->entry;
+
+  // a listing read without caching was never in the list
+  pthread_mutex_lock(&lock);
+  if (--e->users == 0 && (e->dropped || e->wd < 0))
+    entry_free(e);
+  pthread_mutex_unlock(&lock);
+  free(h);
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the dircache_ calls. All documentation is in
+ * the dircache.h file.
+ *
+ **********************************************************************/
+
+int
+dircache_init()
+{
+  pthread_mutex_lock(&lock);
+  if (inotify_fd >= 0)
+    close(inotify_fd);
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  owner = getpid();
+  pthread_mutex_unlock(&lock);
+  return inotify_fd >= 0 ? 0 : -1;
+}
+
+
+int
+dircache_glob(const char *pattern, int flags, glob_t *g)
+{
+  if (!active() && !recording)
+    return glob(pattern, flags, NULL, g);
+
+  g->gl_opendir = glob_opendir;
+  g->gl_readdir = glob_readdir;
+  g->gl_closedir = glob_closedir;
+  g->gl_stat = recording ? record_stat : stat;
+  g->gl_lstat = recording ? record_lstat : lstat;
+  return glob(pattern, flags | GLOB_ALTDIRFUNC, NULL, g);
+}
+
+
+int
+dircache_list(const char *dir, char * const **names, const unsigned char **types)
+{
+  pthread_mutex_lock(&lock);
+  entry_t *e = lookup(dir);
+  pthread_mutex_unlock(&lock);
+  if (!e)
+    return -1;
+  *names = e->names;
+  *types = e->types;
+  return e->n;
+}
+
+
+void
+dircache_set_limit(int new_limit)
+{
+  pthread_mutex_lock(&lock);
+  limit = new_limit < 0 ? 0 : new_limit;
+  while (n_entries > limit && tail) {
+    stats.evictions++;
+    drop(tail);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+
+void
+dircache_clear()
+{
+  pthread_mutex_lock(&lock);
+  drop_all();
+  pthread_mutex_unlock(&lock);
+}
+
+
+void
+dircache_print_stats()
+{
+  size_t bytes = 0;
+  long names = 0;
+
+  pthread_mutex_lock(&lock);
+  for (entry_t *e = head; e; e = e->next) {
+    bytes += e->bytes;
+    names += e->n;
+  }
+
+  unsigned long lookups = stats.hits + stats.misses;
+  printf("directory cache: %s\n", inotify_fd < 0 ? "unavailable" : limit ? "on" : "off");
+  printf("  dirs        %d of %d\n", n_entries, limit);
+  printf("  names       %ld\n", names);
+  printf("  memory      %zu bytes\n", bytes);
+  printf("  hits        %lu (%.1f%%)\n", stats.hits, lookups ? 100.0 * stats.hits / lookups : 0.0);
+  printf("  misses      %lu\n", stats.misses);
+  printf("  invalidated %lu\n", stats.invalidations);
+  printf("  evicted     %lu\n", stats.evictions);
+  if (stats.overflows)
+    printf("  overflows   %lu\n", stats.overflows);
+  pthread_mutex_unlock(&lock);
+}
+
+
+void
+dircache_record_start()
+{
+  dircache_record_free(recording);
+  recording = calloc(1, sizeof(dircache_record_t));
+  if (recording)
+    clock_gettime(CLOCK_REALTIME_COARSE, &recording->start);
+}
+
+
+dircache_record_t *
+dircache_record_stop()
+{
+  dircache_record_t *rec = recording;
+  recording = NULL;
+  if (rec && rec->failed) {
+    dircache_record_free(rec);
+    return NULL;
+  }
+  return rec;
+}
+
+
+bool
+dircache_record_unchanged(const dircache_record_t *rec)
+{
+  for (int i = 0; i < rec->n; i++) {
+    const seen_t *seen = &rec->dirs[i];
+    if (seen->serial && still_cached(seen->serial))
+      continue;
+
+    struct stat st;
+    bool exists = (stat(seen->path, &st) == 0);
+    if (exists != seen->exists)
+      return false;
+    if (!exists)
+      continue;
+
+    // a change in the same clock tick as the recording could leave
+    // the time as it was, so a directory that new proves nothing
+    if (st.st_dev != seen->dev || st.st_ino != seen->ino
+        || st.st_mtim.tv_sec != seen->mtime.tv_sec
+        || st.st_mtim.tv_nsec != seen->mtime.tv_nsec
+        || seen->mtime.tv_sec > rec->start.tv_sec
+        || (seen->mtime.tv_sec == rec->start.tv_sec
+            && seen->mtime.tv_nsec >= rec->start.tv_nsec))
+      return false;
+  }
+  return true;
+}
+
+
+void
+dircache_record_free(dircache_record_t *rec)
+{
+  if (!rec)
+    return;
+  for (int i = 0; i < rec->n; i++)
+    free(rec->dirs[i].path);
+  free(rec->dirs);
+  free(rec);
+}
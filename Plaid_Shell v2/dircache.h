@@ -0,0 +1,117 @@
+/*
+ * dircache.h
+ *
+ * A cache of directory listings, so that globbing and filename
+ * completion in a directory seen recently need no readdir(). Each
+ * cached directory is watched with inotify, and its listing is
+ * dropped as soon as an entry is created, deleted or renamed in it.
+ * The least recently used listing is dropped when the cache is full.
+ *
+ * inotify only reports changes made through this machine's kernel,
+ * so on network file systems a listing may miss files created
+ * elsewhere until it is evicted or "cache clear" is run.
+ *
+ * The cache belongs to the process that called dircache_init(), and
+ * any of its threads may use it. Forked children, and processes that
+ * never call dircache_init(), read directories directly.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _DIRCACHE_H_
+#define _DIRCACHE_H_
+
+#include <stdbool.h>
+#include <glob.h>
+
+#define DIRCACHE_DEFAULT_LIMIT 64   // directories kept by default
+
+/*
+ * Turns the cache on for this process
+ *
+ * Returns:
+ *   0 on success, or -1 with errno set if inotify is not available,
+ *   in which case directories are always read directly
+ */
+int dircache_init();
+
+/*
+ * glob(), with directories read through the cache. Takes and returns
+ * the same as glob(3), and the result is freed with globfree().
+ */
+int dircache_glob(const char *pattern, int flags, glob_t *g);
+
+/*
+ * Returns the entries of a directory, other than "." and "..", from
+ * the cache if possible.
+ *
+ * Parameters:
+ *   dir      The directory, absolute or relative to the cwd
+ *   names    Set to the names of the entries
+ *   types    Set to their d_type values, DT_UNKNOWN where the file
+ *              system does not say
+ *
+ * Returns:
+ *   The number of entries, or -1 with errno set if the directory
+ *   cannot be read. The arrays stay valid until the next dircache_
+ *   call on any thread.
+ */
+int dircache_list(const char *dir, char * const **names, const unsigned char **types);
+
+/*
+ * Sets the number of directories kept, evicting the least recently
+ * used ones if there are more. 0 turns caching off.
+ */
+void dircache_set_limit(int limit);
+
+/*
+ * Drops every cached listing
+ */
+void dircache_clear();
+
+/*
+ * Prints the hit and miss counts, invalidations, evictions and the
+ * current size of the cache to stdout
+ */
+void dircache_print_stats();
+
+/*
+ * A record of the directories that dircache_glob() looked in on one
+ * thread, kept so that a glob result computed ahead of time can be
+ * checked before it is used
+ */
+typedef struct dircache_record_s dircache_record_t;
+
+/*
+ * Starts recording on the calling thread. Until dircache_record_stop(),
+ * dircache_glob() on this thread notes each directory it reads or
+ * looks up a name in.
+ */
+void dircache_record_start();
+
+/*
+ * Stops recording on the calling thread
+ *
+ * Returns:
+ *   The record, to be freed with dircache_record_free(), or NULL if
+ *   memory ran out and it is incomplete
+ */
+dircache_record_t *dircache_record_stop();
+
+/*
+ * Returns true if no directory in the record can have gained, lost
+ * or renamed an entry since it was read: either the cached listing
+ * that was read is still cached, or the directory still has the same
+ * inode and modification time, and that time is older than the
+ * recording. A directory changed during the clock tick in which the
+ * recording started counts as changed, since a second change in the
+ * same tick would leave its time the same.
+ */
+bool dircache_record_unchanged(const dircache_record_t *rec);
+
+/*
+ * Frees a record. Passing NULL is allowed.
+ */
+void dircache_record_free(dircache_record_t *rec);
+
+#endif /* _DIRCACHE_H_ */
@@ -0,0 +1,453 @@
+/*
+ * dirs.c
+ *
+ * Logical working directory, directory stack and CDPATH index
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#define _GNU_SOURCE         // strchrnul
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "dirs.h"
+
+static char *pwd = NULL;          // logical current directory
+static char **stack = NULL;       // pushd stack; the top is last
+static int stack_len = 0;
+
+/*
+ * The subdirectories of one CDPATH entry, as of its mtime
+ */
+typedef struct {
+  char *dir;                      // the entry; NULL for "", the cwd
+  struct timespec mtime;
+  char **names;                   // sorted
+  int n_names;
+} cdpath_entry_t;
+
+static char *cdpath_value = NULL; // $CDPATH that the index was built from
+static cdpath_entry_t *cdpath = NULL;
+static int n_cdpath = 0;
+
+
+/*
+ * Returns path made absolute against base and with ".", ".." and
+ * repeated slashes removed without looking at the file system, as a
+ * malloc'd string
+ */
+static char *
+logical_path(const char *base, const char *path)
+{
+  size_t len = strlen(base) + strlen(path) + 2;
+  char *out = malloc(len + 1);
+  if (!out)
+    return NULL;
+
+  char *joined = malloc(len + 1);
+  if (!joined) {
+    free(out);
+    return NULL;
+  }
+  if (path[0] == '/')
+    strcpy(joined, path);
+  else
+    sprintf(joined, "%s/%s", base, path);
+
+  // copy component by component, backing up over ".."
+  char *o = out;
+  for (char *c = joined; *c; ) {
+    while (*c == '/')
+      c++;
+    char *end = strchrnul(c, '/');
+    size_t n = end - c;
+
+    if (n == 0 || (n == 1 && c[0] == '.')) {
+      // nothing to add
+    } else if (n == 2 && c[0] == '.' && c[1] == '.') {
+      while (o > out && *--o != '/')
+        ;
+    } else {
+      *o++ = '/';
+      memcpy(o, c, n);
+      o += n;
+    }
+    c = end;
+  }
+  if (o == out)
+    *o++ = '/';
+  *o = '\0';
+
+  free(joined);
+  return out;
+}
+
+/*
+ * Makes path, which must be malloc'd, the current directory
+ */
+static void
+set_pwd(char *path)
+{
+  if (pwd)
+    setenv("OLDPWD", pwd, 1);
+  free(pwd);
+  pwd = path;
+  setenv("PWD", pwd, 1);
+}
+
+/*
+ * Changes to dir, keeping the logical path. If the logical path does
+ * not work, as when ".." is needed past a symlink that has gone, the
+ * physical one is tried.
+ */
+static int
+change_to(const char *dir)
+{
+  char *path = logical_path(pwd ? pwd : "/", dir);
+  if (!path)
+    return -1;
+
+  if (chdir(path) == 0) {
+    set_pwd(path);
+    return 0;
+  }
+  free(path);
+
+  int err = errno;
+  char cwd[PATH_MAX];
+  if (chdir(dir) != 0) {
+    errno = err;
+    return -1;
+  }
+  if (!getcwd(cwd, sizeof(cwd)) || !(path = strdup(cwd)))
+    return -1;
+  set_pwd(path);
+  return 0;
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void
+free_names(cdpath_entry_t *e)
+{
+  for (int i = 0; i < e->n_names; i++)
+    free(e->names[i]);
+  free(e->names);
+  e->names = NULL;
+  e->n_names = 0;
+}
+
+/*
+ * Reads the names of the subdirectories of a CDPATH entry. Symlinks,
+ * and entries whose type the file system does not report, are kept
+ * too; chdir() decides whether they lead to a directory.
+ */
+static void
+index_entry(cdpath_entry_t *e)
+{
+  struct stat st;
+  free_names(e);
+  if (stat(e->dir, &st) != 0)
+    return;
+  e->mtime = st.st_mtim;
+
+  DIR *d = opendir(e->dir);
+  if (!d)
+    return;
+
+  int cap = 0;
+  struct dirent *de;
+  while ((de = readdir(d))) {
+    if (de->d_name[0] == '.' || (de->d_type != DT_DIR && de->d_type != DT_LNK
+                                 && de->d_type != DT_UNKNOWN))
+      continue;
+    if (e->n_names == cap) {
+      cap = cap ? 2 * cap : 64;
+      char **grown = realloc(e->names, cap * sizeof(char *));
+      if (!grown)
+        break;
+      e->names = grown;
+    }
+    if (!(e->names[e->n_names] = strdup(de->d_name)))
+      break;
+    e->n_names++;
+  }
+  closedir(d);
+
+  qsort(e->names, e->n_names, sizeof(char *), compare_names);
+}
+
+/*
+ * Rebuilds the index if $CDPATH has changed since it was built
+ */
+static void
+load_cdpath(const char *value)
+{
+  if (cdpath_value && !strcmp(cdpath_value, value))
+    return;
+
+  for (int i = 0; i < n_cdpath; i++) {
+    free_names(&cdpath[i]);
+    free(cdpath[i].dir);
+  }
+  free(cdpath);
+  free(cdpath_value);
+  cdpath = NULL;
+  n_cdpath = 0;
+  if (!(cdpath_value = strdup(value)))
+    return;
+
+  int n = 1;
+  for (const char *p = value; *p; p++)
+    n += (*p == ':');
+  if (!(cdpath = calloc(n, sizeof(cdpath_entry_t))))
+    return;
+
+  const char *p = value;
+  for (int i = 0; i < n; i++) {
+    const char *end = strchrnul(p, ':');
+    cdpath_entry_t *e = &cdpath[n_cdpath++];
+    e->dir = (end > p) ? strndup(p, end - p) : NULL;
+    if (e->dir)
+      index_entry(e);
+    p = *end ? end + 1 : end;
+  }
+}
+
+/*
+ * Re-reads the entries that have changed since they were indexed.
+ * Returns true if any had.
+ */
+static bool
+refresh_cdpath()
+{
+  bool changed = false;
+  for (int i = 0; i < n_cdpath; i++) {
+    cdpath_entry_t *e = &cdpath[i];
+    struct stat st;
+    if (!e->dir || stat(e->dir, &st) != 0)
+      continue;
+    if (st.st_mtim.tv_sec != e->mtime.tv_sec || st.st_mtim.tv_nsec != e->mtime.tv_nsec) {
+      index_entry(e);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+/*
+ * Tries each CDPATH entry whose index holds the first component of
+ * dir. Returns 0 once one works, with *announce set unless it was
+ * the current directory.
+ */
+static int
+cd_via_cdpath(const char *dir, bool *announce)
+{
+  char first[NAME_MAX + 1];
+  size_t n = strchrnul(dir, '/') - dir;
+  if (n > NAME_MAX)
+    return -1;
+  memcpy(first, dir, n);
+  first[n] = '\0';
+  const char *key = first;
+
+  for (int i = 0; i < n_cdpath; i++) {
+    cdpath_entry_t *e = &cdpath[i];
+
+    if (!e->dir) {
+      if (change_to(dir) == 0)
+        return 0;
+      continue;
+    }
+    if (!bsearch(&key, e->names, e->n_names, sizeof(char *), compare_names))
+      continue;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", e->dir, dir);
+    if (change_to(path) == 0) {
+      *announce = true;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the dirs_ calls. All documentation is in the
+ * dirs.h file.
+ *
+ **********************************************************************/
+
+int
+dirs_init()
+{
+  const char *env = getenv("PWD");
+  struct stat env_st, dot_st;
+  char cwd[PATH_MAX];
+  char *path;
+
+  if (env && env[0] == '/' && stat(env, &env_st) == 0 && stat(".", &dot_st) == 0
+      && env_st.st_dev == dot_st.st_dev && env_st.st_ino == dot_st.st_ino)
+    path = logical_path("/", env);
+  else if (getcwd(cwd, sizeof(cwd)))
+    path = strdup(cwd);
+  else
+    return -1;
+
+  if (!path)
+    return -1;
+  free(pwd);
+  pwd = path;
+  setenv("PWD", pwd, 1);
+  return 0;
+}
+
+
+const char *
+dirs_pwd()
+{
+  if (!pwd)
+    dirs_init();
+  return pwd ? pwd : "";
+}
+
+
+int
+dirs_cd(const char *dir, bool *announce)
+{
+  *announce = false;
+  if (!pwd)
+    dirs_init();
+
+  if (dir == NULL && !(dir = getenv("HOME"))) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (!strcmp(dir, "-")) {
+    if (!(dir = getenv("OLDPWD"))) {
+      errno = ENOENT;
+      return -1;
+    }
+    *announce = true;
+  }
+
+  // CDPATH applies to names like "src", not "/src", "./src" or "../src"
+  const char *cdpath_env = getenv("CDPATH");
+  bool relative = dir[0] != '/' && strcmp(dir, ".") != 0 && strcmp(dir, "..") != 0
+                  && strncmp(dir, "./", 2) != 0 && strncmp(dir, "../", 3) != 0;
+
+  if (relative && cdpath_env && *cdpath_env) {
+    load_cdpath(cdpath_env);
+    if (cd_via_cdpath(dir, announce) == 0)
+      return 0;
+    if (refresh_cdpath() && cd_via_cdpath(dir, announce) == 0)
+      return 0;
+  }
+
+  // a stale copy of OLDPWD may go before change_to() replaces it
+  char *copy = strdup(dir);
+  if (!copy)
+    return -1;
+  int ret = change_to(copy);
+  free(copy);
+  return ret;
+}
+
+
+int
+dirs_push(const char *dir)
+{
+  bool announce;
+  if (!pwd)
+    dirs_init();
+
+  if (dir == NULL) {
+    if (stack_len == 0) {
+      errno = EINVAL;
+      return -1;
+    }
+    char *top = stack[stack_len - 1];
+    char *old = strdup(pwd);
+    if (!old || dirs_cd(top, &announce) != 0) {
+      free(old);
+      return -1;
+    }
+    free(top);
+    stack[stack_len - 1] = old;
+    return 0;
+  }
+
+  char **grown = realloc(stack, (stack_len + 1) * sizeof(char *));
+  if (!grown)
+    return -1;
+  stack = grown;
+  if (!(stack[stack_len] = strdup(pwd)))
+    return -1;
+
+  if (dirs_cd(dir, &announce) != 0) {
+    free(stack[stack_len]);
+    return -1;
+  }
+  stack_len++;
+  return 0;
+}
+
+
+int
+dirs_pop()
+{
+  bool announce;
+
+  if (stack_len == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (dirs_cd(stack[stack_len - 1], &announce) != 0)
+    return -1;
+  free(stack[--stack_len]);
+  return 0;
+}
+
+
+void
+dirs_clear()
+{
+  while (stack_len > 0)
+    free(stack[--stack_len]);
+}
+
+
+void
+dirs_print(bool verbose)
+{
+  const char *home = getenv("HOME");
+  size_t home_len = home ? strlen(home) : 0;
+
+  for (int i = 0; i <= stack_len; i++) {
+    const char *dir = (i == 0) ? dirs_pwd() : stack[stack_len - i];
+    bool tilde = home_len > 1 && !strncmp(dir, home, home_len)
+                 && (dir[home_len] == '/' || dir[home_len] == '\0');
+
+    if (verbose)
+      printf("%2d  ", i);
+    else if (i > 0)
+      printf(" ");
+    printf("%s%s", tilde ? "~" : "", tilde ? dir + home_len : dir);
+    if (verbose)
+      printf("\n");
+  }
+  if (!verbose)
+    printf("\n");
+}
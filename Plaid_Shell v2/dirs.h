@@ -0,0 +1,89 @@
+/*
+ * dirs.h
+ *
+ * The shell's working directory as the user sees it. The logical
+ * path, which keeps the symlinks the user went through, is held in
+ * the shell and in $PWD, so pwd costs no system call. Also the
+ * pushd/popd directory stack, "cd -", and CDPATH lookup through a
+ * cached index of the directories under each CDPATH entry.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _DIRS_H_
+#define _DIRS_H_
+
+#include <stdbool.h>
+
+/*
+ * Sets the logical directory from $PWD if that names the current
+ * directory, as it does when the shell is started from another
+ * shell, otherwise from getcwd(). Call at startup, and again after
+ * changing directory behind the shell's back.
+ *
+ * Returns:
+ *   0 on success, -1 if the current directory cannot be found
+ */
+int dirs_init();
+
+/*
+ * Returns the logical current directory. The string is valid until
+ * the directory next changes.
+ */
+const char *dirs_pwd();
+
+/*
+ * Changes directory, updating the logical directory, $PWD and
+ * $OLDPWD. ".." removes the last component of the logical path,
+ * rather than going to the parent of a symlink's target.
+ *
+ * A relative dir that does not start with "." or ".." is looked up
+ * in each directory of $CDPATH in turn, and then in the current
+ * directory. The names of the subdirectories of each CDPATH entry
+ * are read once and kept, so a lookup normally needs no system
+ * calls; an entry is read again if it has changed when a lookup
+ * misses.
+ *
+ * Parameters:
+ *   dir        Where to go; NULL for $HOME, "-" for $OLDPWD
+ *   announce   Set to true if the new directory should be printed,
+ *                as other shells do for "cd -" and CDPATH matches
+ *
+ * Returns:
+ *   0 on success, or -1 with errno set
+ */
+int dirs_cd(const char *dir, bool *announce);
+
+/*
+ * Pushes the current directory onto the stack and changes to dir,
+ * or with dir NULL, exchanges the current directory with the top of
+ * the stack
+ *
+ * Returns:
+ *   0 on success, or -1 with errno set; EINVAL means the stack is
+ *   empty
+ */
+int dirs_push(const char *dir);
+
+/*
+ * Pops the top of the stack and changes to it
+ *
+ * Returns:
+ *   0 on success, or -1 with errno set; EINVAL means the stack is
+ *   empty
+ */
+int dirs_pop();
+
+/*
+ * Empties the directory stack
+ */
+void dirs_clear();
+
+/*
+ * Prints the current directory and then the stack, from the top, with
+ * $HOME shown as ~. With verbose set, prints one per line, numbered
+ * from 0 as the entries are for "cd ~N" in other shells.
+ */
+void dirs_print(bool verbose);
+
+#endif /* _DIRS_H_ */
@@ -0,0 +1,217 @@
+/*
+ * eventloop.c
+ *
+ * epoll-based event loop for descriptors, signals and timers
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "eventloop.h"
+
+#define MAX_EVENTS 16       // events fetched per epoll_wait() call
+
+typedef struct watch_s {
+  int fd;
+  ev_callback_fn fn;
+  void *arg;
+  bool is_timer;          // the callback is passed an already-read timerfd
+  bool removed;           // freed once the current batch is dispatched
+  struct watch_s *next;
+} watch_t;
+
+static int epoll_fd = -1;
+static watch_t *watches = NULL;     // active watches
+static watch_t *graveyard = NULL;   // removed during the current batch
+static int n_watches = 0;
+static bool stopping = false;
+
+static sigset_t orig_mask;          // signal mask before ev_add_signal()
+static bool mask_saved = false;
+
+
+/**********************************************************************
+ *
+ * Implementations for the ev_ calls. All documentation is in the
+ * eventloop.h file.
+ *
+ **********************************************************************/
+
+int
+ev_init()
+{
+  if (epoll_fd >= 0)
+    return 0;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  return (epoll_fd < 0) ? -1 : 0;
+}
+
+
+static int
+add_watch(int fd, ev_callback_fn fn, void *arg, bool is_timer)
+{
+  if (ev_init() != 0)
+    return -1;
+
+  watch_t *w = malloc(sizeof(watch_t));
+  if (!w) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  w->fd = fd;
+  w->fn = fn;
+  w->arg = arg;
+  w->is_timer = is_timer;
+  w->removed = false;
+
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = w };
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    free(w);
+    return -1;
+  }
+
+  w->next = watches;
+  watches = w;
+  n_watches++;
+  return 0;
+}
+
+
+int
+ev_add_fd(int fd, ev_callback_fn fn, void *arg)
+{
+  return add_watch(fd, fn, arg, false);
+}
+
+
+void
+ev_remove_fd(int fd)
+{
+  for (watch_t **pw = &watches; *pw; pw = &(*pw)->next) {
+    watch_t *w = *pw;
+    if (w->fd != fd)
+      continue;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    *pw = w->next;
+    n_watches--;
+
+    // events for w may still be queued in the current batch
+    w->removed = true;
+    w->next = graveyard;
+    graveyard = w;
+    return;
+  }
+}
+
+
+int
+ev_add_signal(int signo, ev_callback_fn fn, void *arg)
+{
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, signo);
+
+  sigset_t old;
+  if (sigprocmask(SIG_BLOCK, &mask, &old) != 0)
+    return -1;
+  if (!mask_saved) {
+    orig_mask = old;
+    mask_saved = true;
+  }
+
+  int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  if (add_watch(fd, fn, arg, false) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+int
+ev_add_timer(int interval_ms, bool repeat, ev_callback_fn fn, void *arg)
+{
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  struct itimerspec its = {0};
+  its.it_value.tv_sec = interval_ms / 1000;
+  its.it_value.tv_nsec = (interval_ms % 1000) * 1000000L;
+  if (repeat)
+    its.it_interval = its.it_value;
+
+  if (timerfd_settime(fd, 0, &its, NULL) != 0 || add_watch(fd, fn, arg, true) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+void
+ev_loop()
+{
+  struct epoll_event events[MAX_EVENTS];
+
+  stopping = false;
+  while (!stopping && n_watches > 0) {
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+
+    for (int i = 0; i < n && !stopping; i++) {
+      watch_t *w = events[i].data.ptr;
+      if (w->removed)
+        continue;
+
+      if (w->is_timer) {
+        uint64_t expirations;
+        if (read(w->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+          continue;
+      }
+      w->fn(w->fd, w->arg);
+    }
+
+    while (graveyard) {
+      watch_t *w = graveyard;
+      graveyard = w->next;
+      free(w);
+    }
+  }
+}
+
+
+void
+ev_stop()
+{
+  stopping = true;
+}
+
+
+void
+ev_reset_child()
+{
+  if (mask_saved)
+    sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+  if (epoll_fd >= 0)
+    close(epoll_fd);
+  epoll_fd = -1;
+}
@@ -0,0 +1,111 @@
+/*
+ * eventloop.h
+ *
+ * A small epoll-based event loop that waits on file descriptors,
+ * signals (through signalfd) and timers (through timerfd), so that
+ * the shell sleeps until something actually happens
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _EVENTLOOP_H_
+#define _EVENTLOOP_H_
+
+#include <stdbool.h>
+
+/*
+ * Callback invoked when a watched descriptor becomes readable (or
+ * hangs up), a watched signal arrives, or a timer expires.
+ *
+ * Parameters:
+ *   fd      The descriptor that is ready. For signals this is the
+ *             signalfd, from which the callback must read the
+ *             struct signalfd_siginfo records; for timers it is the
+ *             timerfd, which has already been read.
+ *   arg     The argument supplied when the watch was added
+ */
+typedef void (*ev_callback_fn)(int fd, void *arg);
+
+/*
+ * Creates the event loop. The other ev_ calls do this on first use,
+ * but calling it early reports failure up front.
+ *
+ * Returns:
+ *   0 on success, -1 on failure (with errno set)
+ */
+int ev_init();
+
+/*
+ * Starts watching fd for input. The descriptor is not closed by the
+ * event loop, even when the watch is removed.
+ *
+ * Parameters:
+ *   fd      The descriptor to watch
+ *   fn      Called each time fd is readable or hung up
+ *   arg     Passed through to fn
+ *
+ * Returns:
+ *   0 on success, -1 on failure (with errno set)
+ */
+int ev_add_fd(int fd, ev_callback_fn fn, void *arg);
+
+/*
+ * Stops watching fd. It is safe to call this from inside any
+ * callback, including the one for fd itself.
+ *
+ * Parameters:
+ *   fd      A descriptor previously passed to ev_add_fd()
+ */
+void ev_remove_fd(int fd);
+
+/*
+ * Blocks delivery of signo to the shell and watches it through a
+ * signalfd instead. Children should call ev_reset_child() after fork
+ * so that they do not inherit the blocked signal mask.
+ *
+ * Parameters:
+ *   signo   The signal to watch, such as SIGCHLD
+ *   fn      Called when one or more signo signals are pending
+ *   arg     Passed through to fn
+ *
+ * Returns:
+ *   The signalfd on success, -1 on failure (with errno set)
+ */
+int ev_add_signal(int signo, ev_callback_fn fn, void *arg);
+
+/*
+ * Starts a timer that calls fn every interval_ms milliseconds (or
+ * only once, if repeat is false). Remove the timer with
+ * ev_remove_fd() on the returned descriptor, then close it.
+ *
+ * Parameters:
+ *   interval_ms   Time until the first expiry, and between expiries
+ *   repeat        True for a periodic timer
+ *   fn            Called on each expiry
+ *   arg           Passed through to fn
+ *
+ * Returns:
+ *   The timerfd on success, -1 on failure (with errno set)
+ */
+int ev_add_timer(int interval_ms, bool repeat, ev_callback_fn fn, void *arg);
+
+/*
+ * Waits for events and dispatches them to their callbacks, until
+ * ev_stop() is called. Waiting uses no CPU time. Returns
+ * immediately if nothing is being watched.
+ */
+void ev_loop();
+
+/*
+ * Makes ev_loop() return once the current callback finishes
+ */
+void ev_stop();
+
+/*
+ * Undoes, in a newly forked child, the signal blocking done by
+ * ev_add_signal(), and closes the epoll descriptor. Call this in the
+ * child before exec.
+ */
+void ev_reset_child();
+
+#endif /* _EVENTLOOP_H_ */
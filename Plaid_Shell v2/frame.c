@@ -0,0 +1,153 @@
+/*
+ * frame.c
+ *
+ * Encoding and decoding of plaidsh --serve protocol frames
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "frame.h"
+
+/*
+ * Reads exactly len bytes, returning 0 at a clean end of file before
+ * the first byte
+ */
+static ssize_t
+read_full(int fd, void *buf, size_t len)
+{
+  size_t done = 0;
+
+  while (done < len) {
+    ssize_t n = read(fd, (char *)buf + done, len - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    if (n == 0) {
+      if (done == 0)
+        return 0;
+      errno = EPROTO;
+      return -1;
+    }
+    done += n;
+  }
+  return done;
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the frame_ calls. All documentation is in the
+ * frame.h file.
+ *
+ **********************************************************************/
+
+int
+frame_send(int fd, char type, const void *data, size_t len)
+{
+  char header[FRAME_HEADER];
+  uint32_t nlen = htonl(len);
+
+  if (len > FRAME_MAX) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  header[0] = type;
+  memcpy(header + 1, &nlen, sizeof(nlen));
+
+  struct iovec iov[2] = {
+    { .iov_base = header, .iov_len = FRAME_HEADER },
+    { .iov_base = (void *)data, .iov_len = len },
+  };
+  struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+
+  while (iov[0].iov_len + iov[1].iov_len > 0) {
+    ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+
+    // step past whatever was sent
+    for (int i = 0; i < 2; i++) {
+      size_t step = (size_t)n < iov[i].iov_len ? (size_t)n : iov[i].iov_len;
+      iov[i].iov_base = (char *)iov[i].iov_base + step;
+      iov[i].iov_len -= step;
+      n -= step;
+    }
+  }
+  return 0;
+}
+
+
+int
+frame_send_status(int fd, int status)
+{
+  uint32_t nstatus = htonl(status);
+  return frame_send(fd, FRAME_EXIT, &nstatus, sizeof(nstatus));
+}
+
+
+ssize_t
+frame_parse(const char *buf, size_t len, char *type, const char **payload, size_t *plen)
+{
+  uint32_t nlen;
+
+  if (len < FRAME_HEADER)
+    return 0;
+
+  memcpy(&nlen, buf + 1, sizeof(nlen));
+  *plen = ntohl(nlen);
+  if (*plen > FRAME_MAX)
+    return -1;
+  if (len < FRAME_HEADER + *plen)
+    return 0;
+
+  *type = buf[0];
+  *payload = buf + FRAME_HEADER;
+  return FRAME_HEADER + *plen;
+}
+
+
+ssize_t
+frame_recv(int fd, char *type, char *payload, size_t cap)
+{
+  char header[FRAME_HEADER];
+  uint32_t nlen;
+
+  *type = '\0';
+  ssize_t n = read_full(fd, header, FRAME_HEADER);
+  if (n <= 0)
+    return n;
+
+  memcpy(&nlen, header + 1, sizeof(nlen));
+  size_t len = ntohl(nlen);
+  if (len >= cap) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  if (len > 0 && read_full(fd, payload, len) <= 0)
+    return -1;
+
+  *type = header[0];
+  payload[len] = '\0';
+  return len;
+}
+
+
+int
+frame_status(const char *payload)
+{
+  uint32_t nstatus;
+  memcpy(&nstatus, payload, sizeof(nstatus));
+  return (int)ntohl(nstatus);
+}
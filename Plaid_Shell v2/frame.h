@@ -0,0 +1,92 @@
+/*
+ * frame.h
+ *
+ * Framing for the plaidsh --serve protocol. Every message on the
+ * socket is a frame: a one-byte type, a four-byte payload length in
+ * network byte order, then the payload.
+ *
+ * A client sends one request at a time: an optional FRAME_CWD, any
+ * number of FRAME_ENV, then a FRAME_CMD, which completes the request.
+ * The server answers with FRAME_STDOUT and FRAME_STDERR frames as the
+ * command produces output, then a single FRAME_EXIT. The client may
+ * then send another request on the same connection.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define FRAME_HEADER 5              // type byte and length
+#define FRAME_MAX (1 << 20)         // largest payload accepted
+
+#define FRAME_CMD    'C'    // command line, run as if typed at the prompt
+#define FRAME_CWD    'D'    // directory to run the command in
+#define FRAME_ENV    'V'    // NAME=VALUE to set for the command
+#define FRAME_STDOUT 'O'    // chunk of the command's standard output
+#define FRAME_STDERR 'E'    // chunk of the command's standard error
+#define FRAME_EXIT   'X'    // exit status, as a four-byte network-order int
+
+/*
+ * Writes one frame, retrying until all of it is written. SIGPIPE is
+ * suppressed, so a vanished peer shows up as an EPIPE failure.
+ *
+ * Parameters:
+ *   fd      A connected socket
+ *   type    The frame type
+ *   data    The payload
+ *   len     Length of the payload, at most FRAME_MAX
+ *
+ * Returns:
+ *   0 on success, -1 on failure (with errno set)
+ */
+int frame_send(int fd, char type, const void *data, size_t len);
+
+/*
+ * Sends a FRAME_EXIT carrying status
+ */
+int frame_send_status(int fd, int status);
+
+/*
+ * Finds the first complete frame in a buffer
+ *
+ * Parameters:
+ *   buf       Bytes received so far
+ *   len       Number of bytes in buf
+ *   type      Set to the frame type
+ *   payload   Set to point at the payload within buf
+ *   plen      Set to the payload length
+ *
+ * Returns:
+ *   The number of bytes the frame occupies in buf, 0 if buf does not
+ *   yet hold a whole frame, or -1 if the frame is larger than
+ *   FRAME_MAX
+ */
+ssize_t frame_parse(const char *buf, size_t len, char *type, const char **payload, size_t *plen);
+
+/*
+ * Reads one whole frame from a blocking socket
+ *
+ * Parameters:
+ *   fd        A connected socket
+ *   type      Set to the frame type
+ *   payload   Receives the payload, which is NUL-terminated
+ *   cap       Size of payload; must be more than FRAME_MAX to accept
+ *               every frame
+ *
+ * Returns:
+ *   The payload length, 0 with *type set to '\0' at end of file, or
+ *   -1 on error or if the payload does not fit
+ */
+ssize_t frame_recv(int fd, char *type, char *payload, size_t cap);
+
+/*
+ * Decodes the payload of a FRAME_EXIT
+ */
+int frame_status(const char *payload);
+
+#endif /* _FRAME_H_ */
@@ -0,0 +1,337 @@
+/*
+ * jobs.c
+ *
+ * Background job table, output collection and completion notices
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#define _GNU_SOURCE         // pipe2
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <readline/readline.h>
+#include "jobs.h"
+#include "eventloop.h"
+
+#define JOB_LINE_MAX 4096   // longest partial output line held back
+
+typedef struct job_s {
+  int id;                   // job number, as in [1]
+  pid_t pid;
+  char *desc;
+  int out_fd;               // read end of the output pipe, or -1 at EOF
+  bool exited;
+  int status;               // exit status once exited
+  char line[JOB_LINE_MAX];  // output not yet ending in a newline
+  size_t line_len;
+  struct job_s *next;
+} job_t;
+
+static job_t *jobs = NULL;
+static int sigchld_fd = -1;
+static bool prompt_visible = false;
+static int last_job_status = 0;     // status of the last job to finish
+
+
+/*
+ * Prints text so that it does not get mixed up with a prompt that
+ * readline is displaying
+ */
+static void
+print_above_prompt(const char *text, size_t len)
+{
+  if (prompt_visible)
+    rl_clear_visible_line();
+
+  fwrite(text, 1, len, stdout);
+  fflush(stdout);
+
+  if (prompt_visible)
+    rl_forced_update_display();
+}
+
+/*
+ * Prints the complete lines in the job's buffer, keeping back any
+ * partial line unless flush is set
+ */
+static void
+print_job_output(job_t *job, bool flush)
+{
+  char *end = job->line + job->line_len;
+  char *last_nl = NULL;
+
+  for (char *p = job->line; p < end; p++)
+    if (*p == '\n')
+      last_nl = p;
+
+  size_t n = last_nl ? (size_t)(last_nl + 1 - job->line) : 0;
+  if (flush || job->line_len == sizeof(job->line))
+    n = job->line_len;
+  if (n == 0)
+    return;
+
+  if (flush && job->line[n-1] != '\n') {
+    print_above_prompt(job->line, n);
+    print_above_prompt("\n", 1);
+  } else {
+    print_above_prompt(job->line, n);
+  }
+
+  memmove(job->line, job->line + n, job->line_len - n);
+  job->line_len -= n;
+}
+
+/*
+ * Once a job has both exited and closed its output, prints its
+ * completion notice and removes it from the table
+ */
+static void
+finish_job(job_t *job)
+{
+  if (!job->exited || job->out_fd >= 0)
+    return;
+
+  char notice[256];
+  int len;
+  if (job->status == 0)
+    len = snprintf(notice, sizeof(notice), "[%d] Done        %s\n", job->id, job->desc);
+  else
+    len = snprintf(notice, sizeof(notice), "[%d] Exit %-3d    %s\n",
+      job->id, job->status, job->desc);
+  if (len >= sizeof(notice))
+    len = sizeof(notice) - 1;
+  print_above_prompt(notice, len);
+  last_job_status = job->status;
+
+  for (job_t **pj = &jobs; *pj; pj = &(*pj)->next) {
+    if (*pj == job) {
+      *pj = job->next;
+      break;
+    }
+  }
+  free(job->desc);
+  free(job);
+}
+
+/*
+ * Reads whatever output is available from a job. Called by the event
+ * loop, and directly by jobs_wait_all().
+ */
+static void
+on_job_output(int fd, void *arg)
+{
+  job_t *job = arg;
+
+  ssize_t n = read(fd, job->line + job->line_len, sizeof(job->line) - job->line_len);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    return;
+
+  if (n > 0) {
+    job->line_len += n;
+    print_job_output(job, false);
+    return;
+  }
+
+  // end of output, or an error that we treat the same way
+  print_job_output(job, true);
+  ev_remove_fd(fd);
+  close(fd);
+  job->out_fd = -1;
+  finish_job(job);
+}
+
+/*
+ * Collects the exit status of any job that has finished
+ */
+static void
+reap_jobs()
+{
+  job_t *next;
+
+  for (job_t *job = jobs; job; job = next) {
+    next = job->next;
+    if (job->exited)
+      continue;
+
+    int status;
+    if (waitpid(job->pid, &status, WNOHANG) == job->pid) {
+      job->exited = true;
+      if (WIFSIGNALED(status))
+        job->status = 128 + WTERMSIG(status);
+      else
+        job->status = WEXITSTATUS(status);
+      finish_job(job);
+    }
+  }
+}
+
+/*
+ * SIGCHLD arrived; only the job table's own children are reaped here,
+ * so that foreground commands can still wait for theirs
+ */
+static void
+on_sigchld(int fd, void *arg)
+{
+  struct signalfd_siginfo si;
+
+  while (read(fd, &si, sizeof(si)) == sizeof(si))
+    ;
+  reap_jobs();
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the jobs_ calls. All documentation is in the
+ * jobs.h file.
+ *
+ **********************************************************************/
+
+int
+jobs_init()
+{
+  if (sigchld_fd >= 0)
+    return 0;
+
+  sigchld_fd = ev_add_signal(SIGCHLD, on_sigchld, NULL);
+  return (sigchld_fd < 0) ? -1 : 0;
+}
+
+
+pid_t
+jobs_fork(const char *desc)
+{
+  if (jobs_init() != 0) {
+    perror("jobs_init");
+    return -1;
+  }
+
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    perror("pipe");
+    return -1;
+  }
+
+  job_t *job = calloc(1, sizeof(job_t));
+  if (!job || !(job->desc = strdup(desc))) {
+    free(job);
+    close(fds[0]);
+    close(fds[1]);
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+
+  fflush(stdout);
+  pid_t pid = fork();
+
+  if (pid == -1) {
+    perror("fork");
+    close(fds[0]);
+    close(fds[1]);
+    free(job->desc);
+    free(job);
+    return -1;
+  }
+
+  if (pid == 0) {
+    ev_reset_child();
+    setpgid(0, 0);
+
+    int null_fd = open("/dev/null", O_RDONLY);
+    if (null_fd >= 0) {
+      dup2(null_fd, STDIN_FILENO);
+      close(null_fd);
+    }
+    dup2(fds[1], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    return 0;
+  }
+
+  close(fds[1]);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+  // number jobs from 1 again once the table has drained
+  int max_id = 0;
+  for (job_t *j = jobs; j; j = j->next)
+    if (j->id > max_id)
+      max_id = j->id;
+
+  job->id = max_id + 1;
+  job->pid = pid;
+  job->out_fd = fds[0];
+  job->next = jobs;
+  jobs = job;
+
+  if (ev_add_fd(job->out_fd, on_job_output, job) != 0)
+    perror("ev_add_fd");
+
+  printf("[%d] %d\n", job->id, pid);
+  return pid;
+}
+
+
+void
+jobs_list()
+{
+  // the table is newest first; print oldest first
+  int max_id = 0;
+  for (job_t *j = jobs; j; j = j->next)
+    if (j->id > max_id)
+      max_id = j->id;
+
+  for (int id = 1; id <= max_id; id++)
+    for (job_t *j = jobs; j; j = j->next)
+      if (j->id == id)
+        printf("[%d] %-11s %s\n", j->id, j->exited ? "Done" : "Running", j->desc);
+}
+
+
+int
+jobs_wait_all()
+{
+  last_job_status = 0;
+
+  while (jobs) {
+    job_t *job = jobs;
+    while (job->next)
+      job = job->next;        // the oldest job
+
+    struct pollfd pfds[2] = {
+      { .fd = sigchld_fd, .events = POLLIN },
+      { .fd = job->out_fd, .events = POLLIN },
+    };
+
+    if (job->exited) {
+      // only output is left; the child may have passed the pipe on
+      if (poll(&pfds[1], 1, -1) > 0)
+        on_job_output(job->out_fd, job);
+      continue;
+    }
+
+    if (poll(pfds, job->out_fd >= 0 ? 2 : 1, -1) < 0 && errno != EINTR)
+      return -1;
+
+    if (job->out_fd >= 0 && pfds[1].revents)
+      on_job_output(job->out_fd, job);
+    if (pfds[0].revents)
+      on_sigchld(sigchld_fd, NULL);
+  }
+
+  return last_job_status;
+}
+
+
+void
+jobs_set_prompt_visible(bool visible)
+{
+  prompt_visible = visible;
+}
@@ -0,0 +1,69 @@
+/*
+ * jobs.h
+ *
+ * Background jobs started with '&'. Their output is collected
+ * through pipes and their completion through a SIGCHLD signalfd, both
+ * watched by the event loop, so that output and "Done" notices are
+ * shown as soon as they happen instead of after the next Enter.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _JOBS_H_
+#define _JOBS_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * Starts watching SIGCHLD. This is done by the first jobs_fork() if
+ * it has not been done already.
+ *
+ * Returns:
+ *   0 on success, -1 on failure (with errno set)
+ */
+int jobs_init();
+
+/*
+ * Forks a background job. In the child, stdin is /dev/null, stdout
+ * and stderr go to a pipe read by the shell, and the signal mask is
+ * reset; the child should run its command and then _exit(). In the
+ * parent, the job is added to the job table and its number and pid
+ * are printed as "[N] pid".
+ *
+ * Parameters:
+ *   desc    Text describing the job, shown by the jobs builtin and
+ *             in the completion notice; it is copied
+ *
+ * Returns:
+ *   0 in the child, the child's pid in the parent, or -1 if the fork
+ *   failed
+ */
+pid_t jobs_fork(const char *desc);
+
+/*
+ * Prints one line per running job, as "[N] Running  desc"
+ */
+void jobs_list();
+
+/*
+ * Waits for every background job to finish, printing their output
+ * and completion notices as they arrive
+ *
+ * Returns:
+ *   The exit status of the last job that finished, or 0 if there
+ *   were no jobs
+ */
+int jobs_wait_all();
+
+/*
+ * Tells the job code whether readline is currently showing a prompt.
+ * While it is, job output and notices are printed above the prompt
+ * and the line being edited is redrawn below them.
+ *
+ * Parameters:
+ *   visible   True while the shell is waiting for input
+ */
+void jobs_set_prompt_visible(bool visible);
+
+#endif /* _JOBS_H_ */
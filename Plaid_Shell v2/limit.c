@@ -0,0 +1,355 @@
+/*
+ * limit.c
+ *
+ * Per-command resource limits, and accounting through transient
+ * cgroup v2 groups when the hierarchy is writable
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "limit.h"
+
+#define MAX_STALE 16                // emptied cgroups still to remove
+
+struct limit_job_s {
+  limit_t lim;
+  int procs_fd;                     // the cgroup's cgroup.procs, or -1
+  char dir[PATH_MAX + 32];          // the cgroup, if procs_fd >= 0
+};
+
+// the shell's own cgroup, below which job cgroups are made
+static int cgroup_state = 0;        // 0 not looked for yet, 1 usable, -1 not
+static char cgroup_base[PATH_MAX];
+static unsigned job_serial = 0;
+
+// cgroups of jobs that left processes behind, removed once they exit
+static char *stale[MAX_STALE];
+
+
+/*
+ * Reads a size such as 512K or 2G
+ */
+static bool
+parse_size(const char *s, rlim_t *value)
+{
+  char *end;
+  errno = 0;
+  unsigned long long n = strtoull(s, &end, 10);
+  if (errno || end == s || *s == '-')
+    return false;
+
+  int shift = 0;
+  switch (*end) {
+  case 'k': case 'K': shift = 10; end++; break;
+  case 'm': case 'M': shift = 20; end++; break;
+  case 'g': case 'G': shift = 30; end++; break;
+  case 't': case 'T': shift = 40; end++; break;
+  }
+  if (*end || n == 0 || n > (ULLONG_MAX >> shift))
+    return false;
+  *value = n << shift;
+  return true;
+}
+
+/*
+ * Finds the shell's cgroup in the cgroup v2 hierarchy, and checks
+ * that groups can be made below it
+ */
+static bool
+find_cgroup()
+{
+  char line[PATH_MAX + 256], path[PATH_MAX] = "";
+  char root[PATH_MAX], mount[PATH_MAX], fstype[64];
+  bool found = false;
+
+  FILE *f = fopen("/proc/self/cgroup", "re");
+  if (!f)
+    return false;
+  while (fgets(line, sizeof(line), f))
+    if (!strncmp(line, "0::", 3) && sscanf(line + 3, "%4095s", path) == 1)
+      break;
+  fclose(f);
+  if (!*path)
+    return false;
+
+  // mountinfo: id parent dev root mountpoint options ... - fstype ...
+  if (!(f = fopen("/proc/self/mountinfo", "re")))
+    return false;
+  while (!found && fgets(line, sizeof(line), f)) {
+    char *sep = strstr(line, " - ");
+    found = sep && sscanf(sep + 3, "%63s", fstype) == 1 && !strcmp(fstype, "cgroup2")
+            && sscanf(line, "%*s %*s %*s %4095s %4095s", root, mount) == 2;
+  }
+  fclose(f);
+  if (!found)
+    return false;
+
+  // the mount may show only part of the hierarchy, as in a container
+  size_t root_len = strcmp(root, "/") ? strlen(root) : 0;
+  if (strncmp(path, root, root_len))
+    return false;
+  snprintf(cgroup_base, sizeof(cgroup_base), "%s%s", mount, path + root_len);
+  return access(cgroup_base, W_OK) == 0;
+}
+
+/*
+ * Removes the cgroups of jobs of shells that have exited, which were
+ * kept while processes the jobs started were still in them
+ */
+static void
+sweep_cgroups()
+{
+  DIR *d = opendir(cgroup_base);
+  if (!d)
+    return;
+
+  struct dirent *de;
+  int pid;
+  while ((de = readdir(d))) {
+    char path[PATH_MAX + 256];
+    if (sscanf(de->d_name, "plaidsh-%d-", &pid) == 1 && kill(pid, 0) != 0 && errno == ESRCH) {
+      snprintf(path, sizeof(path), "%s/%s", cgroup_base, de->d_name);
+      rmdir(path);
+    }
+  }
+  closedir(d);
+}
+
+/*
+ * Writes a short value to a file of a cgroup
+ */
+static int
+write_value(const char *dir, const char *file, const char *value)
+{
+  char path[PATH_MAX + 64];
+  snprintf(path, sizeof(path), "%s/%s", dir, file);
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  int result = (write(fd, value, strlen(value)) == strlen(value)) ? 0 : -1;
+  close(fd);
+  return result;
+}
+
+/*
+ * Reads one number from a file of a cgroup: the whole file, or the
+ * value after key when key is given
+ */
+static bool
+read_value(const char *dir, const char *file, const char *key, unsigned long long *value)
+{
+  char path[PATH_MAX + 64], name[64];
+  unsigned long long n;
+  bool found = false;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, file);
+  FILE *f = fopen(path, "re");
+  if (!f)
+    return false;
+  if (!key)
+    found = fscanf(f, "%llu", value) == 1;
+  while (key && !found && fscanf(f, "%63s %llu", name, &n) == 2)
+    if (!strcmp(name, key)) {
+      *value = n;
+      found = true;
+    }
+  fclose(f);
+  return found;
+}
+
+/*
+ * Removes a job's cgroup, or keeps it to try again later if processes
+ * the job started are still in it
+ */
+static void
+remove_cgroup(const char *dir)
+{
+  for (int i = 0; i < MAX_STALE; i++)
+    if (stale[i] && rmdir(stale[i]) == 0) {
+      free(stale[i]);
+      stale[i] = NULL;
+    }
+
+  if (!dir || rmdir(dir) == 0 || errno != EBUSY)
+    return;
+  for (int i = 0; i < MAX_STALE; i++)
+    if (!stale[i]) {
+      stale[i] = strdup(dir);
+      return;
+    }
+}
+
+/*
+ * Formats a number of bytes for people to read
+ */
+static void
+format_bytes(char *buf, size_t len, unsigned long long bytes)
+{
+  const char *units = "KMGT";
+  double n = bytes;
+  int u = -1;
+  while (n >= 1024 && u < 3) {
+    n /= 1024;
+    u++;
+  }
+  if (u < 0)
+    snprintf(buf, len, "%lluB", bytes);
+  else
+    snprintf(buf, len, "%.1f%c", n, units[u]);
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the limit_ calls. All documentation is in the
+ * limit.h file.
+ *
+ **********************************************************************/
+
+int
+limit_parse(char * const *argv, limit_t *lim)
+{
+  int i;
+  for (i = 1; argv[i] && !strncmp(argv[i], "--", 2); i += 2) {
+    if (!strcmp(argv[i], "--"))
+      return i + 1;
+    if (!argv[i + 1])
+      return -1;
+
+    rlim_t value, *field;
+    if (!parse_size(argv[i + 1], &value))
+      return -1;
+    if (!strcmp(argv[i], "--mem"))
+      field = &lim->mem;
+    else if (!strcmp(argv[i], "--cpu"))
+      field = &lim->cpu;
+    else if (!strcmp(argv[i], "--nofile"))
+      field = &lim->nofile;
+    else
+      return -1;
+
+    // an inner limit can only tighten an outer one
+    if (*field == 0 || value < *field)
+      *field = value;
+  }
+  return i;
+}
+
+
+limit_job_t *
+limit_job_start(const limit_t *lim)
+{
+  limit_job_t *job = malloc(sizeof(limit_job_t));
+  if (!job)
+    return NULL;
+  job->lim = *lim;
+  job->procs_fd = -1;
+
+  if (cgroup_state == 0) {
+    cgroup_state = find_cgroup() ? 1 : -1;
+    if (cgroup_state > 0)
+      sweep_cgroups();
+  }
+  if (cgroup_state < 0)
+    return job;
+
+  char procs[PATH_MAX + 64];
+  snprintf(job->dir, sizeof(job->dir), "%s/plaidsh-%d-%u", cgroup_base, (int)getpid(),
+           ++job_serial);
+  snprintf(procs, sizeof(procs), "%s/cgroup.procs", job->dir);
+  if (mkdir(job->dir, 0755) != 0)
+    return job;
+  if ((job->procs_fd = open(procs, O_WRONLY | O_CLOEXEC)) < 0) {
+    rmdir(job->dir);
+    return job;
+  }
+
+  // only there when the memory controller is enabled for the group
+  if (lim->mem) {
+    char value[32];
+    snprintf(value, sizeof(value), "%llu", (unsigned long long)lim->mem);
+    write_value(job->dir, "memory.max", value);
+  }
+  return job;
+}
+
+
+int
+limit_job_enter(limit_job_t *job)
+{
+  // "0" moves the process that writes it; its children follow
+  if (job->procs_fd >= 0)
+    write(job->procs_fd, "0", 1);
+
+  struct {
+    int resource;
+    rlim_t soft, hard;
+    const char *name;
+  } limits[] = {
+    { RLIMIT_AS, job->lim.mem, job->lim.mem, "--mem" },
+    { RLIMIT_CPU, job->lim.cpu, job->lim.cpu + 1, "--cpu" },
+    { RLIMIT_NOFILE, job->lim.nofile, job->lim.nofile, "--nofile" },
+  };
+  for (int i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+    struct rlimit rl = { limits[i].soft, limits[i].hard };
+    if (limits[i].soft && setrlimit(limits[i].resource, &rl) != 0) {
+      fprintf(stderr, "limit: %s: %s\n", limits[i].name, strerror(errno));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+void
+limit_job_finish(limit_job_t *job, const struct rusage *usage)
+{
+  if (!usage) {
+    if (job->procs_fd >= 0) {
+      close(job->procs_fd);
+      rmdir(job->dir);
+    }
+    free(job);
+    return;
+  }
+
+  unsigned long long user = usage->ru_utime.tv_sec * 1000000ULL + usage->ru_utime.tv_usec;
+  unsigned long long sys = usage->ru_stime.tv_sec * 1000000ULL + usage->ru_stime.tv_usec;
+  unsigned long long peak = usage->ru_maxrss * 1024ULL, n;
+  const char *what = "max rss";
+  bool oom = false;
+
+  // the group counts processes wait4() never saw; if the child could
+  // not join it, it counts less, and wait4() is right
+  if (job->procs_fd >= 0) {
+    close(job->procs_fd);
+    if (read_value(job->dir, "cpu.stat", "user_usec", &n) && n > user)
+      user = n;
+    if (read_value(job->dir, "cpu.stat", "system_usec", &n) && n > sys)
+      sys = n;
+    if (read_value(job->dir, "memory.peak", NULL, &n) && n > peak) {
+      peak = n;
+      what = "memory peak";
+    }
+    oom = read_value(job->dir, "memory.events", "oom_kill", &n) && n > 0;
+  }
+
+  char bytes[32];
+  format_bytes(bytes, sizeof(bytes), peak);
+  fprintf(stderr, "limit: cpu %.2fs (user %.2fs, sys %.2fs), %s %s%s\n", (user + sys) / 1e6,
+          user / 1e6, sys / 1e6, what, bytes, oom ? ", killed for lack of memory" : "");
+
+  remove_cgroup(job->procs_fd >= 0 ? job->dir : NULL);
+  free(job);
+}
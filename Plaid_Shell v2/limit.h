@@ -0,0 +1,98 @@
+/*
+ * limit.h
+ *
+ * Resource limits and accounting for the programs the shell starts,
+ * so that one runaway command cannot take down a shared machine:
+ *
+ *   limit --mem 2G --cpu 60 --nofile 1024 make -j8
+ *
+ * Each limit is set with setrlimit() in the child before it execs,
+ * so it holds for every process the program starts in turn:
+ *
+ *   --mem SIZE     address space of each process (RLIMIT_AS); SIZE
+ *                    may end in K, M, G or T
+ *   --cpu SECS     CPU time of each process (RLIMIT_CPU); SIGXCPU at
+ *                    the limit, SIGKILL a second later
+ *   --nofile N     open files of each process (RLIMIT_NOFILE)
+ *
+ * A value of 0 is refused; an option left out sets no limit.
+ *
+ * When a writable cgroup v2 hierarchy is mounted, each job also runs
+ * in a transient cgroup of its own, below the shell's, which is
+ * removed once the job is reaped. Its CPU time and peak memory then
+ * cover the whole process tree, and --mem becomes the cgroup's
+ * memory.max as well when the memory controller is enabled there.
+ * Without one, the numbers come from wait4(), and the peak is that of
+ * the largest single process.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _LIMIT_H_
+#define _LIMIT_H_
+
+#include <sys/resource.h>
+
+/*
+ * The limits for one command; 0 means no limit
+ */
+typedef struct {
+  rlim_t mem;                 // bytes
+  rlim_t cpu;                 // seconds
+  rlim_t nofile;              // descriptors
+} limit_t;
+
+/*
+ * One program started under limits, from just before its fork until
+ * it is reaped
+ */
+typedef struct limit_job_s limit_job_t;
+
+/*
+ * Reads the options at the start of an argument vector. Options not
+ * given keep the values already in lim, and one looser than the value
+ * already there is ignored, so that nested limits take the tightest
+ * of each:
+ *
+ *   limit --mem 1G limit --mem 4G --cpu 10 cmd    is 1G and 10s
+ *
+ * Parameters:
+ *   argv   The arguments, argv[0] being the builtin's own name
+ *   lim    Updated with the options found
+ *
+ * Returns:
+ *   The index of the first argument after the options, or -1 if an
+ *   option or its value is not valid
+ */
+int limit_parse(char * const *argv, limit_t *lim);
+
+/*
+ * Prepares to start a program under limits; called by the shell just
+ * before it forks. Creates the job's cgroup when there can be one.
+ *
+ * Returns:
+ *   The job, or NULL if out of memory
+ */
+limit_job_t *limit_job_start(const limit_t *lim);
+
+/*
+ * Called in the forked child before it execs: moves it into the job's
+ * cgroup and sets its resource limits
+ *
+ * Returns:
+ *   0 on success, -1 after printing an error
+ */
+int limit_job_enter(limit_job_t *job);
+
+/*
+ * Called once the job is reaped: prints its CPU time and peak memory
+ * to stderr, removes its cgroup and frees the job
+ *
+ * Parameters:
+ *   job      The job
+ *   usage    Its resource usage from wait4(), or NULL if the fork
+ *              failed, when nothing is printed
+ */
+void limit_job_finish(limit_job_t *job, const struct rusage *usage);
+
+#endif /* _LIMIT_H_ */
@@ -0,0 +1,413 @@
+/*
+ * memo.c
+ *
+ * On-disk store of command outputs, keyed by the command and the
+ * fingerprints of what it reads
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#define _GNU_SOURCE         // mkostemp
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "memo.h"
+
+#define MAGIC "PLMEMO1"
+
+// what stdin was when the shell started, or zeroes if it was closed
+static struct stat shell_stdin;
+
+/*
+ * The start of a stored answer, which is followed by the key and then
+ * the output
+ */
+typedef struct {
+  char magic[8];
+  int32_t status;
+  int32_t unused;
+  int64_t created;            // seconds since the epoch
+  uint64_t key_len;
+} header_t;
+
+/*
+ * A growable byte string
+ */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+  bool failed;                // out of memory at some point
+} buf_t;
+
+
+static void
+buf_add(buf_t *b, const void *data, size_t len)
+{
+  if (b->failed)
+    return;
+  if (b->len + len > b->cap) {
+    size_t cap = b->cap ? b->cap : 256;
+    while (cap < b->len + len)
+      cap *= 2;
+    char *grown = realloc(b->data, cap);
+    if (!grown) {
+      b->failed = true;
+      return;
+    }
+    b->data = grown;
+    b->cap = cap;
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+/*
+ * Adds a field to a key, ending in '\0' so that no two different
+ * lists of fields make the same key
+ */
+static void
+buf_field(buf_t *b, const char *s)
+{
+  buf_add(b, s, strlen(s) + 1);
+}
+
+/*
+ * Adds what identifies a version of a file: which file it is, its
+ * size and when it last changed
+ */
+static void
+buf_stat(buf_t *b, const struct stat *st)
+{
+  char fp[128];
+  snprintf(fp, sizeof(fp), "%lx:%lx:%lx:%lld:%ld.%09ld", (unsigned long)st->st_dev,
+           (unsigned long)st->st_ino, (unsigned long)st->st_mode, (long long)st->st_size,
+           (long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec);
+  buf_field(b, fp);
+}
+
+/*
+ * Adds the file a program name runs, found the way execvp() finds it
+ */
+static void
+key_program(buf_t *b, const char *name)
+{
+  struct stat st;
+
+  if (strchr(name, '/')) {
+    if (stat(name, &st) == 0)
+      buf_stat(b, &st);
+    return;
+  }
+
+  const char *path = getenv("PATH");
+  if (!path)
+    path = "/bin:/usr/bin";
+  while (*path) {
+    const char *end = strchrnul(path, ':');
+    char file[PATH_MAX];
+    int len = end - path;
+    if (snprintf(file, sizeof(file), "%.*s/%s", len, len ? path : ".", name) < sizeof(file)
+        && stat(file, &st) == 0 && S_ISREG(st.st_mode)) {
+      buf_field(b, file);
+      buf_stat(b, &st);
+      return;
+    }
+    path = *end ? end + 1 : end;
+  }
+}
+
+/*
+ * Returns true if a and b are the same open file
+ */
+static bool
+same_file(const struct stat *a, const struct stat *b)
+{
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino;
+}
+
+/*
+ * Builds the key for a command
+ *
+ * Returns:
+ *   true with the key in b, or false if the command cannot be
+ *   memoized or memory ran out
+ */
+static bool
+make_key(buf_t *b, command_t *cmd, const char *cwd)
+{
+  char * const *argv = command_get_argv(cmd);
+  struct stat st;
+
+  buf_field(b, "argv");
+  for (int i = 0; argv[i]; i++)
+    buf_field(b, argv[i]);
+
+  buf_field(b, "cwd");
+  buf_field(b, cwd);
+
+  buf_field(b, "env");
+  const char *names = getenv("MEMO_ENV");
+  if (!names)
+    names = MEMO_DEFAULT_ENV;
+  while (*names) {
+    const char *end = strchrnul(names, ':');
+    char name[256];
+    snprintf(name, sizeof(name), "%.*s", (int)(end - names), names);
+    const char *value = getenv(name);
+    if (value) {
+      buf_field(b, name);
+      buf_field(b, value);
+    }
+    names = *end ? end + 1 : end;
+  }
+
+  buf_field(b, "program");
+  key_program(b, argv[0]);
+
+  buf_field(b, "files");
+  for (int i = 1; argv[i]; i++) {
+    if (stat(argv[i], &st) == 0) {
+      buf_field(b, argv[i]);
+      buf_stat(b, &st);
+    }
+  }
+
+  // a here-document is a new file each time, so goes in as its text.
+  // The shell's own stdin, a terminal or a device such as /dev/null is
+  // taken to be no input; a terminal's times change as it is used.
+  buf_field(b, "stdin");
+  if (command_get_input_text(cmd)) {
+    buf_field(b, command_get_input_text(cmd));
+  } else if (fstat(STDIN_FILENO, &st) == 0 && !same_file(&st, &shell_stdin)) {
+    if (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode))
+      return false;
+    if (S_ISREG(st.st_mode))
+      buf_stat(b, &st);
+  }
+
+  return !b->failed;
+}
+
+/*
+ * Returns the directory of the store, which may not exist yet
+ */
+static bool
+store_dir(char *dir, size_t len)
+{
+  const char *env;
+  if ((env = getenv("MEMO_DIR")) && *env)
+    return snprintf(dir, len, "%s", env) < len;
+  if ((env = getenv("XDG_CACHE_HOME")) && *env)
+    return snprintf(dir, len, "%s/plaidsh/memo", env) < len;
+  if ((env = getenv("HOME")) && *env)
+    return snprintf(dir, len, "%s/.cache/plaidsh/memo", env) < len;
+  errno = ENOENT;
+  return false;
+}
+
+/*
+ * Creates a directory and any missing parents
+ */
+static int
+make_dirs(const char *dir)
+{
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s", dir);
+
+  for (char *p = path + 1; ; p++) {
+    if (*p == '/' || *p == '\0') {
+      char c = *p;
+      *p = '\0';
+      if (mkdir(path, 0700) != 0 && errno != EEXIST)
+        return -1;
+      if (!(*p = c))
+        return 0;
+    }
+  }
+}
+
+/*
+ * FNV-1a; stored answers also hold their key, so a collision only
+ * costs a miss
+ */
+static uint64_t
+hash(const char *data, size_t len)
+{
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)data[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+static int
+write_all(int fd, const char *data, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * Copies the rest of from to stdout
+ */
+static void
+copy_out(int from)
+{
+  char data[65536];
+  ssize_t n;
+  while ((n = read(from, data, sizeof(data))) > 0 || (n < 0 && errno == EINTR))
+    if (n > 0 && write_all(STDOUT_FILENO, data, n) != 0)
+      return;
+}
+
+/*
+ * Replays a stored answer if there is one for key, young enough
+ *
+ * Returns:
+ *   true with the exit status set if the answer was replayed
+ */
+static bool
+replay(const char *path, const buf_t *key, long ttl, int *status)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  header_t h;
+  char *stored = NULL;
+  bool hit = read(fd, &h, sizeof(h)) == sizeof(h) && !memcmp(h.magic, MAGIC, sizeof(h.magic))
+             && h.key_len == key->len && (ttl <= 0 || time(NULL) - h.created < ttl)
+             && (stored = malloc(key->len))
+             && read(fd, stored, key->len) == key->len
+             && !memcmp(stored, key->data, key->len);
+  free(stored);
+
+  if (hit) {
+    copy_out(fd);
+    *status = h.status;
+  }
+  close(fd);
+  return hit;
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the memo_ calls. All documentation is in the
+ * memo.h file.
+ *
+ **********************************************************************/
+
+void
+memo_init()
+{
+  if (fstat(STDIN_FILENO, &shell_stdin) != 0)
+    memset(&shell_stdin, 0, sizeof(shell_stdin));
+}
+
+
+int
+memo_run(command_t *cmd, const char *cwd, long ttl, int (*execute)(command_t *cmd))
+{
+  buf_t key = { 0 };
+  char dir[PATH_MAX], path[PATH_MAX + 32], tmp[PATH_MAX + 32];
+  int status;
+
+  fflush(stdout);
+  if (!make_key(&key, cmd, cwd) || !store_dir(dir, sizeof(dir))) {
+    free(key.data);
+    return execute(cmd);
+  }
+
+  uint64_t h = hash(key.data, key.len);
+  snprintf(path, sizeof(path), "%s/%016llx", dir, (unsigned long long)h);
+  if (replay(path, &key, ttl, &status)) {
+    free(key.data);
+    return status;
+  }
+
+  // a miss: run the command into a new file, which becomes the
+  // answer once it is complete
+  header_t header = { .magic = MAGIC, .created = time(NULL), .key_len = key.len };
+  snprintf(tmp, sizeof(tmp), "%s/.%016llx.XXXXXX", dir, (unsigned long long)h);
+  int fd = (make_dirs(dir) == 0) ? mkostemp(tmp, O_CLOEXEC) : -1;
+  int saved_out = (fd >= 0) ? fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10) : -1;
+  if (fd < 0 || saved_out < 0 || write_all(fd, (char *)&header, sizeof(header)) != 0
+      || write_all(fd, key.data, key.len) != 0) {
+    fprintf(stderr, "memo: %s: %s\n", dir, strerror(errno));
+    free(key.data);
+    if (fd >= 0) {
+      unlink(tmp);
+      close(fd);
+    }
+    if (saved_out >= 0)
+      close(saved_out);
+    return execute(cmd);
+  }
+
+  dup2(fd, STDOUT_FILENO);
+  status = execute(cmd);
+  fflush(stdout);
+  dup2(saved_out, STDOUT_FILENO);
+  close(saved_out);
+
+  lseek(fd, sizeof(header) + key.len, SEEK_SET);
+  copy_out(fd);
+
+  // 126 and up: could not run, or killed by a signal
+  header.status = status;
+  if (status >= 0 && status < 126 && pwrite(fd, &header, sizeof(header), 0) == sizeof(header)
+      && rename(tmp, path) == 0) {
+    close(fd);
+  } else {
+    unlink(tmp);
+    close(fd);
+  }
+
+  free(key.data);
+  return status;
+}
+
+
+int
+memo_clear()
+{
+  char dir[PATH_MAX], path[PATH_MAX + 256];
+  if (!store_dir(dir, sizeof(dir)))
+    return -1;
+
+  DIR *d = opendir(dir);
+  if (!d)
+    return errno == ENOENT ? 0 : -1;
+
+  struct dirent *de;
+  int result = 0;
+  while ((de = readdir(d))) {
+    if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+    if (unlink(path) != 0)
+      result = -1;
+  }
+  closedir(d);
+  return result;
+}
@@ -0,0 +1,79 @@
+/*
+ * memo.h
+ *
+ * Memoized commands, for queries that are run over and over and give
+ * the same answer each time, such as version probes or git lookups
+ * at the prompt. A command's stdout and exit status are kept in a
+ * store on disk under a key made of:
+ *
+ *   - its arguments and the directory it runs in
+ *   - the environment variables named in $MEMO_ENV, a colon-separated
+ *     list defaulting to MEMO_DEFAULT_ENV
+ *   - the device, inode, size and modification time of the program,
+ *     of every argument that names an existing file or directory, and
+ *     of stdin when it is a regular file, as with < file
+ *   - the text of a here-document or here-string
+ *
+ * so that editing an input file, upgrading the program or changing
+ * directory runs the command again. Anything else the command reads,
+ * such as the other files of a git repository, is not seen; a time
+ * to live bounds how stale such an answer can get.
+ *
+ * The store is $MEMO_DIR, or $XDG_CACHE_HOME/plaidsh/memo, or
+ * ~/.cache/plaidsh/memo, with one file per key. stderr is not kept,
+ * and commands killed by a signal or that could not be run are not
+ * stored.
+ *
+ * A terminal, a device such as /dev/null, and the stdin the shell
+ * itself was started with, such as the pipe a script is fed through,
+ * are taken to be no input, so that commands that do not read stdin
+ * are memoized wherever they run. A command given its own pipe, as in
+ * a pipeline, is never memoized, since what it reads cannot be known
+ * in advance.
+ *
+ * Only programs are memoized. The memo builtin refuses shell builtins
+ * and functions, whose effect on the shell, such as the directory cd
+ * changes to, would be lost when their output was replayed.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _MEMO_H_
+#define _MEMO_H_
+
+#include "command.h"
+
+#define MEMO_DEFAULT_ENV "PATH:HOME:USER:LANG:LC_ALL:TZ"
+
+/*
+ * Notes what the shell's stdin is; called at startup, before any
+ * command redirects it
+ */
+void memo_init();
+
+/*
+ * Runs a command, or replays its stored output and exit status if an
+ * answer for the same key is in the store and is young enough. A
+ * command that is run has its stdout stored as well as written out.
+ *
+ * Parameters:
+ *   cmd        The command, with stdin and stdout already redirected
+ *   cwd        The directory it runs in
+ *   ttl        Age in seconds after which a stored answer is
+ *                ignored, or 0 for no limit
+ *   execute    Called to run the command
+ *
+ * Returns:
+ *   The exit status of the command, stored or new
+ */
+int memo_run(command_t *cmd, const char *cwd, long ttl, int (*execute)(command_t *cmd));
+
+/*
+ * Removes every stored answer
+ *
+ * Returns:
+ *   0 on success, -1 with errno set
+ */
+int memo_clear();
+
+#endif /* _MEMO_H_ */
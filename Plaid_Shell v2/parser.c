@@ -14,8 +14,258 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <glob.h>
+#include <inttypes.h>
 #include "parser.h"
 #include "command.h"
+#include "timing.h"
+#include "trace.h"
+#include "arith.h"
+#include "dircache.h"
+
+
+#define N_VAR_BUCKETS 64     // buckets in a context's variable table
+
+typedef struct var_s {
+  char *name;
+  char *value;
+  struct var_s *next;
+} var_t;
+
+struct parser_ctx_s {
+  var_t *vars[N_VAR_BUCKETS];   // variables set with parser_ctx_setvar()
+  bool use_environ;             // fall back to getenv() for other names
+  char * const *positional;     // $0..$9 and $#
+  int last_status;              // $?
+  arith_cache_t *arith;         // compiled $((...)) expressions, made on first use
+  char err[128];                // message for the last failure
+};
+
+// The context used by read_word(), parse_input() and the shell itself
+static parser_ctx_t default_ctx = { .use_environ = true };
+
+
+/*
+ * FNV-1a hash of a variable name, reduced to a bucket index
+ */
+static unsigned int
+var_bucket(const char *name)
+{
+  unsigned int h = 2166136261u;
+  for (; *name; name++)
+    h = (h ^ (unsigned char)*name) * 16777619u;
+  return h % N_VAR_BUCKETS;
+}
+
+/*
+ * Looks up a variable in the context, then in the environment if the
+ * context allows it; returns NULL if it is not set
+ */
+static const char *
+lookup_var(parser_ctx_t *ctx, const char *name)
+{
+  for (var_t *v = ctx->vars[var_bucket(name)]; v; v = v->next)
+    if (!strcmp(v->name, name))
+      return v->value;
+
+  return ctx->use_environ ? getenv(name) : NULL;
+}
+
+/*
+ * Records an error message in the context
+ */
+static void
+set_error(parser_ctx_t *ctx, const char *fmt, const char *arg)
+{
+  snprintf(ctx->err, sizeof(ctx->err), fmt, arg);
+}
+
+
+/*
+ * Documented in .h file
+ */
+parser_ctx_t *
+parser_ctx_new()
+{
+  return calloc(1, sizeof(parser_ctx_t));
+}
+
+
+/*
+ * Documented in .h file
+ */
+void
+parser_ctx_free(parser_ctx_t *ctx)
+{
+  if (!ctx)
+    return;
+
+  for (int i = 0; i < N_VAR_BUCKETS; i++) {
+    while (ctx->vars[i]) {
+      var_t *v = ctx->vars[i];
+      ctx->vars[i] = v->next;
+      free(v->name);
+      free(v->value);
+      free(v);
+    }
+  }
+  arith_cache_free(ctx->arith);
+  free(ctx);
+}
+
+
+/*
+ * Documented in .h file
+ */
+int
+parser_ctx_setvar(parser_ctx_t *ctx, const char *name, const char *value)
+{
+  var_t **head = &ctx->vars[var_bucket(name)];
+  char *copy = strdup(value);
+  if (!copy)
+    return -1;
+
+  for (var_t *v = *head; v; v = v->next) {
+    if (!strcmp(v->name, name)) {
+      free(v->value);
+      v->value = copy;
+      return 0;
+    }
+  }
+
+  var_t *v = malloc(sizeof(var_t));
+  if (!v || !(v->name = strdup(name))) {
+    free(v);
+    free(copy);
+    return -1;
+  }
+  v->value = copy;
+  v->next = *head;
+  *head = v;
+  return 0;
+}
+
+
+/*
+ * Documented in .h file
+ */
+int
+parser_ctx_import_environ(parser_ctx_t *ctx)
+{
+  extern char **environ;
+
+  for (char **env = environ; *env; env++) {
+    char *eq = strchr(*env, '=');
+    if (!eq)
+      continue;
+
+    char *name = strndup(*env, eq - *env);
+    int ret = name ? parser_ctx_setvar(ctx, name, eq + 1) : -1;
+    free(name);
+    if (ret != 0)
+      return -1;
+  }
+  return 0;
+}
+
+
+/*
+ * Documented in .h file
+ */
+parser_ctx_t *
+parser_ctx_snapshot(const char *text)
+{
+  parser_ctx_t *ctx = parser_ctx_new();
+  if (!ctx)
+    return NULL;
+
+  // copying a name that only looks like a variable, as in "\$x", is
+  // harmless
+  for (const char *p = strchr(text, '$'); p; p = strchr(p + 1, '$')) {
+    size_t len = 0;
+    while (isalnum(p[1 + len]) || p[1 + len] == '_')
+      len++;
+    if (len == 0 || isdigit(p[1]))
+      continue;
+
+    char name[len + 1];
+    memcpy(name, p + 1, len);
+    name[len] = '\0';
+    const char *value = getenv(name);
+    if (value && parser_ctx_setvar(ctx, name, value) != 0) {
+      parser_ctx_free(ctx);
+      return NULL;
+    }
+  }
+
+  ctx->positional = default_ctx.positional;
+  ctx->last_status = default_ctx.last_status;
+  return ctx;
+}
+
+
+/*
+ * Documented in .h file
+ */
+char * const *
+parser_ctx_set_positional(parser_ctx_t *ctx, char * const *argv)
+{
+  char * const *prev = ctx->positional;
+  ctx->positional = argv;
+  return prev;
+}
+
+
+/*
+ * Documented in .h file
+ */
+void
+parser_ctx_set_last_status(parser_ctx_t *ctx, int status)
+{
+  ctx->last_status = status;
+}
+
+
+/*
+ * Documented in .h file
+ */
+const char *
+parser_ctx_error(parser_ctx_t *ctx)
+{
+  return ctx->err;
+}
+
+
+/*
+ * Documented in .h file
+ */
+char * const *
+parser_set_positional(char * const *argv)
+{
+  return parser_ctx_set_positional(&default_ctx, argv);
+}
+
+
+/*
+ * Documented in .h file
+ */
+void
+parser_set_last_status(int status)
+{
+  parser_ctx_set_last_status(&default_ctx, status);
+}
+
+
+/*
+ * Returns the number of positional parameters, not counting $0
+ */
+static int
+positional_count(parser_ctx_t *ctx)
+{
+  int cnt = 0;
+  while (ctx->positional && ctx->positional[cnt])
+    cnt++;
+  return cnt > 0 ? cnt - 1 : 0;
+}
 
 
 /*
@@ -24,6 +274,158 @@
 int
 read_word(const char *input, char *word, size_t word_len)
 {
+  int ret = read_word_r(&default_ctx, input, word, word_len);
+  if (ret < 0)
+    snprintf(word, word_len, "%s", default_ctx.err);
+  return ret;
+}
+
+
+/*
+ * Copies the process substitution "<(...)" or ">(...)" at in to word
+ * unchanged, up to its matching parenthesis, skipping over quoted
+ * and escaped parentheses
+ *
+ * Returns:
+ *   The characters consumed, or -1 with the message in ctx
+ */
+static int
+copy_subst(parser_ctx_t *ctx, const char *in, char *word, size_t word_len)
+{
+  const char *start = in;
+  bool in_quote = false;
+  int depth = 0;
+
+  for (;;) {
+    if (*in == '\0') {
+      set_error(ctx, "%s", "Unterminated process substitution");
+      return -1;
+    }
+    if (in - start + 2 > word_len) {
+      set_error(ctx, "%s", "Word too long");
+      return -1;
+    }
+
+    if (*in == '\\' && in[1]) {
+      *word++ = *in++;
+    } else if (*in == '"') {
+      in_quote = !in_quote;
+    } else if (*in == '(' && !in_quote) {
+      depth++;
+    } else if (*in == ')' && !in_quote && --depth == 0) {
+      *word++ = *in++;
+      *word = '\0';
+      return in - start;
+    }
+    *word++ = *in++;
+  }
+}
+
+
+/*
+ * What arith_eval() passes back to the variable callbacks
+ */
+typedef struct {
+  parser_ctx_t *ctx;
+  char num[16];                 // $# or $? as text
+} arith_arg_t;
+
+static const char *
+arith_get(void *arg, const char *name)
+{
+  arith_arg_t *a = arg;
+  parser_ctx_t *ctx = a->ctx;
+
+  if (isdigit(*name)) {
+    int idx = *name - '0';
+    return (idx <= positional_count(ctx) && ctx->positional) ? ctx->positional[idx] : NULL;
+  }
+  if (*name == '#' || *name == '?') {
+    snprintf(a->num, sizeof(a->num), "%d", (*name == '#') ? positional_count(ctx) : ctx->last_status);
+    return a->num;
+  }
+  return lookup_var(ctx, name);
+}
+
+/*
+ * Assigns in the context's own table if the variable is there or the
+ * context does not use the environment, and otherwise in the
+ * environment, as the setenv builtin does
+ */
+static int
+arith_set(void *arg, const char *name, const char *value)
+{
+  parser_ctx_t *ctx = ((arith_arg_t *)arg)->ctx;
+
+  if (isdigit(*name) || *name == '#' || *name == '?')
+    return -1;
+  for (var_t *v = ctx->vars[var_bucket(name)]; v; v = v->next)
+    if (!strcmp(v->name, name))
+      return parser_ctx_setvar(ctx, name, value);
+
+  return ctx->use_environ ? setenv(name, value, 1) : parser_ctx_setvar(ctx, name, value);
+}
+
+/*
+ * Evaluates the arithmetic expansion "$((...))" whose first '(' is at
+ * in, writing the value to word
+ *
+ * Returns:
+ *   The characters consumed from in, or -1 with the message in ctx
+ */
+static int
+expand_arith(parser_ctx_t *ctx, const char *in, char *word, size_t word_len)
+{
+  const char *expr = in + 2;
+  const char *end = expr;
+  int depth = 0;
+
+  // the expression ends at the first "))" outside its own parentheses
+  for (;; end++) {
+    if (*end == '\0' || (*end == ')' && depth == 0 && end[1] != ')')) {
+      set_error(ctx, "%s", "Unterminated arithmetic expansion");
+      return -1;
+    }
+    if (*end == '(')
+      depth++;
+    else if (*end == ')' && depth > 0)
+      depth--;
+    else if (*end == ')')
+      break;
+  }
+
+  if (!ctx->arith && !(ctx->arith = arith_cache_new())) {
+    set_error(ctx, "%s", "Out of memory");
+    return -1;
+  }
+
+  char *text = strndup(expr, end - expr);
+  arith_arg_t arg = { .ctx = ctx };
+  int64_t value;
+  char err[96] = "Out of memory";
+  int ret = text ? arith_eval(ctx->arith, text, arith_get, arith_set, &arg, &value,
+                              err, sizeof(err)) : -1;
+  free(text);
+  if (ret != 0) {
+    set_error(ctx, "Arithmetic: %s", err);
+    return -1;
+  }
+
+  if (snprintf(word, word_len, "%" PRId64, value) >= word_len) {
+    set_error(ctx, "%s", "Word too long");
+    return -1;
+  }
+  return end + 2 - in;
+}
+
+
+/*
+ * Documented in .h file
+ */
+int
+read_word_r(parser_ctx_t *ctx, const char *input, char *word, size_t word_len)
+{
+  assert(ctx);
   assert(input);
   assert(word);
 
@@ -32,9 +434,6 @@ read_word(const char *input, char *word, size_t word_len)
   char env[64];
   char *en = env;
 
-  char var[64];
-  char *va = var; 
-
   char *w = word;
   bool in_quote = false;
 
@@ -93,43 +492,93 @@ read_word(const char *input, char *word, size_t word_len)
           *w++ = '<';
           break;
 
+        case ';':
+          *w++ = ';';
+          break;
+
+        case '&':
+          *w++ = '&';
+          break;
+
+        case '|':
+          *w++ = '|';
+          break;
+
         default:     // illegal escape character
-          sprintf(word, "Illegal escape character: %c", *(in+1));
+          snprintf(ctx->err, sizeof(ctx->err), "Illegal escape character: %c", *(in+1));
           return -1;
       }
 
       in += 2;
     
+    // Handles arithmetic expansion
+    } else if (in[0] == '$' && in[1] == '(' && in[2] == '(') {
+      int n = expand_arith(ctx, in + 1, w, word + word_len - w);
+      if (n < 0)
+        return -1;
+      in += 1 + n;
+      w += strlen(w);
+
     // Handles variable expansion
     } else if (*in == '$') {
       
       in++;
       
-      // Check if it is a valid variable expansion and copies it to a temporary variable env
-      while(isalnum(*in) || *in == '_'){
-        *en++ = *in++;
+      const char *value;
+      char count[16];
+
+      if (isdigit(*in)) {
+        // Positional parameter, a single digit as in $1
+        int idx = *in++ - '0';
+        value = (idx <= positional_count(ctx) && ctx->positional) ? ctx->positional[idx] : "";
+
+      } else if (*in == '#') {
+        // Count of positional parameters
+        in++;
+        snprintf(count, sizeof(count), "%d", positional_count(ctx));
+        value = count;
+
+      } else if (*in == '?') {
+        // Status of the last command
+        in++;
+        snprintf(count, sizeof(count), "%d", ctx->last_status);
+        value = count;
+
+      } else {
+        // Check if it is a valid variable expansion and copies it to a temporary variable env
+        en = env;
+        while((isalnum(*in) || *in == '_') && en < env + sizeof(env) - 1){
+          *en++ = *in++;
+        }
+        *en = '\0';
+        value = lookup_var(ctx, env);
       }
-      *en = '\0';
       
       // Print error when enviroment varible is not found
-      if (getenv(env) == NULL) {
-        sprintf(word, "Undefined variable: '%s'", env);
+      if (value == NULL) {
+        set_error(ctx, "Undefined variable: '%s'", env);
         return -1;
+      }
 
-      } else {
-        // Copy enviroment varible to temporary variable after expanding it
-        strcpy(var, getenv(env));
-
-        // Copy Enviroment variable to word 
-        while(*va){
-          *w++ = *va++;
-        }
+      // Copy Enviroment variable to word, stopping if the word fills up
+      while(*value && w < word + word_len){
+        *w++ = *value++;
       }
 
+      // Handles process substitution, which is a word of its own
+    } else if ((*in == '<' || *in == '>') && in[1] == '(' && !in_quote) {
+      if (w > word)
+        break;
+      int n = copy_subst(ctx, in, w, word_len);
+      if (n < 0)
+        return -1;
+      in += n;
+      return in - input;
+
       // Handle case of output redirection character
     } else if (*in == '>' && !in_quote) {
       // Detach character from previous character
-      if(isalnum(*(in-1))){
+      if(in > input && isalnum(*(in-1))){
         break;
       }
       *w++ = *in++;
@@ -140,9 +589,18 @@ read_word(const char *input, char *word, size_t word_len)
       
       // Check if there was a file after the output redirection character
       if (*in == '\0' || isspace(*in)){
-        sprintf(word, "Redirection without filename");
+        set_error(ctx, "%s", "Redirection without filename");
         return -1;
       }
+
+      // A process substitution may stand in for the file
+      if ((*in == '<' || *in == '>') && in[1] == '(') {
+        int n = copy_subst(ctx, in, w, word + word_len - w);
+        if (n < 0)
+          return -1;
+        in += n;
+        return in - input;
+      }
       
       // Copies the output redirection file to the word buffer
       while(*in && *in != '<' && *in != '>' && *in != '$' && !isspace(*in)){
@@ -152,7 +610,7 @@ read_word(const char *input, char *word, size_t word_len)
       // Handles input redirection character
     } else if (*in == '<' && !in_quote) {
       // Detach character from previous word
-      if(isalnum(*(in-1))){
+      if(in > input && isalnum(*(in-1))){
         break;
       }
       *w++ = *in++;
@@ -163,9 +621,18 @@ read_word(const char *input, char *word, size_t word_len)
       
       // Check if there was a file after the input redirection
       if (*in == '\0' || isspace(*in)){
-        sprintf(word, "Redirection without filename");
+        set_error(ctx, "%s", "Redirection without filename");
         return -1;
       }
+
+      // A process substitution may stand in for the file
+      if ((*in == '<' || *in == '>') && in[1] == '(') {
+        int n = copy_subst(ctx, in, w, word + word_len - w);
+        if (n < 0)
+          return -1;
+        in += n;
+        return in - input;
+      }
       
       // Copies the output redirection file to the word buffer
       while(*in && *in != '>' && *in != '<' && *in != '$' && !isspace(*in)){
@@ -181,7 +648,7 @@ read_word(const char *input, char *word, size_t word_len)
     }
     // handle the error case: word is too long
     if (w >= word + word_len) {
-      strcpy(word, "Word too long");
+      set_error(ctx, "%s", "Word too long");
       return -1;
     }
   }
@@ -190,18 +657,93 @@ read_word(const char *input, char *word, size_t word_len)
   *w = '\0';
 
   if (in_quote) {
-    strcpy(word, "Unterminated quote");
+    set_error(ctx, "%s", "Unterminated quote");
     return -1;
   }
 
   return in - input;
 }
 
+
+/*
+ * Reads the word after "<<<" and appends a newline, as other shells
+ * do. The text gets a buffer of its own, because unlike other words
+ * it may be long, such as the body of a here-document.
+ *
+ * Returns:
+ *   The characters of input consumed, with *text set to the malloc'd
+ *   text, or -1 with the message in ctx
+ */
+static int
+read_here_string(parser_ctx_t *ctx, const char *input, char **text)
+{
+  const char *in = input;
+  while (isspace(*in))
+    in++;
+  if (*in == '\0') {
+    set_error(ctx, "%s", "Here-string without text");
+    return -1;
+  }
+
+  // grow the buffer until variable expansion fits
+  for (size_t len = strlen(in) + 256; ; len *= 2) {
+    char *buf = malloc(len + 1);
+    if (!buf) {
+      set_error(ctx, "%s", "Out of memory");
+      return -1;
+    }
+
+    int n = read_word_r(ctx, in, buf, len);
+    if (n >= 0) {
+      strcat(buf, "\n");
+      *text = buf;
+      return (in - input) + n;
+    }
+
+    free(buf);
+    if (strcmp(ctx->err, "Word too long") != 0)
+      return -1;
+  }
+}
+
+
+static command_t *parse_words(parser_ctx_t *ctx, const char *input);
+
+
 /*
  * Documented in .h file
  */
 command_t *
 parse_input(const char *input, char *err_msg, size_t err_msg_len)
+{
+  command_t *cmd = parse_input_r(&default_ctx, input);
+  if (!cmd)
+    strncpy(err_msg, default_ctx.err, err_msg_len);
+  return cmd;
+}
+
+
+/*
+ * Documented in .h file
+ */
+command_t *
+parse_input_r(parser_ctx_t *ctx, const char *input)
+{
+  if (!trace_enabled)
+    return parse_words(ctx, input);
+
+  uint64_t trace_start = trace_begin();
+  command_t *cmd = parse_words(ctx, input);
+  trace_span("parse_input", trace_start, 0, input);
+  return cmd;
+}
+
+
+/*
+ * Does the work of parse_input_r(), which wraps it for tracing
+ */
+static command_t *
+parse_words(parser_ctx_t *ctx, const char *input)
 {
   int chars_read = 0;
   
@@ -216,13 +758,42 @@ parse_input(const char *input, char *err_msg, size_t err_msg_len)
   command_t *cmd = command_new();
 
   while (1) {
-    chars_read = read_word(input, word, sizeof(word));
+    // Handle a here-string, whose text is fed to stdin
+    const char *next = input;
+    while (isspace(*next))
+      next++;
+    if (strncmp(next, "<<<", 3) == 0) {
+      char *text;
+      chars_read = read_here_string(ctx, next + 3, &text);
+      if (chars_read == -1) {
+        command_free(cmd);
+        return NULL;
+      }
+      input = next + 3 + chars_read;
+
+      if (command_get_input(cmd) != NULL || command_get_input_text(cmd) != NULL) {
+        free(text);
+        command_free(cmd);
+        set_error(ctx, "%s", "Multiple redirections not allowed");
+        return NULL;
+      }
+      command_set_input_text(cmd, text);
+      free(text);
+
+      if (command_get_argc(cmd) == 0) {
+        command_free(cmd);
+        set_error(ctx, "%s", "Missing command");
+        return NULL;
+      }
+      continue;
+    }
+
+    chars_read = read_word_r(ctx, input, word, sizeof(word));
     input += chars_read;
     
-    // Checks for error return value and copies error to err_msg
+    // Checks for error return value; the message is in ctx
     if (chars_read == -1) {
       command_free(cmd);
-      strncpy(err_msg, word, err_msg_len);
       return NULL;
     }
   
@@ -232,18 +803,30 @@ parse_input(const char *input, char *err_msg, size_t err_msg_len)
     if (word[0] == '\0') {       // whitespace only 
       break;
 
+      // Handle process substitution; the argument is replaced when
+      // the command runs
+    } else if ((word[0] == '<' || word[0] == '>') && word[1] == '(') {
+      size_t len = strlen(word);
+      command_append_arg(cmd, word);
+      word[len - 1] = '\0';
+      command_add_subst(cmd, command_get_argc(cmd) - 1, word + 2, word[0] == '>');
+
       // Handle setting of input redirection file
     } else if (word[0] == '<') {
       w = word;
       w++;
       
       //  Checks if the input has already been set, returns an error if true
-      if (command_get_input(cmd) != NULL) {
+      if (command_get_input(cmd) != NULL || command_get_input_text(cmd) != NULL) {
         command_free(cmd);
-        strncpy(err_msg, "Multiple redirections not allowed", err_msg_len);
+        set_error(ctx, "%s", "Multiple redirections not allowed");
         return NULL;
       }
       command_set_input(cmd, w); // Set input file
+      if ((w[0] == '<' || w[0] == '>') && w[1] == '(') {
+        w[strlen(w) - 1] = '\0';
+        command_add_subst(cmd, COMMAND_SUBST_INPUT, w + 2, w[0] == '>');
+      }
 
       // Handle setting of output redirection file
     } else if (word[0] == '>') {
@@ -254,25 +837,33 @@ parse_input(const char *input, char *err_msg, size_t err_msg_len)
       //  Checks if the output has already been set, returns an error if true
       if (command_get_output(cmd) != NULL) {
         command_free(cmd);
-        strncpy(err_msg, "Multiple redirections not allowed", err_msg_len);
+        set_error(ctx, "%s", "Multiple redirections not allowed");
         return NULL;
       }
       command_set_output(cmd, w); // Set output file
+      if ((w[0] == '<' || w[0] == '>') && w[1] == '(') {
+        w[strlen(w) - 1] = '\0';
+        command_add_subst(cmd, COMMAND_SUBST_OUTPUT, w + 2, w[0] == '>');
+      }
    
       // Handle Globbing
     } else if (!(word[1] == '>' && word[0] == '>') || !(word[1] == '<' && word[0] == '<')){
       
       // Globs for general matches
-      ret_glob = glob(word, GLOB_NOCHECK, NULL, &globst);
+      uint64_t glob_start = timing_begin();
+      uint64_t glob_trace = trace_begin();
+      ret_glob = dircache_glob(word, GLOB_NOCHECK, &globst);
 
       // Glob for tilde
       if (word[0] == '~') {
-        ret_glob = glob(word, GLOB_TILDE_CHECK, NULL, &globst);
+        ret_glob = dircache_glob(word, GLOB_TILDE_CHECK, &globst);
       } 
       //Glob for braces
       if (word[0] == '{') {
-        ret_glob = glob(word, GLOB_BRACE, NULL, &globst);
+        ret_glob = dircache_glob(word, GLOB_BRACE, &globst);
       }
+      timing_end(STAGE_GLOB, glob_start);
+      trace_span("glob", glob_trace, 0, word);
       
       // Appends arguements when match not found
       if( ret_glob == GLOB_NOMATCH ) {
@@ -297,7 +888,8 @@ parse_input(const char *input, char *err_msg, size_t err_msg_len)
     }
 
     if (command_get_argc(cmd) == 0) {
-      strncpy(err_msg, "Missing command", err_msg_len);
+      command_free(cmd);
+      set_error(ctx, "%s", "Missing command");
       return NULL;
     }
   }
@@ -11,6 +11,17 @@
 
 #include "command.h"
 
+/*
+ * A parser context holds everything that read_word_r() and
+ * parse_input_r() would otherwise share between calls: the variable
+ * table, the positional parameters and $?, and the message for the
+ * last error. Threads that each use their own context can parse at
+ * the same time. read_word() and parse_input() use a built-in
+ * context, which looks variables up with getenv() and is meant for
+ * the shell's main thread.
+ */
+typedef struct parser_ctx_s parser_ctx_t;
+
 /*
  * Returns the first word from input, removing leading whitespace,
  * handling double quotes, and translating escaped characters.
@@ -38,6 +49,18 @@
  * both inside and outside double quotes. If a variable is not found
  * in the environment, the error message "Undefined variable:
  * '<varname>'" is returned.
+ *
+ * The positional parameters set by parser_set_positional() are
+ * available as $0 through $9, and their count (not including $0) as
+ * $#. A positional parameter beyond $# expands to the empty string.
+ * $? expands to the status set by parser_set_last_status().
+ *
+ * $((EXPR)) expands to the value of an integer expression, computed
+ * by arith_eval() (see arith.h), so "$((i + 1))" gives one more than
+ * the value of i. Assignments inside the expression, as in
+ * "$((i += 1))", set the variable in the environment, or for a
+ * private context in its variable table. Failures give the message
+ * "Arithmetic: <error>", or "Unterminated arithmetic expansion".
  * 
  * The function converts escape sequences as follows:
  *    \n        newline
@@ -49,6 +72,9 @@
  *    \$        a literal dollar sign (does not start a variable)
  *    \<        a literal less-than symbol (does not indicate redirection)
  *    \>        a literal greater-than symbol (does not indicate redirection)
+ *    \;        a literal semicolon (does not separate commands)
+ *    \&        a literal ampersand (as in a\&\&b, which is not "&&")
+ *    \|        a literal vertical bar (as in a\|\|b, which is not "||")
  *
  * If an escape sequence other than those listed is encountered, the
  * function places the error message “Illegal escape character:
@@ -131,6 +157,18 @@ int read_word(const char *input, char *word, size_t word_len);
  *
  * is parsed into a command with stdout as its output, and the two
  * arguments "echo" and "thirty > twenty".
+ *
+ * An unquoted <( or >( starts a process substitution, which runs up
+ * to the matching parenthesis and is kept as one argument, unexpanded;
+ * see command_add_subst(). For instance,
+ *     diff <(sort a) <(sort b)
+ * has the three arguments "diff", "<(sort a)" and "<(sort b)".
+ *
+ * An unquoted <<< starts a here-string instead: the word after it is
+ * read as usual, quotes, escapes and variables included, and that
+ * text plus a newline becomes the command's stdin (see
+ * command_set_input_text()). It takes the place of an input file:
+ *     tr a-z A-Z <<< "$USER"
  * 
  * Parameters:
  *   input      Input line as typed by the user
@@ -155,4 +193,105 @@ int read_word(const char *input, char *word, size_t word_len);
  */
 command_t *parse_input(const char *input, char *err_msg, size_t err_msg_len);
 
+
+/*
+ * Versions of read_word() and parse_input() that take a parser
+ * context. They behave exactly like the plain versions, except that
+ * variables and parameters come from ctx, and on error the message
+ * is left in ctx for parser_ctx_error() rather than copied into a
+ * caller's buffer; read_word_r() leaves the word buffer unspecified.
+ */
+int read_word_r(parser_ctx_t *ctx, const char *input, char *word, size_t word_len);
+command_t *parse_input_r(parser_ctx_t *ctx, const char *input);
+
+/*
+ * Creates a parser context with no variables, no positional
+ * parameters and a $? of 0. Unlike the built-in context, it does not
+ * consult the environment; see parser_ctx_import_environ().
+ *
+ * Returns:
+ *   The new context, to be freed with parser_ctx_free(), or NULL if
+ *   out of memory
+ */
+parser_ctx_t *parser_ctx_new();
+
+/*
+ * Frees a context and its variables
+ */
+void parser_ctx_free(parser_ctx_t *ctx);
+
+/*
+ * Sets a variable in a context, replacing any earlier value
+ *
+ * Parameters:
+ *   ctx     The context
+ *   name    Variable name, as written after '$'; it is copied
+ *   value   Its value; it is copied
+ *
+ * Returns:
+ *   0 on success, -1 if out of memory
+ */
+int parser_ctx_setvar(parser_ctx_t *ctx, const char *name, const char *value);
+
+/*
+ * Copies every environment variable into a context. The environment
+ * must not change while this runs, so it is normally called by the
+ * thread that owns the environment before handing ctx to another.
+ *
+ * Returns:
+ *   0 on success, -1 if out of memory
+ */
+int parser_ctx_import_environ(parser_ctx_t *ctx);
+
+/*
+ * Creates a private context that expands text the way the built-in
+ * context would at this moment: it holds the environment variables
+ * that text names, and the positional parameters and $? of the
+ * built-in context. It is called by the thread that owns the
+ * environment, so that another thread can then expand text with
+ * parse_input_r(). The positional parameters are shared, not copied,
+ * so they must not be replaced while the context is in use.
+ *
+ * Returns:
+ *   The new context, to be freed with parser_ctx_free(), or NULL if
+ *   out of memory
+ */
+parser_ctx_t *parser_ctx_snapshot(const char *text);
+
+/*
+ * As parser_set_positional() and parser_set_last_status(), for a
+ * given context
+ */
+char * const *parser_ctx_set_positional(parser_ctx_t *ctx, char * const *argv);
+void parser_ctx_set_last_status(parser_ctx_t *ctx, int status);
+
+/*
+ * Returns the message for the last error reported by read_word_r()
+ * or parse_input_r() on ctx
+ */
+const char *parser_ctx_error(parser_ctx_t *ctx);
+
+/*
+ * Sets the positional parameters used to expand $0..$9 and $#. The
+ * vector is not copied, so it must stay valid until it is replaced.
+ *
+ * Parameters:
+ *   argv   NULL-terminated vector, where argv[0] becomes $0; NULL
+ *            clears all positional parameters
+ *
+ * Returns:
+ *   The previous vector, so that the caller can restore it once the
+ *   new parameters go out of scope
+ */
+char * const *parser_set_positional(char * const *argv);
+
+/*
+ * Sets the exit status that $? expands to; normally called after
+ * each command runs
+ *
+ * Parameters:
+ *   status   The exit status of the last command
+ */
+void parser_set_last_status(int status);
+
 #endif /* _PARSER_H_ */
@@ -6,6 +6,7 @@
  * Author: Okemawo Aniyikaiye Obadofin (OAO)
  */
 
+#define _GNU_SOURCE         // pipe2, memfd_create
 #include <stdio.h>
 #include <stdlib.h>
 #include <readline/readline.h>
@@ -18,12 +19,42 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/resource.h>
 
 
 #include "parser.h"
+#include "script.h"
+#include "eventloop.h"
+#include "jobs.h"
+#include "batch.h"
+#include "builtins.h"
+#include "serve.h"
+#include "zygote.h"
+#include "record.h"
+#include "trace.h"
+#include "dirs.h"
+#include "dircache.h"
+#include "audit.h"
+#include "memo.h"
+#include "limit.h"
+#include "coproc.h"
+#include "dag.h"
 
 #define MAX_ARGS 20
+#define HISTORY_SIZE 1000   // lines of readline history kept
+#define PROMPT "plaid-shell#> "
+#define CONTINUE_PROMPT "> " // while the input is incomplete
+
+extern char **environ;
+
+int execute_command(command_t *cmd);
 
 /*
  * Handles the exit or quit commands, by exiting the shell. Does not
@@ -36,6 +67,10 @@
   int
 builtin_exit(command_t *cmd)
 {
+  // execute_command() logs a command once it returns, which this
+  // never does, so exit is queued here before the log is written out
+  audit_command(cmd, dirs_pwd(), 0);
+  audit_close();
   _exit(0); 
 }
 
@@ -61,9 +96,75 @@ builtin_author(command_t *cmd)
 
 
 /*
- * Handles the cd builtin, by setting cwd to argv[1], which must exist.
+ * Handles the true and false builtins, which do nothing except
+ * return a status; mostly useful as loop conditions
+ *
+ * Parameters:
+ *   command_ t cmd:
+ *      argv - Arguement vector, which is ignored
+ *      argc - Length of Arguement Vector
+ *
+ * Returns:
+ *   0 for true, 1 for false
+ */
+int
+builtin_true(command_t *cmd)
+{
+  return 0;
+}
+
+int
+builtin_false(command_t *cmd)
+{
+  return 1;
+}
+
+
+/*
+ * Handles the jobs builtin, by listing the background jobs that have
+ * not yet finished
+ *
+ * Parameters:
+ *   command_ t cmd:
+ *      argv - Arguement vector, which is ignored
+ *      argc - Length of Arguement Vector
+ *
+ * Returns:
+ *   Always returns 0
+ */
+int
+builtin_jobs(command_t *cmd)
+{
+  jobs_list();
+  return 0;
+}
+
+
+/*
+ * Handles the wait builtin, by waiting for all background jobs to
+ * finish
+ *
+ * Parameters:
+ *   command_ t cmd:
+ *      argv - Arguement vector, which is ignored
+ *      argc - Length of Arguement Vector
+ *
+ * Returns:
+ *   The exit status of the last job to finish
+ */
+int
+builtin_wait(command_t *cmd)
+{
+  return jobs_wait_all();
+}
+
+
+/*
+ * Handles the cd builtin, by changing to argv[1], or to $HOME with no
+ * argument. "cd -" goes back to $OLDPWD, and relative names are
+ * looked up in $CDPATH; see dirs_cd().
  *
- * cd <path>
+ * cd [path | -]
  * 
  * Parameters:
  *   command_ t cmd:
@@ -79,25 +180,28 @@ builtin_cd(command_t *cmd)
   // Retrieve arguement vector and count from command_t struct
   int argc = command_get_argc(cmd);
   char * const *argv = command_get_argv(cmd);
+  bool announce;
 
-  // Defaults to home directory when no arguement is supplied 
-  if (argv[1] == NULL) {
-    chdir(getenv("HOME"));  //chdir system call
-    return 0;
-  }  
+  if (argc > 2) {
+    fprintf(stderr, "cd: too many arguments\n");
+    return 1;
+  }
 
-  for (int i=1; i < argc; i++) {
-    chdir(argv[i]);
+  if (dirs_cd(argv[1], &announce) != 0) {
+    fprintf(stderr, "cd: %s: %s\n", argv[1] ? argv[1] : "HOME", strerror(errno));
+    return 1;
   }
+  if (announce)
+    printf("%s\n", dirs_pwd());
   return 0;
 }
 
 
 /*
- * Handles the pwd builtin, by printing the cwd to the supplied file
- * descriptor
+ * Handles the pwd builtin, by printing the logical cwd, as reached
+ * through any symlinks, or with -P the physical one
  *
- * pwd <> 
+ * pwd [-P]
  *
  * Parameters:
  *   command_ t cmd:
@@ -105,17 +209,106 @@ builtin_cd(command_t *cmd)
  *      argc - Length of Arguement Vector
  *
  * Returns:
- *   Always returns 0, since it always succeeds
+ *   0 on success, 1 if the physical cwd cannot be found
  */
   int
 builtin_pwd(command_t *cmd)
 {
-  char s[100];
-  printf("%s\n", getcwd(s, 100));
+  char * const *argv = command_get_argv(cmd);
+
+  if (argv[1] && !strcmp(argv[1], "-P")) {
+    char s[PATH_MAX];
+    if (!getcwd(s, sizeof(s))) {
+      fprintf(stderr, "pwd: %s\n", strerror(errno));
+      return 1;
+    }
+    printf("%s\n", s);
+    return 0;
+  }
+
+  printf("%s\n", dirs_pwd());
+  return 0;
+}
+
+
+/*
+ * Handles the pushd builtin, by saving the cwd on the directory stack
+ * and changing to argv[1], or with no argument, by swapping the cwd
+ * with the top of the stack. Prints the stack afterwards.
+ *
+ * pushd [path]
+ *
+ * Returns:
+ *   0 on success, 1 on failure
+ */
+int
+builtin_pushd(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+
+  if (dirs_push(argv[1]) != 0) {
+    if (!argv[1] && errno == EINVAL)
+      fprintf(stderr, "pushd: no other directory\n");
+    else
+      fprintf(stderr, "pushd: %s: %s\n", argv[1] ? argv[1] : "", strerror(errno));
+    return 1;
+  }
+  dirs_print(false);
+  return 0;
+}
+
+
+/*
+ * Handles the popd builtin, by changing to the directory on top of
+ * the stack and removing it. Prints the stack afterwards.
+ *
+ * popd
+ *
+ * Returns:
+ *   0 on success, 1 if the stack is empty or the directory has gone
+ */
+int
+builtin_popd(command_t *cmd)
+{
+  if (dirs_pop() != 0) {
+    if (errno == EINVAL)
+      fprintf(stderr, "popd: directory stack empty\n");
+    else
+      fprintf(stderr, "popd: %s\n", strerror(errno));
+    return 1;
+  }
+  dirs_print(false);
+  return 0;
+}
+
+
+/*
+ * Handles the dirs builtin, by printing the directory stack, one per
+ * line and numbered with -v, or emptying it with -c
+ *
+ * dirs [-c | -v]
+ *
+ * Returns:
+ *   0 on success, 1 on an unknown option
+ */
+int
+builtin_dirs(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
 
+  if (argv[1] && !strcmp(argv[1], "-c"))
+    dirs_clear();
+  else if (argv[1] && !strcmp(argv[1], "-v"))
+    dirs_print(true);
+  else if (argv[1]) {
+    fprintf(stderr, "dirs: usage: dirs [-c | -v]\n");
+    return 1;
+  } else
+    dirs_print(false);
   return 0;
 }
 
+
 /*
  * Sets an enviroment variable to a value by using the setenv() function
  * 
@@ -162,8 +355,15 @@ builtin_setenv(command_t *cmd) {
 
 
 /*
- * Process an external (non built-in) command, by forking and execing
- * a child process, and waiting for the child to terminate
+ * Runs a command over a stream of arguments, packing as many of them
+ * into each exec as the system allows, like xargs. The arguments are
+ * the words after ":::" if there are any (so a glob can be used
+ * there), otherwise the lines of FILE, otherwise the lines of stdin.
+ *
+ * batch [-P N] [-a FILE] <command> [args] [::: words]
+ *
+ *   -P N      Run up to N batches at once; 0 means one per CPU
+ *   -a FILE   Read arguments from FILE, one per line
  *
  * Parameters:
  *   command_ t cmd:
@@ -171,137 +371,1368 @@ builtin_setenv(command_t *cmd) {
  *      argc - Length of Arguement Vector
  *
  * Returns:
- *   The child's exit value, or -1 on error
+ *   0 if every batch succeeded, otherwise the status of a failed
+ *   batch, or 1 on a usage error
  */
-  int
-forkexec_external_cmd(command_t *cmd)
+int
+builtin_batch(command_t *cmd)
 {
-  // Retrieve arguement vector
   char * const *argv = command_get_argv(cmd);
+  int procs = 1;
+  const char *file = NULL;
+  int i;
 
-  pid_t pid_child;
+  for (i = 1; argv[i] && argv[i][0] == '-'; i++) {
+    if (!strcmp(argv[i], "-P") && argv[i+1]) {
+      procs = atoi(argv[++i]);
+      if (procs == 0)
+        procs = sysconf(_SC_NPROCESSORS_ONLN);
+    } else if (!strcmp(argv[i], "-a") && argv[i+1]) {
+      file = argv[++i];
+    } else {
+      break;
+    }
+  }
 
-  pid_child = fork();
+  if (!argv[i] || !strcmp(argv[i], ":::")) {
+    fprintf(stderr, "Usage: batch [-P N] [-a FILE] command [args] [::: words]\n");
+    return 1;
+  }
 
-  // if successfully forked, launch exec command
-  if (pid_child == 0) {
-    execvp(argv[0], argv);
+  // the template runs up to an optional ::: marker
+  command_t *tmpl = command_new();
+  for (; argv[i] && strcmp(argv[i], ":::") != 0; i++)
+    command_append_arg(tmpl, argv[i]);
 
+  int status;
+  if (argv[i]) {
+    status = batch_run(tmpl, argv + i + 1, command_get_argc(cmd) - i - 1, procs);
   } else {
-    int exit_status;
+    // read from a private descriptor so stdin's buffer stays clean
+    FILE *fp = file ? fopen(file, "r") : fdopen(dup(STDIN_FILENO), "r");
+    if (!fp) {
+      fprintf(stderr, "%s: %s\n", file ? file : "stdin", strerror(errno));
+      command_free(tmpl);
+      return 1;
+    }
+    int nargs;
+    char **args = batch_read_args(fp, &nargs);
+    fclose(fp);
+    status = args ? batch_run(tmpl, args, nargs, procs) : 1;
+    batch_free_args(args);
+  }
 
-    waitpid(pid_child, &exit_status, 0);
+  command_free(tmpl);
+  return status;
+}
 
-    if (!(WIFEXITED(exit_status)))
-      fprintf(stderr, "Child %d exited with status %d\n", pid_child, exit_status);
 
-  }
+/*
+ * Opens a redirection file, printing an error if it cannot be opened
+ *
+ * Parameters:
+ *   path     The file named after '<' or '>'
+ *   output   True to truncate or create it for writing, false to
+ *              read it
+ *
+ * Returns:
+ *   The new descriptor, or -1 on failure
+ */
+static int
+open_redirect(const char *path, bool output)
+{
+  int create_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+  int fd = output ? open(path, O_RDWR | O_CREAT | O_TRUNC, create_mode)
+                  : open(path, O_RDONLY);
 
-  return 0;
+  if (fd < 0)
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+  return fd;
 }
 
 
+/*
+ * Returns a descriptor that reads back the text of a here-document or
+ * here-string. Text that fits in a pipe goes into one, since the pipe
+ * holds it all without a reader; longer text goes into a sealed
+ * memfd. Neither touches the file system, and both go away with
+ * their last descriptor.
+ *
+ * Returns:
+ *   The new descriptor, or -1 after printing an error
+ */
+static int
+open_input_text(const char *text)
+{
+  size_t len = strlen(text);
+  int fds[2];
+
+  if (len <= PIPE_BUF) {
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+      perror("here-document");
+      return -1;
+    }
+    if (write(fds[1], text, len) != len) {
+      perror("here-document");
+      close(fds[0]);
+      fds[0] = -1;
+    }
+    close(fds[1]);
+    return fds[0];
+  }
+
+  int fd = memfd_create("here-document", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    perror("here-document");
+    return -1;
+  }
+  for (size_t done = 0; done < len; ) {
+    ssize_t n = write(fd, text + done, len - done);
+    if (n < 0) {
+      perror("here-document");
+      close(fd);
+      return -1;
+    }
+    done += n;
+  }
+
+  // the command may seek around in it, but never change it
+  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+  lseek(fd, 0, SEEK_SET);
+  return fd;
+}
+
 
 /*
- * Parses one input line, and executes it
+ * Opens the command's input file or here-document text, and its
+ * output file, onto stdin and stdout of the current process
  *
  * Parameters:
  *   command_ t cmd:
- *       argc - The length of the argv vector, which must be >= 1
- *       argv - Arguement Vector
+ *      The command whose redirections should be applied
+ *
+ * Returns:
+ *   0 on success, or -1 after printing an error if a file could not
+ *   be opened
  */
-  void
-execute_command(command_t *cmd)
+static int
+redirect_stdio(command_t *cmd)
 {
-  // Retrieve arguement vector and arguement count 
-  int argc = command_get_argc(cmd);
-  char * const *argv = command_get_argv(cmd);
-
-  // Verify that number of arguements are more than 1
-  assert(argc >= 1);
-  
   // Check if the ouput file is set not set to null before changing STDOUT
   if (command_get_output(cmd) != NULL) {
-    int create_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
-    int fd = open(command_get_output(cmd), O_RDWR | O_CREAT | O_TRUNC, create_mode);
-
+    int fd = open_redirect(command_get_output(cmd), true);
+    if (fd < 0)
+      return -1;
     dup2(fd, STDOUT_FILENO);
     close(fd);
   }
   // Checks if the input file is not set to null to changing STDIN
-  if (command_get_input(cmd) != NULL) {
-    int fd = open(command_get_input(cmd), O_RDONLY | O_CLOEXEC);
-
+  if (command_get_input_text(cmd) != NULL || command_get_input(cmd) != NULL) {
+    int fd = command_get_input_text(cmd) ? open_input_text(command_get_input_text(cmd))
+                                         : open_redirect(command_get_input(cmd), false);
+    if (fd < 0)
+      return -1;
     dup2(fd, STDIN_FILENO);
     close(fd);
   }
+  return 0;
+}
 
-  // Checks the first arguement to determine the command to call
-  if (!strcmp(argv[0],"cd"))
-    builtin_cd(cmd);
-
-  else if (!strcmp(argv[0],"pwd"))
-    builtin_pwd(cmd);
 
-  else if (!strcmp(argv[0],"author"))
-    builtin_author(cmd);
+/*
+ * Runs an external command through the zygote, opening its
+ * redirections here and passing them along
+ *
+ * Returns:
+ *   0 with pid and wait_status set once the command has finished, 1
+ *   after printing an error if a redirection failed, or -1 if the
+ *   zygote could not take the request
+ */
+static int
+zygote_external_cmd(command_t *cmd, pid_t *pid, int *wait_status)
+{
+  int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+  int result = 1;
 
-  else if (!strcmp(argv[0],"exit"))
-    builtin_exit(cmd);
+  if (command_get_output(cmd) != NULL
+      && (fds[1] = open_redirect(command_get_output(cmd), true)) < 0)
+    return 1;
+  if (command_get_input_text(cmd) != NULL
+      && (fds[0] = open_input_text(command_get_input_text(cmd))) < 0)
+    goto done;
+  if (command_get_input(cmd) != NULL
+      && (fds[0] = open_redirect(command_get_input(cmd), false)) < 0)
+    goto done;
 
-  else if (!strcmp(argv[0],"setenv"))
-    builtin_setenv(cmd);
+  fflush(stdout);
+  result = zygote_spawn(command_get_argv(cmd), environ, fds, pid, wait_status);
 
-  else
-    forkexec_external_cmd(cmd);
+ done:
+  if (fds[0] != STDIN_FILENO)
+    close(fds[0]);
+  if (fds[1] != STDOUT_FILENO)
+    close(fds[1]);
+  return result;
 }
 
 
+// pipes to process substitutions that are running; while there are
+// any, programs are forked here rather than by the zygote, so that
+// they inherit them
+static int n_subst_open = 0;
+
+// limits for the programs started by the command a limit builtin is
+// running, which are forked here so that the child can set them
+static const limit_t *cmd_limits = NULL;
+
+
 /*
- * The main loop for the shell.
+ * Process an external (non built-in) command, by forking and execing
+ * a child process, and waiting for the child to terminate
+ *
+ * Parameters:
+ *   command_ t cmd:
+ *      argv - Arguement vector
+ *      argc - Length of Arguement Vector
+ *
+ * Returns:
+ *   The child's exit value, 128 plus the signal number if the child
+ *   was killed by a signal, 127 if the program could not be run, or
+ *   -1 if the fork failed
  */
-void mainloop()
+  int
+forkexec_external_cmd(command_t *cmd)
 {
-  // welcome message
-  fprintf(stdout, "Welcome to Plaid Shell Hommies!\n");
+  // Retrieve arguement vector
+  char * const *argv = command_get_argv(cmd);
 
-  char *input = NULL;
-  char err_msg[512];
+  pid_t pid_child;
+  int exit_status;
 
-  const char *prompt = "plaid-shell#> ";
+  // launch from the small zygote process when there is one, unless
+  // the program needs the pipes of a process substitution or limits
+  if (zygote_available() && n_subst_open == 0 && !cmd_limits) {
+    // the zygote forks and waits in one round trip, counted as waiting
+    uint64_t round_trip = timing_begin();
+    uint64_t trace_start = trace_begin();
+    int result = zygote_external_cmd(cmd, &pid_child, &exit_status);
+    timing_end(STAGE_WAIT, round_trip);
+    trace_span("zygote", trace_start, 0, argv[0]);
+    if (result == 1)
+      return 1;
+    if (result == 0)
+      goto finished;
+  }
 
-  while (1) {
-    input = readline(prompt);
-    add_history(input);
+  // when tracing, a close-on-exec pipe reaches EOF once the child has
+  // exec'd, which times the exec from the shell's side
+  int exec_pipe[2] = { -1, -1 };
+  if (trace_enabled && pipe(exec_pipe) == 0) {
+    fcntl(exec_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(exec_pipe[1], F_SETFD, FD_CLOEXEC);
+  }
 
-    if (input == NULL)
-      exit(0);
-    if (*input == '\0')
-      continue;
-    
-    // parse the imput stream
-    command_t *cmd = parse_input(input, err_msg, sizeof(err_msg));
+  limit_job_t *job = cmd_limits ? limit_job_start(cmd_limits) : NULL;
+  if (cmd_limits && !job) {
+    perror("limit");
+    return -1;
+  }
 
+  fflush(stdout);
+  uint64_t spawn_start = timing_begin();
+  uint64_t fork_start = trace_begin();
+  pid_child = fork();
 
-    if (cmd == NULL) { 
-      // handle parsing error
-      printf(" Error: %s\n", err_msg);
-    }
-    else{
-      // check for command to execute 
-      execute_command(cmd);
+  if (pid_child == -1) {
+    perror("fork");
+    if (exec_pipe[0] >= 0) {
+      close(exec_pipe[0]);
+      close(exec_pipe[1]);
     }
+    if (job)
+      limit_job_finish(job, NULL);
+    return -1;
+  }
 
-    // free all the malloc'd memory
-    free(input);
+  // if successfully forked, launch exec command
+  if (pid_child == 0) {
+    ev_reset_child();
+    if (job && limit_job_enter(job) != 0)
+      _exit(1);
+    if (redirect_stdio(cmd) != 0)
+      _exit(1);
+    execvp(argv[0], argv);
+
+    // only reached if the exec failed; never return into the shell
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+  }
+  timing_end(STAGE_SPAWN, spawn_start);
+  trace_span("fork", fork_start, 0, argv[0]);
+
+  uint64_t run_start = trace_begin();
+  if (exec_pipe[0] >= 0) {
+    char c;
+    close(exec_pipe[1]);
+    while (read(exec_pipe[0], &c, 1) < 0 && errno == EINTR)
+      ;
+    close(exec_pipe[0]);
+    trace_span("exec", run_start, pid_child, argv[0]);
+    run_start = trace_begin();
+  }
+
+  uint64_t wait_start = timing_begin();
+  struct rusage usage;
+  wait4(pid_child, &exit_status, 0, &usage);
+  timing_end(STAGE_WAIT, wait_start);
+  trace_span("run", run_start, pid_child, argv[0]);
+  if (job)
+    limit_job_finish(job, &usage);
+
+ finished:
 
-    command_free(cmd);
+  // killed by a signal; report it the way other shells do, which
+  // say nothing of a writer stopped because its reader went away
+  if (WIFSIGNALED(exit_status)) {
+    if (WTERMSIG(exit_status) != SIGPIPE)
+      fprintf(stderr, "Child %d killed by signal %d\n", pid_child, WTERMSIG(exit_status));
+    return 128 + WTERMSIG(exit_status);
   }
+
+  return WEXITSTATUS(exit_status);
 }
 
 
-int main(int argc, char *argv[])
+
+/*
+ * Handles the enable builtin, which lists, loads, enables and
+ * disables builtins
+ *
+ * enable                          list all builtins
+ * enable -f <file.so> <name>...   load builtins from a shared object
+ * enable -n <name>...             disable builtins
+ * enable <name>...                re-enable builtins
+ *
+ * Parameters:
+ *   command_ t cmd:
+ *      argv - Arguement vector
+ *      argc - Length of Arguement Vector
+ *
+ * Returns:
+ *   0 on success, 1 if any name could not be loaded or found
+ */
+int
+builtin_enable(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+  char err_msg[512];
+  int status = 0;
+
+  if (argv[1] == NULL) {
+    builtin_list();
+    return 0;
+  }
+
+  if (!strcmp(argv[1], "-f")) {
+    if (argv[2] == NULL || argv[3] == NULL) {
+      fprintf(stderr, "Usage: enable -f file.so name...\n");
+      return 1;
+    }
+    for (int i = 3; argv[i]; i++) {
+      if (builtin_load(argv[2], argv[i], err_msg, sizeof(err_msg)) != 0) {
+        fprintf(stderr, "enable: %s\n", err_msg);
+        status = 1;
+      }
+    }
+    return status;
+  }
+
+  bool enable = true;
+  int i = 1;
+  if (!strcmp(argv[1], "-n")) {
+    enable = false;
+    i++;
+  }
+  for (; argv[i]; i++) {
+    if (builtin_set_enabled(argv[i], enable) != 0) {
+      fprintf(stderr, "enable: %s: not a shell builtin\n", argv[i]);
+      status = 1;
+    }
+  }
+  return status;
+}
+
+
+// set -o lookahead
+static bool lookahead_on = true;
+
+/*
+ * Returns true if cmd will run as a program in a child process, so
+ * that the shell's variables and cwd stay as they are while it runs;
+ * passed to script_set_lookahead()
+ */
+static bool
+runs_in_child(command_t *cmd)
 {
+  char * const *argv = command_get_argv(cmd);
+  return !script_find_function(argv[0]) && !builtin_lookup(argv[0])
+         && command_get_subst_count(cmd) == 0 && !batch_too_long(cmd);
+}
+
+
+/*
+ * Handles the set builtin, which turns shell options on and off: trace
+ * (see trace.h), and lookahead (see script_set_lookahead()), which is
+ * on by default.
+ *
+ * set -o             list the options and whether they are on
+ * set -o <option>    turn an option on
+ * set +o <option>    turn an option off
+ *
+ * Parameters:
+ *   command_ t cmd:
+ *      argv - Arguement vector
+ *      argc - Length of Arguement Vector
+ *
+ * Returns:
+ *   0 on success, 1 on a usage error or an unknown option
+ */
+int
+builtin_set(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+
+  if (argv[1] && !strcmp(argv[1], "-o") && !argv[2]) {
+    printf("lookahead\t%s\n", lookahead_on ? "on" : "off");
+    printf("trace\t%s\n", trace_enabled ? "on" : "off");
+    return 0;
+  }
+
+  if (!argv[1] || !argv[2] || argv[3]
+      || (strcmp(argv[1], "-o") != 0 && strcmp(argv[1], "+o") != 0)) {
+    fprintf(stderr, "Usage: set [-o|+o] option\n");
+    return 1;
+  }
+  if (!strcmp(argv[2], "lookahead")) {
+    lookahead_on = (argv[1][0] == '-');
+    script_set_lookahead(lookahead_on ? runs_in_child : NULL);
+    return 0;
+  }
+  if (strcmp(argv[2], "trace") != 0) {
+    fprintf(stderr, "set: %s: unknown option\n", argv[2]);
+    return 1;
+  }
+
+  if (trace_set_enabled(argv[1][0] == '-') != 0) {
+    perror("set");
+    return 1;
+  }
+  return 0;
+}
+
+
+/*
+ * Handles the trace builtin, by writing the events recorded since
+ * "set -o trace" to a file in the Chrome Trace Event format, for
+ * viewing in Perfetto (ui.perfetto.dev) or chrome://tracing
+ *
+ * trace [file]       defaults to plaidsh-trace.json
+ *
+ * Parameters:
+ *   command_ t cmd:
+ *      argv - Arguement vector
+ *      argc - Length of Arguement Vector
+ *
+ * Returns:
+ *   0 on success, 1 if the file could not be written
+ */
+int
+builtin_trace(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+  const char *path = argv[1] ? argv[1] : "plaidsh-trace.json";
+
+  long n = trace_write(path);
+  if (n < 0) {
+    fprintf(stderr, "trace: %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  printf("%ld events written to %s\n", n, path);
+  return 0;
+}
+
+
+/*
+ * Handles the cache builtin, which reports on or controls the cache
+ * of directory listings used by globbing and completion
+ *
+ * cache stats        hits, misses and size
+ * cache clear        drops every listing
+ * cache limit N      keeps at most N directories; 0 turns it off
+ *
+ * Returns:
+ *   0 on success, 1 on a usage error
+ */
+int
+builtin_cache(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+
+  if (argv[1] && !strcmp(argv[1], "stats") && !argv[2]) {
+    dircache_print_stats();
+  } else if (argv[1] && !strcmp(argv[1], "clear") && !argv[2]) {
+    dircache_clear();
+  } else if (argv[1] && !strcmp(argv[1], "limit") && argv[2] && isdigit(*argv[2])) {
+    dircache_set_limit(atoi(argv[2]));
+  } else {
+    fprintf(stderr, "Usage: cache stats | cache clear | cache limit N\n");
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Handles the memo builtin, which runs a command or replays its
+ * stored output; see memo.h
+ *
+ * memo [--ttl S] command [args]    answers older than S seconds are
+ *                                  not used
+ * memo --clear                     empties the store
+ *
+ * Returns:
+ *   The command's exit status, or 1 on a usage error
+ */
+int
+builtin_memo(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+  long ttl = 0;
+  int i = 1;
+
+  if (argv[1] && !strcmp(argv[1], "--clear") && !argv[2]) {
+    if (memo_clear() != 0) {
+      perror("memo");
+      return 1;
+    }
+    return 0;
+  }
+  if (argv[1] && !strcmp(argv[1], "--ttl") && argv[2] && isdigit(*argv[2])) {
+    ttl = atol(argv[2]);
+    i = 3;
+  }
+  if (!argv[i] || argv[i][0] == '-') {
+    fprintf(stderr, "Usage: memo [--ttl S] command [args] | memo --clear\n");
+    return 1;
+  }
+
+  // a builtin or function acts on the shell itself, as cd does, so
+  // replaying its output would skip what it is for
+  if (script_find_function(argv[i]) || builtin_lookup(argv[i])) {
+    fprintf(stderr, "memo: %s: only programs can be memoized\n", argv[i]);
+    return 1;
+  }
+
+  command_t *inner = command_new();
+  for (; argv[i]; i++)
+    command_append_arg(inner, argv[i]);
+  if (command_get_input_text(cmd))
+    command_set_input_text(inner, command_get_input_text(cmd));
+
+  int status = memo_run(inner, dirs_pwd(), ttl, execute_command);
+  command_free(inner);
+  return status;
+}
+
+/*
+ * Handles the limit builtin, which runs a command with limits on the
+ * resources of the programs it starts and reports what they used; see
+ * limit.h
+ *
+ * limit [--mem SIZE] [--cpu SECS] [--nofile N] command [args]
+ *
+ * Returns:
+ *   The command's exit status, or 1 on a usage error
+ */
+int
+builtin_limit(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+  limit_t lim = cmd_limits ? *cmd_limits : (limit_t){ 0 };
+  int i = limit_parse(argv, &lim);
+
+  if (i < 0 || !argv[i]) {
+    fprintf(stderr, "Usage: limit [--mem SIZE] [--cpu SECS] [--nofile N] command [args]\n");
+    return 1;
+  }
+
+  command_t *inner = command_new();
+  for (; argv[i]; i++)
+    command_append_arg(inner, argv[i]);
+  if (command_get_input_text(cmd))
+    command_set_input_text(inner, command_get_input_text(cmd));
+
+  const limit_t *outer = cmd_limits;
+  cmd_limits = &lim;
+  int status = execute_command(inner);
+  cmd_limits = outer;
+
+  command_free(inner);
+  return status;
+}
+
+/*
+ * Handles the coproc builtin, which starts a coprocess; see coproc.h
+ *
+ * coproc                          list the coprocesses
+ * coproc NAME command [args]      start one
+ *
+ * Returns:
+ *   0 on success, 1 on failure
+ */
+int
+builtin_coproc(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+
+  if (!argv[1]) {
+    coproc_list();
+    return 0;
+  }
+  if (!argv[2]) {
+    fprintf(stderr, "Usage: coproc [NAME command [args]]\n");
+    return 1;
+  }
+  if (coproc_start(argv[1], argv + 2) != 0) {
+    fprintf(stderr, "coproc: %s: %s\n", argv[1], strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Handles the cowrite builtin, which writes its arguments, joined by
+ * spaces, to a coprocess as one line
+ *
+ * cowrite NAME [words]
+ *
+ * Returns:
+ *   0 on success, 1 on failure
+ */
+int
+builtin_cowrite(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+
+  if (!argv[1]) {
+    fprintf(stderr, "Usage: cowrite NAME [words]\n");
+    return 1;
+  }
+
+  size_t len = 1;
+  for (int i = 2; argv[i]; i++)
+    len += strlen(argv[i]) + 1;
+  char *line = malloc(len), *p = line;
+  if (!line) {
+    perror("cowrite");
+    return 1;
+  }
+  for (int i = 2; argv[i]; i++)
+    p += sprintf(p, (i > 2) ? " %s" : "%s", argv[i]);
+  *p++ = '\n';
+
+  int result = coproc_write(argv[1], line, p - line);
+  if (result != 0)
+    fprintf(stderr, "cowrite: %s: %s\n", argv[1], strerror(errno));
+  free(line);
+  return result ? 1 : 0;
+}
+
+/*
+ * Handles the coread builtin, which reads a line from a coprocess
+ * into a variable, or to stdout if no variable is named
+ *
+ * coread [-t SECS] NAME [VAR]
+ *
+ * Returns:
+ *   0 if a line was read, 1 at the end of its output, on a timeout
+ *   or on failure
+ */
+int
+builtin_coread(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+  int timeout_ms = -1;
+  int i = 1;
+
+  if (argv[1] && !strcmp(argv[1], "-t") && argv[2] && isdigit(*argv[2])) {
+    timeout_ms = (int)(atof(argv[2]) * 1000);
+    i = 3;
+  }
+  if (!argv[i] || (argv[i + 1] && argv[i + 2])) {
+    fprintf(stderr, "Usage: coread [-t SECS] NAME [VAR]\n");
+    return 1;
+  }
+
+  char *line;
+  int result = coproc_read(argv[i], timeout_ms, &line);
+  if (result < 0)
+    fprintf(stderr, "coread: %s: %s\n", argv[i], strerror(errno));
+  if (result <= 0)
+    return 1;
+
+  if (argv[i + 1])
+    setenv(argv[i + 1], line, 1);
+  else
+    printf("%s\n", line);
+  free(line);
+  return 0;
+}
+
+/*
+ * Handles the coclose builtin, which ends a coprocess's input and
+ * waits for it to exit, or with -w only ends its input, so that its
+ * remaining output can still be read with coread
+ *
+ * coclose [-w] NAME
+ *
+ * Returns:
+ *   The coprocess's exit status, 0 for -w, or 1 if there is no such
+ *   coprocess
+ */
+int
+builtin_coclose(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+  bool write_only = argv[1] && !strcmp(argv[1], "-w");
+  int i = write_only ? 2 : 1;
+
+  if (!argv[i] || argv[i + 1]) {
+    fprintf(stderr, "Usage: coclose [-w] NAME\n");
+    return 1;
+  }
+  if (write_only) {
+    if (coproc_shutdown(argv[i]) != 0) {
+      fprintf(stderr, "coclose: %s: %s\n", argv[i], strerror(errno));
+      return 1;
+    }
+    return 0;
+  }
+
+  int status = coproc_close(argv[1]);
+  if (status < 0) {
+    fprintf(stderr, "coclose: %s: %s\n", argv[1], strerror(errno));
+    return 1;
+  }
+  return status;
+}
+
+/*
+ * Handles the dag builtin, which runs the tasks of a task file in
+ * parallel, in the order their dependencies allow; see dag.h
+ *
+ * dag [-j N] [FILE]
+ *
+ *   -j N      Run up to N tasks at once; 0, the default, means one
+ *             per CPU
+ *   FILE      The task file; stdin if none is given
+ *
+ * Returns:
+ *   0 if every task succeeded, otherwise the status of the first task
+ *   that failed, or 1 on a usage error or a mistake in the file
+ */
+int
+builtin_dag(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+  int jobs = 0;
+  int i = 1;
+
+  if (argv[1] && !strcmp(argv[1], "-j") && argv[2] && isdigit(*argv[2])) {
+    jobs = atoi(argv[2]);
+    i = 3;
+  }
+  if ((argv[i] && argv[i + 1]) || (argv[i] && argv[i][0] == '-')) {
+    fprintf(stderr, "Usage: dag [-j N] [FILE]\n");
+    return 1;
+  }
+  if (jobs == 0)
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+  // read from a private descriptor so stdin's buffer stays clean
+  const char *file = argv[i];
+  FILE *fp = file ? fopen(file, "r") : fdopen(dup(STDIN_FILENO), "r");
+  if (!fp) {
+    fprintf(stderr, "%s: %s\n", file ? file : "stdin", strerror(errno));
+    return 1;
+  }
+
+  char err_msg[512];
+  dag_t *dag = dag_load(fp, file ? file : "stdin", err_msg, sizeof(err_msg));
+  fclose(fp);
+  if (!dag) {
+    fprintf(stderr, "dag: %s\n", err_msg);
+    return 1;
+  }
+
+  int status = dag_run(dag, jobs, execute_command);
+  dag_free(dag);
+  return status;
+}
+
+/*
+ * The builtins compiled into the shell, registered at startup
+ */
+static const struct {
+  const char *name;
+  builtin_fn fn;
+} core_builtins[] = {
+  {"cd", builtin_cd},
+  {"pwd", builtin_pwd},
+  {"pushd", builtin_pushd},
+  {"popd", builtin_popd},
+  {"dirs", builtin_dirs},
+  {"author", builtin_author},
+  {"exit", builtin_exit},
+  {"setenv", builtin_setenv},
+  {"true", builtin_true},
+  {"false", builtin_false},
+  {"jobs", builtin_jobs},
+  {"wait", builtin_wait},
+  {"batch", builtin_batch},
+  {"enable", builtin_enable},
+  {"set", builtin_set},
+  {"trace", builtin_trace},
+  {"cache", builtin_cache},
+  {"memo", builtin_memo},
+  {"limit", builtin_limit},
+  {"coproc", builtin_coproc},
+  {"cowrite", builtin_cowrite},
+  {"coread", builtin_coread},
+  {"coclose", builtin_coclose},
+  {"dag", builtin_dag},
+};
+
+
+static int dispatch_command(command_t *cmd);
+static int run_with_substitutions(command_t *cmd);
+
+/*
+ * Executes one parsed command, either as a builtin or by running an
+ * external program
+ *
+ * Parameters:
+ *   command_ t cmd:
+ *       argc - The length of the argv vector, which must be >= 1
+ *       argv - Arguement Vector
+ *
+ * Returns:
+ *   The exit status of the command, 0 meaning success
+ */
+  int
+execute_command(command_t *cmd)
+{
+  uint64_t trace_start = trace_begin();
+
+  // the directory the command was given in, which cd changes
+  const char *cwd = audit_active() ? strdupa(dirs_pwd()) : NULL;
+
+  int status = (command_get_subst_count(cmd) > 0) ? run_with_substitutions(cmd)
+                                                  : dispatch_command(cmd);
+  if (cwd)
+    audit_command(cmd, cwd, status);
+  trace_span("execute_command", trace_start, 0, command_get_argv(cmd)[0]);
+  return status;
+}
+
+
+/*
+ * Starts a process substitution in a child of the shell, connected
+ * to the shell by a pipe
+ *
+ * Parameters:
+ *   text     The command inside the parentheses
+ *   output   True for >(text), whose stdin is the pipe; false for
+ *              <(text), whose stdout is the pipe
+ *   pid      Set to the child's pid
+ *
+ * Returns:
+ *   The shell's end of the pipe, close-on-exec, or -1 after printing
+ *   an error
+ */
+static int
+start_subst(const char *text, bool output, pid_t *pid)
+{
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    perror("pipe");
+    return -1;
+  }
+
+  fflush(stdout);
+  *pid = fork();
+
+  if (*pid == -1) {
+    perror("fork");
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+
+  if (*pid == 0) {
+    ev_reset_child();
+    dup2(output ? fds[0] : fds[1], output ? STDIN_FILENO : STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+
+    // stdout may be the pipe, so errors go to stderr
+    char err_msg[512];
+    script_t *script = script_parse(text, err_msg, sizeof(err_msg));
+    if (!script) {
+      fprintf(stderr, " Error: %s\n", err_msg);
+      _exit(2);
+    }
+    int status = script_run(script, execute_command);
+    fflush(NULL);
+    _exit(status);
+  }
+
+  close(output ? fds[0] : fds[1]);
+  return output ? fds[1] : fds[0];
+}
+
+
+/*
+ * Runs a command with process substitutions: starts each of them,
+ * replaces its argument with the /dev/fd path of its pipe, runs the
+ * command, and then closes the pipes and waits for them. Producer and
+ * consumer run at the same time, and no temporary file is needed.
+ */
+static int
+run_with_substitutions(command_t *cmd)
+{
+  int n = command_get_subst_count(cmd);
+  pid_t pids[n];
+  int fds[n];
+  int started, status = 1;
+
+  for (started = 0; started < n; started++) {
+    int arg;
+    bool output;
+    char path[32];
+    const char *text = command_get_subst(cmd, started, &arg, &output);
+
+    if ((fds[started] = start_subst(text, output, &pids[started])) < 0)
+      break;
+    snprintf(path, sizeof(path), "/dev/fd/%d", fds[started]);
+    if (arg == COMMAND_SUBST_INPUT)
+      command_set_input(cmd, path);
+    else if (arg == COMMAND_SUBST_OUTPUT)
+      command_set_output(cmd, path);
+    else
+      command_replace_arg(cmd, arg, path);
+  }
+
+  if (started == n) {
+    // the command, and whatever it runs, must inherit the pipes
+    for (int i = 0; i < n; i++)
+      fcntl(fds[i], F_SETFD, 0);
+    n_subst_open += n;
+    status = dispatch_command(cmd);
+    n_subst_open -= n;
+  }
+
+  // closing the shell's ends gives a >(...) reader its EOF, and stops
+  // a <(...) writer whose output was not all read
+  for (int i = 0; i < started; i++)
+    close(fds[i]);
+  for (int i = 0; i < started; i++)
+    while (waitpid(pids[i], NULL, 0) < 0 && errno == EINTR)
+      ;
+  return status;
+}
+
+
+/*
+ * Does the work of execute_command(), which wraps it for tracing and
+ * process substitution
+ */
+static int
+dispatch_command(command_t *cmd)
+{
+  // Retrieve arguement vector and arguement count 
+  int argc = command_get_argc(cmd);
+  char * const *argv = command_get_argv(cmd);
+
+  // Verify that number of arguements are more than 1
+  assert(argc >= 1);
+
+  // Shell functions take precedence over builtins and programs
+  script_t *func = script_find_function(argv[0]);
+  builtin_fn builtin = func ? NULL : builtin_lookup(argv[0]);
+
+  // Programs redirect their own stdin/stdout after the fork, unless
+  // argv is too big for one exec and has to be split into batches
+  if (!func && !builtin && !batch_too_long(cmd))
+    return forkexec_external_cmd(cmd);
+
+  // Everything else runs in the shell itself, so redirect around it
+  // and put the shell's own stdin and stdout back afterwards
+  fflush(stdout);
+  int saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+  int saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+  int status = 1;
+
+  if (saved_in < 0 || saved_out < 0) {
+    perror(argv[0]);
+    if (saved_in >= 0)
+      close(saved_in);
+    if (saved_out >= 0)
+      close(saved_out);
+    return 1;
+  }
+
+  if (redirect_stdio(cmd) == 0) {
+    if (func)
+      status = script_call_function(func, cmd, execute_command);
+    else if (builtin)
+      status = builtin(cmd);
+    else
+      status = batch_split(cmd);
+  }
+
+  fflush(stdout);
+  dup2(saved_in, STDIN_FILENO);
+  dup2(saved_out, STDOUT_FILENO);
+  close(saved_in);
+  close(saved_out);
+
+  return status;
+}
+
+
+// when the shell last went back to waiting for input, for tracing
+static uint64_t idle_start = 0;
+
+// the lines so far of an input that is not yet complete
+static script_reader_t *reader = NULL;
+
+/*
+ * Called by readline with each complete input line; parses the line
+ * and executes it
+ *
+ * Parameters:
+ *   input    The line, which must be freed, or NULL at end of input
+ */
+static void
+handle_line(char *input)
+{
+  char err_msg[512];
+
+  if (input == NULL) {
+    // report what is wrong with a script cut off at end of input
+    if (!script_reader_empty(reader)) {
+      char *text = script_reader_take(reader);
+      script_t *script = text ? script_parse(text, err_msg, sizeof(err_msg)) : NULL;
+      if (!script)
+        printf(" Error: %s\n", text ? err_msg : "Out of memory");
+      script_free(script);
+      free(text);
+    }
+    rl_callback_handler_remove();
+    exit(0);
+  }
+
+  // quotes, here-documents, compound commands and trailing '\'
+  // continue over the following lines
+  int fed = script_reader_feed(reader, input, strlen(input));
+  free(input);
+  if (fed == 0 && script_reader_feed(reader, "\n", 1) == 0
+      && !script_reader_complete(reader)) {
+    rl_set_prompt(CONTINUE_PROMPT);
+    return;
+  }
+  rl_set_prompt(PROMPT);
+
+  if (!(input = script_reader_take(reader))) {
+    printf(" Error: Out of memory\n");
+    return;
+  }
+  if (*input == '\0') {
+    free(input);
+    return;
+  }
+  add_history(input);
+  jobs_set_prompt_visible(false);
+  trace_span("idle", idle_start, 0, NULL);
+  uint64_t line_start = trace_begin();
+
+  // the directory is the one the line started in, not where a cd in
+  // it went; dirs_pwd() changes under a cd, so it is copied
+  record_entry_t entry = { .line = input, .status = 2 };
+  char cwd[PATH_MAX];
+  if (record_active()) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    entry.time_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    snprintf(cwd, sizeof(cwd), "%s", dirs_pwd());
+    entry.cwd = cwd;
+    timing_take(entry.stage_ns);      // discard anything from earlier
+  }
+
+  // parse the imput stream, including any if/while/for
+  uint64_t parse_start = timing_begin();
+  script_t *script = script_parse(input, err_msg, sizeof(err_msg));
+  timing_end(STAGE_PARSE, parse_start);
+
+
+  if (script == NULL) { 
+    // handle parsing error
+    printf(" Error: %s\n", err_msg);
+  }
+  else{
+    // run each command in the script
+    entry.status = script_run(script, execute_command);
+  }
+
+  if (record_active()) {
+    timing_take(entry.stage_ns);
+    record_line(&entry);
+  }
+
+  trace_span("line", line_start, 0, input);
+
+  // free all the malloc'd memory
+  free(input);
+
+  script_free(script);
+  jobs_set_prompt_visible(true);
+  idle_start = trace_begin();
+}
+
+
+/*
+ * Called by the event loop when there is keyboard input
+ */
+static void
+read_input(int fd, void *arg)
+{
+  rl_callback_read_char();
+}
+
+
+/*
+ * Reads one line of a stdin the event loop cannot watch, without
+ * reading past its end, so that a command run by the script that reads
+ * stdin starts at the line after its own, as it would under readline
+ *
+ * Returns:
+ *   The line without its '\n', which must be freed, or NULL at end of
+ *   input
+ */
+static char *
+read_script_line()
+{
+  // a file can be read ahead and then put back; anything else is read
+  // a byte at a time
+  static int seekable = -1;
+  if (seekable < 0)
+    seekable = lseek(STDIN_FILENO, 0, SEEK_CUR) >= 0;
+
+  char chunk[4096];
+  char *line = NULL;
+  size_t len = 0;
+
+  for (;;) {
+    ssize_t n = read(STDIN_FILENO, chunk, seekable ? sizeof(chunk) : 1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return line;
+
+    char *nl = memchr(chunk, '\n', n);
+    size_t used = nl ? nl - chunk + 1 : n;
+    if (used < n)
+      lseek(STDIN_FILENO, (off_t)used - n, SEEK_CUR);
+
+    char *grown = realloc(line, len + used + 1);
+    if (!grown) {
+      free(line);
+      return NULL;
+    }
+    line = grown;
+    memcpy(line + len, chunk, used);
+    len += used;
+    line[len] = '\0';
+
+    if (nl) {
+      line[len - 1] = '\0';
+      return line;
+    }
+  }
+}
+
+
+/*
+ * Runs a script on a stdin that the event loop cannot watch, such as
+ * a regular file, one line at a time until end of input
+ */
+static void
+read_script()
+{
+  char *line;
+  while ((line = read_script_line()))
+    handle_line(line);
+  handle_line(NULL);
+}
+
+
+/*
+ * Readline completion of file names, served from the directory cache.
+ * Names starting with '~' are left to readline's own function, which
+ * expands them.
+ *
+ * Parameters:
+ *   text     The partial name being completed
+ *   state    0 for the first call of a completion, then 1, 2, ...
+ *
+ * Returns:
+ *   The next match, malloc'd for readline to free, or NULL when there
+ *   are no more
+ */
+static char *
+complete_filename(const char *text, int state)
+{
+  static char * const *names;
+  static const unsigned char *types;
+  static int n_names, next;
+  static size_t dir_len;
+  static bool tilde;
+
+  if (state == 0) {
+    tilde = (text[0] == '~');
+    rl_filename_completion_desired = 1;
+
+    const char *slash = strrchr(text, '/');
+    dir_len = slash ? slash - text + 1 : 0;
+    char *dir = slash ? strndup(text, dir_len > 1 ? dir_len - 1 : 1) : strdup(".");
+    n_names = (dir && !tilde) ? dircache_list(dir, &names, &types) : 0;
+    free(dir);
+    next = 0;
+  }
+  if (tilde)
+    return rl_filename_completion_function(text, state);
+
+  const char *prefix = text + dir_len;
+  size_t prefix_len = strlen(prefix);
+  while (next < n_names) {
+    const char *name = names[next++];
+
+    // hidden files only when asked for
+    if ((name[0] == '.' && prefix[0] != '.') || strncmp(name, prefix, prefix_len) != 0)
+      continue;
+
+    char *match = malloc(dir_len + strlen(name) + 1);
+    if (match)
+      sprintf(match, "%.*s%s", (int)dir_len, text, name);
+    return match;
+  }
+  return NULL;
+}
+
+
+/*
+ * The main loop for the shell. Rather than blocking in readline(),
+ * the shell sleeps in the event loop so that background job output
+ * and completion notices can be shown while it waits for input.
+ */
+void mainloop()
+{
+  // welcome message
+  fprintf(stdout, "Welcome to Plaid Shell Hommies!\n");
+
+  if (ev_init() != 0 || jobs_init() != 0 || !(reader = script_reader_new())) {
+    perror("plaidsh");
+    exit(1);
+  }
+
+  // unbounded history grows the shell by every line ever typed
+  stifle_history(HISTORY_SIZE);
+  rl_completion_entry_function = complete_filename;
+
+  // epoll refuses regular files and /dev/null, as in plaidsh < script
+  jobs_set_prompt_visible(true);
+  if (ev_add_fd(STDIN_FILENO, read_input, NULL) != 0) {
+    if (errno != EPERM) {
+      perror("plaidsh");
+      exit(1);
+    }
+    read_script();
+  }
+
+  rl_callback_handler_install(PROMPT, handle_line);
+  ev_loop();
+}
+
+
+int main(int argc, char *argv[])
+{
+  // plaidsh --zygote ...: start the spawner before anything else is
+  // allocated, so that it stays small
+  if (argc >= 2 && !strcmp(argv[1], "--zygote")) {
+    if (zygote_start() != 0)
+      perror("plaidsh: zygote");
+    argv[1] = argv[0];
+    argv++;
+    argc--;
+  }
+
+  // plaidsh --record <log> ...: log every line typed; see record.h
+  if (argc >= 3 && !strcmp(argv[1], "--record")) {
+    if (record_open(argv[2]) != 0)
+      fprintf(stderr, "plaidsh: %s: %s\n", argv[2], strerror(errno));
+    argv[2] = argv[0];
+    argv += 2;
+    argc -= 2;
+  }
+
+  // plaidsh --audit <log> ...: log every command run; see audit.h
+  if (argc >= 3 && !strcmp(argv[1], "--audit")) {
+    if (audit_open(argv[2], AUDIT_MAX_BYTES, AUDIT_KEEP) != 0) {
+      fprintf(stderr, "plaidsh: %s: %s\n", argv[2], strerror(errno));
+      return 1;
+    }
+    argv[2] = argv[0];
+    argv += 2;
+    argc -= 2;
+  }
+
+  dirs_init();
+  if (dircache_init() != 0)
+    perror("plaidsh: directory cache");
+
+  // the shell's own arguments are the top-level $0..$N
+  parser_set_positional(argv);
+
+  // before any redirection, so memo can tell the shell's own stdin
+  memo_init();
+
+  for (int i = 0; i < sizeof(core_builtins) / sizeof(core_builtins[0]); i++)
+    builtin_register(core_builtins[i].name, core_builtins[i].fn);
+
+  // plaidsh --serve <socket> [--workers N]
+  if (argc >= 3 && !strcmp(argv[1], "--serve")) {
+    int workers = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc >= 5 && !strcmp(argv[3], "--workers"))
+      workers = atoi(argv[4]);
+
+    if (serve_run(argv[2], workers, execute_command) != 0) {
+      fprintf(stderr, "plaidsh: %s: %s\n", argv[2], strerror(errno));
+      return 1;
+    }
+    return 0;
+  }
+
+  script_set_lookahead(runs_in_child);
   mainloop();
   return 0;
 }
@@ -0,0 +1,61 @@
+/*
+ * plugin_basename.c
+ *
+ * Example of a builtin loaded at run time. Build it with
+ * "make plugin_basename.so", then in plaidsh:
+ *
+ *   enable -f ./plugin_basename.so basename
+ *
+ * after which basename runs inside the shell instead of forking
+ * /usr/bin/basename.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "command.h"
+
+/*
+ * Prints the last component of a path, with an optional suffix
+ * removed
+ *
+ * basename <path> [suffix]
+ *
+ * Returns:
+ *   0 on success, 1 if no path was given
+ */
+int
+builtin_basename(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+
+  if (command_get_argc(cmd) < 2) {
+    fprintf(stderr, "basename: missing operand\n");
+    return 1;
+  }
+
+  // strip trailing slashes, then take everything after the last one
+  const char *path = argv[1];
+  size_t end = strlen(path);
+  while (end > 1 && path[end-1] == '/')
+    end--;
+
+  size_t start = end;
+  while (start > 0 && path[start-1] != '/')
+    start--;
+  if (end == 1 && path[0] == '/')
+    start = 0;
+
+  size_t len = end - start;
+  const char *suffix = argv[2];
+  if (suffix) {
+    size_t slen = strlen(suffix);
+    if (slen < len && strncmp(path + end - slen, suffix, slen) == 0)
+      len -= slen;
+  }
+
+  printf("%.*s\n", (int)len, path + start);
+  return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * record.c
+ *
+ * Writing and reading of session logs
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "record.h"
+
+#define RECORD_MAGIC "PLSHREC1"
+#define FLAG_CWD 0x01           // the entry carries a new working directory
+
+static FILE *log_fp = NULL;
+static uint64_t last_time_ns;
+static char *last_cwd = NULL;
+
+struct record_reader_s {
+  FILE *fp;
+  uint64_t last_time_ns;
+  char *cwd;
+  char *line;
+};
+
+
+static void
+put_varint(FILE *fp, uint64_t v)
+{
+  while (v >= 0x80) {
+    putc((v & 0x7f) | 0x80, fp);
+    v >>= 7;
+  }
+  putc(v, fp);
+}
+
+static int
+get_varint(FILE *fp, uint64_t *v)
+{
+  *v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = getc(fp);
+    if (c == EOF)
+      return -1;
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return 0;
+  }
+  return -1;
+}
+
+static void
+put_string(FILE *fp, const char *s)
+{
+  size_t len = strlen(s);
+  put_varint(fp, len);
+  fwrite(s, 1, len, fp);
+}
+
+/*
+ * Reads a length-prefixed string into a buffer that is reallocated to
+ * fit
+ */
+static int
+get_string(FILE *fp, char **s)
+{
+  uint64_t len;
+  if (get_varint(fp, &len) != 0 || len > (1 << 24))
+    return -1;
+
+  char *buf = realloc(*s, len + 1);
+  if (!buf)
+    return -1;
+  *s = buf;
+
+  if (fread(buf, 1, len, fp) != len)
+    return -1;
+  buf[len] = '\0';
+  return 0;
+}
+
+static void
+put_u64(FILE *fp, uint64_t v)
+{
+  for (int i = 0; i < 8; i++)
+    putc((v >> (8 * i)) & 0xff, fp);
+}
+
+static int
+get_u64(FILE *fp, uint64_t *v)
+{
+  *v = 0;
+  for (int i = 0; i < 8; i++) {
+    int c = getc(fp);
+    if (c == EOF)
+      return -1;
+    *v |= (uint64_t)c << (8 * i);
+  }
+  return 0;
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the record_ calls. All documentation is in the
+ * record.h file.
+ *
+ **********************************************************************/
+
+int
+record_open(const char *path)
+{
+  FILE *fp = fopen(path, "w");
+  if (!fp)
+    return -1;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  last_time_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+  fwrite(RECORD_MAGIC, 1, strlen(RECORD_MAGIC), fp);
+  put_u64(fp, last_time_ns);
+  fflush(fp);
+
+  log_fp = fp;
+  timing_enable();
+  return 0;
+}
+
+
+bool
+record_active()
+{
+  return log_fp != NULL;
+}
+
+
+void
+record_line(const record_entry_t *entry)
+{
+  if (!log_fp)
+    return;
+
+  bool new_cwd = !last_cwd || strcmp(last_cwd, entry->cwd) != 0;
+  if (new_cwd) {
+    free(last_cwd);
+    last_cwd = strdup(entry->cwd);
+  }
+
+  uint64_t delta = entry->time_ns > last_time_ns ? entry->time_ns - last_time_ns : 0;
+  last_time_ns = entry->time_ns;
+  int64_t status = entry->status;
+
+  putc(new_cwd ? FLAG_CWD : 0, log_fp);
+  put_varint(log_fp, delta);
+  put_varint(log_fp, ((uint64_t)status << 1) ^ (uint64_t)(status >> 63));
+  for (int i = 0; i < N_STAGES; i++)
+    put_varint(log_fp, entry->stage_ns[i]);
+  if (new_cwd)
+    put_string(log_fp, entry->cwd);
+  put_string(log_fp, entry->line);
+  fflush(log_fp);
+}
+
+
+record_reader_t *
+record_reader_open(const char *path)
+{
+  char magic[sizeof(RECORD_MAGIC)] = "";
+  record_reader_t *reader = calloc(1, sizeof(record_reader_t));
+  if (!reader)
+    return NULL;
+
+  if (!(reader->fp = fopen(path, "r"))) {
+    free(reader);
+    return NULL;
+  }
+
+  if (fread(magic, 1, strlen(RECORD_MAGIC), reader->fp) != strlen(RECORD_MAGIC)
+      || strcmp(magic, RECORD_MAGIC) != 0
+      || get_u64(reader->fp, &reader->last_time_ns) != 0
+      || !(reader->cwd = strdup(""))) {
+    record_reader_close(reader);
+    errno = EINVAL;
+    return NULL;
+  }
+  return reader;
+}
+
+
+int
+record_read(record_reader_t *reader, record_entry_t *entry)
+{
+  int flags = getc(reader->fp);
+  if (flags == EOF)
+    return 0;
+
+  uint64_t delta, status;
+  if (get_varint(reader->fp, &delta) != 0 || get_varint(reader->fp, &status) != 0)
+    return -1;
+  for (int i = 0; i < N_STAGES; i++)
+    if (get_varint(reader->fp, &entry->stage_ns[i]) != 0)
+      return -1;
+
+  if ((flags & FLAG_CWD) && get_string(reader->fp, &reader->cwd) != 0)
+    return -1;
+  if (get_string(reader->fp, &reader->line) != 0)
+    return -1;
+
+  reader->last_time_ns += delta;
+  entry->time_ns = reader->last_time_ns;
+  entry->status = (int)((status >> 1) ^ -(status & 1));
+  entry->cwd = reader->cwd;
+  entry->line = reader->line;
+  return 1;
+}
+
+
+void
+record_reader_close(record_reader_t *reader)
+{
+  if (!reader)
+    return;
+  if (reader->fp)
+    fclose(reader->fp);
+  free(reader->cwd);
+  free(reader->line);
+  free(reader);
+}
@@ -0,0 +1,80 @@
+/*
+ * record.h
+ *
+ * Session recording: a compact binary log of every line typed at the
+ * prompt, with when it was entered, the directory it ran in, its exit
+ * status, and the time spent in each stage (see timing.h). The log is
+ * read back by plaidsh_replay to rerun a session against different
+ * builds of the shell.
+ *
+ * The file starts with the 8 bytes "PLSHREC1" and the start time in
+ * nanoseconds as a little-endian 64-bit integer. Each line follows as
+ * a flags byte, then unsigned LEB128 varints: nanoseconds since the
+ * previous entry (or the start), the zigzag-encoded exit status, and
+ * the four stage times in nanoseconds. The working directory follows
+ * as a varint length and bytes, but only when flags bit 0 says it has
+ * changed; the line itself always comes last, the same way.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _RECORD_H_
+#define _RECORD_H_
+
+#include <stdint.h>
+#include "timing.h"
+
+typedef struct {
+  uint64_t time_ns;             // wall-clock time the line was entered
+  const char *cwd;              // directory the line started in
+  const char *line;             // the input line
+  int status;                   // exit status of the line
+  uint64_t stage_ns[N_STAGES];  // time spent in each stage
+} record_entry_t;
+
+typedef struct record_reader_s record_reader_t;
+
+/*
+ * Starts recording to path, replacing any existing file, and turns on
+ * the stage timers
+ *
+ * Returns:
+ *   0 on success, -1 on failure (with errno set)
+ */
+int record_open(const char *path);
+
+/*
+ * Returns true if record_open() has been called successfully
+ */
+bool record_active();
+
+/*
+ * Appends one entry to the log and flushes it, so that the log is
+ * complete even if the shell is killed. Does nothing unless recording.
+ */
+void record_line(const record_entry_t *entry);
+
+/*
+ * Opens a log for reading
+ *
+ * Returns:
+ *   A reader to be closed with record_reader_close(), or NULL if the
+ *   file cannot be opened or is not a session log (with errno set)
+ */
+record_reader_t *record_reader_open(const char *path);
+
+/*
+ * Reads the next entry. Its strings stay valid until the next call.
+ *
+ * Returns:
+ *   1 if an entry was read, 0 at the end of the log, or -1 if the log
+ *   is truncated or corrupt
+ */
+int record_read(record_reader_t *reader, record_entry_t *entry);
+
+/*
+ * Closes a reader
+ */
+void record_reader_close(record_reader_t *reader);
+
+#endif /* _RECORD_H_ */
@@ -0,0 +1,271 @@
+/*
+ * replay.c
+ *
+ * plaidsh_replay: shows a session log written by "plaidsh --record",
+ * or runs it again against one or two builds of plaidsh and compares
+ * where the time went, stage by stage.
+ *
+ *   plaidsh_replay -p LOG              print the log as text
+ *   plaidsh_replay LOG BUILD [BUILD2]  replay and compare
+ *
+ * Each replay starts the build in a fresh temporary directory with
+ * "--record", feeds it the logged lines on stdin and reads back its
+ * own log. The directory only keeps stray files out of the way; it is
+ * not a security sandbox, and the replayed commands can still reach
+ * the rest of the file system.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#define _XOPEN_SOURCE 700   // nftw
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <ftw.h>
+#include <sys/wait.h>
+
+#include "record.h"
+
+/*
+ * Stage times of every line in one run
+ */
+typedef struct {
+  const char *name;
+  long n;
+  uint64_t *stage_ns[N_STAGES];
+  int *status;
+  char **lines;
+} run_t;
+
+static int
+load_run(const char *path, const char *name, run_t *run)
+{
+  record_reader_t *reader = record_reader_open(path);
+  if (!reader) {
+    fprintf(stderr, "plaidsh_replay: %s: %s\n", path,
+      errno == EINVAL ? "not a session log" : strerror(errno));
+    return -1;
+  }
+
+  long cap = 64;
+  memset(run, 0, sizeof(*run));
+  run->name = name;
+  for (int s = 0; s < N_STAGES; s++)
+    run->stage_ns[s] = malloc(cap * sizeof(uint64_t));
+  run->status = malloc(cap * sizeof(int));
+  run->lines = malloc(cap * sizeof(char *));
+
+  record_entry_t e;
+  int ret;
+  while ((ret = record_read(reader, &e)) == 1) {
+    if (run->n == cap) {
+      cap *= 2;
+      for (int s = 0; s < N_STAGES; s++)
+        run->stage_ns[s] = realloc(run->stage_ns[s], cap * sizeof(uint64_t));
+      run->status = realloc(run->status, cap * sizeof(int));
+      run->lines = realloc(run->lines, cap * sizeof(char *));
+    }
+    for (int s = 0; s < N_STAGES; s++)
+      run->stage_ns[s][run->n] = e.stage_ns[s];
+    run->status[run->n] = e.status;
+    run->lines[run->n] = strdup(e.line);
+    run->n++;
+  }
+
+  if (ret < 0)
+    fprintf(stderr, "plaidsh_replay: %s: truncated after %ld lines\n", path, run->n);
+  record_reader_close(reader);
+  return 0;
+}
+
+/*
+ * Prints a log as text, one line per entry
+ */
+static int
+print_log(const char *path)
+{
+  record_reader_t *reader = record_reader_open(path);
+  if (!reader) {
+    fprintf(stderr, "plaidsh_replay: %s: %s\n", path,
+      errno == EINVAL ? "not a session log" : strerror(errno));
+    return 1;
+  }
+
+  record_entry_t e;
+  int ret;
+  while ((ret = record_read(reader, &e)) == 1) {
+    time_t secs = e.time_ns / 1000000000ull;
+    char when[32];
+    strftime(when, sizeof(when), "%F %T", localtime(&secs));
+
+    printf("%s  %-20s status=%-3d", when, e.cwd, e.status);
+    for (int s = 0; s < N_STAGES; s++)
+      printf(" %s=%.3fms", timing_stage_name(s), e.stage_ns[s] / 1e6);
+    printf("  %s\n", e.line);
+  }
+
+  record_reader_close(reader);
+  return ret < 0 ? 1 : 0;
+}
+
+static int
+remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+  remove(path);
+  return 0;
+}
+
+/*
+ * Replays the lines of orig against a build, filling in run
+ */
+static int
+replay(const char *build, const run_t *orig, run_t *run)
+{
+  char build_path[PATH_MAX];
+  char dir[] = "/tmp/plaidsh-replay.XXXXXX";
+  char log_path[sizeof(dir) + 16];
+
+  if (!realpath(build, build_path)) {
+    fprintf(stderr, "plaidsh_replay: %s: %s\n", build, strerror(errno));
+    return -1;
+  }
+  if (!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return -1;
+  }
+  snprintf(log_path, sizeof(log_path), "%s.log", dir);
+
+  int in[2];
+  if (pipe(in) != 0)
+    return -1;
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(in[0], STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    close(in[0]);
+    close(in[1]);
+    if (chdir(dir) != 0)
+      _exit(127);
+    execl(build_path, build_path, "--record", log_path, (char *)NULL);
+    _exit(127);
+  }
+  close(in[0]);
+
+  // the shell reads one line at a time, so the pipe just fills up
+  FILE *fp = fdopen(in[1], "w");
+  for (long i = 0; i < orig->n; i++)
+    fprintf(fp, "%s\n", orig->lines[i]);
+  fclose(fp);
+
+  int status;
+  waitpid(pid, &status, 0);
+  nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+  int ret = load_run(log_path, build, run);
+  unlink(log_path);
+  if (ret == 0 && run->n != orig->n)
+    fprintf(stderr, "plaidsh_replay: %s replayed %ld of %ld lines\n", build, run->n, orig->n);
+  return ret;
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * Computes the total, median and 99th percentile of one stage
+ */
+static void
+stage_stats(const run_t *run, int s, double *total_ms, double *p50_us, double *p99_us)
+{
+  uint64_t *sorted = malloc((run->n + 1) * sizeof(uint64_t));
+  uint64_t total = 0;
+
+  for (long i = 0; i < run->n; i++) {
+    sorted[i] = run->stage_ns[s][i];
+    total += sorted[i];
+  }
+  qsort(sorted, run->n, sizeof(uint64_t), compare_u64);
+
+  *total_ms = total / 1e6;
+  *p50_us = run->n ? sorted[run->n / 2] / 1e3 : 0;
+  *p99_us = run->n ? sorted[(long)(run->n * 0.99)] / 1e3 : 0;
+  free(sorted);
+}
+
+/*
+ * Prints one table row per stage, with a column group per run, and
+ * the change in total time between the last two runs
+ */
+static void
+print_comparison(run_t *runs, int n_runs)
+{
+  printf("%-8s", "stage");
+  for (int r = 0; r < n_runs; r++)
+    printf(" | %-34.34s", runs[r].name);
+  if (n_runs == 3)
+    printf(" | %8s", "change");
+  printf("\n%-8s", "");
+  for (int r = 0; r < n_runs; r++)
+    printf(" | %10s %11s %11s", "total ms", "p50 us", "p99 us");
+  printf("\n");
+
+  for (int s = 0; s < N_STAGES; s++) {
+    double total[3], p50, p99;
+    printf("%-8s", timing_stage_name(s));
+    for (int r = 0; r < n_runs; r++) {
+      stage_stats(&runs[r], s, &total[r], &p50, &p99);
+      printf(" | %10.2f %11.1f %11.1f", total[r], p50, p99);
+    }
+    if (n_runs == 3 && total[1] > 0)
+      printf(" | %+7.1f%%", 100.0 * (total[2] - total[1]) / total[1]);
+    printf("\n");
+  }
+
+  // lines whose status changed between builds point at behaviour changes
+  if (n_runs == 3) {
+    long n = runs[1].n < runs[2].n ? runs[1].n : runs[2].n;
+    for (long i = 0; i < n; i++)
+      if (runs[1].status[i] != runs[2].status[i])
+        printf("status %d -> %d: %s\n", runs[1].status[i], runs[2].status[i], runs[1].lines[i]);
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  if (argc == 3 && !strcmp(argv[1], "-p"))
+    return print_log(argv[2]);
+
+  if (argc < 3 || argc > 4) {
+    fprintf(stderr, "Usage: plaidsh_replay -p LOG\n"
+                    "       plaidsh_replay LOG BUILD [BUILD2]\n");
+    return 2;
+  }
+
+  run_t runs[3];
+  if (load_run(argv[1], "recorded", &runs[0]) != 0)
+    return 1;
+
+  int n_runs = 1;
+  for (int b = 2; b < argc; b++) {
+    if (replay(argv[b], &runs[0], &runs[n_runs]) != 0)
+      return 1;
+    n_runs++;
+  }
+
+  print_comparison(runs, n_runs);
+  return 0;
+}
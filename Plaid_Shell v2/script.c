@@ -0,0 +1,1641 @@
+/*
+ * script.c
+ *
+ * Command lists and compound commands (if/while/for/functions) built
+ * on top of command_t
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include "script.h"
+#include "parser.h"
+#include "command.h"
+#include "jobs.h"
+#include "timing.h"
+#include "dircache.h"
+
+#define INIT_TOKENS_CAP 16    // initial capacity of the token array
+#define FUNC_TABLE_SIZE 64    // buckets in the function table; a power of 2
+#define MAX_FUNC_DEPTH 1000   // deepest allowed nesting of function calls
+
+
+/*
+ * The line is first split into tokens, which are either raw words
+ * (still holding their quotes, escapes and $variables), command
+ * separators, the && and || operators, or & to run in the
+ * background. The parser then walks the token array once to build
+ * the tree.
+ */
+typedef enum { TOK_WORD, TOK_SEP, TOK_AND, TOK_OR, TOK_AMP, TOK_EOF } tok_type_t;
+
+typedef struct {
+  tok_type_t type;
+  const char *start;    // first character of the word in the input
+  size_t len;           // length of the word
+} token_t;
+
+typedef enum {
+  NODE_SIMPLE, NODE_IF, NODE_WHILE, NODE_FOR, NODE_FUNCDEF, NODE_AND, NODE_OR,
+  NODE_BACKGROUND
+} node_type_t;
+
+typedef struct node_s node_t;
+
+struct node_s {
+  node_type_t type;
+  node_t *next;         // next command in the same list
+
+  // NODE_SIMPLE: the command; NODE_FOR: the words to loop over;
+  // NODE_BACKGROUND: text describes the job
+  char *text;           // source text, if it must be expanded at run time
+  command_t *cmd;       // the parsed command, if it can be reused as is
+
+  node_t *cond;         // NODE_IF, NODE_WHILE: the condition list;
+                        //   NODE_AND, NODE_OR: the left-hand command
+  node_t *body;         // NODE_IF: the then list; NODE_AND, NODE_OR: the
+                        //   right-hand command; NODE_BACKGROUND: the job;
+                        //   otherwise the loop body
+  node_t *else_part;    // NODE_IF: the else list, or an IF node for elif
+  char *var;            // NODE_FOR: the loop variable; NODE_FUNCDEF: the name
+  script_t *func;       // NODE_FUNCDEF: the function body
+};
+
+struct script_s {
+  node_t *list;
+  int refs;             // the parse result, and each function table entry
+};
+
+/*
+ * Function table: a chained hash table from name to body
+ */
+typedef struct func_s {
+  char *name;
+  script_t *body;
+  struct func_s *next;
+} func_t;
+
+static func_t *func_table[FUNC_TABLE_SIZE];
+static int func_depth = 0;
+
+typedef struct {
+  token_t *toks;
+  int pos;
+  bool failed;
+  char *err_msg;
+  size_t err_msg_len;
+} pstate_t;
+
+static const char *reserved_words[] =
+  {"then", "elif", "else", "fi", "do", "done", "}", NULL};
+
+
+/**********************************************************************
+ *
+ * Tokenizer
+ *
+ **********************************************************************/
+
+/*
+ * Returns true if in starts with one of the operators && or ||
+ */
+static bool
+is_operator(const char *in)
+{
+  return (in[0] == '&' || in[0] == '|') && in[1] == in[0];
+}
+
+/*
+ * Splits input into an array of tokens terminated by TOK_EOF. Words
+ * end at unquoted and unescaped whitespace, ';', newline, '&' or
+ * "||", outside any process substitution or arithmetic expansion. Returns NULL and fills in
+ * err_msg on error.
+ */
+static token_t *
+tokenize(const char *input, char *err_msg, size_t err_msg_len)
+{
+  int cap = INIT_TOKENS_CAP;
+  int n = 0;
+  token_t *toks = malloc(cap * sizeof(token_t));
+  const char *in = input;
+
+  if (!toks) {
+    strncpy(err_msg, "Out of memory", err_msg_len);
+    return NULL;
+  }
+
+  while (1) {
+    // consume whitespace, except newlines which separate commands
+    while (*in != '\n' && isspace(*in))
+      in++;
+
+    if (n + 1 == cap) {
+      cap *= 2;
+      token_t *grown = realloc(toks, cap * sizeof(token_t));
+      if (!grown) {
+        free(toks);
+        strncpy(err_msg, "Out of memory", err_msg_len);
+        return NULL;
+      }
+      toks = grown;
+    }
+
+    token_t *t = &toks[n++];
+    t->start = in;
+
+    if (*in == '\0') {
+      t->type = TOK_EOF;
+      t->len = 0;
+      return toks;
+    }
+
+    if (*in == ';' || *in == '\n') {
+      t->type = TOK_SEP;
+      t->len = 1;
+      in++;
+      continue;
+    }
+
+    if (is_operator(in)) {
+      t->type = (*in == '&') ? TOK_AND : TOK_OR;
+      t->len = 2;
+      in += 2;
+      continue;
+    }
+
+    if (*in == '&') {
+      t->type = TOK_AMP;
+      t->len = 1;
+      in++;
+      continue;
+    }
+
+    // a process substitution <(...) or >(...), or an arithmetic
+    // expansion $((...)), is one word, spaces, separators and all
+    bool in_quote = false;
+    int depth = 0;
+    while (*in && (in_quote || depth > 0 || (!isspace(*in) && *in != ';' && *in != '&'
+                                             && !is_operator(in)))) {
+      if (*in == '\\' && *(in+1))
+        in++;
+      else if (*in == '"')
+        in_quote = !in_quote;
+      else if (!in_quote && (*in == '<' || *in == '>' || *in == '$') && in[1] == '(') {
+        depth++;
+        in++;
+      } else if (!in_quote && depth > 0 && *in == '(')
+        depth++;
+      else if (!in_quote && depth > 0 && *in == ')')
+        depth--;
+      in++;
+    }
+
+    if (in_quote || depth > 0) {
+      free(toks);
+      strncpy(err_msg, in_quote ? "Unterminated quote"
+                                : "Unterminated process substitution", err_msg_len);
+      return NULL;
+    }
+
+    t->type = TOK_WORD;
+    t->len = in - t->start;
+  }
+}
+
+
+/**********************************************************************
+ *
+ * Here-documents. Before tokenizing, each "<<DELIM" is replaced by a
+ * here-string holding the lines up to DELIM, quoted and escaped, so
+ * that everything after this point sees one-line commands and
+ * parse_input() feeds the text to stdin as for any here-string.
+ *
+ **********************************************************************/
+
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t cap;
+  bool failed;          // set once an append runs out of memory
+} strbuf_t;
+
+static bool
+sb_append(strbuf_t *sb, const char *s, size_t n)
+{
+  if (sb->failed)
+    return false;
+  if (sb->len + n + 1 > sb->cap) {
+    size_t cap = sb->cap ? sb->cap : 256;
+    while (sb->len + n + 1 > cap)
+      cap *= 2;
+    char *grown = realloc(sb->buf, cap);
+    if (!grown) {
+      sb->failed = true;
+      return false;
+    }
+    sb->buf = grown;
+    sb->cap = cap;
+  }
+  memcpy(sb->buf + sb->len, s, n);
+  sb->len += n;
+  sb->buf[sb->len] = '\0';
+  return true;
+}
+
+typedef struct {
+  const char *op;       // the "<<" in the input
+  const char *op_end;   // just past the delimiter word
+  char delim[64];
+  bool strip_tabs;      // "<<-": leading tabs are removed from each line
+  bool quoted;          // delimiter was quoted: no variable expansion
+} heredoc_t;
+
+#define MAX_HEREDOCS 16       // here-documents started on one line
+
+/*
+ * Reads the delimiter after "<<" or "<<-" at op into hd. Single or
+ * double quotes and backslashes are removed, and their presence
+ * turns off expansion in the body, as in other shells.
+ */
+static bool
+read_delimiter(const char *op, heredoc_t *hd)
+{
+  const char *in = op + 2;
+  char *d = hd->delim;
+
+  hd->op = op;
+  hd->strip_tabs = (*in == '-');
+  hd->quoted = false;
+  if (hd->strip_tabs)
+    in++;
+  while (*in == ' ' || *in == '\t')
+    in++;
+
+  while (*in && !isspace(*in) && !strchr(";&|<>", *in)) {
+    if (*in == '"' || *in == '\'' || *in == '\\') {
+      hd->quoted = true;
+      in++;
+      continue;
+    }
+    if (d == hd->delim + sizeof(hd->delim) - 1)
+      return false;
+    *d++ = *in++;
+  }
+  *d = '\0';
+  hd->op_end = in;
+  return d > hd->delim;
+}
+
+/*
+ * Appends one body line to sb, escaped so that read_word() gives it
+ * back unchanged inside double quotes. In the body of an unquoted
+ * delimiter, $variables still expand and "\$" stays an escape.
+ */
+static bool
+append_body_line(strbuf_t *sb, const char *line, size_t len, bool quoted)
+{
+  for (size_t i = 0; i < len; i++) {
+    char c = line[i];
+    const char *esc = NULL;
+
+    if (c == '"')
+      esc = "\\\"";
+    else if (c == '\t')
+      esc = "\\t";
+    else if (c == '\r')
+      esc = "\\r";
+    else if (c == '$' && quoted)
+      esc = "\\$";
+    else if (c == '\\' && !quoted && i + 1 < len && line[i+1] == '$') {
+      esc = "\\$";
+      i++;
+    } else if (c == '\\')
+      esc = "\\\\";
+
+    if (!(esc ? sb_append(sb, esc, strlen(esc)) : sb_append(sb, &c, 1)))
+      return false;
+  }
+  return true;
+}
+
+/*
+ * Returns a copy of input with every here-document inlined, or NULL
+ * with err_msg filled in
+ */
+static char *
+inline_heredocs(const char *input, char *err_msg, size_t err_msg_len)
+{
+  strbuf_t out = { NULL, 0, 0, false };
+  const char *in = input;
+  bool in_quote = false;
+  int depth = 0;              // inside $((...)) or <(...), "<<" is not special
+
+  sb_append(&out, "", 0);
+
+  while (*in) {
+    // find the here-documents started on this line
+    heredoc_t docs[MAX_HEREDOCS];
+    int n_docs = 0;
+    const char *line = in;
+
+    while (*in && (*in != '\n' || in_quote)) {
+      if (*in == '\\' && in[1]) {
+        in += 2;
+      } else if (*in == '"') {
+        in_quote = !in_quote;
+        in++;
+      } else if (!in_quote && strchr("$<>", in[0]) && in[1] == '(') {
+        depth++;
+        in += 2;
+      } else if (!in_quote && depth > 0 && (*in == '(' || *in == ')')) {
+        depth += (*in == '(') ? 1 : -1;
+        in++;
+      } else if (!in_quote && in[0] == '<' && in[1] == '<' && in[2] == '<') {
+        in += 3;
+      } else if (!in_quote && depth == 0 && in[0] == '<' && in[1] == '<') {
+        if (n_docs == MAX_HEREDOCS || !read_delimiter(in, &docs[n_docs])) {
+          snprintf(err_msg, err_msg_len, "%s", n_docs == MAX_HEREDOCS
+                   ? "Too many here-documents" : "Here-document without delimiter");
+          free(out.buf);
+          return NULL;
+        }
+        in = docs[n_docs++].op_end;
+      } else {
+        in++;
+      }
+    }
+    const char *line_end = in;
+    if (*in)
+      in++;
+
+    // copy the line, with each here-document replaced by its body
+    const char *copied = line;
+    for (int i = 0; i < n_docs; i++) {
+      heredoc_t *hd = &docs[i];
+      strbuf_t body = { NULL, 0, 0, false };
+
+      for (;;) {
+        if (*in == '\0') {
+          snprintf(err_msg, err_msg_len, "Unterminated here-document '%s'", hd->delim);
+          free(body.buf);
+          free(out.buf);
+          return NULL;
+        }
+        const char *text = in;
+        const char *nl = strchr(in, '\n');
+        size_t len = nl ? (size_t)(nl - in) : strlen(in);
+        in += len + (nl ? 1 : 0);
+
+        if (hd->strip_tabs)
+          while (len > 0 && *text == '\t') {
+            text++;
+            len--;
+          }
+        if (len == strlen(hd->delim) && !strncmp(text, hd->delim, len))
+          break;
+
+        // the newline after the last line comes from the here-string
+        if (body.buf)
+          sb_append(&body, "\\n", 2);
+        else
+          sb_append(&body, "", 0);
+        append_body_line(&body, text, len, hd->quoted);
+      }
+
+      sb_append(&out, copied, hd->op - copied);
+      if (body.buf) {
+        sb_append(&out, "<<<\"", 4);
+        sb_append(&out, body.buf, body.len);
+        sb_append(&out, "\"", 1);
+      } else {
+        // an empty here-document gives no input at all, not a newline
+        sb_append(&out, "</dev/null", 10);
+      }
+      out.failed |= body.failed;
+      free(body.buf);
+      copied = hd->op_end;
+    }
+    sb_append(&out, copied, line_end - copied);
+    if (*line_end == '\n')
+      sb_append(&out, "\n", 1);
+  }
+
+  if (out.failed) {
+    free(out.buf);
+    strncpy(err_msg, "Out of memory", err_msg_len);
+    return NULL;
+  }
+  return out.buf;
+}
+
+
+/**********************************************************************
+ *
+ * Input reader. A state machine over the characters of the input as
+ * they arrive, tracking just enough of the tokenizer's and parser's
+ * view to tell whether the script so far is complete.
+ *
+ **********************************************************************/
+
+typedef enum {
+  RD_NORMAL,            // between or inside unquoted words
+  RD_ESCAPE,            // after a backslash
+  RD_QUOTE,             // inside double quotes
+  RD_QUOTE_ESCAPE,      // after a backslash inside double quotes
+  RD_DELIM,             // reading the delimiter after "<<"
+  RD_HEREDOC            // reading here-document bodies
+} rd_mode_t;
+
+#define MAX_KEYWORD 8         // longest word checked for a keyword, plus 1
+
+struct script_reader_s {
+  strbuf_t text;        // everything fed, less continuations
+  rd_mode_t mode;
+  bool seen_word;       // anything but whitespace fed yet
+
+  int subst_depth;      // parentheses open in a process substitution
+  int compound_depth;   // if/while/for/{ not yet closed
+  bool pending_op;      // the last token was && or ||
+  bool joined;          // the last thing fed was a continuation
+  char prev;            // previous character in RD_NORMAL
+
+  // the word being read, for spotting keywords at command position
+  char word[MAX_KEYWORD];
+  int word_len;         // -1 once it cannot be a keyword
+  bool cmd_start;       // the next word starts a command
+  int lt_run;           // consecutive '<' just read
+
+  // here-documents started on the current line, then being read
+  heredoc_t docs[MAX_HEREDOCS];
+  int n_docs;
+  int cur_doc;
+  size_t delim_len;
+  bool delim_started;   // RD_DELIM: past the '-' and blanks
+  size_t line_start;    // RD_HEREDOC: offset of the body line in text
+};
+
+/*
+ * Ends the word being read, adjusting the compound depth if it was a
+ * keyword at the start of a command
+ */
+static void
+rd_end_word(script_reader_t *r)
+{
+  if (r->word_len == 0)
+    return;
+
+  const char *w = r->word;
+  if (r->word_len >= 2 && !strcmp(w + r->word_len - 2, "()")) {
+    // "NAME()" and "()" are followed by the function body
+    r->cmd_start = true;
+  } else if (r->word_len > 0 && r->cmd_start && r->subst_depth == 0) {
+    if (!strcmp(w, "if") || !strcmp(w, "while") || !strcmp(w, "{"))
+      r->compound_depth++;
+    else if (!strcmp(w, "for")) {
+      r->compound_depth++;
+      r->cmd_start = false;
+    } else if (!strcmp(w, "fi") || !strcmp(w, "done") || !strcmp(w, "}")) {
+      if (r->compound_depth > 0)
+        r->compound_depth--;
+    } else if (strcmp(w, "then") && strcmp(w, "do") && strcmp(w, "else")
+               && strcmp(w, "elif"))
+      r->cmd_start = false;
+  } else {
+    r->cmd_start = false;
+  }
+  r->word_len = 0;
+}
+
+/*
+ * Adds c to the word being read
+ */
+static void
+rd_word_char(script_reader_t *r, char c)
+{
+  r->pending_op = false;
+  if (r->word_len < 0)
+    return;
+  if (r->word_len == MAX_KEYWORD - 1) {
+    r->word_len = -1;
+    return;
+  }
+  r->word[r->word_len++] = c;
+  r->word[r->word_len] = '\0';
+}
+
+/*
+ * Checks whether the body line just read ends the current
+ * here-document, moving on to the next one if so
+ */
+static void
+rd_end_body_line(script_reader_t *r, size_t line_end)
+{
+  heredoc_t *hd = &r->docs[r->cur_doc];
+  const char *line = r->text.buf + r->line_start;
+  size_t len = line_end - r->line_start;
+
+  if (hd->strip_tabs)
+    while (len > 0 && *line == '\t') {
+      line++;
+      len--;
+    }
+  if (len == strlen(hd->delim) && !strncmp(line, hd->delim, len)
+      && ++r->cur_doc == r->n_docs) {
+    r->n_docs = 0;
+    r->mode = RD_NORMAL;
+  }
+}
+
+/*
+ * Runs the state machine over one character, appending it to the
+ * text unless it is dropped
+ */
+static void
+rd_step(script_reader_t *r, char c)
+{
+  strbuf_t *sb = &r->text;
+
+  r->joined = false;
+  switch (r->mode) {
+  case RD_HEREDOC:
+    sb_append(sb, &c, 1);
+    if (c == '\n') {
+      rd_end_body_line(r, sb->len - 1);
+      r->line_start = sb->len;
+    }
+    return;
+
+  case RD_ESCAPE:
+  case RD_QUOTE_ESCAPE:
+    r->mode = (r->mode == RD_ESCAPE) ? RD_NORMAL : RD_QUOTE;
+    if (c == '\n') {
+      // a continuation: drop the backslash and the newline
+      sb->len--;
+      sb->buf[sb->len] = '\0';
+      r->joined = true;
+      return;
+    }
+    sb_append(sb, &c, 1);
+    r->word_len = -1;
+    r->pending_op = false;
+    r->prev = '\0';
+    return;
+
+  case RD_QUOTE:
+    sb_append(sb, &c, 1);
+    if (c == '\\')
+      r->mode = RD_QUOTE_ESCAPE;
+    else if (c == '"')
+      r->mode = RD_NORMAL;
+    return;
+
+  case RD_DELIM: {
+    heredoc_t *hd = &r->docs[r->n_docs];
+    if (!r->delim_started && (c == '-' || c == ' ' || c == '\t')) {
+      // "<<-" only when the dash comes straight after the "<<"
+      hd->strip_tabs |= (c == '-' && sb->buf[sb->len - 1] == '<');
+      break;
+    }
+    r->delim_started = true;
+    if (c == '"' || c == '\'' || c == '\\')
+      break;
+    if (!isspace(c) && !strchr(";&|<>", c)) {
+      if (r->delim_len < sizeof(hd->delim) - 1)
+        hd->delim[r->delim_len++] = c;
+      break;
+    }
+    // the delimiter has ended; c belongs to what follows it
+    hd->delim[r->delim_len] = '\0';
+    if (r->delim_len > 0)
+      r->n_docs++;
+    r->mode = RD_NORMAL;
+    rd_step(r, c);
+    return;
+  }
+
+  case RD_NORMAL:
+    break;
+  }
+
+  if (r->mode == RD_DELIM) {
+    sb_append(sb, &c, 1);
+    return;
+  }
+
+  // "<<" not followed by a third '<' starts a here-document
+  if (r->lt_run == 2 && c != '<' && r->subst_depth == 0) {
+    r->lt_run = 0;
+    if (r->n_docs < MAX_HEREDOCS) {
+      memset(&r->docs[r->n_docs], 0, sizeof(heredoc_t));
+      r->delim_len = 0;
+      r->delim_started = false;
+      r->mode = RD_DELIM;
+      rd_step(r, c);
+      return;
+    }
+  }
+  r->lt_run = (c == '<') ? r->lt_run + 1 : 0;
+
+  sb_append(sb, &c, 1);
+  if (!isspace(c))
+    r->seen_word = true;
+
+  if (c == '\\') {
+    // prev is left alone, in case this starts a continuation
+    r->mode = RD_ESCAPE;
+    return;
+  }
+  if (c == '"') {
+    r->mode = RD_QUOTE;
+    r->word_len = -1;
+    r->pending_op = false;
+    r->prev = c;
+    return;
+  }
+
+  if (r->subst_depth > 0) {
+    if (c == '(')
+      r->subst_depth++;
+    else if (c == ')')
+      r->subst_depth--;
+  } else if (c == '(' && (r->prev == '<' || r->prev == '>' || r->prev == '$')) {
+    r->subst_depth++;
+    r->word_len = -1;
+  } else if (c == '\n' || c == ';' || c == '&' || c == '|') {
+    rd_end_word(r);
+    r->cmd_start = true;
+    if (c == '&' || c == '|')
+      r->pending_op = (r->prev == c && !r->pending_op);
+    else if (c == ';')
+      r->pending_op = false;
+    if (c == '\n' && r->n_docs > 0) {
+      r->mode = RD_HEREDOC;
+      r->cur_doc = 0;
+      r->line_start = sb->len;
+    }
+  } else if (isspace(c)) {
+    rd_end_word(r);
+  } else {
+    rd_word_char(r, c);
+  }
+  r->prev = c;
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the script_reader_t calls. All documentation
+ * is in the script.h file.
+ *
+ **********************************************************************/
+
+script_reader_t *
+script_reader_new()
+{
+  script_reader_t *r = calloc(1, sizeof(script_reader_t));
+  if (!r)
+    return NULL;
+  r->cmd_start = true;
+  if (!sb_append(&r->text, "", 0)) {
+    free(r);
+    return NULL;
+  }
+  return r;
+}
+
+
+void
+script_reader_free(script_reader_t *reader)
+{
+  if (!reader)
+    return;
+  free(reader->text.buf);
+  free(reader);
+}
+
+
+int
+script_reader_feed(script_reader_t *reader, const char *chunk, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+    rd_step(reader, chunk[i]);
+  return reader->text.failed ? -1 : 0;
+}
+
+
+bool
+script_reader_complete(script_reader_t *r)
+{
+  // the last body line of a here-document may be missing its newline
+  if (r->mode == RD_HEREDOC && r->cur_doc == r->n_docs - 1
+      && r->line_start < r->text.len) {
+    script_reader_t probe = *r;
+    rd_end_body_line(&probe, r->text.len);
+    if (probe.mode == RD_NORMAL)
+      return !r->pending_op && r->compound_depth == 0;
+  }
+
+  // an unfinished delimiter word, or "<<" right at the end, still
+  // needs its body
+  bool open_heredoc = r->n_docs > 0 || r->lt_run == 2
+                      || (r->mode == RD_DELIM && r->delim_len > 0);
+
+  return (r->mode == RD_NORMAL || r->mode == RD_DELIM) && !open_heredoc && !r->joined
+         && r->subst_depth == 0 && !r->pending_op && r->compound_depth == 0;
+}
+
+
+bool
+script_reader_empty(script_reader_t *reader)
+{
+  return !reader->seen_word;
+}
+
+
+char *
+script_reader_take(script_reader_t *reader)
+{
+  char *text = reader->text.buf;
+  if (reader->text.failed) {
+    free(text);
+    text = NULL;
+  } else if (reader->text.len > 0 && text[reader->text.len - 1] == '\n') {
+    text[reader->text.len - 1] = '\0';
+  }
+
+  memset(reader, 0, sizeof(*reader));
+  reader->cmd_start = true;
+  sb_append(&reader->text, "", 0);
+  return text;
+}
+
+
+/**********************************************************************
+ *
+ * Parser
+ *
+ **********************************************************************/
+
+static void
+node_free(node_t *node)
+{
+  while (node) {
+    node_t *next = node->next;
+
+    free(node->text);
+    command_free(node->cmd);
+    node_free(node->cond);
+    node_free(node->body);
+    node_free(node->else_part);
+    free(node->var);
+    script_free(node->func);
+    free(node);
+
+    node = next;
+  }
+}
+
+static node_t *
+node_new(node_type_t type)
+{
+  node_t *node = calloc(1, sizeof(node_t));
+  if (node)
+    node->type = type;
+  return node;
+}
+
+/*
+ * Returns true if the current token is the unquoted word kw
+ */
+static bool
+at_word(pstate_t *ps, const char *kw)
+{
+  token_t *t = &ps->toks[ps->pos];
+  return t->type == TOK_WORD && t->len == strlen(kw)
+    && strncmp(t->start, kw, t->len) == 0;
+}
+
+static void
+fail(pstate_t *ps, const char *fmt, const char *word, int word_len)
+{
+  if (!ps->failed)
+    snprintf(ps->err_msg, ps->err_msg_len, fmt, word_len, word);
+  ps->failed = true;
+}
+
+/*
+ * Reports an error for the current token, which was not expected
+ */
+static void
+fail_unexpected(pstate_t *ps, const char *expected)
+{
+  token_t *t = &ps->toks[ps->pos];
+
+  if (t->type == TOK_EOF && expected)
+    fail(ps, "Syntax error: missing '%.*s'", expected, strlen(expected));
+  else if (t->type == TOK_EOF)
+    fail(ps, "Syntax error: unexpected end of input%.*s", "", 0);
+  else if (t->type == TOK_SEP && *t->start == '\n')
+    fail(ps, "Syntax error: unexpected newline%.*s", "", 0);
+  else
+    fail(ps, "Syntax error: unexpected '%.*s'", t->start, t->len);
+}
+
+/*
+ * Consumes the keyword kw, or fails if it is not the current token
+ */
+static bool
+expect_word(pstate_t *ps, const char *kw)
+{
+  if (!at_word(ps, kw)) {
+    fail_unexpected(ps, kw);
+    return false;
+  }
+  ps->pos++;
+  return true;
+}
+
+/*
+ * Returns true if text needs to be expanded each time it is run,
+ * because it contains a variable or something that may glob, or a
+ * process substitution, whose argument is replaced when it runs
+ */
+static bool
+is_dynamic(const char *text)
+{
+  return strpbrk(text, "$*?[{~(") != NULL;
+}
+
+/*
+ * Consumes words up to the next separator and stores them in node,
+ * either as a ready-made command or as source text
+ */
+static bool
+parse_words(pstate_t *ps, node_t *node)
+{
+  token_t *first = &ps->toks[ps->pos];
+  token_t *last = first;
+
+  while (ps->toks[ps->pos].type == TOK_WORD)
+    last = &ps->toks[ps->pos++];
+
+  if (last->type != TOK_WORD) {
+    // no words at all
+    node->cmd = command_new();
+    return node->cmd != NULL;
+  }
+
+  size_t len = last->start + last->len - first->start;
+  node->text = strndup(first->start, len);
+  if (!node->text) {
+    fail(ps, "%.*s", "Out of memory", 13);
+    return false;
+  }
+
+  if (is_dynamic(node->text))
+    return true;
+
+  node->cmd = parse_input(node->text, ps->err_msg, ps->err_msg_len);
+  if (!node->cmd) {
+    ps->failed = true;
+    return false;
+  }
+  free(node->text);
+  node->text = NULL;
+  return true;
+}
+
+/*
+ * Returns true if the len characters at name form a valid function
+ * or variable name
+ */
+static bool
+is_name(const char *name, size_t len)
+{
+  if (len == 0)
+    return false;
+  for (size_t i = 0; i < len; i++)
+    if (!isalnum(name[i]) && name[i] != '_')
+      return false;
+  return true;
+}
+
+static node_t *parse_list(pstate_t *ps, const char *terms[]);
+
+/*
+ * Parses the remainder of an if or elif clause; the keyword has
+ * already been consumed
+ */
+static node_t *
+parse_if(pstate_t *ps)
+{
+  static const char *then_terms[] = {"then", NULL};
+  static const char *body_terms[] = {"elif", "else", "fi", NULL};
+  static const char *else_terms[] = {"fi", NULL};
+
+  node_t *node = node_new(NODE_IF);
+  if (!node)
+    return NULL;
+
+  node->cond = parse_list(ps, then_terms);
+  if (!node->cond || !expect_word(ps, "then"))
+    goto error;
+
+  node->body = parse_list(ps, body_terms);
+  if (!node->body)
+    goto error;
+
+  if (at_word(ps, "elif")) {
+    ps->pos++;
+    node->else_part = parse_if(ps);
+    if (!node->else_part)
+      goto error;
+    return node;
+  }
+
+  if (at_word(ps, "else")) {
+    ps->pos++;
+    node->else_part = parse_list(ps, else_terms);
+    if (!node->else_part)
+      goto error;
+  }
+
+  if (!expect_word(ps, "fi"))
+    goto error;
+  return node;
+
+ error:
+  node_free(node);
+  return NULL;
+}
+
+static node_t *
+parse_while(pstate_t *ps)
+{
+  static const char *do_terms[] = {"do", NULL};
+  static const char *done_terms[] = {"done", NULL};
+
+  node_t *node = node_new(NODE_WHILE);
+  if (!node)
+    return NULL;
+
+  ps->pos++;
+  node->cond = parse_list(ps, do_terms);
+  if (!node->cond || !expect_word(ps, "do"))
+    goto error;
+
+  node->body = parse_list(ps, done_terms);
+  if (!node->body || !expect_word(ps, "done"))
+    goto error;
+
+  return node;
+
+ error:
+  node_free(node);
+  return NULL;
+}
+
+static node_t *
+parse_for(pstate_t *ps)
+{
+  static const char *done_terms[] = {"done", NULL};
+
+  node_t *node = node_new(NODE_FOR);
+  if (!node)
+    return NULL;
+
+  ps->pos++;
+  token_t *name = &ps->toks[ps->pos];
+  if (name->type != TOK_WORD) {
+    fail_unexpected(ps, "in");
+    goto error;
+  }
+  if (!is_name(name->start, name->len)) {
+    fail(ps, "Syntax error: bad for variable '%.*s'", name->start, name->len);
+    goto error;
+  }
+  node->var = strndup(name->start, name->len);
+  ps->pos++;
+
+  if (!expect_word(ps, "in") || !parse_words(ps, node))
+    goto error;
+
+  while (ps->toks[ps->pos].type == TOK_SEP)
+    ps->pos++;
+
+  if (!expect_word(ps, "do"))
+    goto error;
+
+  node->body = parse_list(ps, done_terms);
+  if (!node->body || !expect_word(ps, "done"))
+    goto error;
+
+  return node;
+
+ error:
+  node_free(node);
+  return NULL;
+}
+
+/*
+ * If the current tokens start a function definition, either "NAME()"
+ * or "NAME ()", returns the length of NAME; otherwise returns 0
+ */
+static size_t
+funcdef_name_len(pstate_t *ps)
+{
+  token_t *t = &ps->toks[ps->pos];
+
+  if (t->type != TOK_WORD)
+    return 0;
+  if (t->len > 2 && strncmp(t->start + t->len - 2, "()", 2) == 0
+      && is_name(t->start, t->len - 2))
+    return t->len - 2;
+
+  token_t *next = t + 1;
+  if (next->type == TOK_WORD && next->len == 2
+      && strncmp(next->start, "()", 2) == 0 && is_name(t->start, t->len))
+    return t->len;
+
+  return 0;
+}
+
+static node_t *
+parse_funcdef(pstate_t *ps, size_t name_len)
+{
+  static const char *brace_terms[] = {"}", NULL};
+
+  node_t *node = node_new(NODE_FUNCDEF);
+  if (!node)
+    return NULL;
+
+  node->var = strndup(ps->toks[ps->pos].start, name_len);
+  ps->pos += (ps->toks[ps->pos].len == name_len) ? 2 : 1;
+
+  // the body may start on the next line
+  while (ps->toks[ps->pos].type == TOK_SEP && *ps->toks[ps->pos].start == '\n')
+    ps->pos++;
+
+  node->func = calloc(1, sizeof(script_t));
+  if (!node->var || !node->func || !expect_word(ps, "{"))
+    goto error;
+  node->func->refs = 1;
+
+  node->func->list = parse_list(ps, brace_terms);
+  if (!node->func->list || !expect_word(ps, "}"))
+    goto error;
+
+  return node;
+
+ error:
+  node_free(node);
+  return NULL;
+}
+
+/*
+ * Parses one command, simple or compound
+ */
+static node_t *
+parse_command(pstate_t *ps)
+{
+  if (ps->toks[ps->pos].type != TOK_WORD) {
+    fail_unexpected(ps, NULL);
+    return NULL;
+  }
+
+  size_t name_len = funcdef_name_len(ps);
+  if (name_len > 0)
+    return parse_funcdef(ps, name_len);
+
+  if (at_word(ps, "if")) {
+    ps->pos++;
+    return parse_if(ps);
+  }
+  if (at_word(ps, "while"))
+    return parse_while(ps);
+  if (at_word(ps, "for"))
+    return parse_for(ps);
+
+  for (int i = 0; reserved_words[i]; i++) {
+    if (at_word(ps, reserved_words[i])) {
+      fail_unexpected(ps, NULL);
+      return NULL;
+    }
+  }
+
+  node_t *node = node_new(NODE_SIMPLE);
+  if (node && !parse_words(ps, node)) {
+    node_free(node);
+    return NULL;
+  }
+  return node;
+}
+
+/*
+ * Parses commands joined by && and ||, which group from the left so
+ * that "a && b || c" runs c if either a or b fails. A newline may
+ * follow an operator.
+ */
+static node_t *
+parse_and_or(pstate_t *ps)
+{
+  node_t *left = parse_command(ps);
+
+  while (left) {
+    tok_type_t op = ps->toks[ps->pos].type;
+    if (op != TOK_AND && op != TOK_OR)
+      break;
+    ps->pos++;
+
+    while (ps->toks[ps->pos].type == TOK_SEP && *ps->toks[ps->pos].start == '\n')
+      ps->pos++;
+
+    node_t *node = node_new(op == TOK_AND ? NODE_AND : NODE_OR);
+    if (!node) {
+      node_free(left);
+      return NULL;
+    }
+    node->cond = left;
+    left = node;
+
+    if (ps->toks[ps->pos].type != TOK_WORD) {
+      fail_unexpected(ps, NULL);
+      break;
+    }
+    node->body = parse_command(ps);
+    if (!node->body)
+      break;
+  }
+
+  if (ps->failed) {
+    node_free(left);
+    return NULL;
+  }
+  return left;
+}
+
+/*
+ * Parses a list of commands, up to the end of input or one of the
+ * keywords in terms. If terms is NULL, the list runs to the end of
+ * input. An empty list is an error unless terms is NULL; the empty
+ * top-level list is returned as a single empty command.
+ */
+static node_t *
+parse_list(pstate_t *ps, const char *terms[])
+{
+  node_t *head = NULL;
+  node_t **tail = &head;
+
+  while (1) {
+    while (ps->toks[ps->pos].type == TOK_SEP)
+      ps->pos++;
+
+    if (ps->toks[ps->pos].type == TOK_EOF)
+      break;
+
+    bool at_term = false;
+    for (int i = 0; terms && terms[i]; i++)
+      if (at_word(ps, terms[i]))
+        at_term = true;
+    if (at_term)
+      break;
+
+    token_t *first = &ps->toks[ps->pos];
+    node_t *node = parse_and_or(ps);
+    if (!node)
+      goto error;
+
+    // a trailing & runs everything since the last separator as a job
+    if (ps->toks[ps->pos].type == TOK_AMP) {
+      token_t *last = &ps->toks[ps->pos - 1];
+      node_t *job = node_new(NODE_BACKGROUND);
+      if (!job) {
+        node_free(node);
+        goto error;
+      }
+      job->body = node;
+      job->text = strndup(first->start, last->start + last->len - first->start);
+      node = job;
+    }
+
+    *tail = node;
+    tail = &node->next;
+
+    if (node->type == NODE_BACKGROUND) {
+      ps->pos++;        // the & separates this command from the next
+      continue;
+    }
+
+    // a compound command must be followed by a separator
+    tok_type_t next = ps->toks[ps->pos].type;
+    if (next != TOK_SEP && next != TOK_EOF) {
+      fail_unexpected(ps, NULL);
+      goto error;
+    }
+  }
+
+  if (!head) {
+    if (terms) {
+      fail_unexpected(ps, terms[0]);
+      return NULL;
+    }
+    head = node_new(NODE_SIMPLE);
+    if (head)
+      head->cmd = command_new();
+  }
+
+  return head;
+
+ error:
+  node_free(head);
+  return NULL;
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the script_t calls. All documentation is in
+ * the script.h file.
+ *
+ **********************************************************************/
+
+script_t *
+script_parse(const char *input, char *err_msg, size_t err_msg_len)
+{
+  pstate_t ps = {
+    .pos = 0, .failed = false, .err_msg = err_msg, .err_msg_len = err_msg_len
+  };
+
+  // the tokens point into the inlined copy until parsing is done
+  char *inlined = NULL;
+  if (strstr(input, "<<")) {
+    if (!(inlined = inline_heredocs(input, err_msg, err_msg_len)))
+      return NULL;
+    input = inlined;
+  }
+
+  ps.toks = tokenize(input, err_msg, err_msg_len);
+  if (!ps.toks) {
+    free(inlined);
+    return NULL;
+  }
+
+  node_t *list = parse_list(&ps, NULL);
+  free(ps.toks);
+  free(inlined);
+
+  if (!list) {
+    if (!ps.failed)
+      strncpy(err_msg, "Out of memory", err_msg_len);
+    return NULL;
+  }
+
+  script_t *script = malloc(sizeof(script_t));
+  if (!script) {
+    node_free(list);
+    strncpy(err_msg, "Out of memory", err_msg_len);
+    return NULL;
+  }
+  script->list = list;
+  script->refs = 1;
+  return script;
+}
+
+
+void
+script_free(script_t *script)
+{
+  if (!script || --script->refs > 0)
+    return;
+  node_free(script->list);
+  free(script);
+}
+
+
+/*
+ * Lookahead: a helper thread that expands the next command while the
+ * current one runs. The shell hands over one node at a time, and
+ * takes the result back before it hands over another.
+ */
+typedef enum { LA_IDLE, LA_WORKING, LA_DONE } la_state_t;
+
+static struct {
+  bool (*runs_apart)(command_t *cmd);
+  pid_t owner;                  // the process the helper belongs to
+  bool started;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  la_state_t state;
+  node_t *node;                 // the command being expanded
+  parser_ctx_t *ctx;            // what it is expanded with
+  command_t *cmd;               // the result, or NULL on error
+  dircache_record_t *dirs;      // the directories its globs read
+} la = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+
+static void *
+lookahead_main(void *arg)
+{
+  pthread_mutex_lock(&la.lock);
+  for (;;) {
+    while (la.state != LA_WORKING)
+      pthread_cond_wait(&la.cond, &la.lock);
+    pthread_mutex_unlock(&la.lock);
+
+    dircache_record_start();
+    command_t *cmd = parse_input_r(la.ctx, la.node->text);
+    dircache_record_t *dirs = dircache_record_stop();
+
+    pthread_mutex_lock(&la.lock);
+    la.cmd = cmd;
+    la.dirs = dirs;
+    la.state = LA_DONE;
+    pthread_cond_broadcast(&la.cond);
+  }
+  return NULL;
+}
+
+/*
+ * Hands next to the helper if it may be expanded while cmd runs
+ */
+static void
+lookahead_start(node_t *next, command_t *cmd)
+{
+  if (!la.runs_apart || !next || next->type != NODE_SIMPLE || !next->text
+      || la.state != LA_IDLE || getpid() != la.owner
+      || strstr(next->text, "$?") || strstr(next->text, "$(")
+      || !la.runs_apart(cmd))
+    return;
+
+  if (!la.started) {
+    // signals stay with the shell's main thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    la.started = (pthread_create(&la.thread, NULL, lookahead_main, NULL) == 0);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (!la.started) {
+      la.runs_apart = NULL;
+      return;
+    }
+  }
+
+  parser_ctx_t *ctx = parser_ctx_snapshot(next->text);
+  if (!ctx)
+    return;
+
+  pthread_mutex_lock(&la.lock);
+  la.node = next;
+  la.ctx = ctx;
+  la.state = LA_WORKING;
+  pthread_cond_broadcast(&la.cond);
+  pthread_mutex_unlock(&la.lock);
+}
+
+/*
+ * Returns the command prepared for node, if there is one and it is
+ * still good, and the caller must free it; otherwise NULL. Any other
+ * prepared command is thrown away.
+ */
+static command_t *
+lookahead_take(node_t *node)
+{
+  // a forked child has no helper, only a copy of its state
+  if (!la.started || getpid() != la.owner)
+    return NULL;
+
+  pthread_mutex_lock(&la.lock);
+  if (la.state == LA_IDLE) {
+    pthread_mutex_unlock(&la.lock);
+    return NULL;
+  }
+  while (la.state == LA_WORKING)
+    pthread_cond_wait(&la.cond, &la.lock);
+  command_t *cmd = la.cmd;
+  dircache_record_t *dirs = la.dirs;
+  bool same = (la.node == node);
+  la.state = LA_IDLE;
+  pthread_mutex_unlock(&la.lock);
+
+  parser_ctx_free(la.ctx);
+  if (!same || !cmd || !dirs || !dircache_record_unchanged(dirs)) {
+    command_free(cmd);
+    cmd = NULL;
+  }
+  dircache_record_free(dirs);
+  return cmd;
+}
+
+
+/*
+ * Returns the command held by node, expanding it first if it was
+ * stored as text. If *owned is set on return, the caller must free
+ * the command. Returns NULL and prints the error if expansion fails.
+ */
+static command_t *
+node_command(node_t *node, bool *owned)
+{
+  char err_msg[512];
+
+  *owned = false;
+  if (node->cmd)
+    return node->cmd;
+
+  command_t *cmd = lookahead_take(node);
+  if (cmd) {
+    *owned = true;
+    return cmd;
+  }
+
+  uint64_t parse_start = timing_begin();
+  cmd = parse_input(node->text, err_msg, sizeof(err_msg));
+  timing_end(STAGE_PARSE, parse_start);
+  if (!cmd) {
+    printf(" Error: %s\n", err_msg);
+    return NULL;
+  }
+  *owned = true;
+  return cmd;
+}
+
+static int run_list(node_t *node, script_exec_fn exec);
+
+/*
+ * FNV-1a hash of a function name, reduced to a bucket index
+ */
+static unsigned int
+func_hash(const char *name)
+{
+  unsigned int h = 2166136261u;
+  for (; *name; name++)
+    h = (h ^ (unsigned char)*name) * 16777619u;
+  return h & (FUNC_TABLE_SIZE - 1);
+}
+
+/*
+ * Adds or replaces a function; the table takes a reference to body
+ */
+static int
+define_function(const char *name, script_t *body)
+{
+  func_t **slot = &func_table[func_hash(name)];
+
+  for (func_t *f = *slot; f; f = f->next) {
+    if (strcmp(f->name, name) == 0) {
+      body->refs++;
+      script_free(f->body);
+      f->body = body;
+      return 0;
+    }
+  }
+
+  func_t *f = malloc(sizeof(func_t));
+  if (!f || !(f->name = strdup(name))) {
+    free(f);
+    fprintf(stderr, "%s: Out of memory\n", name);
+    return 1;
+  }
+  body->refs++;
+  f->body = body;
+  f->next = *slot;
+  *slot = f;
+  return 0;
+}
+
+static int
+run_node(node_t *node, script_exec_fn exec)
+{
+  int status = 0;
+  bool owned;
+  command_t *cmd;
+  pid_t pid;
+
+  switch (node->type) {
+    case NODE_SIMPLE:
+      cmd = node_command(node, &owned);
+      if (!cmd)
+        return 1;
+      if (command_get_argc(cmd) > 0) {
+        lookahead_start(node->next, cmd);
+        status = exec(cmd);
+        parser_set_last_status(status);
+      }
+      if (owned)
+        command_free(cmd);
+      return status;
+
+    case NODE_IF:
+      if (run_list(node->cond, exec) == 0)
+        return run_list(node->body, exec);
+      if (node->else_part)
+        return run_list(node->else_part, exec);
+      return 0;
+
+    case NODE_WHILE:
+      while (run_list(node->cond, exec) == 0)
+        status = run_list(node->body, exec);
+      return status;
+
+    case NODE_FOR:
+      cmd = node_command(node, &owned);
+      if (!cmd)
+        return 1;
+      char * const *argv = command_get_argv(cmd);
+      for (int i = 0; argv[i]; i++) {
+        setenv(node->var, argv[i], 1);
+        status = run_list(node->body, exec);
+      }
+      if (owned)
+        command_free(cmd);
+      return status;
+
+    case NODE_FUNCDEF:
+      return define_function(node->var, node->func);
+
+    case NODE_BACKGROUND:
+      pid = jobs_fork(node->text ? node->text : "");
+      if (pid != 0)
+        return (pid < 0) ? 1 : 0;
+      status = run_node(node->body, exec);
+      fflush(NULL);
+      _exit(status);
+
+    case NODE_AND:
+      status = run_node(node->cond, exec);
+      return (status == 0) ? run_node(node->body, exec) : status;
+
+    case NODE_OR:
+      status = run_node(node->cond, exec);
+      return (status != 0) ? run_node(node->body, exec) : status;
+  }
+
+  return status;
+}
+
+static int
+run_list(node_t *node, script_exec_fn exec)
+{
+  int status = 0;
+
+  for (; node; node = node->next)
+    status = run_node(node, exec);
+
+  return status;
+}
+
+
+int
+script_run(script_t *script, script_exec_fn exec)
+{
+  if (!script)
+    return 0;
+  return run_list(script->list, exec);
+}
+
+
+void
+script_set_lookahead(bool (*runs_apart)(command_t *cmd))
+{
+  la.runs_apart = runs_apart;
+  la.owner = getpid();
+}
+
+
+script_t *
+script_find_function(const char *name)
+{
+  for (func_t *f = func_table[func_hash(name)]; f; f = f->next)
+    if (strcmp(f->name, name) == 0)
+      return f->body;
+  return NULL;
+}
+
+
+int
+script_call_function(script_t *func, command_t *cmd, script_exec_fn exec)
+{
+  if (func_depth >= MAX_FUNC_DEPTH) {
+    fprintf(stderr, "%s: Function nesting too deep\n", command_get_argv(cmd)[0]);
+    return 1;
+  }
+
+  // hold a reference in case the function redefines itself
+  func->refs++;
+  func_depth++;
+  char * const *saved = parser_set_positional(command_get_argv(cmd));
+
+  int status = run_list(func->list, exec);
+
+  parser_set_positional(saved);
+  func_depth--;
+  script_free(func);
+  return status;
+}
@@ -0,0 +1,236 @@
+/*
+ * script.h
+ *
+ * Parses a line of shell input into a tree of command lists and
+ * compound commands (if/while/for/functions) sitting above
+ * command_t, and executes that tree in-process
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _SCRIPT_H_
+#define _SCRIPT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "command.h"
+
+typedef struct script_s script_t;
+
+/*
+ * Callback used by script_run() to execute one simple command.
+ *
+ * Parameters:
+ *   cmd     The command to execute; argc is always >= 1
+ *
+ * Returns:
+ *   The exit status of the command: 0 means success ("true"), and
+ *   any other value means failure ("false")
+ */
+typedef int (*script_exec_fn)(command_t *cmd);
+
+/*
+ * Parses input into a newly allocated script_t.
+ *
+ * The input is a sequence of commands separated by unquoted and
+ * unescaped ';' characters or newlines. Each command is either a
+ * simple command, exactly as accepted by parse_input(), or one of
+ * the compound commands below. Keywords are only recognized as the
+ * first word of a command, so "echo if" is an ordinary command.
+ *
+ * Commands may also be joined with "&&", which runs the right-hand
+ * command only if the left-hand one succeeded, and "||", which runs
+ * it only if the left-hand one failed. Both operators have equal
+ * precedence and group from the left, as in other shells:
+ *
+ *   make && ./test || echo "build or test failed"
+ *
+ * Ending a command (or an && / || chain) with '&' instead of ';'
+ * runs it in the background as a job; see jobs.h.
+ *
+ *   if LIST; then LIST; [elif LIST; then LIST;]... [else LIST;] fi
+ *   while LIST; do LIST; done
+ *   for NAME in [WORD...]; do LIST; done
+ *   NAME() { LIST; }
+ *
+ * The line is tokenized exactly once. Simple commands that contain
+ * no variables and no glob characters are turned into a command_t
+ * here and reused on every execution; the remaining ones keep their
+ * source text and are expanded with parse_input() each time they
+ * run, so that "$x" inside a loop body sees the current value.
+ *
+ * A "<<DELIM" redirection starts a here-document: the lines after the
+ * current one, up to a line holding only DELIM, are fed to the
+ * command's stdin as if by the here-string <<< (see parse_input()).
+ * Variables in the body are expanded unless DELIM is quoted, and
+ * "<<-DELIM" also strips leading tabs from each line:
+ *
+ *   cat <<EOF
+ *   Hello, $USER
+ *   EOF
+ *
+ * For loops assign each word to the environment variable NAME in
+ * turn, in the same way as the setenv builtin.
+ *
+ * Running a function definition stores its body in the function
+ * table under NAME, replacing any earlier definition; see
+ * script_find_function().
+ *
+ * Parameters:
+ *   input        Input as typed by the user
+ *   err_msg      In case of error, an error message will be returned
+ *                  in this string
+ *   err_msg_len  Length of the err_msg string
+ *
+ * Returns:
+ *   A newly-allocated script_t, which the caller must free via
+ *   script_free(). If the input holds only whitespace, the script
+ *   is empty and running it does nothing.
+ *
+ *   In case of error, copies a descriptive error message into
+ *   err_msg and returns NULL. Besides the errors from parse_input(),
+ *   this may be "Syntax error: unexpected '<word>'" or "Syntax
+ *   error: missing '<keyword>'".
+ */
+script_t *script_parse(const char *input, char *err_msg, size_t err_msg_len);
+
+/*
+ * Collects input for script_parse() as it arrives, a line or any
+ * other chunk at a time, and says when it forms a complete script.
+ * Input is incomplete while it is inside a double-quoted string or a
+ * process substitution, after a trailing "&&" or "||", inside an
+ * if/while/for/function body that has not been closed, or before
+ * the delimiter of a here-document. A backslash before a newline
+ * joins the two lines, and both characters are removed.
+ *
+ * The reader is a state machine whose state is kept between calls,
+ * so each chunk is scanned once, and reading a script of any number
+ * of lines takes time linear in its length.
+ */
+typedef struct script_reader_s script_reader_t;
+
+/*
+ * Creates an empty reader
+ *
+ * Returns:
+ *   The reader, to be freed with script_reader_free(), or NULL if out
+ *   of memory
+ */
+script_reader_t *script_reader_new();
+
+/*
+ * Deletes a reader. Passing NULL is allowed.
+ */
+void script_reader_free(script_reader_t *reader);
+
+/*
+ * Adds the next len characters of input. A chunk may end anywhere,
+ * even in the middle of a word or a quoted string.
+ *
+ * Returns:
+ *   0 on success, -1 if out of memory
+ */
+int script_reader_feed(script_reader_t *reader, const char *chunk, size_t len);
+
+/*
+ * Returns true if the input fed so far is complete, so that the
+ * caller should parse it rather than read more. Input that is
+ * complete may still fail to parse, as "fi" does.
+ */
+bool script_reader_complete(script_reader_t *reader);
+
+/*
+ * Returns true if nothing but whitespace has been fed since the
+ * reader was created or last taken from
+ */
+bool script_reader_empty(script_reader_t *reader);
+
+/*
+ * Takes the input fed so far, with continuations removed and without
+ * a final newline, and empties the reader for the next script.
+ *
+ * Returns:
+ *   The text, which the caller must free, or NULL if out of memory
+ */
+char *script_reader_take(script_reader_t *reader);
+
+/*
+ * Deletes a previously parsed script. Passing NULL is allowed.
+ *
+ * Parameters:
+ *   script   The script to be freed
+ */
+void script_free(script_t *script);
+
+/*
+ * Executes a parsed script. The script is not modified, so it may be
+ * run any number of times.
+ *
+ * Parameters:
+ *   script   The script to execute
+ *   exec     Called once for every simple command that runs
+ *
+ * Returns:
+ *   The exit status of the last command executed, or 0 if no command
+ *   was executed. The status of each simple command is also passed
+ *   to parser_set_last_status() so that it is available as $?. If a simple command fails to expand at run time
+ *   (for instance, an undefined variable), the error is printed to
+ *   stdout in the same form as mainloop() uses and the status is 1.
+ */
+int script_run(script_t *script, script_exec_fn exec);
+
+/*
+ * Turns on lookahead in script_run(). While a simple command runs
+ * apart from the shell, the next simple command in the same list is
+ * expanded on a helper thread, so that its variables and globs are
+ * ready when the first one finishes:
+ *
+ *   cc -c a.c; ls *.o; wc -l $LOG
+ *
+ * The prepared command is only used if nothing it depended on can
+ * have changed. Variables and the cwd cannot, because the running
+ * command is not in the shell. Every directory its globs read must
+ * still have the same modification time. Commands using $? or
+ * $((...)), whose value the running command may decide or which set
+ * variables, are never prepared ahead. Otherwise the command is
+ * expanded again as usual, so the result is always what running the
+ * list one command at a time would give.
+ *
+ * Parameters:
+ *   runs_apart   Returns true if cmd will run in a child process,
+ *                  without touching the shell's variables, cwd or
+ *                  functions; NULL turns lookahead off
+ */
+void script_set_lookahead(bool (*runs_apart)(command_t *cmd));
+
+/*
+ * Looks up a shell function by name.
+ *
+ * Parameters:
+ *   name     The function name, normally argv[0] of a command
+ *
+ * Returns:
+ *   The function body, or NULL if no function by that name has been
+ *   defined. The body stays valid until the function is redefined.
+ */
+script_t *script_find_function(const char *name);
+
+/*
+ * Calls a shell function in the current process. While the body
+ * runs, the positional parameters $1..$N and $# are taken from the
+ * arguments of cmd, and $0 is the function name; the caller's
+ * parameters are restored afterwards.
+ *
+ * Parameters:
+ *   func     A function body returned by script_find_function()
+ *   cmd      The command that invoked the function
+ *   exec     Called once for every simple command that runs
+ *
+ * Returns:
+ *   The exit status of the last command run by the function. If
+ *   calls are nested too deeply (see MAX_FUNC_DEPTH in script.c), an
+ *   error is printed and the status is 1.
+ */
+int script_call_function(script_t *func, command_t *cmd, script_exec_fn exec);
+
+#endif /* _SCRIPT_H_ */
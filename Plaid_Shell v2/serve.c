@@ -0,0 +1,524 @@
+/*
+ * serve.c
+ *
+ * Unix socket server for plaidsh --serve
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#define _GNU_SOURCE         // pipe2, accept4
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/pidfd.h>
+#include "serve.h"
+#include "frame.h"
+#include "eventloop.h"
+#include "jobs.h"
+#include "dirs.h"
+
+#define LISTEN_BACKLOG 128
+#define READ_CHUNK 65536        // bytes read from a socket or pipe at once
+
+typedef struct conn_s {
+  int fd;
+  char *buf;                    // received bytes not yet parsed
+  size_t len;
+  size_t cap;
+
+  char *cwd;                    // the request being assembled
+  char **env;
+  int n_env;
+  char *cmd;                    // set once the request is complete
+
+  pid_t worker;                 // worker running the request, or 0
+  int pidfd;
+
+  struct conn_s *next;          // all connections
+  struct conn_s *next_queued;   // requests waiting for a worker
+} conn_t;
+
+static int listen_fd = -1;
+static script_exec_fn exec_fn;
+static int max_workers;
+static int n_workers = 0;
+static conn_t *conns = NULL;
+static conn_t *queue_head = NULL;
+static conn_t *queue_tail = NULL;
+
+static void on_readable(int fd, void *arg);
+
+
+/*
+ * Forgets the current request, keeping any bytes already received
+ * for the next one
+ */
+static void
+clear_request(conn_t *c)
+{
+  free(c->cwd);
+  free(c->cmd);
+  for (int i = 0; i < c->n_env; i++)
+    free(c->env[i]);
+  free(c->env);
+  c->cwd = c->cmd = NULL;
+  c->env = NULL;
+  c->n_env = 0;
+}
+
+/*
+ * Closes a connection that is neither queued nor running
+ */
+static void
+conn_close(conn_t *c)
+{
+  ev_remove_fd(c->fd);
+  close(c->fd);
+
+  for (conn_t **pc = &conns; *pc; pc = &(*pc)->next) {
+    if (*pc == c) {
+      *pc = c->next;
+      break;
+    }
+  }
+
+  clear_request(c);
+  free(c->buf);
+  free(c);
+}
+
+/*
+ * Sends an error in place of running a request, as stderr output and
+ * an exit status
+ */
+static void
+fail_request(conn_t *c, const char *what, int status)
+{
+  char msg[256];
+  int len = snprintf(msg, sizeof(msg), "plaidsh: %s: %s\n", what, strerror(errno));
+  frame_send(c->fd, FRAME_STDERR, msg, len);
+  frame_send_status(c->fd, status);
+}
+
+
+/**********************************************************************
+ *
+ * Worker processes
+ *
+ **********************************************************************/
+
+/*
+ * Runs in the grandchild: sets up the request's directory and
+ * environment, then runs the command line like handle_line() does
+ */
+static void
+run_command(conn_t *c)
+{
+  char err_msg[512];
+
+  if (c->cwd && chdir(c->cwd) != 0) {
+    fprintf(stderr, "cd: %s: %s\n", c->cwd, strerror(errno));
+    _exit(1);
+  }
+
+  // NAME=VALUE sets a variable; a bare NAME unsets it
+  for (int i = 0; i < c->n_env; i++) {
+    char *eq = strchr(c->env[i], '=');
+    if (eq) {
+      *eq = '\0';
+      setenv(c->env[i], eq + 1, 1);
+    } else {
+      unsetenv(c->env[i]);
+    }
+  }
+  dirs_init();
+
+  script_t *script = script_parse(c->cmd, err_msg, sizeof(err_msg));
+  if (script == NULL) {
+    printf(" Error: %s\n", err_msg);
+    fflush(NULL);
+    _exit(2);
+  }
+
+  int status = script_run(script, exec_fn);
+
+  // nobody is left to collect background output after we exit
+  jobs_wait_all();
+
+  fflush(NULL);
+  _exit(status);
+}
+
+/*
+ * Runs in the worker: forks the command with its output on pipes,
+ * forwards that output to the client as frames, and finally sends
+ * the exit status. Never returns.
+ */
+static void
+run_worker(conn_t *c)
+{
+  int out[2], err[2];
+
+  ev_reset_child();
+  close(listen_fd);
+  for (conn_t *other = conns; other; other = other->next)
+    if (other != c)
+      close(other->fd);
+
+  if (pipe2(out, O_CLOEXEC) != 0 || pipe2(err, O_CLOEXEC) != 0) {
+    fail_request(c, "pipe", 127);
+    _exit(0);
+  }
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    fail_request(c, "fork", 127);
+    _exit(0);
+  }
+
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_RDONLY);
+    if (null_fd >= 0) {
+      dup2(null_fd, STDIN_FILENO);
+      close(null_fd);
+    }
+    dup2(out[1], STDOUT_FILENO);
+    dup2(err[1], STDERR_FILENO);
+    close(c->fd);
+    run_command(c);
+  }
+
+  close(out[1]);
+  close(err[1]);
+
+  struct pollfd pfds[2] = {
+    { .fd = out[0], .events = POLLIN },
+    { .fd = err[0], .events = POLLIN },
+  };
+  const char types[2] = { FRAME_STDOUT, FRAME_STDERR };
+  char *chunk = malloc(READ_CHUNK);
+  bool sent = (chunk != NULL);
+
+  // forward output until both pipes reach end of file
+  while (sent && (pfds[0].fd >= 0 || pfds[1].fd >= 0)) {
+    if (poll(pfds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    for (int i = 0; i < 2; i++) {
+      if (pfds[i].fd < 0 || !pfds[i].revents)
+        continue;
+
+      ssize_t n = read(pfds[i].fd, chunk, READ_CHUNK);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0) {
+        close(pfds[i].fd);
+        pfds[i].fd = -1;
+      } else if (frame_send(c->fd, types[i], chunk, n) != 0) {
+        sent = false;       // the client has gone; stop reading
+        break;
+      }
+    }
+  }
+
+  int status;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+
+  if (sent && frame_send_status(c->fd, status) != 0)
+    sent = false;
+  _exit(sent ? 0 : 1);
+}
+
+
+/**********************************************************************
+ *
+ * Scheduling of requests onto workers
+ *
+ **********************************************************************/
+
+static void process_frames(conn_t *c);
+static void on_worker_exit(int fd, void *arg);
+
+/*
+ * Makes a connection readable again once its request has finished
+ */
+static void
+finish_request(conn_t *c)
+{
+  clear_request(c);
+  if (ev_add_fd(c->fd, on_readable, c) != 0)
+    conn_close(c);
+  else
+    process_frames(c);      // the client may already have sent more
+}
+
+/*
+ * Starts queued requests until the worker limit is reached
+ */
+static void
+start_workers()
+{
+  while (n_workers < max_workers && queue_head) {
+    conn_t *c = queue_head;
+    queue_head = c->next_queued;
+    if (!queue_head)
+      queue_tail = NULL;
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0)
+      run_worker(c);
+
+    int pidfd = (pid > 0) ? pidfd_open(pid, 0) : -1;
+    if (pidfd >= 0 && ev_add_fd(pidfd, on_worker_exit, c) == 0) {
+      c->worker = pid;
+      c->pidfd = pidfd;
+      n_workers++;
+      continue;
+    }
+
+    fail_request(c, "fork", 127);
+    if (pid > 0) {
+      kill(pid, SIGKILL);
+      waitpid(pid, NULL, 0);
+    }
+    if (pidfd >= 0)
+      close(pidfd);
+    finish_request(c);
+    break;                  // try again when the next event comes in
+  }
+}
+
+/*
+ * Called by the event loop when a worker's pidfd becomes readable,
+ * meaning the worker has exited
+ */
+static void
+on_worker_exit(int fd, void *arg)
+{
+  conn_t *c = arg;
+  int status;
+
+  while (waitpid(c->worker, &status, 0) < 0 && errno == EINTR)
+    ;
+  ev_remove_fd(fd);
+  close(fd);
+  c->worker = 0;
+  c->pidfd = -1;
+  n_workers--;
+
+  // a worker that could not deliver the exit status leaves the
+  // client waiting, so hang up to tell it
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    conn_close(c);
+  else
+    finish_request(c);
+
+  start_workers();
+}
+
+/*
+ * Queues a complete request. The connection is not read again until
+ * the request has finished, so clients send one request at a time.
+ */
+static void
+enqueue(conn_t *c)
+{
+  ev_remove_fd(c->fd);
+
+  c->next_queued = NULL;
+  if (queue_tail)
+    queue_tail->next_queued = c;
+  else
+    queue_head = c;
+  queue_tail = c;
+}
+
+/*
+ * Parses whatever frames have been received, stopping after a
+ * complete request
+ */
+static void
+process_frames(conn_t *c)
+{
+  size_t used = 0;
+
+  while (!c->cmd) {
+    char type;
+    const char *payload;
+    size_t plen;
+
+    ssize_t n = frame_parse(c->buf + used, c->len - used, &type, &payload, &plen);
+    if (n == 0)
+      break;
+    if (n < 0) {
+      conn_close(c);
+      return;
+    }
+    used += n;
+
+    char *value = strndup(payload, plen);
+    if (!value) {
+      conn_close(c);
+      return;
+    }
+
+    if (type == FRAME_CMD) {
+      c->cmd = value;
+    } else if (type == FRAME_CWD) {
+      free(c->cwd);
+      c->cwd = value;
+    } else if (type == FRAME_ENV) {
+      char **grown = realloc(c->env, (c->n_env + 1) * sizeof(char *));
+      if (!grown) {
+        free(value);
+        conn_close(c);
+        return;
+      }
+      c->env = grown;
+      c->env[c->n_env++] = value;
+    } else {
+      free(value);
+      conn_close(c);
+      return;
+    }
+  }
+
+  memmove(c->buf, c->buf + used, c->len - used);
+  c->len -= used;
+
+  if (c->cmd)
+    enqueue(c);
+}
+
+
+/**********************************************************************
+ *
+ * Connections
+ *
+ **********************************************************************/
+
+/*
+ * Called by the event loop when a client sends data or hangs up
+ */
+static void
+on_readable(int fd, void *arg)
+{
+  conn_t *c = arg;
+
+  if (c->cap - c->len < READ_CHUNK) {
+    size_t cap = c->len + READ_CHUNK;
+    char *grown = realloc(c->buf, cap);
+    if (!grown) {
+      conn_close(c);
+      return;
+    }
+    c->buf = grown;
+    c->cap = cap;
+  }
+
+  ssize_t n = recv(fd, c->buf + c->len, c->cap - c->len, MSG_DONTWAIT);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    return;
+  if (n <= 0) {
+    conn_close(c);
+    return;
+  }
+  c->len += n;
+
+  process_frames(c);
+  start_workers();
+}
+
+/*
+ * Called by the event loop when connections are waiting to be accepted
+ */
+static void
+on_accept(int fd, void *arg)
+{
+  int client;
+
+  // client sockets stay blocking, so that workers can write to them
+  // simply; this process only ever reads them with MSG_DONTWAIT
+  while ((client = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+    conn_t *c = calloc(1, sizeof(conn_t));
+    if (!c || ev_add_fd(client, on_readable, c) != 0) {
+      free(c);
+      close(client);
+      continue;
+    }
+    c->fd = client;
+    c->pidfd = -1;
+    c->next = conns;
+    conns = c;
+  }
+}
+
+/*
+ * Called by the event loop on SIGINT or SIGTERM
+ */
+static void
+on_stop_signal(int fd, void *arg)
+{
+  ev_stop();
+}
+
+
+/**********************************************************************
+ *
+ * Implementation for the serve_ call. All documentation is in the
+ * serve.h file.
+ *
+ **********************************************************************/
+
+int
+serve_run(const char *path, int max, script_exec_fn exec)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  exec_fn = exec;
+  max_workers = (max > 0) ? max : 1;
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0)
+    return -1;
+
+  unlink(path);
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+      || listen(listen_fd, LISTEN_BACKLOG) != 0
+      || ev_add_fd(listen_fd, on_accept, NULL) != 0
+      || ev_add_signal(SIGINT, on_stop_signal, NULL) < 0
+      || ev_add_signal(SIGTERM, on_stop_signal, NULL) < 0) {
+    int saved = errno;
+    close(listen_fd);
+    errno = saved;
+    return -1;
+  }
+
+  ev_loop();
+
+  ev_remove_fd(listen_fd);
+  close(listen_fd);
+  unlink(path);
+  return 0;
+}
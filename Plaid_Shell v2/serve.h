@@ -0,0 +1,39 @@
+/*
+ * serve.h
+ *
+ * Daemon mode: "plaidsh --serve /path/sock" runs commands on behalf of
+ * clients connected to a Unix socket, so that callers running many
+ * short commands pay for a fork instead of a whole shell startup.
+ * The protocol is described in frame.h.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _SERVE_H_
+#define _SERVE_H_
+
+#include "script.h"
+
+/*
+ * Listens on a Unix socket and serves requests until SIGINT or SIGTERM.
+ *
+ * Connections and worker exits are all handled by the event loop in
+ * this process. Each request runs in a worker process, which forks
+ * once more to run the command line in the requested directory and
+ * environment, exactly as if it had been typed at the prompt, and
+ * streams its output back to the client. At most max_workers requests
+ * run at once; later ones wait their turn in arrival order.
+ *
+ * Parameters:
+ *   path          Path of the socket; an existing file there is
+ *                   replaced, and it is removed on exit
+ *   max_workers   Number of requests that may run at the same time
+ *   exec          Runs each simple command, as for script_run()
+ *
+ * Returns:
+ *   0 after a clean shutdown, -1 if the socket could not be set up
+ *   (with errno set)
+ */
+int serve_run(const char *path, int max_workers, script_exec_fn exec);
+
+#endif /* _SERVE_H_ */
@@ -0,0 +1,110 @@
+/*
+ * serve_client.c
+ *
+ * Minimal client for plaidsh --serve, for testing the daemon from
+ * the command line:
+ *
+ *   serve_client SOCKET [-C DIR] [-e NAME=VALUE]... COMMAND...
+ *
+ * The remaining arguments are joined with spaces into one command
+ * line. Its output is copied to this program's stdout and stderr,
+ * and its exit status becomes this program's exit status.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "frame.h"
+
+static void
+usage()
+{
+  fprintf(stderr, "Usage: serve_client SOCKET [-C DIR] [-e NAME=VALUE]... COMMAND...\n");
+  exit(2);
+}
+
+
+int main(int argc, char *argv[])
+{
+  const char *cwd = NULL;
+  int opt;
+
+  if (argc < 2)
+    usage();
+  const char *path = argv[1];
+
+  // options follow the socket; stop at the first word of the command
+  optind = 2;
+  int fd = -1;
+  char **env = calloc(argc, sizeof(char *));
+  int n_env = 0;
+  while ((opt = getopt(argc, argv, "+C:e:")) != -1) {
+    if (opt == 'C')
+      cwd = optarg;
+    else if (opt == 'e')
+      env[n_env++] = optarg;
+    else
+      usage();
+  }
+  if (optind >= argc)
+    usage();
+
+  size_t len = 0;
+  for (int i = optind; i < argc; i++)
+    len += strlen(argv[i]) + 1;
+  char *cmd = malloc(len);
+  cmd[0] = '\0';
+  for (int i = optind; i < argc; i++) {
+    strcat(cmd, argv[i]);
+    if (i + 1 < argc)
+      strcat(cmd, " ");
+  }
+
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    perror(path);
+    return 127;
+  }
+
+  if ((cwd && frame_send(fd, FRAME_CWD, cwd, strlen(cwd)) != 0)) {
+    perror("send");
+    return 127;
+  }
+  for (int i = 0; i < n_env; i++) {
+    if (frame_send(fd, FRAME_ENV, env[i], strlen(env[i])) != 0) {
+      perror("send");
+      return 127;
+    }
+  }
+  if (frame_send(fd, FRAME_CMD, cmd, strlen(cmd)) != 0) {
+    perror("send");
+    return 127;
+  }
+
+  char *payload = malloc(FRAME_MAX + 1);
+  char type;
+  ssize_t n;
+  while ((n = frame_recv(fd, &type, payload, FRAME_MAX + 1)) >= 0) {
+    if (type == FRAME_STDOUT) {
+      fwrite(payload, 1, n, stdout);
+    } else if (type == FRAME_STDERR) {
+      fflush(stdout);
+      fwrite(payload, 1, n, stderr);
+    } else if (type == FRAME_EXIT && n == 4) {
+      return frame_status(payload);
+    } else {
+      break;
+    }
+  }
+
+  fprintf(stderr, "serve_client: connection closed without an exit status\n");
+  return 127;
+}
@@ -0,0 +1,195 @@
+/*
+ * stress_parser.c
+ *
+ * Multithreaded stress test for parse_input_r(): one thread per core,
+ * each with its own parser context, parsing lines whose expansions
+ * differ between threads, while the main thread keeps changing the
+ * environment
+ *
+ * Usage: stress_parser [total_lines]
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "parser.h"
+
+#define DEFAULT_LINES 2000000
+
+/*
+ * One input line and its expected parse. "%d" in input or expected is
+ * replaced by the thread's number. expected is the argv joined with
+ * '|', or the error message if is_error is set.
+ */
+typedef struct {
+  const char *input;
+  const char *expected;
+  const char *in_file;
+  const char *out_file;
+  bool is_error;
+} stress_case_t;
+
+static const stress_case_t cases[] = {
+  { "echo $TID",                  "echo|%d" },
+  { "cmd \"$WORD\" $1 $#",        "cmd|hello world|a%d|2" },
+  { "x $? >/tmp/out",             "x|%d", NULL, "/tmp/out" },
+  { "grep foo <in bar",           "grep|foo|bar", "in", NULL },
+  { "echo $TID$TID x%d",          "echo|%d%d|x%d" },
+  { "a\\;b\\ c \\$TID",         "a;b c|$TID" },
+  { "echo $NOPE",                 "Undefined variable: 'NOPE'", NULL, NULL, true },
+  { "echo \"open",                "Unterminated quote", NULL, NULL, true },
+  { ">file",                      "Missing command", NULL, NULL, true },
+  { "x <a <b",                    "Multiple redirections not allowed", NULL, NULL, true },
+};
+#define N_CASES (sizeof(cases) / sizeof(cases[0]))
+
+typedef struct {
+  int id;
+  long lines;
+  long failures;
+} worker_t;
+
+static atomic_int n_finished = 0;
+
+/*
+ * Substitutes the thread number for every "%d" in fmt
+ */
+static void
+expand(char *buf, size_t len, const char *fmt, int id)
+{
+  char num[16];
+  snprintf(num, sizeof(num), "%d", id);
+
+  char *b = buf;
+  while (*fmt && b < buf + len - 16) {
+    if (fmt[0] == '%' && fmt[1] == 'd') {
+      b = stpcpy(b, num);
+      fmt += 2;
+    } else {
+      *b++ = *fmt++;
+    }
+  }
+  *b = '\0';
+}
+
+/*
+ * Joins argv with '|'
+ */
+static void
+join_argv(char *buf, size_t len, command_t *cmd)
+{
+  char *b = buf;
+  *b = '\0';
+  for (char * const *a = command_get_argv(cmd); *a; a++)
+    b += snprintf(b, len - (b - buf), "%s%s", (a == command_get_argv(cmd)) ? "" : "|", *a);
+}
+
+static bool
+same(const char *a, const char *b)
+{
+  return (a == NULL) ? (b == NULL) : (b != NULL && !strcmp(a, b));
+}
+
+static void *
+run_worker(void *arg)
+{
+  worker_t *wk = arg;
+  char inputs[N_CASES][128];
+  char expected[N_CASES][128];
+  char actual[256];
+  char tid[16], pos1[16];
+
+  parser_ctx_t *ctx = parser_ctx_new();
+  snprintf(tid, sizeof(tid), "%d", wk->id);
+  snprintf(pos1, sizeof(pos1), "a%d", wk->id);
+  char *positional[] = { "stress", pos1, "b", NULL };
+
+  parser_ctx_setvar(ctx, "TID", tid);
+  parser_ctx_setvar(ctx, "WORD", "hello world");
+  parser_ctx_set_positional(ctx, positional);
+  parser_ctx_set_last_status(ctx, wk->id);
+
+  for (int i = 0; i < N_CASES; i++) {
+    expand(inputs[i], sizeof(inputs[i]), cases[i].input, wk->id);
+    expand(expected[i], sizeof(expected[i]), cases[i].expected, wk->id);
+  }
+
+  for (long n = 0; n < wk->lines; n++) {
+    int i = n % N_CASES;
+    const stress_case_t *c = &cases[i];
+    command_t *cmd = parse_input_r(ctx, inputs[i]);
+    bool ok;
+
+    if (c->is_error) {
+      ok = (cmd == NULL) && !strcmp(parser_ctx_error(ctx), expected[i]);
+    } else if (cmd) {
+      join_argv(actual, sizeof(actual), cmd);
+      ok = !strcmp(actual, expected[i])
+        && same(command_get_input(cmd), c->in_file)
+        && same(command_get_output(cmd), c->out_file);
+    } else {
+      ok = false;
+    }
+
+    if (!ok && wk->failures++ < 5)
+      fprintf(stderr, "thread %d: [%s] parsed wrongly (error '%s')\n",
+        wk->id, inputs[i], cmd ? "" : parser_ctx_error(ctx));
+    command_free(cmd);
+  }
+
+  parser_ctx_free(ctx);
+  atomic_fetch_add(&n_finished, 1);
+  return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+  long total = (argc > 1) ? atol(argv[1]) : DEFAULT_LINES;
+  int n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n_threads < 2)
+    n_threads = 2;
+
+  pthread_t threads[n_threads];
+  worker_t workers[n_threads];
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int t = 0; t < n_threads; t++) {
+    workers[t] = (worker_t){ .id = t, .lines = total / n_threads };
+    pthread_create(&threads[t], NULL, run_worker, &workers[t]);
+  }
+
+  // the workers must not notice the environment changing under them
+  for (long flips = 0; atomic_load(&n_finished) < n_threads; flips++)
+    setenv("TID", (flips & 1) ? "environ" : "changed", 1);
+
+  for (int t = 0; t < n_threads; t++)
+    pthread_join(threads[t], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  long lines = 0, failures = 0;
+  for (int t = 0; t < n_threads; t++) {
+    lines += workers[t].lines;
+    failures += workers[t].failures;
+  }
+  double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  unsigned int leaked = command_outstanding_allocs();
+
+  printf("stress_parser: %ld lines on %d threads in %.2fs (%.0f lines/s): %ld failures, %u blocks outstanding\n",
+    lines, n_threads, secs, lines / secs, failures, leaked);
+
+  if (failures || leaked) {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+  return 0;
+}
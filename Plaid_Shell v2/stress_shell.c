@@ -0,0 +1,396 @@
+/*
+ * stress_shell.c
+ *
+ * End-to-end stress harness: drives ./plaidsh through a long run of
+ * mixed builtins, redirections, external programs and failing
+ * commands, once on a pty as a user would and once over pipes as a
+ * script would. It samples the shell's open descriptors, zombie
+ * children and resident memory as it goes, and fails if any of them
+ * drift upward or if prompt-to-prompt latency degrades.
+ *
+ * Usage: stress_shell [-n commands] [-m pty|pipe]
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#define _GNU_SOURCE         // memmem
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pty.h>
+#include <sys/wait.h>
+
+#define PROMPT "plaid-shell#> "
+#define DEFAULT_COMMANDS 100000     // per mode
+#define N_SAMPLES 20                // resource samples per mode
+#define PROMPT_TIMEOUT_MS 10000     // a command this slow counts as hung
+#define RSS_SLACK_KB 1024           // RSS growth tolerated after warm-up
+#define LATENCY_SLACK 3.0           // tolerated growth of windowed p99
+#define N_LATENCY_WINDOWS 5         // windows whose p99s are compared
+
+typedef struct {
+  pid_t pid;
+  int to_shell;
+  int from_shell;
+  char buf[65536];                  // output since the last command
+  size_t len;
+} shell_t;
+
+typedef struct {
+  long commands;
+  int fds;
+  int zombies;
+  long rss_kb;
+  double p99_ms;
+} sample_t;
+
+static char out_file[64];
+
+// %d is replaced by the command number, %s by out_file
+static const char *commands[] = {
+  "true",
+  "pwd",
+  "setenv STRESS_N %d",       // glibc keeps every value ever set
+  "echo $STRESS_N > %s",
+  "cat < %s",
+  "/bin/true",
+  "false",
+  "ls /nonexistent_stress_dir",
+  "cat < /nonexistent_stress_file",
+  "no_such_command_stress",
+  "cd /tmp",
+  "echo a b c > %s",
+  "for i in 1 2 3; do true; done",
+  "f() { echo $1 > %s; }; f %d",
+  "true && echo ok || echo no",
+  "author",
+};
+#define N_COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+
+static double
+now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * Starts ./plaidsh on a pty, or with pipes for stdin and stdout
+ */
+static int
+start_shell(shell_t *sh, bool use_pty)
+{
+  memset(sh, 0, sizeof(*sh));
+
+  if (use_pty) {
+    struct winsize ws = { .ws_row = 50, .ws_col = 250 };
+    int master;
+    sh->pid = forkpty(&master, NULL, NULL, &ws);
+    if (sh->pid == 0) {
+      execl("./plaidsh", "plaidsh", (char *)NULL);
+      _exit(127);
+    }
+    sh->to_shell = sh->from_shell = master;
+  } else {
+    int in[2], out[2];
+    if (pipe(in) != 0 || pipe(out) != 0)
+      return -1;
+    sh->pid = fork();
+    if (sh->pid == 0) {
+      dup2(in[0], STDIN_FILENO);
+      dup2(out[1], STDOUT_FILENO);
+      dup2(out[1], STDERR_FILENO);
+      close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+      execl("./plaidsh", "plaidsh", (char *)NULL);
+      _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    sh->to_shell = in[1];
+    sh->from_shell = out[0];
+  }
+  return (sh->pid < 0) ? -1 : 0;
+}
+
+/*
+ * Reads shell output until a prompt appears
+ */
+static int
+wait_prompt(shell_t *sh)
+{
+  struct pollfd pfd = { .fd = sh->from_shell, .events = POLLIN };
+
+  for (;;) {
+    if (memmem(sh->buf, sh->len, PROMPT, strlen(PROMPT)))
+      return 0;
+
+    if (poll(&pfd, 1, PROMPT_TIMEOUT_MS) <= 0)
+      return -1;
+
+    // keep only the tail of long output; the prompt is at the end
+    if (sh->len > sizeof(sh->buf) / 2) {
+      memmove(sh->buf, sh->buf + sh->len - 64, 64);
+      sh->len = 64;
+    }
+
+    ssize_t n = read(sh->from_shell, sh->buf + sh->len, sizeof(sh->buf) - sh->len);
+    if (n <= 0)
+      return -1;
+    sh->len += n;
+  }
+}
+
+/*
+ * Counts the entries in /proc/<pid>/fd
+ */
+static int
+count_fds(pid_t pid)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+
+  DIR *dir = opendir(path);
+  if (!dir)
+    return -1;
+
+  int n = 0;
+  struct dirent *de;
+  while ((de = readdir(dir)))
+    if (de->d_name[0] != '.')
+      n++;
+  closedir(dir);
+  return n;
+}
+
+/*
+ * Counts zombie processes whose parent is pid
+ */
+static int
+count_zombies(pid_t pid)
+{
+  DIR *dir = opendir("/proc");
+  if (!dir)
+    return -1;
+
+  int n = 0;
+  struct dirent *de;
+  while ((de = readdir(dir))) {
+    char path[300], stat[512];
+    snprintf(path, sizeof(path), "/proc/%s/stat", de->d_name);
+
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+      continue;
+    size_t len = fread(stat, 1, sizeof(stat) - 1, fp);
+    fclose(fp);
+    stat[len] = '\0';
+
+    // the command name may contain spaces; the fields follow its ')'
+    char *close_paren = strrchr(stat, ')');
+    char state;
+    int ppid;
+    if (close_paren && sscanf(close_paren + 1, " %c %d", &state, &ppid) == 2
+        && state == 'Z' && ppid == pid)
+      n++;
+  }
+  closedir(dir);
+  return n;
+}
+
+/*
+ * Returns the resident set size of pid in kB
+ */
+static long
+rss_kb(pid_t pid)
+{
+  char path[64];
+  long pages_total, pages_resident;
+  snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return -1;
+  int n = fscanf(fp, "%ld %ld", &pages_total, &pages_resident);
+  fclose(fp);
+  return (n == 2) ? pages_resident * (sysconf(_SC_PAGESIZE) / 1024) : -1;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * Returns the 99th percentile of n latencies, sorting them in place
+ */
+static double
+p99(double *lat, long n)
+{
+  if (n == 0)
+    return 0;
+  qsort(lat, n, sizeof(double), compare_double);
+  return lat[(long)(n * 0.99)];
+}
+
+/*
+ * Returns the median of the p99 latencies of n samples, which
+ * smooths over a single slow window on a busy machine
+ */
+static double
+median_p99(const sample_t *samples, int n)
+{
+  double p[n];
+  for (int i = 0; i < n; i++)
+    p[i] = samples[i].p99_ms;
+  qsort(p, n, sizeof(double), compare_double);
+  return p[n / 2];
+}
+
+/*
+ * Runs one stress pass and returns the number of drift failures
+ */
+static int
+run_mode(bool use_pty, long n_commands)
+{
+  shell_t sh;
+  const char *mode = use_pty ? "pty" : "pipe";
+  long window = n_commands / N_SAMPLES;
+  double *lat = malloc(window * sizeof(double));
+  sample_t samples[N_SAMPLES];
+  char line[300];
+  int failures = 0;
+
+  if (!lat || window < 1 || start_shell(&sh, use_pty) != 0 || wait_prompt(&sh) != 0) {
+    fprintf(stderr, "stress_shell: could not start ./plaidsh on a %s\n", mode);
+    return 1;
+  }
+
+  printf("%s mode: %ld commands\n", mode, n_commands);
+  printf("%10s %10s %10s %8s %8s %10s\n", "commands", "cmds/s", "p99 ms", "fds", "zombies", "rss kB");
+
+  double start = now_ms();
+  long done = 0;
+  for (int s = 0; s < N_SAMPLES; s++) {
+    double window_start = now_ms();
+
+    for (long i = 0; i < window; i++, done++) {
+      const char *fmt = commands[done % N_COMMANDS];
+      char expanded[256];
+
+      // fill in %s and %d in the order they appear
+      const char *ps = strstr(fmt, "%s"), *pd = strstr(fmt, "%d");
+      if (ps && pd && ps < pd)
+        snprintf(expanded, sizeof(expanded), fmt, out_file, (int)done);
+      else if (ps && pd)
+        snprintf(expanded, sizeof(expanded), fmt, (int)done, out_file);
+      else if (ps)
+        snprintf(expanded, sizeof(expanded), fmt, out_file);
+      else
+        snprintf(expanded, sizeof(expanded), fmt, (int)done);
+      snprintf(line, sizeof(line), "%s\n", expanded);
+
+      sh.len = 0;
+      double t0 = now_ms();
+      if (write(sh.to_shell, line, strlen(line)) < 0 || wait_prompt(&sh) != 0) {
+        fprintf(stderr, "stress_shell: no prompt after [%s]\n", expanded);
+        kill(sh.pid, SIGKILL);
+        waitpid(sh.pid, NULL, 0);
+        free(lat);
+        return 1;
+      }
+      lat[i] = now_ms() - t0;
+    }
+
+    sample_t *smp = &samples[s];
+    smp->commands = done;
+    smp->fds = count_fds(sh.pid);
+    smp->zombies = count_zombies(sh.pid);
+    smp->rss_kb = rss_kb(sh.pid);
+    smp->p99_ms = p99(lat, window);
+
+    printf("%10ld %10.0f %10.3f %8d %8d %10ld\n", done,
+      window / ((now_ms() - window_start) / 1e3), smp->p99_ms,
+      smp->fds, smp->zombies, smp->rss_kb);
+    fflush(stdout);
+  }
+  double elapsed = now_ms() - start;
+
+  // the first sample is the warm-up; compare the last against it
+  sample_t *base = &samples[0], *last = &samples[N_SAMPLES - 1];
+  if (last->fds > base->fds) {
+    printf("FAIL: open fds grew from %d to %d\n", base->fds, last->fds);
+    failures++;
+  }
+  if (last->zombies > 0) {
+    printf("FAIL: %d zombie children left\n", last->zombies);
+    failures++;
+  }
+  if (last->rss_kb > base->rss_kb + RSS_SLACK_KB) {
+    printf("FAIL: RSS grew from %ld kB to %ld kB\n", base->rss_kb, last->rss_kb);
+    failures++;
+  }
+  double early = median_p99(samples, N_LATENCY_WINDOWS);
+  double late = median_p99(samples + N_SAMPLES - N_LATENCY_WINDOWS, N_LATENCY_WINDOWS);
+  if (late > LATENCY_SLACK * early + 1.0) {
+    printf("FAIL: p99 latency grew from %.3f ms to %.3f ms\n", early, late);
+    failures++;
+  }
+
+  printf("%s mode: %.0f commands/s overall\n\n", mode, done / (elapsed / 1e3));
+
+  close(sh.to_shell);
+  if (sh.from_shell != sh.to_shell)
+    close(sh.from_shell);
+  waitpid(sh.pid, NULL, 0);
+  free(lat);
+  return failures;
+}
+
+
+int main(int argc, char *argv[])
+{
+  long n_commands = DEFAULT_COMMANDS;
+  const char *only = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:m:")) != -1) {
+    if (opt == 'n')
+      n_commands = atol(optarg);
+    else if (opt == 'm')
+      only = optarg;
+    else {
+      fprintf(stderr, "Usage: stress_shell [-n commands] [-m pty|pipe]\n");
+      return 2;
+    }
+  }
+
+  snprintf(out_file, sizeof(out_file), "/tmp/stress_shell.%d", getpid());
+  signal(SIGPIPE, SIG_IGN);
+
+  int failures = 0;
+  if (!only || !strcmp(only, "pty"))
+    failures += run_mode(true, n_commands);
+  if (!only || !strcmp(only, "pipe"))
+    failures += run_mode(false, n_commands);
+
+  unlink(out_file);
+
+  if (failures) {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+  printf("stress_shell: no drift detected\n");
+  return 0;
+}
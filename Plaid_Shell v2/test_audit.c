@@ -0,0 +1,479 @@
+/*
+ * test_audit.c
+ *
+ * Test functions for audit.c. The log can only be opened once per
+ * process, so each test logs from a forked child and then reads back
+ * what it left in a scratch directory under /tmp.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "audit.h"
+
+static char root[] = "/tmp/test_audit.XXXXXX";
+
+/*
+ * Reads a whole file and splits it into lines, which are
+ * NULL-terminated and released with free_lines()
+ *
+ * Returns:
+ *   The number of lines, or -1 if the file cannot be read
+ */
+static int
+read_lines(const char *path, char ***lines)
+{
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return -1;
+
+  char *data = NULL;
+  size_t cap = 0, len = 0, n;
+  do {
+    if (len + 4096 > cap && !(data = realloc(data, cap = 2 * cap + 4096)))
+      break;
+    n = fread(data + len, 1, cap - len - 1, fp);
+    len += n;
+  } while (n > 0);
+  fclose(fp);
+  if (!data)
+    return -1;
+  data[len] = '\0';
+
+  int count = 0;
+  for (size_t i = 0; i < len; i++)
+    count += (data[i] == '\n');
+
+  // the data is kept after the NULL, for free_lines()
+  *lines = calloc(count + 2, sizeof(char *));
+  (*lines)[count + 1] = data;
+  char *p = data;
+  for (int i = 0; i < count; i++) {
+    (*lines)[i] = p;
+    p = strchr(p, '\n');
+    *p++ = '\0';
+  }
+  return count;
+}
+
+static void
+free_lines(char **lines)
+{
+  if (!lines)
+    return;
+  int i = 0;
+  while (lines[i])
+    i++;
+  free(lines[i + 1]);
+  free(lines);
+}
+
+/*
+ * Logs one command
+ */
+static void
+log_args(const char *cwd, int status, const char *args[])
+{
+  command_t *cmd = command_new();
+  for (int i = 0; args[i]; i++)
+    command_append_arg(cmd, args[i]);
+  audit_command(cmd, cwd, status);
+  command_free(cmd);
+}
+
+/*
+ * Logs "cmd N" for N from first to last, each with a line of about
+ * line_len bytes
+ */
+static void
+log_numbered(int first, int last, int line_len)
+{
+  char num[32], pad[256];
+  memset(pad, 'x', sizeof(pad) - 1);
+  pad[line_len < sizeof(pad) ? line_len : sizeof(pad) - 1] = '\0';
+
+  for (int i = first; i <= last; i++) {
+    snprintf(num, sizeof(num), "%d", i);
+    const char *args[] = {"cmd", num, pad, NULL};
+    log_args("/", 0, args);
+  }
+}
+
+/*
+ * Checks that lines end with the commands "cmd first" ... "cmd last",
+ * in order
+ *
+ * Returns:
+ *   True if they do
+ */
+static bool
+numbered_in_order(char **lines, int count, int first, int last)
+{
+  if (count != last - first + 1)
+    return false;
+  for (int i = 0; i < count; i++) {
+    char *cmd = strrchr(lines[i], '\t');
+    if (!cmd || strncmp(cmd, "\tcmd ", 5) || atoi(cmd + 5) != first + i)
+      return false;
+  }
+  return true;
+}
+
+/*
+ * Runs fn in a forked child with its own audit log state
+ *
+ * Returns:
+ *   The child's exit status, or -1 if it did not exit
+ */
+static int
+in_child(void (*fn)(const char *log), const char *log)
+{
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    fn(log);
+    exit(0);
+  }
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+    return -1;
+  return WEXITSTATUS(status);
+}
+
+
+/*
+ * Child bodies for test_audit_exit(): many more commands than the
+ * queue holds, then an exit with the queue still full
+ */
+static void
+exit_after_flood(const char *log)
+{
+  if (audit_open(log, 0, AUDIT_KEEP) != 0)
+    _exit(2);
+  log_numbered(0, 4999, 40);
+}
+
+static void
+close_after_flood(const char *log)
+{
+  if (audit_open(log, 0, AUDIT_KEEP) != 0)
+    _exit(2);
+  log_numbered(0, 4999, 40);
+  audit_close();
+  audit_close();                  // harmless the second time
+  _exit(0);
+}
+
+static void
+forked_job(const char *log)
+{
+  if (audit_open(log, 0, AUDIT_KEEP) != 0)
+    _exit(2);
+  log_numbered(0, 9, 10);
+  nanosleep(&(struct timespec){ 0, 3 * AUDIT_FLUSH_MS * 1000000L }, NULL);
+  pid_t pid = fork();
+  if (pid == 0) {
+    log_numbered(10, 10, 10);     // straight to the log
+    _exit(0);
+  }
+  waitpid(pid, NULL, 0);
+  audit_close();
+  log_numbered(11, 11, 10);       // after closing: ignored
+}
+
+
+/*
+ * Tests that nothing queued is lost when the process exits, or when
+ * the log is closed by hand, and that a forked child's commands are
+ * logged too
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_audit_exit()
+{
+  typedef struct {
+    void (*fn)(const char *log);
+    int exp_first, exp_last;
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {exit_after_flood, 0, 4999},
+    {close_after_flood, 0, 4999},
+    {forked_job, 0, 10},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  char log[sizeof(root) + 32];
+  char **lines = NULL;
+
+  for (int i = 0; i < num_tests; i++) {
+    snprintf(log, sizeof(log), "%s/exit%d.log", root, i);
+    int status = in_child(tests[i].fn, log);
+    int count = read_lines(log, &lines);
+
+    if (status != 0)
+      printf("  FAILED: test %d: child exited with %d\n", i, status);
+    else if (!numbered_in_order(lines, count, tests[i].exp_first, tests[i].exp_last))
+      printf("  FAILED: test %d: %d lines, expected commands %d to %d in order\n", i, count,
+             tests[i].exp_first, tests[i].exp_last);
+    else
+      tests_passed++;
+    free_lines(lines);
+    lines = NULL;
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Child body for test_audit_format()
+ */
+static void
+log_awkward(const char *log)
+{
+  if (audit_open(log, 0, AUDIT_KEEP) != 0)
+    _exit(2);
+  const char *plain[] = {"ls", "-l", NULL};
+  const char *awkward[] = {"printf", "a\tb", "c\nd", "e\\f", "", "\\t", NULL};
+  log_args("/home/someone", 0, plain);
+  log_args("/tmp/odd\tdir\nname\\", -1, awkward);
+  log_args("/", 255, plain);
+}
+
+
+/*
+ * Tests the fields of each line, and the escaping of tab, newline and
+ * backslash, so that every command is one line of six fields
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_audit_format()
+{
+  typedef struct {
+    const char *cwd;
+    const char *status;
+    const char *args;
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {"/home/someone", "0", "ls -l"},
+    {"/tmp/odd\\tdir\\nname\\\\", "-1", "printf a\\tb c\\nd e\\\\f  \\\\t"},
+    {"/", "255", "ls -l"},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  char log[sizeof(root) + 32];
+  char **lines = NULL;
+
+  snprintf(log, sizeof(log), "%s/format.log", root);
+  int status = in_child(log_awkward, log);
+  int count = read_lines(log, &lines);
+  if (status != 0 || count != num_tests)
+    printf("  FAILED: child exited with %d, %d lines logged\n", status, count);
+
+  for (int i = 0; status == 0 && i < num_tests && i < count; i++) {
+    char *field[8];
+    int n = 0;
+    for (char *p = lines[i]; n < 8; p++) {
+      field[n++] = p;
+      if (!(p = strchr(p, '\t')))
+        break;
+      *p = '\0';
+    }
+
+    // 2026-10-18T09:15:02.123456Z
+    bool time_ok = strlen(field[0]) == 27 && field[0][10] == 'T' && field[0][19] == '.'
+                   && field[0][26] == 'Z';
+    if (n != 6)
+      printf("  FAILED: line %d: %d fields\n", i, n);
+    else if (!time_ok || !*field[1] || atoi(field[2]) <= 0)
+      printf("  FAILED: line %d: time \"%s\", user \"%s\", pid \"%s\"\n", i, field[0],
+             field[1], field[2]);
+    else if (strcmp(field[3], tests[i].cwd) || strcmp(field[4], tests[i].status)
+             || strcmp(field[5], tests[i].args))
+      printf("  FAILED: line %d: expected \"%s\" %s \"%s\", got \"%s\" %s \"%s\"\n", i,
+             tests[i].cwd, tests[i].status, tests[i].args, field[3], field[4], field[5]);
+    else
+      tests_passed++;
+  }
+  free_lines(lines);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Child body for test_audit_rotate(): eight bursts, each bigger than
+ * the limit, with time between them for the writer to write each
+ * burst out on its own
+ */
+static void
+log_bursts(const char *log)
+{
+  if (audit_open(log, 1000, 3) != 0)
+    _exit(2);
+  for (int b = 0; b < 8; b++) {
+    log_numbered(b * 20, b * 20 + 19, 100);
+    nanosleep(&(struct timespec){ 0, 3 * AUDIT_FLUSH_MS * 1000000L }, NULL);
+  }
+}
+
+
+/*
+ * Tests rotation to LOG.1 ... LOG.<keep>: the newest lines are in
+ * LOG, older ones in the rotated logs, oldest in LOG.<keep>, with
+ * nothing missing between them and nothing kept past LOG.<keep>
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_audit_rotate()
+{
+  const int num_tests = 3;
+  int tests_passed = 0;
+  char log[sizeof(root) + 32], path[sizeof(root) + 48];
+  char **lines = NULL;
+  struct stat st;
+
+  snprintf(log, sizeof(log), "%s/rotate.log", root);
+  int status = in_child(log_bursts, log);
+
+  // LOG.3, LOG.2, LOG.1 and LOG, oldest first, continue each other
+  int next = -1, total = 0;
+  bool contiguous = status == 0;
+  for (int k = 3; k >= 0 && contiguous; k--) {
+    if (k > 0)
+      snprintf(path, sizeof(path), "%s.%d", log, k);
+    else
+      snprintf(path, sizeof(path), "%s", log);
+    int count = read_lines(path, &lines);
+    if (count < 0 || (k > 0 && count == 0)) {
+      printf("  FAILED: %s: %s\n", path, count < 0 ? "missing" : "empty");
+      contiguous = false;
+    } else if (count > 0) {
+      char *cmd = strrchr(lines[0], '\t');
+      int first = (cmd && !strncmp(cmd, "\tcmd ", 5)) ? atoi(cmd + 5) : -2;
+      if (next < 0)
+        next = first;
+      contiguous = numbered_in_order(lines, count, next, next + count - 1);
+      next += count;
+      total += count;
+    }
+    free_lines(lines);
+    lines = NULL;
+  }
+  if (contiguous)
+    tests_passed++;
+  else
+    printf("  FAILED: rotated logs are not in order\n");
+
+  if (next == 160 && total >= 3 * 20)
+    tests_passed++;
+  else
+    printf("  FAILED: logs end before command %d, and hold %d lines\n", next, total);
+
+  snprintf(path, sizeof(path), "%s.4", log);
+  if (stat(path, &st) != 0)
+    tests_passed++;
+  else
+    printf("  FAILED: more than 3 rotated logs kept\n");
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Tests that the shell logs its exit command, which does not return
+ * to where commands are normally logged
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_audit_shell_exit()
+{
+  int tests_passed = 0;
+  char log[sizeof(root) + 32], input[sizeof(root) + 32];
+  char **lines = NULL;
+
+  snprintf(log, sizeof(log), "%s/shell.log", root);
+  snprintf(input, sizeof(input), "%s/shell.in", root);
+  FILE *fp = fopen(input, "w");
+  if (fp) {
+    fputs("echo one\nexit\necho never\n", fp);
+    fclose(fp);
+  }
+
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    int in = open(input, O_RDONLY), out = open("/dev/null", O_WRONLY);
+    dup2(in, STDIN_FILENO);
+    dup2(out, STDOUT_FILENO);
+    execl("./plaidsh", "plaidsh", "--audit", log, (char *)NULL);
+    _exit(127);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+
+  int count = read_lines(log, &lines);
+  if (count == 2 && strstr(lines[0], "\techo one") && strstr(lines[1], "\t0\texit"))
+    tests_passed++;
+  else
+    printf("  FAILED: %d lines logged, the last \"%s\"\n", count,
+           count > 0 ? lines[count - 1] : "");
+  free_lines(lines);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, 1);
+  return (tests_passed == 1);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int success = 1;
+
+  if (!mkdtemp(root)) {
+    perror("test_audit: scratch directory");
+    return 1;
+  }
+
+  success &= test_audit_exit();
+  success &= test_audit_format();
+  success &= test_audit_rotate();
+  success &= test_audit_shell_exit();
+
+  char cmd[sizeof(root) + 16];
+  snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+  if (system(cmd) != 0)
+    perror("test_audit: removing scratch directory");
+
+  if (success) {
+    printf("All audit tests succeeded!\n");
+    return 0;
+  } else {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+}
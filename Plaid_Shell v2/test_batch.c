@@ -0,0 +1,430 @@
+/*
+ * test_batch.c
+ *
+ * Test functions for batch.c. The batches are run as this program
+ * with -record as its first argument, which appends the arguments it
+ * was given to the file named by $TEST_BATCH_LOG.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "batch.h"
+
+#define MAX_BATCHES 64
+
+static char self[] = "./test_batch";
+static char log_path[] = "/tmp/test_batch.XXXXXX";
+
+/*
+ * What one run of batch_run() did, as read back from the log
+ */
+typedef struct {
+  int n_batches;
+  int counts[MAX_BATCHES];        // arguments in each batch
+  char **args;                    // all of them, in the order logged
+  int n_args;
+} record_t;
+
+
+/*
+ * The -record mode: writes "#N" and then the N arguments, one per
+ * line, in one write so that parallel batches do not interleave.
+ * Exits with status 3 if one of the arguments is "fail".
+ */
+static int
+record(int argc, char *argv[])
+{
+  size_t len = 16;
+  for (int i = 2; i < argc; i++)
+    len += strlen(argv[i]) + 1;
+
+  char *buf = malloc(len);
+  if (!buf)
+    return 126;
+  char *p = buf + sprintf(buf, "#%d\n", argc - 2);
+  int status = 0;
+  for (int i = 2; i < argc; i++) {
+    p += sprintf(p, "%s\n", argv[i]);
+    if (!strcmp(argv[i], "fail"))
+      status = 3;
+  }
+
+  int fd = open(getenv("TEST_BATCH_LOG"), O_WRONLY | O_APPEND);
+  if (fd < 0 || write(fd, buf, p - buf) != p - buf)
+    return 126;
+  close(fd);
+  free(buf);
+  return status;
+}
+
+/*
+ * Empties the log
+ */
+static void
+clear_log()
+{
+  if (truncate(log_path, 0) != 0)
+    perror(log_path);
+}
+
+/*
+ * Reads the log back into rec, which is released with free_record()
+ *
+ * Returns:
+ *   True if the log could be read
+ */
+static bool
+read_log(record_t *rec)
+{
+  memset(rec, 0, sizeof(record_t));
+
+  FILE *fp = fopen(log_path, "r");
+  if (!fp)
+    return false;
+  rec->args = batch_read_args(fp, &rec->n_args);
+  fclose(fp);
+  if (!rec->args)
+    return false;
+
+  // take the "#N" lines out of the arguments
+  int kept = 0;
+  for (int i = 0; i < rec->n_args; i++) {
+    if (rec->args[i][0] == '#') {
+      if (rec->n_batches < MAX_BATCHES)
+        rec->counts[rec->n_batches++] = atoi(rec->args[i] + 1);
+      free(rec->args[i]);
+    } else {
+      rec->args[kept++] = rec->args[i];
+    }
+  }
+  rec->args[kept] = NULL;
+  rec->n_args = kept;
+  return true;
+}
+
+static void
+free_record(record_t *rec)
+{
+  batch_free_args(rec->args);
+}
+
+/*
+ * Returns the bytes an argument takes in an exec, as batch.c counts
+ * them
+ */
+static long
+arg_bytes(const char *arg)
+{
+  return strlen(arg) + 1 + sizeof(char *);
+}
+
+/*
+ * Makes n arguments of len bytes each, "0000000...", "0000001...",
+ * so that their order can be checked
+ */
+static char **
+make_args(int n, int len)
+{
+  char **args = calloc(n + 1, sizeof(char *));
+  for (int i = 0; args && i < n; i++) {
+    if (!(args[i] = malloc(len + 1)))
+      break;
+    memset(args[i], 'x', len);
+    args[i][len] = '\0';
+    char num[16];
+    int digits = snprintf(num, sizeof(num), "%07d", i);
+    memcpy(args[i], num, digits < len ? digits : len);
+  }
+  return args;
+}
+
+/*
+ * Makes the template "./test_batch -record"
+ */
+static command_t *
+make_template()
+{
+  command_t *tmpl = command_new();
+  command_append_arg(tmpl, self);
+  command_append_arg(tmpl, "-record");
+  return tmpl;
+}
+
+
+/*
+ * Tests reading an argument stream
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_batch_read_args()
+{
+  typedef struct {
+    const char *text;
+    const char *exp_args;         // joined with '|'
+    int exp_n;
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {"", "", 0},
+    {"\n\n\r\n", "", 0},
+    {"a\nb\nc\n", "a|b|c", 3},
+    {"a\r\r\nb", "a|b", 2},
+    {"a\n\nb\r\n  c \n", "a|b|  c ", 3},
+    {"no newline", "no newline", 1},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  char joined[256];
+
+  for (int i = 0; i < num_tests; i++) {
+    FILE *fp = tmpfile();
+    int n = -1;
+    char **args = NULL;
+    if (fp && fputs(tests[i].text, fp) >= 0 && fseek(fp, 0, SEEK_SET) == 0)
+      args = batch_read_args(fp, &n);
+    if (fp)
+      fclose(fp);
+
+    joined[0] = '\0';
+    for (int a = 0; args && args[a]; a++)
+      snprintf(joined + strlen(joined), sizeof(joined) - strlen(joined), "%s%s",
+               a ? "|" : "", args[a]);
+
+    if (!args || n != tests[i].exp_n || strcmp(joined, tests[i].exp_args))
+      printf("  FAILED: test %d: expected %d \"%s\", got %d \"%s\"\n", i, tests[i].exp_n,
+             tests[i].exp_args, n, joined);
+    else
+      tests_passed++;
+    batch_free_args(args);
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Tests that arguments are packed into as few batches as the limit
+ * allows, in order, each of which could be exec'd
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_batch_packing()
+{
+  typedef struct {
+    int n_args;
+    int arg_len;
+    int max_procs;
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {0, 10, 1},
+    {1, 10, 1},
+    {100, 10, 1},
+    {30000, 100, 1},              // a few megabytes: more than one batch
+    {2000, 4000, 1},
+    {30000, 100, 4},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  long limit = batch_arg_limit();
+
+  for (int i = 0; i < num_tests; i++) {
+    test_case_t *t = &tests[i];
+    char **args = make_args(t->n_args, t->arg_len);
+    command_t *tmpl = make_template();
+    record_t rec;
+
+    clear_log();
+    int status = batch_run(tmpl, args, t->n_args, t->max_procs);
+    bool ok = read_log(&rec);
+
+    if (status != 0 || !ok) {
+      printf("  FAILED: test %d: status %d\n", i, status);
+    } else if (rec.n_args != t->n_args) {
+      printf("  FAILED: test %d: %d arguments given, %d run\n", i, t->n_args, rec.n_args);
+    } else {
+      // in parallel the batches may finish in any order, so only the
+      // serial runs are checked argument by argument
+      bool in_order = true;
+      for (int a = 0; t->max_procs == 1 && a < t->n_args; a++)
+        in_order &= !strcmp(args[a], rec.args[a]);
+
+      // each batch fits, and the next argument would not have
+      long base = arg_bytes(self) + arg_bytes("-record");
+      bool packed = true;
+      int a = 0;
+      for (int b = 0; t->max_procs == 1 && b < rec.n_batches; b++) {
+        long size = base;
+        for (int k = 0; k < rec.counts[b]; k++)
+          size += arg_bytes(args[a++]);
+        if (size > limit || (a < t->n_args && size + arg_bytes(args[a]) <= limit))
+          packed = false;
+      }
+
+      long total = base;
+      for (a = 0; a < t->n_args; a++)
+        total += arg_bytes(args[a]);
+      bool split = t->n_args == 0 ? rec.n_batches == 0 : (total > limit) == (rec.n_batches > 1);
+
+      if (!in_order)
+        printf("  FAILED: test %d: arguments out of order\n", i);
+      else if (!packed)
+        printf("  FAILED: test %d: %d batches not packed to the limit of %ld\n", i,
+               rec.n_batches, limit);
+      else if (!split)
+        printf("  FAILED: test %d: %ld bytes run in %d batches\n", i, total, rec.n_batches);
+      else
+        tests_passed++;
+    }
+
+    free_record(&rec);
+    command_free(tmpl);
+    batch_free_args(args);
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Tests batch_too_long(), batch_split(), and the status when a batch
+ * fails or an argument cannot fit
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_batch_errors()
+{
+  const int num_tests = 5;
+  int tests_passed = 0;
+  long limit = batch_arg_limit();
+  record_t rec;
+
+  // exactly the limit, then over it
+  command_t *cmd = make_template();
+  long size = arg_bytes(self) + arg_bytes("-record");
+  char **fill = make_args(1, limit - size - arg_bytes(""));
+  command_append_arg(cmd, fill[0]);
+  if (!batch_too_long(cmd))
+    tests_passed++;
+  else
+    printf("  FAILED: a command of exactly the limit is too long\n");
+  command_append_arg(cmd, "");
+  if (batch_too_long(cmd))
+    tests_passed++;
+  else
+    printf("  FAILED: a command over the limit is not too long\n");
+  command_free(cmd);
+  batch_free_args(fill);
+
+  // enough 100-byte arguments to need two batches
+  int n = limit / (100 + 1 + sizeof(char *)) + 1000;
+
+  // the leading options stay in every batch
+  cmd = make_template();
+  char **args = make_args(n, 100);
+  for (int a = 0; a < n; a++)
+    command_append_arg(cmd, args[a]);
+  clear_log();
+  int status = batch_split(cmd);
+  read_log(&rec);
+  if (status == 0 && rec.n_batches > 1 && rec.n_args == n
+      && !strcmp(rec.args[0], args[0]) && !strcmp(rec.args[n - 1], args[n - 1]))
+    tests_passed++;
+  else
+    printf("  FAILED: batch_split: status %d, %d batches, %d arguments\n", status,
+           rec.n_batches, rec.n_args);
+  free_record(&rec);
+  command_free(cmd);
+
+  // a failing batch gives its status, and the others still run
+  free(args[1000]);
+  args[1000] = strdup("fail");
+  cmd = make_template();
+  clear_log();
+  status = batch_run(cmd, args, n, 1);
+  read_log(&rec);
+  if (status == 3 && rec.n_args == n)
+    tests_passed++;
+  else
+    printf("  FAILED: failing batch: status %d, %d arguments\n", status, rec.n_args);
+  free_record(&rec);
+
+  // an argument too long for any batch is left out, with status 1
+  char **huge = make_args(1, limit);
+  free(args[n - 1000]);
+  args[n - 1000] = huge[0];
+  huge[0] = NULL;
+  free(args[1000]);
+  args[1000] = strdup("ok");
+  clear_log();
+
+  fflush(stderr);
+  int saved_stderr = dup(STDERR_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDERR_FILENO);
+  close(null_fd);
+  status = batch_run(cmd, args, n, 1);
+  dup2(saved_stderr, STDERR_FILENO);
+  close(saved_stderr);
+
+  read_log(&rec);
+  if (status == 1 && rec.n_args == n - 1)
+    tests_passed++;
+  else
+    printf("  FAILED: over-long argument: status %d, %d arguments\n", status, rec.n_args);
+  free_record(&rec);
+  command_free(cmd);
+  batch_free_args(huge);
+  batch_free_args(args);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int success = 1;
+
+  if (argc > 1 && !strcmp(argv[1], "-record"))
+    return record(argc, argv);
+
+  int fd = mkstemp(log_path);
+  if (fd < 0) {
+    perror("test_batch");
+    return 1;
+  }
+  close(fd);
+  setenv("TEST_BATCH_LOG", log_path, 1);
+
+  success &= test_batch_read_args();
+  success &= test_batch_packing();
+  success &= test_batch_errors();
+
+  unlink(log_path);
+
+  if (success) {
+    printf("All batch tests succeeded!\n");
+    return 0;
+  } else {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+}
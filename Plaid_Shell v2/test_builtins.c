@@ -0,0 +1,242 @@
+/*
+ * test_builtins.c
+ *
+ * Test functions for builtins.c. The loading tests use the example
+ * plugin, plugin_basename.so, which must be built first.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "builtins.h"
+
+static int fn_a(command_t *cmd) { return 1; }
+static int fn_b(command_t *cmd) { return 2; }
+
+/*
+ * Runs a builtin with the given arguments, catching what it prints
+ *
+ * Parameters:
+ *   fn       The builtin
+ *   args     Its arguments after argv[0], NULL-terminated
+ *   out      Where its standard output is put
+ *   out_len  Size of out
+ *
+ * Returns:
+ *   The builtin's status, or -1 if its output could not be caught
+ */
+static int
+run_builtin(builtin_fn fn, const char *args[], char *out, size_t out_len)
+{
+  command_t *cmd = command_new();
+  command_append_arg(cmd, "builtin");
+  for (int i = 0; args[i]; i++)
+    command_append_arg(cmd, args[i]);
+
+  FILE *fp = tmpfile();
+  if (!fp) {
+    command_free(cmd);
+    return -1;
+  }
+
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  dup2(fileno(fp), STDOUT_FILENO);
+  int status = fn(cmd);
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+
+  size_t len = pread(fileno(fp), out, out_len - 1, 0);
+  out[len < out_len ? len : 0] = '\0';
+  fclose(fp);
+  command_free(cmd);
+  return status;
+}
+
+
+/*
+ * Tests registering, replacing, looking up, disabling and enabling
+ * builtins, and growing the table
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_builtin_registry()
+{
+  typedef struct {
+    char op;                      // 'r' register, 'd' disable, 'e' enable,
+                                  //   'l' just look up
+    const char *name;
+    builtin_fn fn;                // for 'r'
+    int exp_ret;
+    builtin_fn exp_lookup;        // builtin_lookup(name) afterwards
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {'l', "a", NULL, 0, NULL},
+    {'d', "a", NULL, -1, NULL},   // nothing registered yet
+    {'r', "a", fn_a, 0, fn_a},
+    {'r', "b", fn_b, 0, fn_b},
+    {'l', "a", NULL, 0, fn_a},
+    {'l', "ab", NULL, 0, NULL},
+    {'l', "", NULL, 0, NULL},
+    {'r', "a", fn_b, 0, fn_b},    // replaced
+    {'d', "a", NULL, 0, NULL},
+    {'l', "b", NULL, 0, fn_b},
+    {'d', "a", NULL, 0, NULL},    // twice is harmless
+    {'e', "a", NULL, 0, fn_b},
+    {'d', "b", NULL, 0, NULL},
+    {'r', "b", fn_a, 0, fn_a},    // registering enables it again
+    {'e', "c", NULL, -1, NULL},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+
+  for (int i = 0; i < num_tests; i++) {
+    test_case_t *t = &tests[i];
+    int ret = 0;
+
+    switch (t->op) {
+    case 'r': ret = builtin_register(t->name, t->fn); break;
+    case 'd': ret = builtin_set_enabled(t->name, false); break;
+    case 'e': ret = builtin_set_enabled(t->name, true); break;
+    }
+
+    if (ret != t->exp_ret)
+      printf("  FAILED: test %d (%c %s): returned %d\n", i, t->op, t->name, ret);
+    else if (builtin_lookup(t->name) != t->exp_lookup)
+      printf("  FAILED: test %d (%c %s): wrong function looked up\n", i, t->op, t->name);
+    else
+      tests_passed++;
+  }
+
+  // enough builtins to grow the table several times, each still found
+  char name[32];
+  bool all_found = true;
+  for (int n = 0; n < 500; n++) {
+    snprintf(name, sizeof(name), "grow%d", n);
+    if (builtin_register(name, (n & 1) ? fn_a : fn_b) != 0)
+      all_found = false;
+  }
+  for (int n = 0; n < 500; n++) {
+    snprintf(name, sizeof(name), "grow%d", n);
+    if (builtin_lookup(name) != ((n & 1) ? fn_a : fn_b))
+      all_found = false;
+  }
+  if (all_found && builtin_lookup("a") == fn_b && builtin_lookup("b") == fn_a)
+    tests_passed++;
+  else
+    printf("  FAILED: builtins lost as the table grew\n");
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests + 1);
+  return (tests_passed == num_tests + 1);
+}
+
+
+/*
+ * Tests loading the example plugin and running it, and that only a
+ * builtin_<name> defined by the plugin itself is accepted
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_builtin_load()
+{
+  typedef struct {
+    const char *path;
+    const char *name;
+    int exp_ret;
+  } load_case_t;
+
+  load_case_t loads[] = {
+    {"./plugin_basename.so", "basename", 0},
+    {"./plugin_basename.so", "nosuch", -1},
+    {"./plugin_basename.so", "free", -1},     // in libc, not the plugin
+    {"./plugin_basename.so", "printf", -1},
+    {"./no_such_plugin.so", "dirname", -1},
+  };
+
+  typedef struct {
+    const char *args[3];
+    int exp_status;
+    const char *exp_out;
+  } run_case_t;
+
+  run_case_t runs[] = {
+    {{"/usr/lib/libc.so", NULL}, 0, "libc.so\n"},
+    {{"/usr/lib/", NULL}, 0, "lib\n"},
+    {{"/", NULL}, 0, "/\n"},
+    {{"name", NULL}, 0, "name\n"},
+    {{"/a/b/c.txt", ".txt", NULL}, 0, "c\n"},
+    {{"c.txt", "c.txt", NULL}, 0, "c.txt\n"},
+    {{NULL}, 1, ""},
+  };
+
+  const int num_loads = sizeof(loads) / sizeof(load_case_t);
+  const int num_runs = sizeof(runs) / sizeof(run_case_t);
+  int tests_passed = 0;
+  char err[256], out[256];
+
+  for (int i = 0; i < num_loads; i++) {
+    err[0] = '\0';
+    int ret = builtin_load(loads[i].path, loads[i].name, err, sizeof(err));
+    bool registered = builtin_lookup(loads[i].name) != NULL;
+
+    if (ret != loads[i].exp_ret || registered != (ret == 0))
+      printf("  FAILED: load %d (%s %s): returned %d, %s\n", i, loads[i].path, loads[i].name,
+             ret, registered ? "registered" : "not registered");
+    else if (ret != 0 && !err[0])
+      printf("  FAILED: load %d (%s %s): no error message\n", i, loads[i].path, loads[i].name);
+    else
+      tests_passed++;
+  }
+
+  builtin_fn fn = builtin_lookup("basename");
+  for (int i = 0; fn && i < num_runs; i++) {
+    // messages, such as a missing operand, are not checked
+    fflush(stderr);
+    int saved_stderr = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+    int status = run_builtin(fn, runs[i].args, out, sizeof(out));
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+
+    if (status != runs[i].exp_status || strcmp(out, runs[i].exp_out))
+      printf("  FAILED: run %d: expected %d \"%s\", got %d \"%s\"\n", i, runs[i].exp_status,
+             runs[i].exp_out, status, out);
+    else
+      tests_passed++;
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_loads + num_runs);
+  return (tests_passed == num_loads + num_runs);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int success = 1;
+
+  success &= test_builtin_registry();
+  success &= test_builtin_load();
+
+  if (success) {
+    printf("All builtins tests succeeded!\n");
+    return 0;
+  } else {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+}
@@ -0,0 +1,248 @@
+/*
+ * test_coproc.c
+ *
+ * Test functions for coproc.c. Each test is a script of calls made
+ * against real helper programs (sed, cat, sort, sh), checked one by
+ * one.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "coproc.h"
+
+typedef struct {
+  char op;                        // 's' start, 'w' write, 'r' read,
+                                  //   'h' shutdown, 'c' close
+  const char *name;
+  const char *argv[5];            // for 's'
+  const char *text;               // for 'w'; for 'r' the line expected
+  int timeout_ms;                 // for 'r'
+  int exp_ret;
+  int exp_errno;                  // checked when exp_ret is -1
+} step_t;
+
+/*
+ * Runs a script of calls, printing the first one that goes wrong
+ *
+ * Parameters:
+ *   steps  The calls
+ *   n      How many there are
+ *
+ * Returns:
+ *   The number of calls that did what was expected
+ */
+static int
+run_steps(const step_t *steps, int n)
+{
+  int passed = 0;
+
+  for (int i = 0; i < n; i++) {
+    const step_t *t = &steps[i];
+    char *line = NULL;
+    int ret = 0;
+
+    errno = 0;
+    switch (t->op) {
+    case 's': ret = coproc_start(t->name, (char * const *)t->argv); break;
+    case 'w': ret = coproc_write(t->name, t->text, strlen(t->text)); break;
+    case 'r': ret = coproc_read(t->name, t->timeout_ms, &line); break;
+    case 'h': ret = coproc_shutdown(t->name); break;
+    case 'c': ret = coproc_close(t->name); break;
+    }
+
+    if (ret != t->exp_ret || (ret == -1 && errno != t->exp_errno))
+      printf("  FAILED: step %d (%c %s): returned %d, errno %d\n", i, t->op, t->name, ret,
+             errno);
+    else if (t->op == 'r' && ret == 1 && strcmp(line, t->text))
+      printf("  FAILED: step %d (%c %s): read \"%s\", expected \"%s\"\n", i, t->op, t->name,
+             line, t->text);
+    else
+      passed++;
+    free(line);
+  }
+  return passed;
+}
+
+
+/*
+ * Tests the round trip of starting a helper, writing to it, reading
+ * its answers and closing it, with two helpers at once
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_coproc_round_trip()
+{
+  step_t tests[] = {
+    {'s', "up", {"sed", "-u", "s/a/A/g", NULL}, NULL, 0, 0},
+    {'s', "up", {"cat", NULL}, NULL, 0, -1, EEXIST},
+    {'s', "echo", {"cat", NULL}, NULL, 0, 0},
+    {'w', "up", {NULL}, "banana\n", 0, 0},
+    {'r', "up", {NULL}, "bAnAnA", -1, 1},
+    {'w', "echo", {NULL}, "one\ntwo\n", 0, 0},
+    {'w', "up", {NULL}, "a\n\nab\n", 0, 0},
+    {'r', "echo", {NULL}, "one", 1000, 1},
+    {'r', "up", {NULL}, "A", 1000, 1},
+    {'r', "up", {NULL}, "", 1000, 1},                 // an empty line
+    {'r', "up", {NULL}, "Ab", 1000, 1},
+    {'r', "echo", {NULL}, "two", 1000, 1},
+    {'c', "up", {NULL}, NULL, 0, 0},
+    {'w', "up", {NULL}, "x\n", 0, -1, ENOENT},
+    {'r', "up", {NULL}, NULL, 0, -1, ENOENT},
+    {'c', "up", {NULL}, NULL, 0, -1, ENOENT},
+    {'s', "up", {"cat", NULL}, NULL, 0, 0},           // the name is free again
+    {'c', "up", {NULL}, NULL, 0, 0},
+    {'c', "echo", {NULL}, NULL, 0, 0},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(step_t);
+  int tests_passed = run_steps(tests, num_tests);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Tests the end of a helper's output, including a last line with no
+ * '\n', and the status coproc_close() gives for helpers that exit,
+ * are killed or cannot be run
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_coproc_eof()
+{
+  step_t tests[] = {
+    {'s', "e", {"sh", "-c", "echo one; printf two", NULL}, NULL, 0, 0},
+    {'r', "e", {NULL}, "one", 1000, 1},
+    {'r', "e", {NULL}, "two", 1000, 1},
+    {'r', "e", {NULL}, NULL, 1000, 0},
+    {'r', "e", {NULL}, NULL, 1000, 0},                // still at the end
+    {'c', "e", {NULL}, NULL, 0, 0},
+    {'s', "e", {"sh", "-c", "exit 3", NULL}, NULL, 0, 0},
+    {'r', "e", {NULL}, NULL, 1000, 0},
+    {'c', "e", {NULL}, NULL, 0, 3},
+    {'s', "e", {"sh", "-c", "kill -9 $$", NULL}, NULL, 0, 0},
+    {'c', "e", {NULL}, NULL, 0, 128 + SIGKILL},
+    {'s', "e", {"./no_such_program", NULL}, NULL, 0, 0},
+    {'r', "e", {NULL}, NULL, 1000, 0},
+    {'c', "e", {NULL}, NULL, 0, 127},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(step_t);
+
+  // the helper that cannot be run says so on stderr
+  fflush(stderr);
+  int saved_stderr = dup(STDERR_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDERR_FILENO);
+  close(null_fd);
+  int tests_passed = run_steps(tests, num_tests);
+  dup2(saved_stderr, STDERR_FILENO);
+  close(saved_stderr);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Tests reads that time out, and that what arrives afterwards is
+ * still read whole
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_coproc_timeout()
+{
+  step_t tests[] = {
+    {'s', "t", {"cat", NULL}, NULL, 0, 0},
+    {'r', "t", {NULL}, NULL, 100, -1, ETIMEDOUT},
+    {'r', "t", {NULL}, NULL, 0, -1, ETIMEDOUT},
+    {'w', "t", {NULL}, "par", 0, 0},
+    {'r', "t", {NULL}, NULL, 100, -1, ETIMEDOUT},     // no '\n' yet
+    {'w', "t", {NULL}, "tial\n", 0, 0},
+    {'r', "t", {NULL}, "partial", 1000, 1},
+    {'c', "t", {NULL}, NULL, 0, 0},
+    {'s', "t", {"sh", "-c", "sleep 0.2; echo late", NULL}, NULL, 0, 0},
+    {'r', "t", {NULL}, NULL, 50, -1, ETIMEDOUT},
+    {'r', "t", {NULL}, "late", 5000, 1},
+    {'c', "t", {NULL}, NULL, 0, 0},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(step_t);
+  int tests_passed = run_steps(tests, num_tests);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Tests ending a helper's input with coproc_shutdown(), for helpers
+ * that answer only at the end of it
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_coproc_shutdown()
+{
+  step_t tests[] = {
+    {'s', "sort", {"sort", NULL}, NULL, 0, 0},
+    {'w', "sort", {NULL}, "pear\napple\n", 0, 0},
+    {'w', "sort", {NULL}, "fig\n", 0, 0},
+    {'r', "sort", {NULL}, NULL, 100, -1, ETIMEDOUT},  // nothing until the end
+    {'h', "sort", {NULL}, NULL, 0, 0},
+    {'r', "sort", {NULL}, "apple", 1000, 1},
+    {'r', "sort", {NULL}, "fig", 1000, 1},
+    {'r', "sort", {NULL}, "pear", 1000, 1},
+    {'r', "sort", {NULL}, NULL, 1000, 0},
+    {'w', "sort", {NULL}, "late\n", 0, -1, EPIPE},
+    {'c', "sort", {NULL}, NULL, 0, 0},
+    {'s', "wc", {"wc", "-l", NULL}, NULL, 0, 0},
+    {'w', "wc", {NULL}, "a\nb\nc\n", 0, 0},
+    {'h', "wc", {NULL}, NULL, 0, 0},
+    {'r', "wc", {NULL}, "3", 1000, 1},
+    {'c', "wc", {NULL}, NULL, 0, 0},
+    {'h', "wc", {NULL}, NULL, 0, -1, ENOENT},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(step_t);
+  int tests_passed = run_steps(tests, num_tests);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int success = 1;
+
+  success &= test_coproc_round_trip();
+  success &= test_coproc_eof();
+  success &= test_coproc_timeout();
+  success &= test_coproc_shutdown();
+
+  if (success) {
+    printf("All coproc tests succeeded!\n");
+    return 0;
+  } else {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+}
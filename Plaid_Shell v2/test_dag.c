@@ -0,0 +1,229 @@
+/*
+ * test_dag.c
+ *
+ * Test functions for dag.c
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "dag.h"
+
+static int log_fd = -1;           // where the tasks' children write
+
+/*
+ * Stand-in for execute_command(), run in each task's child: the
+ * command "run NAME STATUS" appends NAME and a space to the log and
+ * exits with STATUS
+ */
+static int
+log_run(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+  char entry[64];
+
+  int len = snprintf(entry, sizeof(entry), "%s ", argv[1]);
+  if (write(log_fd, entry, len) != len)
+    return 127;
+  return atoi(argv[2]);
+}
+
+/*
+ * Loads a task file held in a string
+ */
+static dag_t *
+load_text(const char *text, char *err, size_t err_len)
+{
+  FILE *fp = fmemopen((void *)text, strlen(text), "r");
+  if (!fp) {
+    snprintf(err, err_len, "fmemopen failed");
+    return NULL;
+  }
+  dag_t *dag = dag_load(fp, "t", err, err_len);
+  fclose(fp);
+  return dag;
+}
+
+
+/*
+ * Tests reading task files, and the errors found before anything runs
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_dag_load()
+{
+  typedef struct {
+    const char *text;
+    const char *exp_err;          // NULL if it should load
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {"", NULL},
+    {"# only a comment\n\n   \n\t\n", NULL},
+    {"a: echo a\nb a: echo b\n", NULL},
+    {"b a: echo b\na: echo a\n", NULL},           // any order
+    {"a: echo a\r\nb a: echo \"x: y\"\r\n", NULL},
+    {"  a  :  echo a", NULL},
+    {"a: echo a\nb: echo b\nc a b: echo c\nd c a: echo d\n", NULL},
+
+    // mistakes in a line
+    {"echo a\n", "t:1: Missing ':' before the command"},
+    {"a: echo a\n: echo\n", "t:2: Missing task name"},
+    {"a:\n", "t:1: Missing command for a"},
+    {"a:   \n", "t:1: Missing command for a"},
+    {"a: echo a\n# a again\na: echo b\n", "t:3: Task a is defined twice"},
+    {"a: echo \"oops\n", "t:1: Unterminated quote"},
+
+    // mistakes in the graph
+    {"a b: echo a\n", "t:1: a depends on unknown task b"},
+    {"a: echo a\nb a c: echo b\n", "t:2: b depends on unknown task c"},
+    {"a a: echo a\n", "t:1: a is part of a dependency cycle"},
+    {"a b: echo a\nb a: echo b\n", "t:1: a is part of a dependency cycle"},
+    {"a: echo a\nb d: echo b\nc b: echo c\nd c: echo d\ne a: echo e\n",
+     "t:2: b is part of a dependency cycle"},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  char err[256];
+
+  for (int i = 0; i < num_tests; i++) {
+    err[0] = '\0';
+    dag_t *dag = load_text(tests[i].text, err, sizeof(err));
+
+    if (!tests[i].exp_err && !dag) {
+      printf("  FAILED: test %d: did not load: %s\n", i, err);
+    } else if (tests[i].exp_err && dag) {
+      printf("  FAILED: test %d: loaded, expected \"%s\"\n", i, tests[i].exp_err);
+    } else if (tests[i].exp_err && strcmp(err, tests[i].exp_err)) {
+      printf("  FAILED: test %d: expected \"%s\", got \"%s\"\n", i, tests[i].exp_err, err);
+    } else {
+      tests_passed++;
+    }
+    dag_free(dag);
+  }
+
+  if (command_outstanding_allocs() != 0) {
+    printf("  FAILED: %u commands not freed\n", command_outstanding_allocs());
+    tests_passed--;
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Tests the order tasks run in, skipping after a failure, and the
+ * status returned
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_dag_run()
+{
+  typedef struct {
+    const char *text;
+    int max_jobs;
+    const char *exp_log;          // the tasks that ran, in order
+    int exp_status;
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {"", 1, "", 0},
+    {"a: run a 0\nb a: run b 0\nc a: run c 0\nd b c: run d 0\n", 1, "a b c d ", 0},
+    {"c b: run c 0\nb a: run b 0\na: run a 0\n", 4, "a b c ", 0},
+
+    // the ready task with the longest chain after it goes first
+    {"x: run x 0\ny: run y 0\nz y: run z 0\n", 1, "y x z ", 0},
+    {"p: run p 0\nq: run q 0\nr q: run r 0\ns r: run s 0\nt p: run t 0\n", 1,
+     "q p r s t ", 0},
+
+    // a failure skips what depends on it, and nothing else
+    {"a: run a 3\nb a: run b 0\nc b: run c 0\nd: run d 0\ne d: run e 0\n", 1, "a d e ", 3},
+    {"a: run a 0\nb a: run b 4\nc a: run c 0\nd b c: run d 0\n", 1, "a b c ", 4},
+
+    // the status is that of the first task to fail
+    {"a: run a 2\nb: run b 5\nc a: run c 0\n", 1, "a b ", 2},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  char path[] = "/tmp/test_dag.XXXXXX";
+  char err[256], got[256];
+
+  if ((log_fd = mkstemp(path)) < 0) {
+    perror("test_dag");
+    return false;
+  }
+  unlink(path);
+
+  // the summary dag_run() prints is not checked
+  fflush(stderr);
+  int saved_stderr = dup(STDERR_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDERR_FILENO);
+  close(null_fd);
+
+  for (int i = 0; i < num_tests; i++) {
+    dag_t *dag = load_text(tests[i].text, err, sizeof(err));
+    if (!dag) {
+      printf("  FAILED: test %d: did not load: %s\n", i, err);
+      continue;
+    }
+
+    if (ftruncate(log_fd, 0) != 0 || lseek(log_fd, 0, SEEK_SET) != 0) {
+      printf("  FAILED: test %d: cannot reset log\n", i);
+      dag_free(dag);
+      continue;
+    }
+    int status = dag_run(dag, tests[i].max_jobs, log_run);
+    dag_free(dag);
+
+    ssize_t len = pread(log_fd, got, sizeof(got) - 1, 0);
+    got[len > 0 ? len : 0] = '\0';
+
+    if (strcmp(got, tests[i].exp_log)) {
+      printf("  FAILED: test %d: expected \"%s\" to run, got \"%s\"\n", i, tests[i].exp_log, got);
+      continue;
+    }
+    if (status != tests[i].exp_status) {
+      printf("  FAILED: test %d: expected status %d, got %d\n", i, tests[i].exp_status, status);
+      continue;
+    }
+    tests_passed++;
+  }
+
+  dup2(saved_stderr, STDERR_FILENO);
+  close(saved_stderr);
+  close(log_fd);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int success = 1;
+
+  success &= test_dag_load();
+  success &= test_dag_run();
+
+  if (success) {
+    printf("All dag tests succeeded!\n");
+    return 0;
+  } else {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+}
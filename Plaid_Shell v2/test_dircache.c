@@ -0,0 +1,407 @@
+/*
+ * test_dircache.c
+ *
+ * Test functions for dircache.c, run in a scratch tree under /tmp.
+ * Hits, misses and evictions are read from dircache_print_stats().
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <glob.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "dircache.h"
+
+static char root[] = "/tmp/test_dircache.XXXXXX";
+
+/*
+ * The counters dircache_print_stats() prints
+ */
+typedef struct {
+  int dirs;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long invalidated;
+  unsigned long evicted;
+} stats_t;
+
+/*
+ * Reads the cache's counters by catching what dircache_print_stats()
+ * prints
+ */
+static void
+get_stats(stats_t *st)
+{
+  char out[1024], *p;
+  memset(st, 0, sizeof(stats_t));
+
+  FILE *fp = tmpfile();
+  if (!fp)
+    return;
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  dup2(fileno(fp), STDOUT_FILENO);
+  dircache_print_stats();
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+
+  ssize_t len = pread(fileno(fp), out, sizeof(out) - 1, 0);
+  out[len > 0 ? len : 0] = '\0';
+  fclose(fp);
+
+  if ((p = strstr(out, "dirs")))
+    sscanf(p, "dirs %d", &st->dirs);
+  if ((p = strstr(out, "hits")))
+    sscanf(p, "hits %lu", &st->hits);
+  if ((p = strstr(out, "misses")))
+    sscanf(p, "misses %lu", &st->misses);
+  if ((p = strstr(out, "invalidated")))
+    sscanf(p, "invalidated %lu", &st->invalidated);
+  if ((p = strstr(out, "evicted")))
+    sscanf(p, "evicted %lu", &st->evicted);
+}
+
+/*
+ * Makes an empty file
+ */
+static void
+touch(const char *path)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    perror(path);
+  else
+    close(fd);
+}
+
+/*
+ * Returns true if name is among the entries of dir, as the cache
+ * gives them
+ */
+static bool
+listed(const char *dir, const char *name, int *n)
+{
+  char * const *names;
+  const unsigned char *types;
+  *n = dircache_list(dir, &names, &types);
+  for (int i = 0; i < *n; i++)
+    if (!strcmp(names[i], name))
+      return true;
+  return false;
+}
+
+/*
+ * qsort() comparison of two paths in a glob_t
+ */
+static int
+compare_paths(const void *a, const void *b)
+{
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+/*
+ * Tests that the limit holds, and that the least recently used
+ * listing is the one evicted
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_dircache_lru()
+{
+  typedef struct {
+    const char *dir;              // listed, or NULL to set the limit
+    int new_limit;
+    bool exp_hit;
+    int exp_dirs;
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {"d0", 0, false, 1},
+    {"d1", 0, false, 2},
+    {"d2", 0, false, 3},
+    {"d0", 0, true, 3},
+    {"d3", 0, false, 3},          // evicts d1
+    {"d0", 0, true, 3},
+    {"d2", 0, true, 3},
+    {"d1", 0, false, 3},          // evicts d3
+    {"d3", 0, false, 3},          // evicts d0
+    {"d2", 0, true, 3},
+    {"d1", 0, true, 3},
+    {NULL, 2, false, 2},          // evicts d3
+    {"d2", 0, true, 2},
+    {"d3", 0, false, 2},          // evicts d1
+    {"d1", 0, false, 2},          // evicts d2
+    {NULL, 0, false, 0},          // off: nothing is cached
+    {"d1", 0, false, 0},
+    {NULL, 3, false, 0},
+    {".", 0, false, 1},
+    {root, 0, true, 1},           // "." by its absolute name
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  char * const *names;
+  const unsigned char *types;
+  stats_t before, after;
+
+  dircache_clear();
+  dircache_set_limit(3);
+
+  for (int i = 0; i < num_tests; i++) {
+    test_case_t *t = &tests[i];
+    get_stats(&before);
+    int n = 0;
+    if (t->dir)
+      n = dircache_list(t->dir, &names, &types);
+    else
+      dircache_set_limit(t->new_limit);
+    get_stats(&after);
+
+    bool hit = after.hits > before.hits;
+    if (n < 0)
+      printf("  FAILED: test %d (%s): %s\n", i, t->dir, strerror(errno));
+    else if (t->dir && hit != t->exp_hit)
+      printf("  FAILED: test %d (%s): expected a %s\n", i, t->dir, t->exp_hit ? "hit" : "miss");
+    else if (after.dirs != t->exp_dirs)
+      printf("  FAILED: test %d (%s): %d dirs cached, expected %d\n", i,
+             t->dir ? t->dir : "limit", after.dirs, t->exp_dirs);
+    else
+      tests_passed++;
+  }
+
+  dircache_set_limit(DIRCACHE_DEFAULT_LIMIT);
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Tests that a change to a directory drops its listing, so that the
+ * next lookup reads it again, and that other changes do not
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_dircache_inotify()
+{
+  typedef struct {
+    char op;                      // '-' nothing, 't' touch a, 'w' write
+                                  //   to a, 'r' rm a, 'm' mkdir a,
+                                  //   'v' mv a b
+    const char *a, *b;
+    const char *look_for;         // a name to look up in w afterwards
+    bool exp_listed;
+    bool exp_hit;
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {'-', NULL, NULL, "new", false, false},
+    {'-', NULL, NULL, "new", false, true},
+    {'t', "w/new", NULL, "new", true, false},
+    {'-', NULL, NULL, "new", true, true},
+    {'w', "w/new", NULL, "new", true, true},     // contents are not entries
+    {'r', "w/new", NULL, "new", false, false},
+    {'m', "w/sub", NULL, "sub", true, false},
+    {'t', "w/sub/f", NULL, "sub", true, true},   // not in w itself
+    {'v', "w/sub", "w/moved", "moved", true, false},
+    {'v', "w/moved", "d0/in", "moved", false, false},
+    {'v', "d0/in", "w/back", "back", true, false},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  stats_t before, after;
+  int n;
+
+  dircache_clear();
+  for (int i = 0; i < num_tests; i++) {
+    test_case_t *t = &tests[i];
+    int fd, err = 0;
+    switch (t->op) {
+    case 't': touch(t->a); break;
+    case 'w':
+      fd = open(t->a, O_WRONLY);
+      err = (fd < 0 || write(fd, "data", 4) != 4);
+      if (fd >= 0)
+        close(fd);
+      break;
+    case 'r': err = unlink(t->a); break;
+    case 'm': err = mkdir(t->a, 0755); break;
+    case 'v': err = rename(t->a, t->b); break;
+    }
+    if (err)
+      perror(t->a);
+
+    get_stats(&before);
+    bool found = listed("w", t->look_for, &n);
+    get_stats(&after);
+    bool hit = after.hits > before.hits;
+
+    if (n < 0)
+      printf("  FAILED: test %d (%c): %s\n", i, t->op, strerror(errno));
+    else if (found != t->exp_listed)
+      printf("  FAILED: test %d (%c): %s %s\n", i, t->op, t->look_for,
+             found ? "still listed" : "not listed");
+    else if (hit != t->exp_hit)
+      printf("  FAILED: test %d (%c): expected a %s\n", i, t->op,
+             t->exp_hit ? "hit" : "miss");
+    else
+      tests_passed++;
+  }
+
+  // a directory that is removed is not read from the cache
+  char * const *names;
+  const unsigned char *types;
+  mkdir("gone", 0755);
+  bool before_ok = dircache_list("gone", &names, &types) == 0;
+  rmdir("gone");
+  errno = 0;
+  if (before_ok && dircache_list("gone", &names, &types) == -1 && errno == ENOENT)
+    tests_passed++;
+  else
+    printf("  FAILED: a removed directory can still be listed\n");
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests + 1);
+  return (tests_passed == num_tests + 1);
+}
+
+
+/*
+ * Tests that dircache_glob() matches what glob(3) finds, with a cold
+ * cache, a warm one, and after the tree changes
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_dircache_glob()
+{
+  typedef struct {
+    const char *pattern;
+    int flags;
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {"*", 0},
+    {"*", GLOB_MARK},
+    {"*", GLOB_PERIOD},
+    {".*", 0},
+    {"*.c", 0},
+    {"g/*.c", 0},
+    {"g/[ab]*", 0},
+    {"g/?.h", 0},
+    {"*/*", 0},
+    {"*/", 0},
+    {"d*/..", 0},
+    {"g/{a,b}*", GLOB_BRACE},
+    {"g/nomatch*", 0},
+    {"g/nomatch*", GLOB_NOCHECK},
+    {"no/such/dir/*", 0},
+    {"g/*", GLOB_ONLYDIR},
+    {"g/sub/*/*", 0},
+    {"g/*.c", GLOB_NOSORT},
+    {"g/\\*", 0},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0, num_checks = 0;
+
+  const char *files[] = {"g/a.c", "g/b.c", "g/c.h", "g/.hidden.c", "g/ab", "g/*",
+                         "g/sub/x/y", "top.c"};
+  mkdir("g", 0755);
+  mkdir("g/sub", 0755);
+  mkdir("g/sub/x", 0755);
+  for (int f = 0; f < sizeof(files) / sizeof(files[0]); f++)
+    touch(files[f]);
+
+  dircache_clear();
+  for (int round = 0; round < 3; round++) {
+    // round 0 is cold, round 1 warm, round 2 after a change
+    if (round == 2) {
+      touch("g/bb.c");
+      unlink("g/a.c");
+      mkdir("g/sub/z", 0755);
+      touch("g/sub/z/w");
+    }
+
+    for (int i = 0; i < num_tests; i++) {
+      glob_t exp, got;
+      int exp_ret = glob(tests[i].pattern, tests[i].flags, NULL, &exp);
+      int got_ret = dircache_glob(tests[i].pattern, tests[i].flags, &got);
+      num_checks++;
+
+      // GLOB_NOSORT leaves the order to the directory, so sort both
+      if (tests[i].flags & GLOB_NOSORT) {
+        qsort(exp.gl_pathv, exp.gl_pathc, sizeof(char *), compare_paths);
+        qsort(got.gl_pathv, got.gl_pathc, sizeof(char *), compare_paths);
+      }
+
+      bool same = exp_ret == got_ret && exp.gl_pathc == got.gl_pathc;
+      for (size_t k = 0; same && k < exp.gl_pathc; k++)
+        same = !strcmp(exp.gl_pathv[k], got.gl_pathv[k]);
+
+      if (same) {
+        tests_passed++;
+      } else {
+        printf("  FAILED: round %d, %s (flags %#x): glob gave %d with %zu paths, "
+               "dircache_glob %d with %zu\n", round, tests[i].pattern, tests[i].flags, exp_ret,
+               exp_ret ? 0 : exp.gl_pathc, got_ret, got_ret ? 0 : got.gl_pathc);
+      }
+      if (exp_ret == 0 || exp_ret == GLOB_NOMATCH)
+        globfree(&exp);
+      if (got_ret == 0 || got_ret == GLOB_NOMATCH)
+        globfree(&got);
+    }
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_checks);
+  return (tests_passed == num_checks);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int success = 1;
+
+  if (!mkdtemp(root) || chdir(root) != 0) {
+    perror("test_dircache: scratch tree");
+    return 1;
+  }
+  const char *dirs[] = {"d0", "d1", "d2", "d3", "d4", "w"};
+  for (int i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++)
+    mkdir(dirs[i], 0755);
+
+  if (dircache_init() != 0) {
+    perror("test_dircache: dircache_init");
+    return 1;
+  }
+
+  success &= test_dircache_lru();
+  success &= test_dircache_inotify();
+  success &= test_dircache_glob();
+
+  char cmd[sizeof(root) + 16];
+  snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+  if (chdir("/") != 0 || system(cmd) != 0)
+    perror("test_dircache: removing scratch tree");
+
+  if (success) {
+    printf("All dircache tests succeeded!\n");
+    return 0;
+  } else {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+}
@@ -0,0 +1,310 @@
+/*
+ * test_dirs.c
+ *
+ * Tests of the logical working directory, "cd -", CDPATH lookup and
+ * the directory stack, run in a scratch tree under /tmp
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "dirs.h"
+
+static char root[PATH_MAX];       // the scratch tree
+
+/*
+ * One call to a dirs_ function and what it should leave behind
+ */
+typedef struct {
+  char op;                        // 'c' cd, 'p' pushd, 's' swap (pushd
+                                  //   with no dir), 'o' popd
+  const char *arg;
+  int exp_ret;
+  const char *exp_pwd;            // relative to root, "" for root itself
+  bool exp_announce;              // for cd only
+} step_t;
+
+
+/*
+ * Builds the scratch tree:
+ *
+ *   a/b  a/proj  link -> a/b  p1/proj  p2/proj  p2/only2
+ *
+ * Returns:
+ *   True on success
+ */
+static bool
+make_tree()
+{
+  const char *dirs[] = {"a", "a/b", "a/proj", "p1", "p1/proj", "p2", "p2/proj", "p2/only2"};
+  char tmpl[] = "/tmp/test_dirs.XXXXXX";
+  char path[PATH_MAX + 16];
+
+  if (!mkdtemp(tmpl) || !realpath(tmpl, root))
+    return false;
+  for (int i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+    snprintf(path, sizeof(path), "%s/%s", root, dirs[i]);
+    if (mkdir(path, 0755) != 0)
+      return false;
+  }
+  snprintf(path, sizeof(path), "%s/link", root);
+  return symlink("a/b", path) == 0;
+}
+
+/*
+ * Starts a test from root with an empty stack
+ */
+static void
+reset()
+{
+  if (chdir(root) != 0)
+    perror(root);
+  setenv("PWD", root, 1);
+  unsetenv("OLDPWD");
+  unsetenv("CDPATH");
+  dirs_init();
+  dirs_clear();
+}
+
+/*
+ * Runs a list of steps, printing any that go wrong
+ *
+ * Returns:
+ *   The number of steps that went right
+ */
+static int
+run_steps(const char *name, const step_t *steps, int num)
+{
+  int passed = 0;
+  char exp[PATH_MAX * 2];
+
+  for (int i = 0; i < num; i++) {
+    const step_t *s = &steps[i];
+    bool announce = false;
+    int ret;
+
+    switch (s->op) {
+    case 'c': ret = dirs_cd(s->arg, &announce); break;
+    case 'p': ret = dirs_push(s->arg); break;
+    case 's': ret = dirs_push(NULL); break;
+    default:  ret = dirs_pop(); break;
+    }
+
+    snprintf(exp, sizeof(exp), "%s%s", root, s->exp_pwd);
+    char cwd[PATH_MAX], real_exp[PATH_MAX];
+    bool same_dir = getcwd(cwd, sizeof(cwd)) && realpath(exp, real_exp)
+                    && !strcmp(cwd, real_exp);
+
+    if (ret != s->exp_ret) {
+      printf("  FAILED: %s step %d (%c %s): returned %d\n", name, i, s->op,
+             s->arg ? s->arg : "NULL", ret);
+    } else if (strcmp(dirs_pwd(), exp) || strcmp(getenv("PWD"), exp) || !same_dir) {
+      printf("  FAILED: %s step %d (%c %s): expected %s, got %s (PWD %s, cwd %s)\n",
+             name, i, s->op, s->arg ? s->arg : "NULL", exp, dirs_pwd(),
+             getenv("PWD"), cwd);
+    } else if (s->op == 'c' && announce != s->exp_announce) {
+      printf("  FAILED: %s step %d (cd %s): announce %d\n", name, i,
+             s->arg ? s->arg : "NULL", announce);
+    } else {
+      passed++;
+    }
+  }
+  return passed;
+}
+
+
+/*
+ * Tests the logical path kept through symlinks, and "cd -"
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_dirs_logical()
+{
+  step_t steps[] = {
+    {'c', "link", 0, "/link", false},
+    {'c', "..", 0, "", false},              // not a, the parent of link's target
+    {'c', "link/../a", 0, "/a", false},
+    {'c', "./b//.", 0, "/a/b", false},
+    {'c', "../../link/", 0, "/link", false},
+    {'c', "-", 0, "/a/b", true},
+    {'c', "-", 0, "/link", true},
+    {'c', "no/such/dir", -1, "/link", false},
+    {'c', "link/../../a/./b/..", 0, "/a", false},
+    {'c', "../link/..", 0, "", false},
+    {'c', "-", 0, "/a", true},
+  };
+
+  const int num = sizeof(steps) / sizeof(step_t);
+  reset();
+  int passed = run_steps(__FUNCTION__, steps, num);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, passed, num);
+  return (passed == num);
+}
+
+
+/*
+ * Tests the order in which CDPATH entries are tried, starting each
+ * lookup from a. Entries are given relative to the scratch tree.
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_dirs_cdpath()
+{
+  typedef struct {
+    const char *cdpath;
+    const char *dir;
+    int exp_ret;
+    const char *exp_pwd;
+    bool exp_announce;
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {"p1:p2", "proj", 0, "/p1/proj", true},
+    {"p2:p1", "proj", 0, "/p2/proj", true},
+    {"p1:p2", "only2", 0, "/p2/only2", true},
+    {"p1:p2", "proj/..", 0, "/p1", true},
+
+    // an empty entry is the current directory, in its place in the list
+    {":p1", "proj", 0, "/a/proj", false},
+    {"p1:", "proj", 0, "/p1/proj", true},
+
+    // the current directory is tried last if it is not listed
+    {"p1", "b", 0, "/a/b", false},
+    {"p1", "only2", -1, "/a", false},
+
+    // names that start with . or / do not use CDPATH
+    {"p1", "./proj", 0, "/a/proj", false},
+    {"p1:p2", "../p2", 0, "/p2", false},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  char cdpath[PATH_MAX * 4];
+
+  for (int i = 0; i < num_tests; i++) {
+    // "p1:" is root/p1 then an empty entry
+    char *o = cdpath;
+    const char *p = tests[i].cdpath;
+    for (;;) {
+      size_t n = strcspn(p, ":");
+      if (n > 0)
+        o += sprintf(o, "%s/%.*s", root, (int)n, p);
+      if (!p[n])
+        break;
+      *o++ = ':';
+      p += n + 1;
+    }
+    *o = '\0';
+
+    reset();
+    setenv("CDPATH", cdpath, 1);
+    step_t steps[] = {
+      {'c', "a", 0, "/a", false},
+      {'c', tests[i].dir, tests[i].exp_ret, tests[i].exp_pwd, tests[i].exp_announce},
+    };
+    if (run_steps(__FUNCTION__, steps, 2) == 2)
+      tests_passed++;
+    else
+      printf("  FAILED: test %d (CDPATH %s)\n", i, tests[i].cdpath);
+  }
+
+  // a directory made after CDPATH was read is still found
+  char made[PATH_MAX + 16];
+  snprintf(made, sizeof(made), "%s/p1/late", root);
+  step_t late[] = {
+    {'c', "late", 0, "/p1/late", true},
+  };
+  reset();
+  snprintf(cdpath, sizeof(cdpath), "%s/p1", root);
+  setenv("CDPATH", cdpath, 1);
+  bool announce;
+  dirs_cd("proj", &announce);
+  if (mkdir(made, 0755) == 0 && run_steps(__FUNCTION__, late, 1) == 1)
+    tests_passed++;
+  rmdir(made);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests + 1);
+  return (tests_passed == num_tests + 1);
+}
+
+
+/*
+ * Tests pushd, pushd with no directory, and popd
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_dirs_stack()
+{
+  step_t steps[] = {
+    {'o', NULL, -1, "", false},             // empty stack
+    {'s', NULL, -1, "", false},
+    {'p', "a", 0, "/a", false},             // stack: root
+    {'p', "../link", 0, "/link", false},    // stack: root a
+    {'p', "no/such/dir", -1, "/link", false},
+    {'s', NULL, 0, "/a", false},            // stack: root link
+    {'s', NULL, 0, "/link", false},         // stack: root a
+    {'o', NULL, 0, "/a", false},            // stack: root
+    {'c', "../link", 0, "/link", false},
+    {'p', "../p1", 0, "/p1", false},        // stack: root link
+    {'o', NULL, 0, "/link", false},         // stack: root
+    {'c', "..", 0, "", false},              // popd kept link logical
+    {'o', NULL, 0, "", false},
+    {'o', NULL, -1, "", false},
+  };
+
+  const int num = sizeof(steps) / sizeof(step_t);
+  reset();
+  int passed = run_steps(__FUNCTION__, steps, num);
+
+  // popping an empty stack says so
+  errno = 0;
+  if (dirs_pop() != -1 || errno != EINVAL) {
+    printf("  FAILED: %s: popd of an empty stack did not give EINVAL\n", __FUNCTION__);
+    passed--;
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, passed, num);
+  return (passed == num);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int success = 1;
+
+  if (!make_tree()) {
+    perror("test_dirs: scratch tree");
+    return 1;
+  }
+
+  success &= test_dirs_logical();
+  success &= test_dirs_cdpath();
+  success &= test_dirs_stack();
+
+  char cmd[PATH_MAX + 16];
+  snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+  if (chdir("/") != 0 || system(cmd) != 0)
+    perror("test_dirs: removing scratch tree");
+
+  if (success) {
+    printf("All dirs tests succeeded!\n");
+    return 0;
+  } else {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+}
@@ -0,0 +1,119 @@
+/*
+ * test_limit.c
+ *
+ * Test functions for limit_parse() in limit.c
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "limit.h"
+
+#define G (1ULL << 30)
+
+
+/*
+ * Tests reading options: sizes and their suffixes, values that are
+ * not valid, and nesting inside limits already set
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_limit_parse()
+{
+  typedef struct {
+    const char *args;             // after "limit", space-separated
+    limit_t outer;                // lim before the call
+    int exp_ret;
+    limit_t exp;                  // lim after, if exp_ret >= 0
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {"cmd", {0, 0, 0}, 1, {0, 0, 0}},
+    {"", {0, 0, 0}, 1, {0, 0, 0}},
+    {"--mem 2G cmd", {0, 0, 0}, 3, {2 * G, 0, 0}},
+    {"--mem 2g --cpu 60 --nofile 1024 make -j8", {0, 0, 0}, 7, {2 * G, 60, 1024}},
+    {"--mem 512K cmd", {0, 0, 0}, 3, {512 << 10, 0, 0}},
+    {"--mem 3M cmd", {0, 0, 0}, 3, {3 << 20, 0, 0}},
+    {"--mem 1T cmd", {0, 0, 0}, 3, {1ULL << 40, 0, 0}},
+    {"--mem 100 cmd", {0, 0, 0}, 3, {100, 0, 0}},
+    {"--cpu 5 -- --mem 1G", {0, 0, 0}, 4, {0, 5, 0}},
+    {"--cpu 5 --cpu 9 cmd", {0, 0, 0}, 5, {0, 5, 0}},
+    {"cmd --mem 1G", {0, 0, 0}, 1, {0, 0, 0}},
+
+    // not valid
+    {"--mem 0 cmd", {0, 0, 0}, -1},
+    {"--cpu 0 cmd", {0, 0, 0}, -1},
+    {"--mem -1 cmd", {0, 0, 0}, -1},
+    {"--mem 2X cmd", {0, 0, 0}, -1},
+    {"--mem 2GB cmd", {0, 0, 0}, -1},
+    {"--mem G cmd", {0, 0, 0}, -1},
+    {"--mem 1.5G cmd", {0, 0, 0}, -1},
+    {"--mem 18446744073709551616 cmd", {0, 0, 0}, -1},         // 2^64
+    {"--mem 17179869184G cmd", {0, 0, 0}, -1},                 // 2^64 bytes
+    {"--mem 16777215T cmd", {0, 0, 0}, 3, {16777215ULL << 40, 0, 0}},
+    {"--mem 16777216T cmd", {0, 0, 0}, -1},
+    {"--mem", {0, 0, 0}, -1},
+    {"--cpu 5 --nofile", {0, 0, 0}, -1},
+    {"--stack 8M cmd", {0, 0, 0}, -1},
+    {"--MEM 1G cmd", {0, 0, 0}, -1},
+    {"--mem=1G cmd", {0, 0, 0}, -1},
+
+    // nested: each field is the tighter of the two
+    {"--mem 4G cmd", {1 * G, 0, 0}, 3, {1 * G, 0, 0}},
+    {"--mem 512M cmd", {1 * G, 0, 0}, 3, {512 << 20, 0, 0}},
+    {"--cpu 10 cmd", {1 * G, 0, 0}, 3, {1 * G, 10, 0}},
+    {"cmd", {1 * G, 30, 64}, 1, {1 * G, 30, 64}},
+    {"--mem 2G --cpu 10 --nofile 4096 cmd", {1 * G, 30, 64}, 7, {1 * G, 10, 64}},
+    {"--nofile 32 cmd", {1 * G, 30, 64}, 3, {1 * G, 30, 32}},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+
+  for (int i = 0; i < num_tests; i++) {
+    test_case_t *t = &tests[i];
+    char words[256], *argv[16] = {"limit"};
+    int argc = 1;
+    snprintf(words, sizeof(words), "%s", t->args);
+    for (char *w = strtok(words, " "); w && argc < 15; w = strtok(NULL, " "))
+      argv[argc++] = w;
+    argv[argc] = NULL;
+
+    limit_t lim = t->outer;
+    int ret = limit_parse(argv, &lim);
+
+    if (ret != t->exp_ret)
+      printf("  FAILED: test %d (%s): expected %d, got %d\n", i, t->args, t->exp_ret, ret);
+    else if (ret >= 0 && memcmp(&lim, &t->exp, sizeof(lim)))
+      printf("  FAILED: test %d (%s): got mem %llu cpu %llu nofile %llu\n", i, t->args,
+             (unsigned long long)lim.mem, (unsigned long long)lim.cpu,
+             (unsigned long long)lim.nofile);
+    else
+      tests_passed++;
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int success = 1;
+
+  success &= test_limit_parse();
+
+  if (success) {
+    printf("All limit tests succeeded!\n");
+    return 0;
+  } else {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+}
@@ -0,0 +1,354 @@
+/*
+ * test_memo.c
+ *
+ * Test functions for memo.c. The store and the files the commands
+ * name are kept in a scratch directory under /tmp, and the commands
+ * are run by a stand-in for execute_command() that counts its calls.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include "memo.h"
+
+static char root[] = "/tmp/test_memo.XXXXXX";
+static int runs = 0;              // calls to fake_run()
+static int next_status = 0;       // what fake_run() returns
+
+/*
+ * Stand-in for execute_command(): prints how many times it has run,
+ * so that a replayed answer shows an old count
+ */
+static int
+fake_run(command_t *cmd)
+{
+  printf("run %d\n", ++runs);
+  return next_status;
+}
+
+/*
+ * Writes a file in the scratch directory
+ */
+static void
+write_file(const char *name, const char *text)
+{
+  FILE *fp = fopen(name, "w");
+  if (!fp || fputs(text, fp) < 0 || fclose(fp) != 0)
+    perror(name);
+}
+
+/*
+ * Makes every stored answer look age seconds older. The creation
+ * time follows the 8-byte magic and two 32-bit fields of the header.
+ */
+static void
+age_store(long age)
+{
+  DIR *d = opendir("store");
+  struct dirent *de;
+  char path[PATH_MAX];
+
+  while (d && (de = readdir(d))) {
+    if (de->d_name[0] == '.')
+      continue;
+    snprintf(path, sizeof(path), "store/%s", de->d_name);
+    int fd = open(path, O_RDWR);
+    int64_t created;
+    if (fd >= 0 && pread(fd, &created, sizeof(created), 16) == sizeof(created)) {
+      created -= age;
+      if (pwrite(fd, &created, sizeof(created), 16) != sizeof(created))
+        perror(path);
+    }
+    if (fd >= 0)
+      close(fd);
+  }
+  if (d)
+    closedir(d);
+}
+
+/*
+ * Runs a command through memo_run(), catching what it prints
+ *
+ * Parameters:
+ *   args     The command, as space-separated words
+ *   cwd      The directory given to memo_run()
+ *   ttl      The time to live given to memo_run()
+ *   out      Where the output is put
+ *   out_len  Size of out
+ *
+ * Returns:
+ *   The exit status memo_run() gave
+ */
+static int
+run_memo(const char *args, const char *cwd, long ttl, char *out, size_t out_len)
+{
+  command_t *cmd = command_new();
+  char words[256];
+  snprintf(words, sizeof(words), "%s", args);
+  for (char *w = strtok(words, " "); w; w = strtok(NULL, " "))
+    command_append_arg(cmd, w);
+
+  FILE *fp = tmpfile();
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  dup2(fileno(fp), STDOUT_FILENO);
+  int status = memo_run(cmd, cwd, ttl, fake_run);
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+
+  ssize_t len = pread(fileno(fp), out, out_len - 1, 0);
+  out[len > 0 ? len : 0] = '\0';
+  fclose(fp);
+  command_free(cmd);
+  return status;
+}
+
+
+/*
+ * Tests what is in the key: a change to the arguments, the directory,
+ * a listed environment variable, a file named as an argument or a
+ * file given as stdin runs the command again, and nothing else does
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_memo_key()
+{
+  typedef struct {
+    char action;                  // before running: 'w' rewrites data,
+                                  //   'e' changes TEST_MEMO_VAR, 'u'
+                                  //   changes an unlisted variable, 'i'
+                                  //   rewrites input, '-' nothing
+    const char *args;
+    const char *cwd;
+    bool exp_run;
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {'-', "probe a", "/x", true},
+    {'-', "probe a", "/x", false},
+    {'-', "probe b", "/x", true},               // argv
+    {'-', "probe a b", "/x", true},
+    {'-', "probe ab", "/x", true},              // not the same as "a b"
+    {'-', "probe a", "/y", true},               // cwd
+    {'-', "probe a", "/x", false},
+    {'e', "probe a", "/x", true},               // listed variable
+    {'-', "probe a", "/x", false},
+    {'u', "probe a", "/x", false},              // unlisted variable
+    {'-', "probe data", "/x", true},
+    {'-', "probe data", "/x", false},
+    {'w', "probe data", "/x", true},            // the file changed
+    {'-', "probe data", "/x", false},
+    {'i', "probe", "/x", true},                 // stdin from input
+    {'-', "probe", "/x", false},
+    {'i', "probe", "/x", true},                 // input changed
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  char out[256], exp_out[32];
+  int saved_stdin = dup(STDIN_FILENO);
+
+  setenv("MEMO_ENV", "TEST_MEMO_VAR", 1);
+  setenv("TEST_MEMO_VAR", "1", 1);
+  write_file("data", "one\n");
+  write_file("input", "one\n");
+
+  for (int i = 0; i < num_tests; i++) {
+    test_case_t *t = &tests[i];
+    char value[32];
+    snprintf(value, sizeof(value), "%0*d", i + 1, i);      // a new size each time
+
+    switch (t->action) {
+    case 'w': write_file("data", "a longer line\n"); break;
+    case 'e': setenv("TEST_MEMO_VAR", value, 1); break;
+    case 'u': setenv("TEST_MEMO_OTHER", value, 1); break;
+    case 'i': write_file("input", value); break;
+    }
+
+    // the stdin is an open file, so is checked while it is in place
+    if (t->action == 'i' || (i > 0 && tests[i - 1].action == 'i')) {
+      int fd = open("input", O_RDONLY);
+      dup2(fd, STDIN_FILENO);
+      close(fd);
+    }
+
+    int before = runs;
+    next_status = 0;
+    int status = run_memo(t->args, t->cwd, 0, out, sizeof(out));
+    dup2(saved_stdin, STDIN_FILENO);
+
+    bool ran = runs != before;
+    snprintf(exp_out, sizeof(exp_out), "run %d\n", runs);
+    if (ran != t->exp_run)
+      printf("  FAILED: test %d (%s in %s): %s\n", i, t->args, t->cwd,
+             ran ? "ran again" : "replayed");
+    else if (status != 0 || (ran && strcmp(out, exp_out)))
+      printf("  FAILED: test %d (%s in %s): status %d, output \"%s\"\n", i, t->args, t->cwd,
+             status, out);
+    else
+      tests_passed++;
+  }
+  close(saved_stdin);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Tests that a stored answer is replayed with its output and status
+ * until it is older than the time to live
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_memo_ttl()
+{
+  typedef struct {
+    long age;                     // seconds to age the store by first
+    long ttl;
+    bool exp_run;
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {0, 60, true},
+    {0, 60, false},
+    {30, 60, false},
+    {0, 0, false},                // no limit
+    {40, 60, true},               // 70 seconds old
+    {0, 60, false},               // the new answer
+    {100, 0, false},
+    {0, 1, true},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  char out[256], first_out[256] = "";
+  int first_status = 0;
+
+  for (int i = 0; i < num_tests; i++) {
+    age_store(tests[i].age);
+
+    int before = runs;
+    next_status = 3 + i;
+    int status = run_memo("probe ttl", "/ttl", tests[i].ttl, out, sizeof(out));
+    bool ran = runs != before;
+
+    if (ran) {
+      snprintf(first_out, sizeof(first_out), "%s", out);
+      first_status = status;
+    }
+    if (ran != tests[i].exp_run)
+      printf("  FAILED: test %d (age %ld, ttl %ld): %s\n", i, tests[i].age, tests[i].ttl,
+             ran ? "ran again" : "replayed");
+    else if (!ran && (status != first_status || strcmp(out, first_out)))
+      printf("  FAILED: test %d: replayed %d \"%s\", stored %d \"%s\"\n", i, status, out,
+             first_status, first_out);
+    else
+      tests_passed++;
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Tests which exit statuses are stored: failures are, but 126 and up,
+ * for a command that could not run or was killed, are not
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_memo_status()
+{
+  typedef struct {
+    int status;
+    bool exp_stored;
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {0, true},
+    {1, true},
+    {125, true},
+    {126, false},
+    {127, false},
+    {130, false},
+    {137, false},
+    {255, false},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  char args[32], out[256];
+
+  for (int i = 0; i < num_tests; i++) {
+    snprintf(args, sizeof(args), "probe status%d", tests[i].status);
+    next_status = tests[i].status;
+    int first = run_memo(args, "/status", 0, out, sizeof(out));
+
+    int before = runs;
+    next_status = 0;
+    int second = run_memo(args, "/status", 0, out, sizeof(out));
+    bool stored = runs == before;
+
+    if (first != tests[i].status || stored != tests[i].exp_stored
+        || second != (stored ? tests[i].status : 0))
+      printf("  FAILED: status %d: %s, then %d\n", tests[i].status,
+             stored ? "stored" : "not stored", second);
+    else
+      tests_passed++;
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int success = 1;
+  char store[sizeof(root) + 8];
+
+  if (!mkdtemp(root) || chdir(root) != 0) {
+    perror("test_memo: scratch directory");
+    return 1;
+  }
+  snprintf(store, sizeof(store), "%s/store", root);
+  setenv("MEMO_DIR", store, 1);
+  memo_init();
+
+  success &= test_memo_key();
+  success &= test_memo_ttl();
+  success &= test_memo_status();
+
+  if (memo_clear() != 0)
+    perror("test_memo: memo_clear");
+  char cmd[sizeof(root) + 16];
+  snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+  if (chdir("/") != 0 || system(cmd) != 0)
+    perror("test_memo: removing scratch directory");
+
+  if (success) {
+    printf("All memo tests succeeded!\n");
+    return 0;
+  } else {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+}
@@ -38,6 +38,11 @@ ilse_test_read_word()
   } test_matrix_t;
 
   setenv("TESTVAR", "Scotty Dog", 1);
+  setenv("ARITH_N", "1", 1);
+  unsetenv("ARITH_M");
+
+  char *params[] = {"test_parser", "one", "two", NULL};
+  parser_set_positional(params);
   
   char word_buf[32];
   test_matrix_t tests[] =
@@ -92,6 +97,7 @@ ilse_test_read_word()
       {"\\\"", "\"", 2},
       {" one\\<two  ", "one<two", 9},
       {" two\\>one!", "two>one!", 10},
+      {"one\\;two", "one;two", 8},
 
 
       {"x\\n\\t\\r\\\\\\ \\\"   ", "x\n\t\r\\ \"", 13},
@@ -117,9 +123,31 @@ ilse_test_read_word()
       {"\"$-TESTVAR\"", "Undefined variable: ''", -1},
       {"$$", "Undefined variable: ''", -1},
       {"x\"$TESTVAR\"x", "xScotty Dogx", 12},
+      {"$TESTVAR$TESTVAR", "Scotty DogScotty Dog", 16},
       {"\\$TESTVAR", "$TESTVAR", 9},
+
+      // positional parameters
+      {"$0", "test_parser", 2},
+      {"$1-$2", "one-two", 5},
+      {"$3", "", 2},
+      {"$#", "2", 2},
+      {"\"$# args\"", "2 args", 9},
+      {"$12", "one2", 3},
       {"\"\\$TESTVAR\"", "$TESTVAR", 11},
 
+      // arithmetic expansion
+      {"$((1 + 2 * 3))", "7", 14},
+      {"x$(( (1+2)*3 ))y", "x9y", 16},
+      {"\"$((-7 % 3)) $((7/2))\"", "-1 3", 22},
+      {"$((1 << 4 | 0x0f)),$((010))", "31,8", 27},
+      {"$(($# + $2$1))", "Arithmetic: Syntax error in exp", -1},
+      {"$(($# + ARITH_N))", "3", 17},
+      {"$((ARITH_N += 2, ARITH_N * 10))", "30", 31},
+      {"$((ARITH_N++ + ARITH_N))", "7", 24},
+      {"$((ARITH_N > 3 ? 1 : 0 && ARITH_M++))", "1", 37},
+      {"$((ARITH_N == 4 || ARITH_M++))", "1", 30},
+      {"$((1/0))", "Arithmetic: Division by zero", -1},
+
       // redirection
       {"< /path/to/file  $TESTVAR", "</path/to/file", 15},
       {"<    /path/to/file  $TESTVAR", "</path/to/file", 18},
@@ -162,6 +190,12 @@ ilse_test_read_word()
     
   }
 
+  parser_set_positional(NULL);
+  if (getenv("ARITH_M")) {
+    printf("  FAILED: an operand that should be skipped was evaluated\n");
+    tests_passed--;
+  }
+
   printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
   return (tests_passed == num_tests);
 }
@@ -430,6 +464,38 @@ ilse_test_parse_input()
   passed += test_parser_once("cat > /a/file >/a/different/file", NULL,
       NULL, false, "Multiple redirections not allowed");
 
+  passed += test_parser_once("echo $((1 +)) ok", NULL, NULL, false,
+      "Arithmetic: Syntax error in expression");
+  passed += test_parser_once("echo $((FOO))", NULL, NULL, false,
+      "Arithmetic: Bad number 'Carnegie Mellon' in FOO");
+  passed += test_parser_once("echo $((1 + 2) >out", NULL, NULL, false,
+      "Unterminated arithmetic expansion");
+  passed += test_parser_once("echo $(( 6 * 7 )) > $((2 + 2))", NULL, "4", true,
+      "echo", "42", NULL);
+
+  // deep nesting is refused rather than running out of C stack
+  char *deep = malloc(200020);
+  if (deep) {
+    const char *nests[][2] = {{"(", ")"}, {"~", ""}, {"1?", ":0"}, {"x=", ""}};
+    for (int n = 0; n < sizeof(nests) / sizeof(nests[0]); n++) {
+      int times = 50000 / (strlen(nests[n][0]) + strlen(nests[n][1]));
+      char *p = deep + sprintf(deep, "echo $((");
+      for (int i = 0; i < times; i++)
+        p += sprintf(p, "%s", nests[n][0]);
+      p += sprintf(p, "1");
+      for (int i = 0; i < times; i++)
+        p += sprintf(p, "%s", nests[n][1]);
+      sprintf(p, "))");
+      passed += test_parser_once(deep, NULL, NULL, false,
+          "Arithmetic: Expression nested too deeply");
+    }
+    free(deep);
+  }
+  passed += test_parser_once("echo $((((((((((((((((((((7))))))))))))))))))))", NULL, NULL,
+      true, "echo", "7", NULL);
+  passed += test_parser_once("echo $((- - - -1 ? 2 ? 3 : 4 : 5))", NULL, NULL, true, "echo",
+      "3", NULL);
+
   passed += test_parser_once("<foo", "foo", NULL, false, "Missing command");
   passed += test_parser_once("  < foo", "foo", NULL, false, "Missing command");
   passed += test_parser_once(">  foo", NULL, "foo", false, "Missing command");
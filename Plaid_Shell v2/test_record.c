@@ -0,0 +1,234 @@
+/*
+ * test_record.c
+ *
+ * Test functions for record.c: entries written with record_line()
+ * must read back unchanged, including the values at the edges of the
+ * varint and zigzag encodings
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "record.h"
+
+static char log_path[] = "/tmp/test_record.XXXXXX";
+
+/*
+ * The entries written, in order. Times are offsets from when the
+ * recording starts, and must not go backwards.
+ */
+static const struct {
+  uint64_t offset_ns;
+  const char *cwd;
+  const char *line;
+  int status;
+  uint64_t stage_ns[N_STAGES];
+} entries[] = {
+  {0, "/", "true", 0, {0, 0, 0, 0}},
+  {0, "/", "", 0, {0, 0, 0, 0}},                  // no time passed
+  {1, "/tmp", "cd /tmp", 1, {1, 1, 1, 1}},
+  {127, "/tmp", "false", -1, {127, 128, 129, 255}},
+  {128, "/tmp", "echo", 63, {16383, 16384, 0, 0}},
+  {16511, "", "x", -64, {0, 0, 0, 0}},
+  {16512, "/tmp", "y", 64, {0, 0, 0, 0}},
+  {16512, "/a/much/longer/directory", "z", -65, {0, 0, 0, 0}},
+  {1000000000, "/a/much/longer/directory", "sleep 1", 126, {0, 0, 0, 1000000000}},
+  {1000000001, "/home/us\xc3\xa9r", "echo caf\xc3\xa9", 127, {0, 0, 0, 0}},
+  {1000000002, "/home/us\xc3\xa9r", "kill -9 $$", INT_MAX,
+   {UINT32_MAX, (uint64_t)UINT32_MAX + 1, INT64_MAX, UINT64_MAX}},
+  {1000000002, "/home/us\xc3\xa9r", "again", INT_MIN, {UINT64_MAX, 0, UINT64_MAX, 0}},
+  {(uint64_t)1 << 62, "/", "much later", INT_MIN + 1, {0, 0, 0, 0}},
+};
+
+#define N_ENTRIES (sizeof(entries) / sizeof(entries[0]))
+
+/*
+ * Compares an entry read back with the one written
+ *
+ * Returns:
+ *   True if they are the same
+ */
+static bool
+same_entry(int i, const record_entry_t *e, uint64_t start_ns)
+{
+  if (e->time_ns != start_ns + entries[i].offset_ns || e->status != entries[i].status
+      || strcmp(e->cwd, entries[i].cwd) || strcmp(e->line, entries[i].line))
+    return false;
+  for (int s = 0; s < N_STAGES; s++)
+    if (e->stage_ns[s] != entries[i].stage_ns[s])
+      return false;
+  return true;
+}
+
+
+/*
+ * Tests that every entry written reads back the same, in order, and
+ * that the log then ends
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_record_round_trip(uint64_t start_ns)
+{
+  int tests_passed = 0;
+  record_entry_t e;
+
+  record_reader_t *reader = record_reader_open(log_path);
+  if (!reader) {
+    printf("  FAILED: cannot open %s: %s\n", log_path, strerror(errno));
+    return false;
+  }
+
+  for (int i = 0; i < N_ENTRIES; i++) {
+    int result = record_read(reader, &e);
+    if (result != 1)
+      printf("  FAILED: entry %d: record_read returned %d\n", i, result);
+    else if (!same_entry(i, &e, start_ns))
+      printf("  FAILED: entry %d: read back as %llu \"%s\" \"%s\" status %d\n", i,
+             (unsigned long long)(e.time_ns - start_ns), e.cwd, e.line, e.status);
+    else
+      tests_passed++;
+  }
+
+  int result = record_read(reader, &e);
+  if (result == 0)
+    tests_passed++;
+  else
+    printf("  FAILED: record_read at the end returned %d\n", result);
+  record_reader_close(reader);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, (int)N_ENTRIES + 1);
+  return (tests_passed == N_ENTRIES + 1);
+}
+
+
+/*
+ * Tests logs cut short at every byte, and a file that is not a log:
+ * whatever is read before the cut is right, and nothing past it is
+ * made up
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_record_truncated(uint64_t start_ns)
+{
+  char cut_path[] = "/tmp/test_record_cut.XXXXXX";
+  int tests_passed = 0, num_tests = 0;
+  record_entry_t e;
+
+  FILE *fp = fopen(log_path, "r");
+  char *data = malloc(1 << 16);
+  size_t full = (fp && data) ? fread(data, 1, 1 << 16, fp) : 0;
+  if (fp)
+    fclose(fp);
+  int fd = mkstemp(cut_path);
+  if (full == 0 || fd < 0) {
+    printf("  FAILED: cannot set up\n");
+    free(data);
+    return false;
+  }
+  close(fd);
+
+  // the header is 16 bytes; anything shorter is not a log
+  for (size_t len = 0; len < full; len++) {
+    num_tests++;
+    fp = fopen(cut_path, "w");
+    if (!fp || fwrite(data, 1, len, fp) != len || fclose(fp) != 0)
+      continue;
+
+    record_reader_t *reader = record_reader_open(cut_path);
+    if (len < 16) {
+      if (!reader && errno == EINVAL)
+        tests_passed++;
+      else
+        printf("  FAILED: %zu bytes opened as a log\n", len);
+      record_reader_close(reader);
+      continue;
+    }
+    if (!reader) {
+      printf("  FAILED: %zu bytes: cannot open\n", len);
+      continue;
+    }
+
+    int n = 0, result;
+    bool ok = true;
+    while ((result = record_read(reader, &e)) == 1)
+      ok &= n < N_ENTRIES && same_entry(n++, &e, start_ns);
+    record_reader_close(reader);
+
+    if (ok && n < N_ENTRIES)
+      tests_passed++;
+    else
+      printf("  FAILED: %zu bytes: %d entries read, last result %d\n", len, n, result);
+  }
+
+  num_tests++;
+  fp = fopen(cut_path, "w");
+  if (fp && fputs("PLSHREC0 and then some more", fp) >= 0 && fclose(fp) == 0
+      && !record_reader_open(cut_path) && errno == EINVAL)
+    tests_passed++;
+  else
+    printf("  FAILED: a file with the wrong magic opened as a log\n");
+
+  unlink(cut_path);
+  free(data);
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int success = 1;
+  record_entry_t e;
+  struct timespec ts;
+
+  int fd = mkstemp(log_path);
+  if (fd < 0) {
+    perror("test_record");
+    return 1;
+  }
+  close(fd);
+
+  // record_open() takes the start time, so the entries' times are
+  // offsets from just after it
+  if (record_open(log_path) != 0) {
+    perror("test_record: record_open");
+    return 1;
+  }
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint64_t start_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+  for (int i = 0; i < N_ENTRIES; i++) {
+    e.time_ns = start_ns + entries[i].offset_ns;
+    e.cwd = entries[i].cwd;
+    e.line = entries[i].line;
+    e.status = entries[i].status;
+    memcpy(e.stage_ns, entries[i].stage_ns, sizeof(e.stage_ns));
+    record_line(&e);
+  }
+
+  success &= test_record_round_trip(start_ns);
+  success &= test_record_truncated(start_ns);
+
+  unlink(log_path);
+
+  if (success) {
+    printf("All record tests succeeded!\n");
+    return 0;
+  } else {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+}
@@ -0,0 +1,439 @@
+/*
+ * test_script.c
+ *
+ * Test functions for script.c
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include "script.h"
+#include "dircache.h"
+
+static char exec_log[1024];
+
+/*
+ * Stand-in for execute_command(): appends the argv of each command
+ * to exec_log, separated by '|', followed by any input redirection
+ * or here-document text. The commands "true" and "false"
+ * return their usual status, "count N" succeeds the first N times
+ * it is called after a reset, and "mk NAME" creates the file NAME. Shell functions are called the same
+ * way as in plaidsh, and are not logged themselves.
+ */
+static int count_calls;
+
+static int
+log_exec(command_t *cmd)
+{
+  char * const *argv = command_get_argv(cmd);
+
+  script_t *func = script_find_function(argv[0]);
+  if (func)
+    return script_call_function(func, cmd, log_exec);
+
+  if (exec_log[0])
+    strncat(exec_log, "|", sizeof(exec_log) - strlen(exec_log) - 1);
+  for (int i = 0; argv[i]; i++) {
+    if (i > 0)
+      strncat(exec_log, " ", sizeof(exec_log) - strlen(exec_log) - 1);
+    strncat(exec_log, argv[i], sizeof(exec_log) - strlen(exec_log) - 1);
+  }
+  if (command_get_input_text(cmd)) {
+    strncat(exec_log, " <<<", sizeof(exec_log) - strlen(exec_log) - 1);
+    strncat(exec_log, command_get_input_text(cmd), sizeof(exec_log) - strlen(exec_log) - 1);
+  } else if (command_get_input(cmd)) {
+    strncat(exec_log, " <", sizeof(exec_log) - strlen(exec_log) - 1);
+    strncat(exec_log, command_get_input(cmd), sizeof(exec_log) - strlen(exec_log) - 1);
+  }
+
+  if (!strcmp(argv[0], "false"))
+    return 1;
+  if (!strcmp(argv[0], "count"))
+    return (count_calls++ < atoi(argv[1])) ? 0 : 1;
+  if (!strcmp(argv[0], "mk") && argv[1]) {
+    int fd = open(argv[1], O_WRONLY | O_CREAT, 0644);
+    if (fd < 0)
+      return 1;
+    close(fd);
+  }
+  return 0;
+}
+
+
+/*
+ * Tests script_parse() and script_run() on inputs that are valid
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_script_run()
+{
+  typedef struct {
+    const char *input;
+    const char *exp_log;
+    int exp_status;
+  } test_matrix_t;
+
+  setenv("FOO", "Carnegie Mellon", 1);
+
+  test_matrix_t tests[] =
+    {
+      {"", "", 0},
+      {"   ;  ; ", "", 0},
+      {"echo one", "echo one", 0},
+      {"echo one; echo two", "echo one|echo two", 0},
+      {"echo one\necho two\n", "echo one|echo two", 0},
+      {"echo \"a;b\" a\\;b", "echo a;b a;b", 0},
+      {"echo if then fi", "echo if then fi", 0},
+      {"false", "false", 1},
+
+      {"if true; then echo yes; fi", "true|echo yes", 0},
+      {"if false; then echo yes; fi", "false", 0},
+      {"if false; then echo yes; else echo no; fi", "false|echo no", 0},
+      {"if false; then echo 1; elif true; then echo 2; else echo 3; fi",
+       "false|true|echo 2", 0},
+      {"if false; then echo 1; elif false; then echo 2; else echo 3; fi",
+       "false|false|echo 3", 0},
+      {"if true; then false; fi", "true|false", 1},
+      {"if true\nthen\n  echo a\n  echo b\nfi", "true|echo a|echo b", 0},
+      {"if if true; then false; fi; then echo a; else echo b; fi",
+       "true|false|echo b", 0},
+
+      {"while count 3; do echo x; done",
+       "count 3|echo x|count 3|echo x|count 3|echo x|count 3", 0},
+      {"while false; do echo x; done", "false", 0},
+
+      {"for i in a b c; do echo $i; done", "echo a|echo b|echo c", 0},
+      {"for i in; do echo $i; done", "", 0},
+      {"for i in \"a b\" $FOO; do echo $i; done",
+       "echo a b|echo Carnegie Mellon", 0},
+      {"for i in 1 2; do for j in x y; do echo $i$j; done; done",
+       "echo 1x|echo 1y|echo 2x|echo 2y", 0},
+      {"for i in 1 2; do if true; then echo $i; fi; done; echo end",
+       "true|echo 1|true|echo 2|echo end", 0},
+
+      {"greet() { echo hi $1; }; greet Bob; greet", "echo hi Bob|echo hi", 0},
+      {"greet Ann", "echo hi Ann", 0},
+      {"greet ()\n{\n  echo hello $# $2\n}\ngreet a b c", "echo hello 3 b", 0},
+      {"args() { echo $0 $#; }; args; args x \"y z\"", "echo args 0|echo args 2", 0},
+      {"fails() { true; false; }; if fails; then echo a; else echo b; fi",
+       "true|false|echo b", 0},
+      {"outer() { inner $1 $1; echo $1; }; inner() { echo $#; }; outer q",
+       "echo 2|echo q", 0},
+      {"countdown() { if count $1; then echo $1; countdown $1; fi; }; countdown 2",
+       "count 2|echo 2|count 2|echo 2|count 2", 0},
+      {"redef() { echo 1; redef() { echo 2; }; }; redef; redef",
+       "echo 1|echo 2", 0},
+
+      {"true && echo a", "true|echo a", 0},
+      {"false && echo a", "false", 1},
+      {"false || echo a", "false|echo a", 0},
+      {"true || echo a", "true", 0},
+      {"false && echo a || echo b", "false|echo b", 0},
+      {"true && false || echo b; echo c", "true|false|echo b|echo c", 0},
+      {"true&&echo a||echo b", "true|echo a", 0},
+      {"false ||\n echo a", "false|echo a", 0},
+      {"echo a\\&\\&b \"c||d\"", "echo a&&b c||d", 0},
+      {"if false || true; then echo y; fi && echo z", "false|true|echo y|echo z", 0},
+      {"false; echo $?; true; echo $?", "false|echo 1|true|echo 0", 0},
+      {"while count 2 && true; do echo x; done && echo end",
+       "count 2|true|echo x|count 2|true|echo x|count 2|echo end", 0},
+
+      {"cat <<EOF\na $FOO\n  b\"c\\d \\$FOO\nEOF\necho after",
+       "cat <<<a Carnegie Mellon\n  b\"c\\d $FOO\n|echo after", 0},
+      {"cat <<'EOF'\n$FOO\nEOF", "cat <<<$FOO\n", 0},
+      {"cat <<-X\n\t\tx\n\tX", "cat <<<x\n", 0},
+      {"cat <<A; cat <<B >out\n1\nA\n2\nB", "cat <<<1\n|cat <<<2\n", 0},
+      {"wc <<E\nE", "wc </dev/null", 0},
+      {"f() { cat <<EOF\nin $1\nEOF\n}; f z", "cat <<<in z\n", 0},
+      {"tr a-z <<< \"a b\"; tr<<<$FOO", "tr a-z <<<a b\n|tr <<<Carnegie Mellon\n", 0},
+
+      {"diff <(sort a; echo \"x)\") >(wc -l)", "diff <(sort a; echo \"x)\") >(wc -l)", 0},
+      {"cat < <(ls && true) && echo ok", "cat <<(ls && true)|echo ok", 0},
+    };
+  const int num_tests = sizeof(tests) / sizeof(test_matrix_t);
+  int tests_passed = 0;
+  char err_msg[128];
+
+  for (int i = 0; i < num_tests; i++) {
+    exec_log[0] = '\0';
+    count_calls = 0;
+
+    script_t *script = script_parse(tests[i].input, err_msg, sizeof(err_msg));
+    if (!script) {
+      printf("  FAILED: script_parse(\"%s\") returned error \"%s\"\n",
+        tests[i].input, err_msg);
+      continue;
+    }
+
+    int status = script_run(script, log_exec);
+    if (status == tests[i].exp_status && strcmp(exec_log, tests[i].exp_log) == 0)
+      tests_passed++;
+    else
+      printf("  FAILED: script_run(\"%s\") returned %d, \"%s\"\n",
+        tests[i].input, status, exec_log);
+
+    script_free(script);
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Tests script_parse() on inputs that must be rejected
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_script_errors()
+{
+  typedef struct {
+    const char *input;
+    const char *exp_error;
+  } test_matrix_t;
+
+  test_matrix_t tests[] =
+    {
+      {"echo \"one", "Unterminated quote"},
+      {"fi", "Syntax error: unexpected 'fi'"},
+      {"echo a; done", "Syntax error: unexpected 'done'"},
+      {"if true; then echo a", "Syntax error: missing 'fi'"},
+      {"if true; echo a; fi", "Syntax error: unexpected 'fi'"},
+      {"if; then echo a; fi", "Syntax error: unexpected 'then'"},
+      {"if true; then fi", "Syntax error: unexpected 'fi'"},
+      {"if true; then echo a; fi echo b", "Syntax error: unexpected 'echo'"},
+      {"while true; do echo a", "Syntax error: missing 'done'"},
+      {"while true; echo a; done", "Syntax error: unexpected 'done'"},
+      {"for; do echo a; done", "Syntax error: unexpected ';'"},
+      {"for i a b; do echo a; done", "Syntax error: unexpected 'a'"},
+      {"for i-j in a; do echo a; done", "Syntax error: bad for variable 'i-j'"},
+      {"for i in a b", "Syntax error: missing 'do'"},
+      {"cat < a < b", "Multiple redirections not allowed"},
+      {"f() echo a", "Syntax error: unexpected 'echo'"},
+      {"f() { echo a", "Syntax error: missing '}'"},
+      {"f() { echo a }", "Syntax error: missing '}'"},
+      {"f() { }", "Syntax error: unexpected '}'"},
+      {"}", "Syntax error: unexpected '}'"},
+      {"&& echo a", "Syntax error: unexpected '&&'"},
+      {"echo a ||", "Syntax error: unexpected end of input"},
+      {"echo a && ; echo b", "Syntax error: unexpected ';'"},
+      {"echo a || || echo b", "Syntax error: unexpected '||'"},
+      {"true && fi", "Syntax error: unexpected 'fi'"},
+      {"cat <<EOF\nno end", "Unterminated here-document 'EOF'"},
+      {"cat <<", "Here-document without delimiter"},
+      {"cat <<<", "Here-string without text"},
+      {"cat <in <<<x", "Multiple redirections not allowed"},
+      {"cat <(echo a", "Unterminated process substitution"},
+    };
+  const int num_tests = sizeof(tests) / sizeof(test_matrix_t);
+  int tests_passed = 0;
+  char err_msg[128];
+
+  for (int i = 0; i < num_tests; i++) {
+    script_t *script = script_parse(tests[i].input, err_msg, sizeof(err_msg));
+    if (script) {
+      printf("  FAILED: script_parse(\"%s\") succeeded but expected error\n",
+        tests[i].input);
+      script_free(script);
+    } else if (strcmp(err_msg, tests[i].exp_error) != 0) {
+      printf("  FAILED: script_parse(\"%s\") returned error \"%s\"\n",
+        tests[i].input, err_msg);
+    } else {
+      tests_passed++;
+    }
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Tests script_reader_t, feeding each input both whole and one
+ * character at a time, which must agree
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_script_reader()
+{
+  typedef struct {
+    const char *input;
+    bool exp_complete;
+    const char *exp_text;
+  } test_matrix_t;
+
+  test_matrix_t tests[] =
+    {
+      {"", true, ""},
+      {"echo a\n", true, "echo a"},
+      {"echo \"a\n", false, NULL},
+      {"echo \"a\nb\"\n", true, "echo \"a\nb\""},
+      {"echo \\\"a\n", true, "echo \\\"a"},
+      {"echo a \\\n", false, NULL},
+      {"echo a \\\nb\n", true, "echo a b"},
+      {"echo \"a\\\nb\"\n", true, "echo \"ab\""},
+      {"true &&\n", false, NULL},
+      {"true &&\necho a\n", true, "true &&\necho a"},
+      {"true &\n", true, "true &"},
+      {"if true; then\n", false, NULL},
+      {"if true; then\n echo fi\n", false, NULL},
+      {"if true; then\n echo fi\nfi\n", true, "if true; then\n echo fi\nfi"},
+      {"for if in a; do\n", false, NULL},
+      {"while true; do if x; then y; fi; done\n", true, "while true; do if x; then y; fi; done"},
+      {"f() {\n", false, NULL},
+      {"f ()\n{ echo a; }\n", true, "f ()\n{ echo a; }"},
+      {"echo if {\n", true, "echo if {"},
+      {"cat <<EOF\n", false, NULL},
+      {"cat <<EOF\nx\n", false, NULL},
+      {"cat <<EOF\nif\nEOF\n", true, "cat <<EOF\nif\nEOF"},
+      {"cat <<EOF\nEOF", true, "cat <<EOF\nEOF"},
+      {"cat <<-'E' <<F\n\tE\nF\n", true, "cat <<-'E' <<F\n\tE\nF"},
+      {"cat <<A <<B\nA\n", false, NULL},
+      {"cat <<<x\n", true, "cat <<<x"},
+      {"echo \"<<x\"\n", true, "echo \"<<x\""},
+      {"cat <(echo a\n", false, NULL},
+      {"cat <(echo a\n)\n", true, "cat <(echo a\n)"},
+      {"echo (x\n", true, "echo (x"},
+    };
+  const int num_tests = sizeof(tests) / sizeof(test_matrix_t);
+  int tests_passed = 0;
+
+  for (int i = 0; i < num_tests; i++) {
+    script_reader_t *whole = script_reader_new();
+    script_reader_t *bytes = script_reader_new();
+    const char *in = tests[i].input;
+
+    script_reader_feed(whole, in, strlen(in));
+    for (size_t j = 0; in[j]; j++)
+      script_reader_feed(bytes, in + j, 1);
+
+    bool complete = script_reader_complete(whole);
+    bool complete2 = script_reader_complete(bytes);
+    char *text = script_reader_take(whole);
+    char *text2 = script_reader_take(bytes);
+
+    if (complete == tests[i].exp_complete && complete2 == complete
+        && !strcmp(text, text2) && (!complete || !strcmp(text, tests[i].exp_text)))
+      tests_passed++;
+    else
+      printf("  FAILED: script_reader(\"%s\") complete %d, text \"%s\"\n",
+        in, complete, text);
+
+    free(text);
+    free(text2);
+    script_reader_free(whole);
+    script_reader_free(bytes);
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+static bool
+always_apart(command_t *cmd)
+{
+  return true;
+}
+
+/*
+ * Tests script_run() with lookahead on, in an empty directory, both
+ * with and without the directory cache. Each command that a glob
+ * depends on is treated as running apart, so the next one is
+ * expanded while it runs and must still see the files it made.
+ *
+ * Returns:
+ *   true if all test cases pass; false otherwise
+ */
+bool
+test_script_lookahead()
+{
+  typedef struct {
+    const char *input;
+    const char *exp_log;
+  } test_matrix_t;
+
+  test_matrix_t tests[] =
+    {
+      {"mk a.x; echo *.x; mk b.x; echo *.x", "mk a.x|echo a.x|mk b.x|echo a.x b.x"},
+      {"echo *.y; mk c.y; echo *.y", "echo *.y|mk c.y|echo c.y"},
+      {"false; echo $?; true; echo $?", "false|echo 1|true|echo 0"},
+      {"mk d.z; echo d*; echo *.x *.y", "mk d.z|echo d.z|echo a.x b.x c.y"},
+      {"echo one; echo *.x; echo *.x", "echo one|echo a.x b.x|echo a.x b.x"},
+    };
+  const int num_tests = sizeof(tests) / sizeof(test_matrix_t);
+  int tests_passed = 0;
+  char err_msg[128];
+  char dir[] = "/tmp/test_script.XXXXXX";
+  char cwd[4096];
+
+  if (!getcwd(cwd, sizeof(cwd)) || !mkdtemp(dir) || chdir(dir) != 0) {
+    printf("  FAILED: cannot make a directory to test in\n");
+    return false;
+  }
+  script_set_lookahead(always_apart);
+
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 1)
+      dircache_init();
+    for (int i = 0; i < num_tests; i++) {
+      exec_log[0] = '\0';
+
+      script_t *script = script_parse(tests[i].input, err_msg, sizeof(err_msg));
+      script_run(script, log_exec);
+      if (strcmp(exec_log, tests[i].exp_log) == 0)
+        tests_passed++;
+      else
+        printf("  FAILED: lookahead %s(\"%s\") gave \"%s\"\n",
+          pass ? "with cache " : "", tests[i].input, exec_log);
+      script_free(script);
+    }
+
+    DIR *d = opendir(".");
+    struct dirent *de;
+    while (d && (de = readdir(d)))
+      unlink(de->d_name);
+    if (d)
+      closedir(d);
+  }
+
+  script_set_lookahead(NULL);
+  dircache_set_limit(0);
+  if (chdir(cwd) == 0)
+    rmdir(dir);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, 2 * num_tests);
+  return (tests_passed == 2 * num_tests);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int success = 1;
+
+  success &= test_script_run();
+  success &= test_script_errors();
+  success &= test_script_reader();
+  success &= test_script_lookahead();
+
+  if (success) {
+    printf("All script tests succeeded!\n");
+    return 0;
+  } else {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+}
@@ -0,0 +1,286 @@
+/*
+ * test_shell.c
+ *
+ * End-to-end tests of ./plaidsh: running a script from a file on its
+ * stdin, as in plaidsh < script, and reporting background jobs while
+ * it waits for input
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define WELCOME "Welcome to Plaid Shell Hommies!\n"
+#define TIMEOUT_MS 5000             // a run this slow counts as hung
+
+/*
+ * Runs ./plaidsh with stdin from a file holding script, or from
+ * /dev/null if script is NULL, and collects what it writes to stdout
+ *
+ * Parameters:
+ *   script   The script
+ *   out      Filled with the output, cut short if it does not fit
+ *   out_len  Size of out
+ *
+ * Returns:
+ *   The shell's exit status, or -1 if it did not finish in time or
+ *   could not be run
+ */
+static int
+run_shell(const char *script, char *out, size_t out_len)
+{
+  char path[] = "/tmp/test_shell.XXXXXX";
+  int in = -1, pipefd[2];
+
+  if (script) {
+    if ((in = mkstemp(path)) < 0)
+      return -1;
+    unlink(path);
+    if (write(in, script, strlen(script)) != strlen(script) || lseek(in, 0, SEEK_SET) != 0) {
+      close(in);
+      return -1;
+    }
+  }
+  if (pipe(pipefd) != 0)
+    return -1;
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (script)
+      dup2(in, STDIN_FILENO);
+    else
+      freopen("/dev/null", "r", stdin);
+    dup2(pipefd[1], STDOUT_FILENO);
+    close(pipefd[0]);
+    execl("./plaidsh", "plaidsh", (char *)NULL);
+    _exit(127);
+  }
+  close(pipefd[1]);
+  if (in >= 0)
+    close(in);
+
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  size_t len = 0;
+  bool timed_out = false;
+  for (;;) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long left = TIMEOUT_MS - ((now.tv_sec - start.tv_sec) * 1000
+                              + (now.tv_nsec - start.tv_nsec) / 1000000);
+    struct pollfd pfd = { .fd = pipefd[0], .events = POLLIN };
+    if (left <= 0 || poll(&pfd, 1, left) == 0) {
+      timed_out = true;
+      break;
+    }
+    ssize_t n = read(pipefd[0], out + len, out_len - len - 1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    len += n;
+    if (len == out_len - 1)
+      break;
+  }
+  out[len] = '\0';
+  close(pipefd[0]);
+
+  int status;
+  if (timed_out)
+    kill(pid, SIGKILL);
+  waitpid(pid, &status, 0);
+  if (timed_out || !WIFEXITED(status))
+    return -1;
+  return WEXITSTATUS(status);
+}
+
+
+/*
+ * Tests running scripts from a file on stdin
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_shell_file_stdin()
+{
+  typedef struct {
+    const char *script;         // NULL for /dev/null
+    const char *exp_out;        // after the welcome line
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {NULL, ""},
+    {"", ""},
+    {"echo one\necho two\n", "one\ntwo\n"},
+    {"echo no newline at the end", "no newline at the end\n"},
+
+    // a command reading stdin gets the line after it, and no more
+    {"echo before\nhead -n 1\nread by head\necho after\n", "before\nread by head\nafter\n"},
+    {"cat\nline 1\nline 2\n", "line 1\nline 2\n"},
+
+    // input over several lines, and errors
+    {"if true; then echo yes; fi\n", "yes\n"},
+    {"if true\nthen\n  echo yes\nfi\n", "yes\n"},
+    {"for x in a b\ndo\n  echo $x\ndone\necho after\n", "a\nb\nafter\n"},
+    {"setenv X 5\necho $X $((X * 2))\n", "5 10\n"},
+    {"echo \"unterminated\n", " Error: Unterminated quote\n"},
+    {"false\necho $?\n", "1\n"},
+
+    // a coprocess that answers at the end of its input
+    {"coproc s sort\ncowrite s pear\ncowrite s apple\ncoclose -w s\ncoread s a\ncoread s b\n"
+     "echo $a $b\ncoclose s\n", "apple pear\n"},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  char out[4096];
+
+  for (int i = 0; i < num_tests; i++) {
+    int status = run_shell(tests[i].script, out, sizeof(out));
+    const char *body = strncmp(out, WELCOME, strlen(WELCOME)) ? out : out + strlen(WELCOME);
+
+    if (status != 0) {
+      printf("  FAILED: test %d: status %d\n", i, status);
+      continue;
+    }
+    if (strcmp(body, tests[i].exp_out)) {
+      printf("  FAILED: test %d: expected \"%s\", got \"%s\"\n", i, tests[i].exp_out, body);
+      continue;
+    }
+    tests_passed++;
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+/*
+ * Starts ./plaidsh with stdin and stdout on pipes, writes input, and
+ * then waits, without writing any more or closing its stdin, until
+ * the output contains expect
+ *
+ * Parameters:
+ *   input    What to type
+ *   expect   The output to wait for
+ *   out      Filled with the output, cut short if it does not fit
+ *   out_len  Size of out
+ *
+ * Returns:
+ *   True if expect appeared within the time allowed
+ */
+static bool
+wait_for_output(const char *input, const char *expect, char *out, size_t out_len)
+{
+  int to_shell[2], from_shell[2];
+
+  if (pipe(to_shell) != 0 || pipe(from_shell) != 0)
+    return false;
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(to_shell[0], STDIN_FILENO);
+    dup2(from_shell[1], STDOUT_FILENO);
+    close(to_shell[1]);
+    close(from_shell[0]);
+    execl("./plaidsh", "plaidsh", (char *)NULL);
+    _exit(127);
+  }
+  close(to_shell[0]);
+  close(from_shell[1]);
+  bool written = write(to_shell[1], input, strlen(input)) == strlen(input);
+
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  size_t len = 0;
+  bool found = false;
+  out[0] = '\0';
+  while (written && !found && len < out_len - 1) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long left = TIMEOUT_MS - ((now.tv_sec - start.tv_sec) * 1000
+                              + (now.tv_nsec - start.tv_nsec) / 1000000);
+    struct pollfd pfd = { .fd = from_shell[0], .events = POLLIN };
+    if (left <= 0 || poll(&pfd, 1, left) == 0)
+      break;
+    ssize_t n = read(from_shell[0], out + len, out_len - len - 1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    len += n;
+    out[len] = '\0';
+    found = strstr(out, expect) != NULL;
+  }
+
+  // end of input makes the shell exit
+  close(to_shell[1]);
+  close(from_shell[0]);
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+  return found;
+}
+
+
+/*
+ * Tests that a background job's output and its completion notice are
+ * shown as soon as it finishes, while the shell waits for input
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_shell_job_notices()
+{
+  typedef struct {
+    const char *input;
+    const char *expect;
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {"sleep 0.2 &\n", "[1] Done        sleep 0.2"},
+    {"false &\n", "[1] Exit 1      false"},
+    {"sh -c \"sleep 0.2; echo late\" &\n", "late\n"},
+    {"sleep 0.2 &\nsleep 0.1 &\n", "[2] Done"},
+    {"sleep 1 &\njobs\n", "[1] Running     sleep 1"},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  char out[4096];
+
+  for (int i = 0; i < num_tests; i++) {
+    if (wait_for_output(tests[i].input, tests[i].expect, out, sizeof(out)))
+      tests_passed++;
+    else
+      printf("  FAILED: test %d: expected \"%s\", got \"%s\"\n", i, tests[i].expect, out);
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int success = 1;
+
+  success &= test_shell_file_stdin();
+  success &= test_shell_job_notices();
+
+  if (success) {
+    printf("All shell tests succeeded!\n");
+    return 0;
+  } else {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+}
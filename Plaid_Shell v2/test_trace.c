@@ -0,0 +1,474 @@
+/*
+ * test_trace.c
+ *
+ * Test functions for trace.c: the file trace_write() makes must be
+ * valid JSON in the Chrome Trace Event format, and events read while
+ * the ring is being overwritten must never be torn
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "trace.h"
+
+static char json_path[] = "/tmp/test_trace.XXXXXX";
+
+/*
+ * A small JSON checker, strict about the grammar and about UTF-8.
+ * Each function takes a pointer to where a value starts and returns
+ * a pointer to just past it, or NULL if it is not valid.
+ */
+static const char *json_value(const char *p, int depth);
+
+static const char *
+skip_space(const char *p)
+{
+  while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+    p++;
+  return p;
+}
+
+static const char *
+json_string(const char *p)
+{
+  if (*p++ != '"')
+    return NULL;
+  while (*p != '"') {
+    unsigned char c = *p;
+    if (c < 0x20)
+      return NULL;
+    if (c == '\\') {
+      p++;
+      if (*p == 'u') {
+        for (int i = 1; i <= 4; i++)
+          if (!strchr("0123456789abcdefABCDEF", p[i]) || !p[i])
+            return NULL;
+        p += 5;
+      } else if (*p && strchr("\"\\/bfnrt", *p)) {
+        p++;
+      } else {
+        return NULL;
+      }
+    } else if (c < 0x80) {
+      p++;
+    } else {
+      // a lead byte and the continuation bytes it calls for
+      int more = (c >= 0xc2 && c <= 0xdf) ? 1 : (c >= 0xe0 && c <= 0xef) ? 2
+                 : (c >= 0xf0 && c <= 0xf4) ? 3 : -1;
+      if (more < 0)
+        return NULL;
+      for (p++; more > 0; more--, p++)
+        if ((*p & 0xc0) != 0x80)
+          return NULL;
+    }
+  }
+  return p + 1;
+}
+
+static const char *
+json_number(const char *p)
+{
+  const char *start = p;
+  if (*p == '-')
+    p++;
+  if (*p == '0')
+    p++;
+  else if (*p >= '1' && *p <= '9')
+    while (*p >= '0' && *p <= '9')
+      p++;
+  else
+    return NULL;
+  if (*p == '.') {
+    if (*++p < '0' || *p > '9')
+      return NULL;
+    while (*p >= '0' && *p <= '9')
+      p++;
+  }
+  if (*p == 'e' || *p == 'E') {
+    if (*++p == '+' || *p == '-')
+      p++;
+    if (*p < '0' || *p > '9')
+      return NULL;
+    while (*p >= '0' && *p <= '9')
+      p++;
+  }
+  return p > start ? p : NULL;
+}
+
+static const char *
+json_value(const char *p, int depth)
+{
+  char close = (*p == '{') ? '}' : (*p == '[') ? ']' : '\0';
+
+  if (!close) {
+    if (*p == '"')
+      return json_string(p);
+    if (!strncmp(p, "true", 4) || !strncmp(p, "null", 4))
+      return p + 4;
+    if (!strncmp(p, "false", 5))
+      return p + 5;
+    return json_number(p);
+  }
+
+  if (depth > 16)
+    return NULL;
+  p = skip_space(p + 1);
+  if (*p == close)
+    return p + 1;
+  for (;;) {
+    if (close == '}') {
+      p = json_string(p);
+      if (!p || *(p = skip_space(p)) != ':')
+        return NULL;
+      p = skip_space(p + 1);
+    }
+    p = json_value(p, depth + 1);
+    if (!p)
+      return NULL;
+    p = skip_space(p);
+    if (*p == close)
+      return p + 1;
+    if (*p != ',')
+      return NULL;
+    p = skip_space(p + 1);
+  }
+}
+
+/*
+ * Checks that a whole document is one valid JSON object with a
+ * traceEvents array, as Chrome Trace Event files are
+ */
+static bool
+valid_trace_json(const char *doc)
+{
+  const char *end = json_value(skip_space(doc), 0);
+  return end && *skip_space(end) == '\0' && doc[0] == '{' && strstr(doc, "\"traceEvents\":[");
+}
+
+/*
+ * Decodes the JSON string that follows key in line, as written by
+ * trace.c, which only escapes '"', '\\' and control characters
+ *
+ * Returns:
+ *   True if the key was found
+ */
+static bool
+string_after(const char *line, const char *key, char *out, size_t out_len)
+{
+  const char *p = strstr(line, key);
+  if (!p)
+    return false;
+  size_t n = 0;
+  for (p += strlen(key); *p && *p != '"' && n + 1 < out_len; p++) {
+    if (*p == '\\' && p[1] == 'u') {
+      out[n++] = (char)strtol((char[]){p[2], p[3], p[4], p[5], '\0'}, NULL, 16);
+      p += 5;
+    } else {
+      if (*p == '\\')
+        p++;
+      out[n++] = *p;
+    }
+  }
+  out[n] = '\0';
+  return true;
+}
+
+/*
+ * Reads the whole of the trace file
+ *
+ * Returns:
+ *   Its contents in malloc'd memory, or NULL
+ */
+static char *
+read_trace()
+{
+  FILE *fp = fopen(json_path, "r");
+  if (!fp)
+    return NULL;
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  rewind(fp);
+  char *doc = malloc(size + 1);
+  if (doc && fread(doc, 1, size, fp) != size) {
+    free(doc);
+    doc = NULL;
+  }
+  if (doc)
+    doc[size] = '\0';
+  fclose(fp);
+  return doc;
+}
+
+
+/*
+ * Tests that events are written out as they were recorded, with their
+ * details escaped and truncated so that the file is valid JSON
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_trace_json()
+{
+  typedef struct {
+    char phase;                   // 'X' span, 'i' instant
+    const char *name;
+    pid_t pid;
+    const char *arg;
+    const char *exp_detail;
+  } test_case_t;
+
+  test_case_t tests[] = {
+    {'X', "parse", 0, "echo hello", "echo hello"},
+    {'i', "fork", 0, NULL, ""},
+    {'X', "run", 4242, "sleep 1", "sleep 1"},   // a child gets its own track
+    {'i', "signal", 4242, "", ""},
+    {'X', "run", 0, "echo \"quoted\" and \\back\\", "echo \"quoted\" and \\back\\"},
+    {'i', "line", 0, "tab\there\nnewline\x01", "tab\there\nnewline\x01"},
+    {'X', "run", 4243, "a \"name\" needing \\ escapes", "a \"name\" needing \\ escapes"},
+    {'i', "line", 0, "caf\xc3\xa9 \xe2\x82\xac", "caf\xc3\xa9 \xe2\x82\xac"},
+
+    // cut to TRACE_ARG_LEN - 1 bytes, and never through a character
+    {'i', "line", 0, "0123456789012345678901234567890123456789012345678901234567",
+     "01234567890123456789012345678901234567890123456"},
+    {'i', "line", 0, "012345678901234567890123456789012345678901234\xc3\xa9",
+     "012345678901234567890123456789012345678901234\xc3\xa9"},
+    {'i', "line", 0, "0123456789012345678901234567890123456789012345\xc3\xa9",
+     "0123456789012345678901234567890123456789012345"},
+    {'i', "line", 0, "01234567890123456789012345678901234567890123\xe2\x82\xac",
+     "01234567890123456789012345678901234567890123\xe2\x82\xac"},
+    {'i', "line", 0, "012345678901234567890123456789012345678901234\xe2\x82\xac",
+     "012345678901234567890123456789012345678901234"},
+    {'i', "line", 0, "0123456789012345678901234567890123456789012345\xe2\x82\xac",
+     "0123456789012345678901234567890123456789012345"},
+  };
+
+  const int num_tests = sizeof(tests) / sizeof(test_case_t);
+  int tests_passed = 0;
+  char detail[256], name[32];
+
+  // nothing is recorded while tracing is off, nor a span begun then
+  uint64_t before_on = trace_begin();
+  trace_instant("off", 0, "not recorded");
+  trace_set_enabled(true);
+  trace_span("off", before_on, 0, "not recorded");
+
+  for (int i = 0; i < num_tests; i++) {
+    if (tests[i].phase == 'X')
+      trace_span(tests[i].name, trace_begin(), tests[i].pid, tests[i].arg);
+    else
+      trace_instant(tests[i].name, tests[i].pid, tests[i].arg);
+  }
+
+  long written = trace_write(json_path);
+  char *doc = read_trace();
+  if (written != num_tests || !doc || !valid_trace_json(doc)) {
+    printf("  FAILED: %ld events written, %s\n", written,
+           !doc ? "cannot read the file" : valid_trace_json(doc) ? "valid" : "not valid JSON");
+    free(doc);
+    printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+    return false;
+  }
+
+  // the metadata lines come first: the shell's, then one per child run
+  char *line = strtok(doc, "\n");
+  int i = 0, tracks = 0;
+  for (; line; line = strtok(NULL, "\n")) {
+    if (strstr(line, "\"ph\":\"M\"")) {
+      tracks++;
+      continue;
+    }
+    if (!strstr(line, "\"ph\":\""))
+      continue;
+    if (i == num_tests) {
+      printf("  FAILED: more events than recorded: %s\n", line);
+      break;
+    }
+
+    test_case_t *t = &tests[i++];
+    char phase_key[16];
+    snprintf(phase_key, sizeof(phase_key), "\"ph\":\"%c\"", t->phase);
+    pid_t exp_pid = t->pid ? t->pid : getpid();
+    char *pid_at = strstr(line, "\"pid\":");
+
+    if (!string_after(line, "\"name\":\"", name, sizeof(name)) || strcmp(name, t->name)
+        || !strstr(line, phase_key) || !pid_at || atoi(pid_at + 6) != exp_pid)
+      printf("  FAILED: event %d: %s\n", i - 1, line);
+    else if (!string_after(line, "\"detail\":\"", detail, sizeof(detail))
+             || strcmp(detail, t->exp_detail))
+      printf("  FAILED: event %d: detail \"%s\", expected \"%s\"\n", i - 1, detail,
+             t->exp_detail);
+    else
+      tests_passed++;
+  }
+  if (tracks != 3) {
+    printf("  FAILED: %d process_name tracks, expected 3\n", tracks);
+    tests_passed--;
+  }
+  free(doc);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests);
+  return (tests_passed == num_tests);
+}
+
+
+static atomic_bool writing = false;
+static atomic_bool wrapped = false;     // the writer has filled the ring
+
+/*
+ * Records numbered events as fast as it can until told to stop. Each
+ * event's name, phase, pid and detail all follow from its number, so
+ * a torn event shows as a mix of two.
+ */
+static void *
+writer(void *arg)
+{
+  static const char *names[] = {"parse", "run", "wait"};
+  char detail[TRACE_ARG_LEN];
+
+  for (unsigned long n = 0; atomic_load(&writing); n++) {
+    if (n == TRACE_RING_SIZE)
+      atomic_store(&wrapped, true);
+    for (int i = 0; i < 5; i++)
+      snprintf(detail + 9 * i, sizeof(detail) - 9 * i, "%08lu ", n % 100000000);
+    if (n & 1)
+      trace_instant(names[n % 3], 2 + n % 1000, detail);
+    else
+      trace_span(names[n % 3], trace_begin(), 2 + n % 1000, detail);
+  }
+  return NULL;
+}
+
+/*
+ * Checks one event line written while the writer was running
+ *
+ * Parameters:
+ *   line   The line
+ *   last   The number of the event before it, updated
+ *
+ * Returns:
+ *   True if the event is whole and comes after the one before it
+ */
+static bool
+whole_event(const char *line, long *last)
+{
+  static const char *names[] = {"parse", "run", "wait"};
+  char detail[TRACE_ARG_LEN + 8], name[16], exp[TRACE_ARG_LEN];
+
+  if (!string_after(line, "\"detail\":\"", detail, sizeof(detail)))
+    return false;
+  long n = atol(detail);
+  for (int i = 0; i < 5; i++)
+    snprintf(exp + 9 * i, sizeof(exp) - 9 * i, "%08lu ", n % 100000000);
+  exp[TRACE_ARG_LEN - 1] = '\0';
+
+  char *pid_at = strstr(line, "\"pid\":");
+  bool ok = !strcmp(detail, exp) && n > *last && pid_at && atoi(pid_at + 6) == 2 + n % 1000
+            && string_after(line, "\"name\":\"", name, sizeof(name))
+            && !strcmp(name, names[n % 3]) && strstr(line, (n & 1) ? "\"ph\":\"i\"" : "\"ph\":\"X\"");
+  *last = n;
+  return ok;
+}
+
+
+/*
+ * Tests writing the trace out while a writer keeps overwriting the
+ * ring, as the shell does when "trace write" is used with tracing on.
+ * The ring wraps many times over; every event written out must be
+ * whole, in order, and the file valid.
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_trace_wrap()
+{
+  const int num_tests = 8;
+  int tests_passed = 0;
+  pthread_t thread;
+
+  atomic_store(&writing, true);
+  pthread_create(&thread, NULL, writer, NULL);
+
+  // from here on only the writer's events are in the ring
+  while (!atomic_load(&wrapped))
+    usleep(1000);
+
+  for (int i = 0; i < num_tests; i++) {
+    long written = trace_write(json_path);
+    char *doc = read_trace();
+
+    long events = 0, torn = 0, last = -1;
+    bool valid = doc && valid_trace_json(doc);
+    for (char *line = doc ? strtok(doc, "\n") : NULL; line; line = strtok(NULL, "\n")) {
+      if (!strstr(line, "\"ph\":\"") || strstr(line, "\"ph\":\"M\""))
+        continue;
+      events++;
+      if (!whole_event(line, &last) && torn++ == 0)
+        printf("  FAILED: round %d: torn or out of order: %s\n", i, line);
+    }
+    free(doc);
+
+    if (!valid || written != events || events > TRACE_RING_SIZE || torn)
+      printf("  FAILED: round %d: %s, %ld written, %ld events, %ld torn\n", i,
+             valid ? "valid" : "not valid JSON", written, events, torn);
+    else
+      tests_passed++;
+  }
+
+  atomic_store(&writing, false);
+  pthread_join(thread, NULL);
+
+  // once the writer has stopped, exactly the newest ring's worth
+  long written = trace_write(json_path);
+  char *doc = read_trace();
+  long events = 0, torn = 0, last = -1;
+  for (char *line = doc ? strtok(doc, "\n") : NULL; line; line = strtok(NULL, "\n"))
+    if (strstr(line, "\"ph\":\"") && !strstr(line, "\"ph\":\"M\"")) {
+      events++;
+      torn += !whole_event(line, &last);
+    }
+  free(doc);
+  if (written == TRACE_RING_SIZE && events == TRACE_RING_SIZE && !torn)
+    tests_passed++;
+  else
+    printf("  FAILED: after the writer stopped: %ld written, %ld events, %ld torn\n", written,
+           events, torn);
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests + 1);
+  return (tests_passed == num_tests + 1);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int success = 1;
+
+  int fd = mkstemp(json_path);
+  if (fd < 0) {
+    perror("test_trace");
+    return 1;
+  }
+  close(fd);
+
+  success &= test_trace_json();
+  success &= test_trace_wrap();
+
+  unlink(json_path);
+
+  if (success) {
+    printf("All trace tests succeeded!\n");
+    return 0;
+  } else {
+    printf("NOTE: FAILURES OCCURRED\n");
+    return 1;
+  }
+}
@@ -0,0 +1,71 @@
+/*
+ * timing.c
+ *
+ * Per-stage timers for one line of input
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <string.h>
+#include <time.h>
+#include "timing.h"
+
+bool timing_enabled = false;
+
+// each thread times its own work
+static _Thread_local uint64_t totals_ns[N_STAGES];
+
+static const char *stage_names[N_STAGES] = { "parse", "glob", "spawn", "wait" };
+
+
+static uint64_t
+now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the timing_ calls. All documentation is in the
+ * timing.h file.
+ *
+ **********************************************************************/
+
+void
+timing_enable()
+{
+  timing_enabled = true;
+}
+
+
+uint64_t
+timing_begin()
+{
+  return timing_enabled ? now_ns() : 0;
+}
+
+
+void
+timing_end(stage_t stage, uint64_t begin)
+{
+  if (timing_enabled)
+    totals_ns[stage] += now_ns() - begin;
+}
+
+
+void
+timing_take(uint64_t totals[N_STAGES])
+{
+  memcpy(totals, totals_ns, sizeof(totals_ns));
+  memset(totals_ns, 0, sizeof(totals_ns));
+}
+
+
+const char *
+timing_stage_name(stage_t stage)
+{
+  return stage_names[stage];
+}
@@ -0,0 +1,55 @@
+/*
+ * timing.h
+ *
+ * Per-stage timers for the work done on one line of input: parsing,
+ * globbing, spawning programs and waiting for them. They cost nothing
+ * beyond a flag test until timing_enable() is called, and are used by
+ * the session recorder (see record.h).
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _TIMING_H_
+#define _TIMING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+  STAGE_PARSE,    // script_parse() and parse_input(), including globbing
+  STAGE_GLOB,     // glob() calls made while parsing
+  STAGE_SPAWN,    // fork() of external programs
+  STAGE_WAIT,     // waiting for external programs to finish
+  N_STAGES
+} stage_t;
+
+extern bool timing_enabled;
+
+/*
+ * Turns the timers on for the rest of the process's life
+ */
+void timing_enable();
+
+/*
+ * Returns the time at which a stage starts, or 0 if timing is off
+ */
+uint64_t timing_begin();
+
+/*
+ * Adds the time since begin, as returned by timing_begin(), to a
+ * stage of the current thread
+ */
+void timing_end(stage_t stage, uint64_t begin);
+
+/*
+ * Copies the current thread's accumulated stage times, in
+ * nanoseconds, into totals and sets them back to zero
+ */
+void timing_take(uint64_t totals[N_STAGES]);
+
+/*
+ * Returns the name of a stage, such as "parse"
+ */
+const char *timing_stage_name(stage_t stage);
+
+#endif /* _TIMING_H_ */
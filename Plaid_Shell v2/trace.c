@@ -0,0 +1,212 @@
+/*
+ * trace.c
+ *
+ * Lock-free ring buffer of trace events and its Chrome Trace Event
+ * JSON writer
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "trace.h"
+
+typedef struct {
+  atomic_ulong seq;         // slot number + 1 once complete, 0 while written
+  uint64_t ts_ns;
+  uint64_t dur_ns;
+  const char *name;
+  pid_t pid;
+  char phase;               // 'X' for a span, 'i' for an instant
+  char arg[TRACE_ARG_LEN];
+} event_t;
+
+bool trace_enabled = false;
+
+static event_t *ring = NULL;            // mapped when first turned on
+static atomic_ulong ring_next = 0;      // slots ever claimed
+
+
+static uint64_t
+now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Claims the next slot, overwriting the oldest event, and fills it.
+ * A writer marks the slot incomplete, fills it, then publishes it
+ * with its sequence number, so a reader never uses a torn event.
+ */
+static void
+add_event(char phase, const char *name, uint64_t ts, uint64_t dur, pid_t pid, const char *arg)
+{
+  unsigned long slot = atomic_fetch_add_explicit(&ring_next, 1, memory_order_relaxed);
+  event_t *ev = &ring[slot & (TRACE_RING_SIZE - 1)];
+
+  atomic_store_explicit(&ev->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  ev->ts_ns = ts;
+  ev->dur_ns = dur;
+  ev->name = name;
+  ev->pid = pid ? pid : getpid();
+  ev->phase = phase;
+  size_t len = arg ? strnlen(arg, TRACE_ARG_LEN - 1) : 0;
+  // back off a character cut short, which would not be valid UTF-8
+  if (arg && arg[len])
+    while (len > 0 && (arg[len] & 0xc0) == 0x80)
+      len--;
+  if (len)
+    memcpy(ev->arg, arg, len);
+  ev->arg[len] = '\0';
+
+  atomic_store_explicit(&ev->seq, slot + 1, memory_order_release);
+}
+
+/*
+ * Runs in every child the shell forks. The ring is not mapped there,
+ * so a child that keeps running shell code, such as a background job,
+ * must not trace.
+ */
+static void
+disable_in_child()
+{
+  trace_enabled = false;
+}
+
+/*
+ * Maps the ring. It is kept out of forked children: otherwise every
+ * fork would copy its page table entries, and the shell's next event
+ * would take a copy-on-write fault while the child was still starting.
+ */
+static int
+map_ring()
+{
+  void *mem = mmap(NULL, TRACE_RING_SIZE * sizeof(event_t), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return -1;
+
+  madvise(mem, TRACE_RING_SIZE * sizeof(event_t), MADV_DONTFORK);
+  pthread_atfork(NULL, NULL, disable_in_child);
+  ring = mem;
+  return 0;
+}
+
+/*
+ * Writes s as the contents of a JSON string
+ */
+static void
+write_json_string(FILE *fp, const char *s)
+{
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\')
+      fprintf(fp, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(fp, "\\u%04x", c);
+    else
+      putc(c, fp);
+  }
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the trace_ calls. All documentation is in the
+ * trace.h file.
+ *
+ **********************************************************************/
+
+int
+trace_set_enabled(bool enable)
+{
+  if (enable && !ring && map_ring() != 0)
+    return -1;
+
+  trace_enabled = enable;
+  return 0;
+}
+
+
+uint64_t
+trace_begin()
+{
+  return trace_enabled ? now_ns() : 0;
+}
+
+
+void
+trace_span(const char *name, uint64_t start, pid_t pid, const char *arg)
+{
+  // a start of 0 means tracing was turned on partway through the span
+  if (trace_enabled && start)
+    add_event('X', name, start, now_ns() - start, pid, arg);
+}
+
+
+void
+trace_instant(const char *name, pid_t pid, const char *arg)
+{
+  if (trace_enabled)
+    add_event('i', name, now_ns(), 0, pid, arg);
+}
+
+
+long
+trace_write(const char *path)
+{
+  unsigned long end = atomic_load(&ring_next);
+  unsigned long start = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+
+  FILE *fp = fopen(path, "w");
+  if (!fp)
+    return -1;
+
+  pid_t shell = getpid();
+  long written = 0;
+
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"plaidsh\"}}", shell);
+
+  for (unsigned long slot = start; slot < end; slot++) {
+    // skip an event that is overwritten while it is being copied
+    event_t *src = &ring[slot & (TRACE_RING_SIZE - 1)];
+    if (atomic_load_explicit(&src->seq, memory_order_acquire) != slot + 1)
+      continue;
+    event_t ev = *src;
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&src->seq, memory_order_relaxed) != slot + 1)
+      continue;
+
+    // child processes get a named track of their own
+    if (ev.pid != shell && !strcmp(ev.name, "run")) {
+      fprintf(fp, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"", ev.pid);
+      write_json_string(fp, ev.arg);
+      fprintf(fp, "\"}}");
+    }
+
+    fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,", ev.name, ev.phase, ev.ts_ns / 1e3);
+    if (ev.phase == 'X')
+      fprintf(fp, "\"dur\":%.3f,", ev.dur_ns / 1e3);
+    else
+      fprintf(fp, "\"s\":\"t\",");
+    fprintf(fp, "\"pid\":%d,\"tid\":%d,\"args\":{\"detail\":\"", ev.pid, ev.pid);
+    write_json_string(fp, ev.arg);
+    fprintf(fp, "\"}}");
+    written++;
+  }
+
+  fprintf(fp, "\n]}\n");
+  if (fclose(fp) != 0)
+    return -1;
+  return written;
+}
@@ -0,0 +1,71 @@
+/*
+ * trace.h
+ *
+ * Execution tracing for "set -o trace". Events are written into a
+ * fixed-size in-memory ring buffer without taking locks, the oldest
+ * being overwritten once it is full, and are written out on demand
+ * in the Chrome Trace Event format, which Perfetto and chrome://tracing
+ * open as a timeline. While tracing is off, each trace point costs a
+ * single flag test.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define TRACE_RING_SIZE 65536   // events kept; a power of 2
+#define TRACE_ARG_LEN 48        // bytes of each event's argument kept
+
+extern bool trace_enabled;
+
+/*
+ * Turns tracing on or off. Events already recorded are kept. The ring
+ * buffer is allocated the first time tracing is turned on; forked
+ * children do not inherit it, and never trace.
+ *
+ * Returns:
+ *   0 on success, or -1 if the ring buffer could not be allocated
+ */
+int trace_set_enabled(bool enable);
+
+/*
+ * Returns the current time in nanoseconds if tracing is on, or 0;
+ * used as the start of a span passed to trace_span()
+ */
+uint64_t trace_begin();
+
+/*
+ * Records a span that started at start and ends now. Does nothing
+ * unless tracing is on, or if it was off when the span started.
+ *
+ * Parameters:
+ *   name    Event name; must be a string constant
+ *   start   As returned by trace_begin()
+ *   pid     Process the span belongs to, or 0 for the shell. Spans of
+ *             other processes are shown on their own track.
+ *   arg     Detail shown with the event, such as a command; may be
+ *             NULL, and is truncated to TRACE_ARG_LEN
+ */
+void trace_span(const char *name, uint64_t start, pid_t pid, const char *arg);
+
+/*
+ * Records an instantaneous event, in the same way as trace_span()
+ */
+void trace_instant(const char *name, pid_t pid, const char *arg);
+
+/*
+ * Writes every event still in the ring buffer to path as Chrome
+ * Trace Event JSON, oldest first
+ *
+ * Returns:
+ *   The number of events written, or -1 if the file could not be
+ *   written (with errno set)
+ */
+long trace_write(const char *path);
+
+#endif /* _TRACE_H_ */
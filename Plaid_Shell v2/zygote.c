@@ -0,0 +1,347 @@
+/*
+ * zygote.c
+ *
+ * Spawner process that forks programs for the shell, receiving their
+ * descriptors with SCM_RIGHTS
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#define _GNU_SOURCE         // O_PATH
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "zygote.h"
+
+#define N_PASSED_FDS 4      // stdin, stdout, stderr and the working directory
+
+extern char **environ;
+
+/*
+ * Fixed part of a spawn request. It is followed by size bytes of
+ * NUL-terminated strings: argc arguments, then envc environment
+ * entries.
+ */
+typedef struct {
+  uint32_t size;
+  uint32_t argc;
+  uint32_t envc;
+} request_t;
+
+/*
+ * The zygote's answer once the program has finished
+ */
+typedef struct {
+  int32_t pid;
+  int32_t wait_status;
+} reply_t;
+
+static int sock = -1;           // the shell's end of the socketpair
+static pid_t owner = 0;         // the process that started the zygote
+static pid_t zygote_pid = 0;
+
+static const int ignored_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGPIPE };
+#define N_IGNORED (sizeof(ignored_signals) / sizeof(ignored_signals[0]))
+
+
+static int
+write_full(int fd, const void *buf, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    buf = (const char *)buf + n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int
+read_full(int fd, void *buf, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = read(fd, buf, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    buf = (char *)buf + n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * Receives the fixed part of a request along with its descriptors
+ */
+static int
+recv_request(int fd, request_t *req, int fds[N_PASSED_FDS])
+{
+  union {
+    char buf[CMSG_SPACE(N_PASSED_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = { .iov_base = req, .iov_len = sizeof(*req) };
+  struct msghdr msg = {
+    .msg_iov = &iov, .msg_iovlen = 1,
+    .msg_control = control.buf, .msg_controllen = sizeof(control.buf),
+  };
+
+  ssize_t n;
+  while ((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+    ;
+  if (n <= 0)
+    return -1;
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS
+      || cmsg->cmsg_len != CMSG_LEN(N_PASSED_FDS * sizeof(int)))
+    return -1;
+  memcpy(fds, CMSG_DATA(cmsg), N_PASSED_FDS * sizeof(int));
+
+  // the rest of the fixed part, if the stream split it
+  if ((size_t)n < sizeof(*req) && read_full(fd, (char *)req + n, sizeof(*req) - n) != 0)
+    return -1;
+  return 0;
+}
+
+/*
+ * Splits a block of NUL-terminated strings into a NULL-terminated
+ * vector, checking that the block really holds count strings
+ */
+static char **
+split_strings(char *block, char *end, uint32_t count, char **next)
+{
+  char **vec = malloc((count + 1) * sizeof(char *));
+  if (!vec)
+    return NULL;
+
+  for (uint32_t i = 0; i < count; i++) {
+    char *nul = memchr(block, '\0', end - block);
+    if (!nul) {
+      free(vec);
+      return NULL;
+    }
+    vec[i] = block;
+    block = nul + 1;
+  }
+  vec[count] = NULL;
+  *next = block;
+  return vec;
+}
+
+/*
+ * Runs in the program's process: sets it up and execs it
+ */
+static void
+exec_program(char **argv, char **envp, int fds[N_PASSED_FDS])
+{
+  for (int i = 0; i < N_IGNORED; i++)
+    signal(ignored_signals[i], SIG_DFL);
+
+  if (fchdir(fds[3]) != 0) {
+    perror("cd");
+    _exit(127);
+  }
+
+  // the received descriptors are close-on-exec, dup2()'s copies are not
+  for (int i = 0; i < 3; i++)
+    dup2(fds[i], i);
+
+  environ = envp;
+  execvp(argv[0], argv);
+
+  fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+  _exit(127);
+}
+
+/*
+ * The zygote's main loop: one request at a time, until the shell
+ * goes away
+ */
+static void
+zygote_main(int fd)
+{
+  for (int i = 0; i < N_IGNORED; i++)
+    signal(ignored_signals[i], SIG_IGN);
+
+  for (;;) {
+    request_t req;
+    int fds[N_PASSED_FDS];
+
+    if (recv_request(fd, &req, fds) != 0)
+      _exit(0);
+
+    char *block = malloc(req.size + 1);
+    if (!block || read_full(fd, block, req.size) != 0)
+      _exit(1);
+    block[req.size] = '\0';
+
+    char *next;
+    char **argv = split_strings(block, block + req.size, req.argc, &next);
+    char **envp = argv ? split_strings(next, block + req.size, req.envc, &next) : NULL;
+    reply_t reply = { .pid = -1, .wait_status = 127 << 8 };
+
+    if (argv && envp && req.argc > 0) {
+      pid_t pid = fork();
+      if (pid == 0)
+        exec_program(argv, envp, fds);
+
+      if (pid > 0) {
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+          ;
+        reply.pid = pid;
+        reply.wait_status = status;
+      }
+    }
+
+    for (int i = 0; i < N_PASSED_FDS; i++)
+      close(fds[i]);
+    free(argv);
+    free(envp);
+    free(block);
+
+    if (write_full(fd, &reply, sizeof(reply)) != 0)
+      _exit(0);
+  }
+}
+
+/*
+ * Forgets a zygote that stopped answering, reaping it if it exited
+ */
+static void
+zygote_stop()
+{
+  close(sock);
+  sock = -1;
+  waitpid(zygote_pid, NULL, 0);
+  zygote_pid = 0;
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the zygote_ calls. All documentation is in the
+ * zygote.h file.
+ *
+ **********************************************************************/
+
+int
+zygote_start()
+{
+  int pair[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0)
+    return -1;
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    close(pair[0]);
+    close(pair[1]);
+    return -1;
+  }
+
+  if (pid == 0) {
+    close(pair[0]);
+    zygote_main(pair[1]);
+  }
+
+  close(pair[1]);
+  sock = pair[0];
+  owner = getpid();
+  zygote_pid = pid;
+  return 0;
+}
+
+
+bool
+zygote_available()
+{
+  return sock >= 0 && getpid() == owner;
+}
+
+
+int
+zygote_spawn(char * const argv[], char * const envp[], const int fds[3],
+             pid_t *pid, int *wait_status)
+{
+  if (!zygote_available())
+    return -1;
+
+  request_t req = { 0 };
+  for (char * const *a = argv; *a; a++, req.argc++)
+    req.size += strlen(*a) + 1;
+  for (char * const *e = envp; *e; e++, req.envc++)
+    req.size += strlen(*e) + 1;
+
+  char *block = malloc(req.size);
+  if (!block)
+    return -1;
+  char *p = block;
+  for (char * const *a = argv; *a; a++)
+    p = stpcpy(p, *a) + 1;
+  for (char * const *e = envp; *e; e++)
+    p = stpcpy(p, *e) + 1;
+
+  int passed[N_PASSED_FDS] = { fds[0], fds[1], fds[2] };
+  passed[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (passed[3] < 0) {
+    free(block);
+    return -1;
+  }
+
+  union {
+    char buf[CMSG_SPACE(N_PASSED_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+  struct iovec iov = { .iov_base = &req, .iov_len = sizeof(req) };
+  struct msghdr msg = {
+    .msg_iov = &iov, .msg_iovlen = 1,
+    .msg_control = control.buf, .msg_controllen = sizeof(control.buf),
+  };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(N_PASSED_FDS * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), passed, N_PASSED_FDS * sizeof(int));
+
+  ssize_t n;
+  while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+    ;
+  close(passed[3]);
+
+  bool sent = n >= 0
+    && write_full(sock, (char *)&req + n, sizeof(req) - n) == 0
+    && write_full(sock, block, req.size) == 0;
+  free(block);
+  if (!sent) {
+    zygote_stop();
+    return -1;
+  }
+
+  // the program may already have run, so this is not retried
+  reply_t reply;
+  if (read_full(sock, &reply, sizeof(reply)) != 0) {
+    fprintf(stderr, "plaidsh: spawner exited unexpectedly\n");
+    zygote_stop();
+    reply.pid = -1;
+    reply.wait_status = 127 << 8;
+  }
+
+  *pid = reply.pid;
+  *wait_status = reply.wait_status;
+  return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * zygote.h
+ *
+ * A small helper process, forked when the shell starts and before
+ * it allocates much memory, that forks and execs programs on the
+ * shell's behalf. Forking copies the page tables of the process that
+ * forks, so launching from the zygote costs the same however large
+ * the interactive shell has grown.
+ *
+ * Author: Okemawo Aniyikaiye Obadofin (OAO)
+ */
+
+#ifndef _ZYGOTE_H_
+#define _ZYGOTE_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * Forks the zygote. It talks to the shell over a socketpair and
+ * exits when the shell closes its end.
+ *
+ * Returns:
+ *   0 on success, -1 on failure (with errno set)
+ */
+int zygote_start();
+
+/*
+ * Returns true if the zygote is running and this is the process that
+ * started it. Children forked from the shell, such as background
+ * jobs, share the socket and must fork for themselves instead.
+ */
+bool zygote_available();
+
+/*
+ * Has the zygote run a program and waits for it to finish. The
+ * program runs in the caller's current directory with the given
+ * environment, and with fds as its stdin, stdout and stderr; signals
+ * that the zygote ignores are reset to their defaults. If the exec
+ * fails, the program's stderr gets "<argv[0]>: <reason>" and the exit
+ * status is 127, as with fork and execvp.
+ *
+ * Parameters:
+ *   argv          The program and its arguments; argv[0] is looked
+ *                   up in the PATH of envp
+ *   envp          The program's environment
+ *   fds           Descriptors for its stdin, stdout and stderr
+ *   pid           Set to the pid the program ran as
+ *   wait_status   Set to its status, as returned by waitpid()
+ *
+ * Returns:
+ *   0 once the program has finished, or -1 if the request could not
+ *   be delivered and the caller should fork for itself. If the zygote
+ *   dies, it is shut down and zygote_available() becomes false; a
+ *   request it had already accepted reports exit status 127.
+ */
+int zygote_spawn(char * const argv[], char * const envp[], const int fds[3],
+                 pid_t *pid, int *wait_status);
+
+#endif /* _ZYGOTE_H_ */